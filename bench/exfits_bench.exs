@@ -0,0 +1,193 @@
+# Benchmarks for the read, write and header hot paths.
+#
+#     mix bench                                  # run and save a baseline
+#     EXFITS_BENCH_SIZES=64,8192 mix bench       # pick image sizes (default 64..4096)
+#     EXFITS_BENCH_TAG=v0.2.1 mix bench          # name the saved baseline
+#     EXFITS_BENCH_BASELINE=v0.2.1 mix bench     # compare against a saved baseline
+#
+# Each run is saved under bench/baselines/<tag>.benchee. When a baseline is
+# given, every scenario is compared with it and the run exits non-zero if any
+# scenario got slower than EXFITS_BENCH_MAX_REGRESSION percent (default 10).
+#
+# Memory figures are Benchee's process-heap measurements, so they show what a
+# call allocates on the BEAM side; pixel binaries allocated by the NIF are
+# off-heap and are reported as throughput instead.
+
+alias ExFITS.NIF
+
+defmodule ExFITS.Bench do
+  @mib 1024 * 1024
+
+  def sizes do
+    "EXFITS_BENCH_SIZES"
+    |> System.get_env("64,256,1024,4096")
+    |> String.split(",", trim: true)
+    |> Enum.map(&String.to_integer(String.trim(&1)))
+  end
+
+  def types, do: [{:u, 8}, {:s, 16}, {:s, 32}, {:f, 32}, {:f, 64}]
+
+  # Deterministic pixel data of the given type, so that every run reads and
+  # writes the same bytes. The image repeats one row to keep generation cheap.
+  def pixels({kind, bits}, size) do
+    row =
+      for x <- 0..(size - 1), into: <<>> do
+        value = rem(x * 7, 100)
+
+        case kind do
+          :u -> <<value::unsigned-native-size(bits)>>
+          :s -> <<(value - 50)::signed-native-size(bits)>>
+          :f -> <<(value / 10)::float-native-size(bits)>>
+        end
+      end
+
+    :binary.copy(row, size)
+  end
+
+  # Write one fixture per size and type, returning the Benchee inputs
+  def inputs(dir) do
+    for size <- sizes(), {kind, bits} = type <- types(), into: %{} do
+      path = Path.join(dir, "bench_#{size}_#{kind}#{bits}.fits")
+      data = pixels(type, size)
+      :ok = ExFITS.write_array(path, data, {size, size}, type: type, header: %{"OBJECT" => "BENCH"})
+
+      input = %{
+        path: path,
+        out: Path.join(dir, "out_#{size}_#{kind}#{bits}.fits"),
+        data: data,
+        float_data: if(type == {:f, 32}, do: data, else: pixels({:f, 32}, size)),
+        shape: {size, size},
+        type: type,
+        bytes: byte_size(data)
+      }
+
+      {"#{size}x#{size} #{kind}#{bits}", input}
+    end
+  end
+
+  def jobs do
+    jobs = %{
+      "read_image" => fn %{path: path} -> {:ok, _} = ExFITS.read_image(path) end,
+      "read_array native" => fn %{path: path} -> {:ok, _} = ExFITS.read_array(path, type: :native) end,
+      "read_header" => fn %{path: path} -> {:ok, _} = ExFITS.read_header(path) end,
+      "write_array native" => fn %{out: out, data: data, shape: shape, type: type} ->
+        :ok = ExFITS.write_array(out, data, shape, type: type)
+      end,
+      "write_fits_file" => fn %{out: out, float_data: data, shape: {height, width}, type: type} ->
+        :ok = NIF.write_fits_file(out, data, width, height, ExFITS.bitpix_for_type(type), %{OBJECT: "BENCH"})
+      end,
+      "copy_with_header" => fn %{path: path, out: out} -> {:ok, _} = ExFITS.copy_with_header(path, out) end
+    }
+
+    if Code.ensure_loaded?(Nx) do
+      Map.merge(jobs, %{
+        "to_nx native" => fn %{path: path} -> {:ok, _} = ExFITS.to_nx(path, %{type: :native}) end,
+        "write_nx" => {
+          fn {tensor, %{out: out}} -> :ok = ExFITS.write_nx(tensor, out) end,
+          before_scenario: fn %{data: data, type: type, shape: shape} = input ->
+            {data |> Nx.from_binary(type) |> Nx.reshape(shape), input}
+          end
+        }
+      })
+    else
+      jobs
+    end
+  end
+
+  def tag do
+    System.get_env("EXFITS_BENCH_TAG") ||
+      case System.cmd("git", ["rev-parse", "--short", "HEAD"], stderr_to_stdout: true) do
+        {rev, 0} -> String.trim(rev)
+        _ -> "local"
+      end
+  end
+
+  def mb_per_s(bytes, average_ns) when average_ns > 0, do: bytes / @mib / (average_ns / 1.0e9)
+  def mb_per_s(_bytes, _average_ns), do: 0.0
+
+  # Throughput of each scenario measured in this run
+  def report_throughput(suite, inputs) do
+    IO.puts("\nThroughput (pixel bytes per second):")
+
+    suite.scenarios
+    |> Enum.filter(&(&1.tag == tag()))
+    |> Enum.sort_by(&{&1.input_name, &1.job_name})
+    |> Enum.each(fn scenario ->
+      %{bytes: bytes} = Map.fetch!(inputs, scenario.input_name)
+      rate = mb_per_s(bytes, scenario.run_time_data.statistics.average)
+
+      IO.puts(
+        String.pad_trailing(scenario.input_name, 16) <>
+          String.pad_trailing(scenario.job_name, 22) <>
+          :erlang.float_to_binary(rate, decimals: 1) <> " MB/s"
+      )
+    end)
+  end
+
+  # Compare this run with a saved baseline, returning the regressed scenarios
+  def regressions(suite, baseline, max_percent) do
+    {current, loaded} = Enum.split_with(suite.scenarios, &(&1.tag == tag()))
+    baseline_by_key = for s <- loaded, s.tag == baseline, into: %{}, do: {{s.job_name, s.input_name}, s}
+
+    for scenario <- current,
+        %{} = old <- [Map.get(baseline_by_key, {scenario.job_name, scenario.input_name})],
+        change <- [percent_change(old.run_time_data.statistics.average, scenario.run_time_data.statistics.average)],
+        change > max_percent do
+      {scenario.input_name, scenario.job_name, change}
+    end
+  end
+
+  defp percent_change(old, new) when old > 0, do: (new - old) / old * 100
+  defp percent_change(_old, _new), do: 0.0
+end
+
+dir = Path.join(System.tmp_dir!(), "exfits_bench")
+File.rm_rf!(dir)
+File.mkdir_p!(dir)
+
+inputs = ExFITS.Bench.inputs(dir)
+tag = ExFITS.Bench.tag()
+baseline = System.get_env("EXFITS_BENCH_BASELINE")
+baseline_dir = Path.join(__DIR__, "baselines")
+
+load =
+  if baseline do
+    path = Path.join(baseline_dir, "#{baseline}.benchee")
+    File.exists?(path) || raise "no saved baseline at #{path}"
+    baseline != tag || raise "EXFITS_BENCH_TAG must differ from the baseline being compared against"
+    path
+  else
+    false
+  end
+
+suite =
+  Benchee.run(
+    ExFITS.Bench.jobs(),
+    inputs: inputs,
+    warmup: 1,
+    time: 3,
+    memory_time: 1,
+    save: [path: Path.join(baseline_dir, "#{tag}.benchee"), tag: tag],
+    load: load
+  )
+
+ExFITS.Bench.report_throughput(suite, inputs)
+File.rm_rf!(dir)
+
+if baseline do
+  max_percent = String.to_integer(System.get_env("EXFITS_BENCH_MAX_REGRESSION", "10"))
+
+  case ExFITS.Bench.regressions(suite, baseline, max_percent) do
+    [] ->
+      IO.puts("\nNo scenario regressed by more than #{max_percent}% against #{baseline}")
+
+    regressed ->
+      IO.puts("\nRegressions against #{baseline}:")
+
+      for {input, job, change} <- regressed do
+        IO.puts("  #{input} #{job}: +#{:erlang.float_to_binary(change, decimals: 1)}%")
+      end
+
+      System.halt(1)
+  end
+end
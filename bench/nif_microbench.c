@@ -0,0 +1,136 @@
+// Microbenchmark of the CFITSIO calls underneath the NIFs, without the BEAM.
+//
+// It times the same pixel read/write and header calls that exfits_nif.c makes,
+// for each BITPIX type and image size, so a slowdown in `mix bench` can be
+// split between CFITSIO itself and the NIF layer on top of it. Writes go
+// through a bounded staging buffer exactly like write_pixels_from_binary.
+//
+//     sh bench/run_microbench.sh [size ...]
+
+#include <fitsio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WRITE_CHUNK_BYTES (1 << 20)
+
+typedef struct {
+    const char *name;
+    int bitpix;
+    int datatype;
+    size_t size;
+} bench_type;
+
+static const bench_type types[] = {
+    {"u8", BYTE_IMG, TBYTE, 1},
+    {"s16", SHORT_IMG, TSHORT, 2},
+    {"s32", LONG_IMG, TINT, 4},
+    {"f32", FLOAT_IMG, TFLOAT, 4},
+    {"f64", DOUBLE_IMG, TDOUBLE, 8},
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write an image through a staging buffer, as the write NIFs do
+static int write_image(const char *path, const bench_type *type, long size, const unsigned char *data) {
+    fitsfile *fptr;
+    int status = 0;
+    long naxes[2] = {size, size};
+    LONGLONG npixels = (LONGLONG)size * size;
+    LONGLONG per_chunk = WRITE_CHUNK_BYTES / type->size;
+    unsigned char *chunk = malloc(WRITE_CHUNK_BYTES);
+
+    remove(path);
+    fits_create_file(&fptr, path, &status);
+    fits_create_img(fptr, type->bitpix, 2, naxes, &status);
+    fits_update_key(fptr, TSTRING, "OBJECT", "BENCH", NULL, &status);
+    for (LONGLONG first = 0; first < npixels && !status; first += per_chunk) {
+        LONGLONG n = npixels - first < per_chunk ? npixels - first : per_chunk;
+        memcpy(chunk, data + first * type->size, n * type->size);
+        fits_write_img(fptr, type->datatype, first + 1, n, chunk, &status);
+    }
+    fits_close_file(fptr, &status);
+    free(chunk);
+    return status;
+}
+
+static int read_image(const char *path, const bench_type *type, long size, unsigned char *out) {
+    fitsfile *fptr;
+    int status = 0, anynul = 0;
+    fits_open_file(&fptr, path, READONLY, &status);
+    fits_read_img(fptr, type->datatype, 1, (LONGLONG)size * size, NULL, out, &anynul, &status);
+    fits_close_file(fptr, &status);
+    return status;
+}
+
+static int read_header(const char *path) {
+    fitsfile *fptr;
+    int status = 0, nkeys = 0;
+    char card[FLEN_CARD];
+    fits_open_file(&fptr, path, READONLY, &status);
+    fits_get_hdrspace(fptr, &nkeys, NULL, &status);
+    for (int i = 1; i <= nkeys && !status; i++) {
+        fits_read_record(fptr, i, card, &status);
+    }
+    fits_close_file(fptr, &status);
+    return status;
+}
+
+// Repeat an operation for at least min_seconds and return the mean time per call
+#define TIME_CALLS(min_seconds, call, status) ({                      \
+    double start = now_seconds(), elapsed;                            \
+    long calls = 0;                                                   \
+    do {                                                              \
+        status = (call);                                              \
+        calls++;                                                      \
+        elapsed = now_seconds() - start;                              \
+    } while (!status && elapsed < (min_seconds));                     \
+    elapsed / calls;                                                  \
+})
+
+static void report(const char *label, const char *type, long size, double seconds, size_t bytes) {
+    printf("%-12s %-4s %6ldx%-6ld %10.1f us %10.1f MB/s\n", label, type, size, size,
+           seconds * 1e6, bytes / (1024.0 * 1024.0) / seconds);
+}
+
+int main(int argc, char **argv) {
+    static const long default_sizes[] = {64, 256, 1024, 4096};
+    int nsizes = argc > 1 ? argc - 1 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+    const char *path = "microbench.fits";
+
+    for (int s = 0; s < nsizes; s++) {
+        long size = argc > 1 ? atol(argv[s + 1]) : default_sizes[s];
+        for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+            const bench_type *type = &types[t];
+            size_t bytes = (size_t)size * size * type->size;
+            unsigned char *data = malloc(bytes);
+            int status = 0;
+            if (data == NULL) {
+                fprintf(stderr, "out of memory for %ldx%ld %s\n", size, size, type->name);
+                return 1;
+            }
+            memset(data, 0, bytes);
+
+            double write_s = TIME_CALLS(1.0, write_image(path, type, size, data), status);
+            double read_s = TIME_CALLS(1.0, read_image(path, type, size, data), status);
+            double header_s = TIME_CALLS(0.5, read_header(path), status);
+            free(data);
+            if (status) {
+                fits_report_error(stderr, status);
+                return 1;
+            }
+
+            report("write_image", type->name, size, write_s, bytes);
+            report("read_image", type->name, size, read_s, bytes);
+            printf("%-12s %-4s %6ldx%-6ld %10.1f us\n", "read_header", type->name, size, size, header_s * 1e6);
+        }
+    }
+
+    remove(path);
+    return 0;
+}
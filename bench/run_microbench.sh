@@ -0,0 +1,24 @@
+#!/bin/sh
+set -e
+
+# Build and run the CFITSIO-level microbenchmark. Arguments are image sizes.
+
+if pkg-config --exists cfitsio; then
+  CFITSIO_CFLAGS="$(pkg-config --cflags cfitsio)"
+  CFITSIO_LIBS="$(pkg-config --libs cfitsio)"
+elif [ -f "./cfitsio/local/include/fitsio.h" ]; then
+  CFITSIO_CFLAGS="-I./cfitsio/local/include"
+  CFITSIO_LIBS="-L./cfitsio/local/lib -lcfitsio"
+elif [ -f "/opt/homebrew/include/fitsio.h" ]; then
+  CFITSIO_CFLAGS="-I/opt/homebrew/include"
+  CFITSIO_LIBS="-L/opt/homebrew/lib -lcfitsio"
+else
+  CFITSIO_CFLAGS="-I/usr/local/include"
+  CFITSIO_LIBS="-L/usr/local/lib -lcfitsio"
+fi
+
+mkdir -p _build/bench
+gcc -O2 -o _build/bench/nif_microbench bench/nif_microbench.c $CFITSIO_CFLAGS $CFITSIO_LIBS -lm
+
+cd _build/bench
+./nif_microbench "$@"
@@ -0,0 +1,260 @@
+#include <erl_nif.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Buffers under 2^POOL_MIN_SHIFT bytes come straight from the allocator:
+// they are cheap to allocate, and pooling them would mostly hold memory.
+// Above that, each power of two is split into POOL_CLASS_STEPS size classes,
+// so a pooled buffer is at most a quarter larger than the size asked for.
+#define POOL_MIN_SHIFT 16
+#define POOL_MAX_SHIFT 34
+#define POOL_CLASS_STEPS 4
+#define POOL_CLASSES ((POOL_MAX_SHIFT - POOL_MIN_SHIFT) * POOL_CLASS_STEPS)
+// Bytes of free buffers kept for reuse unless configured otherwise
+#define POOL_DEFAULT_MAX_BYTES ((size_t)256 << 20)
+
+// A free buffer, linked through its own first bytes
+typedef struct pool_free_buffer {
+    struct pool_free_buffer *next;
+} pool_free_buffer;
+
+// The free buffers of each size class, shared by every NIF and thread, with
+// counts of how often a buffer was found (hits) or had to be allocated
+// (misses), and of buffers returned and kept (recycled) or freed because
+// the pool was full (dropped).
+static struct {
+    ErlNifMutex *lock;
+    size_t page_size;
+    size_t max_bytes;
+    size_t retained_bytes;
+    size_t retained_buffers;
+    pool_free_buffer *free[POOL_CLASSES];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t recycled;
+    uint64_t dropped;
+} buffer_pool;
+
+// A page-aligned pooled buffer lent to the binaries made over it; it goes
+// back to the pool once the last of them is garbage collected
+typedef struct {
+    void *data;
+    int size_class;
+} pooled_buffer;
+
+static ErlNifResourceType *POOLED_BUFFER_TYPE = NULL;
+
+// Size class of a buffer of size bytes, with the capacity of the class, or
+// -1 if buffers of that size are not pooled
+static int pool_size_class(size_t size, size_t *capacity) {
+    if (size < ((size_t)1 << POOL_MIN_SHIFT)) {
+        return -1;
+    }
+    int shift = 63 - __builtin_clzll((unsigned long long)size);
+    size_t step = (size_t)1 << (shift - 2);
+    size_t steps = (size + step - 1) / step;
+    int size_class = (shift - POOL_MIN_SHIFT) * POOL_CLASS_STEPS + (int)steps - POOL_CLASS_STEPS;
+    *capacity = steps * step;
+    return size_class < POOL_CLASSES ? size_class : -1;
+}
+
+static size_t pool_class_capacity(int size_class) {
+    int shift = size_class / POOL_CLASS_STEPS + POOL_MIN_SHIFT;
+    return (size_t)(size_class % POOL_CLASS_STEPS + POOL_CLASS_STEPS) << (shift - 2);
+}
+
+// Take a buffer of at least size bytes, reusing a free one of its class when
+// there is one. Sets *size_class for pool_give; returns NULL when out of memory.
+static void *pool_take(size_t size, int *size_class) {
+    size_t capacity;
+    *size_class = pool_size_class(size, &capacity);
+    if (*size_class < 0) {
+        return enif_alloc(size ? size : 1);
+    }
+
+    enif_mutex_lock(buffer_pool.lock);
+    pool_free_buffer *buffer = buffer_pool.free[*size_class];
+    if (buffer != NULL) {
+        buffer_pool.free[*size_class] = buffer->next;
+        buffer_pool.retained_bytes -= capacity;
+        buffer_pool.retained_buffers--;
+        buffer_pool.hits++;
+    } else {
+        buffer_pool.misses++;
+    }
+    enif_mutex_unlock(buffer_pool.lock);
+    if (buffer != NULL) {
+        return buffer;
+    }
+
+    void *data;
+    return posix_memalign(&data, buffer_pool.page_size, capacity) == 0 ? data : NULL;
+}
+
+// Return a buffer from pool_take, keeping it for reuse while the pool has room
+static void pool_give(void *data, int size_class) {
+    if (size_class < 0) {
+        enif_free(data);
+        return;
+    }
+
+    size_t capacity = pool_class_capacity(size_class);
+    enif_mutex_lock(buffer_pool.lock);
+    if (buffer_pool.retained_bytes + capacity <= buffer_pool.max_bytes) {
+        pool_free_buffer *buffer = (pool_free_buffer*)data;
+        buffer->next = buffer_pool.free[size_class];
+        buffer_pool.free[size_class] = buffer;
+        buffer_pool.retained_bytes += capacity;
+        buffer_pool.retained_buffers++;
+        buffer_pool.recycled++;
+        data = NULL;
+    } else {
+        buffer_pool.dropped++;
+    }
+    enif_mutex_unlock(buffer_pool.lock);
+    free(data);
+}
+
+static void pooled_buffer_dtor(ErlNifEnv* env, void* obj) {
+    pooled_buffer *pooled = (pooled_buffer*)obj;
+    if (pooled->data != NULL) {
+        pool_give(pooled->data, pooled->size_class);
+    }
+}
+
+static int init_buffer_pool(ErlNifEnv* env) {
+    memset(&buffer_pool, 0, sizeof(buffer_pool));
+    long page = sysconf(_SC_PAGESIZE);
+    buffer_pool.page_size = page > 0 ? (size_t)page : 4096;
+    buffer_pool.max_bytes = POOL_DEFAULT_MAX_BYTES;
+    buffer_pool.lock = enif_mutex_create("exfits_buffer_pool");
+    POOLED_BUFFER_TYPE = enif_open_resource_type(env, NULL, "pooled_buffer", pooled_buffer_dtor,
+                                                 ERL_NIF_RT_CREATE, NULL);
+    return buffer_pool.lock != NULL && POOLED_BUFFER_TYPE != NULL;
+}
+
+// Pixels being read for Elixir: a pooled buffer for frame-sized reads, or a
+// plain binary for small ones. Used like an ErlNifBinary, through
+// alloc_pixel_buffer, make_pixel_binary and release_pixel_buffer.
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    pooled_buffer *pooled;
+    ErlNifBinary bin;
+} pixel_buffer;
+
+static int alloc_pixel_buffer(size_t size, pixel_buffer *buf) {
+    size_t capacity;
+    buf->size = size;
+    buf->pooled = NULL;
+    if (pool_size_class(size, &capacity) < 0) {
+        if (!enif_alloc_binary(size, &buf->bin)) {
+            return 0;
+        }
+        buf->data = buf->bin.data;
+        return 1;
+    }
+
+    pooled_buffer *pooled = enif_alloc_resource(POOLED_BUFFER_TYPE, sizeof(pooled_buffer));
+    if (pooled == NULL) {
+        return 0;
+    }
+    pooled->data = pool_take(size, &pooled->size_class);
+    if (pooled->data == NULL) {
+        enif_release_resource(pooled);
+        return 0;
+    }
+    buf->pooled = pooled;
+    buf->data = pooled->data;
+    return 1;
+}
+
+// Hand the pixels to Elixir as a binary; the buffer must not be used after
+static ERL_NIF_TERM make_pixel_binary(ErlNifEnv* env, pixel_buffer *buf) {
+    if (buf->pooled == NULL) {
+        return enif_make_binary(env, &buf->bin);
+    }
+    ERL_NIF_TERM binary = enif_make_resource_binary(env, buf->pooled, buf->data, buf->size);
+    enif_release_resource(buf->pooled);
+    return binary;
+}
+
+static void release_pixel_buffer(pixel_buffer *buf) {
+    if (buf->pooled == NULL) {
+        enif_release_binary(&buf->bin);
+    } else {
+        enif_release_resource(buf->pooled);
+    }
+}
+
+/**
+ * Reports the state of the buffer pool.
+ *
+ * Returns:
+ *   %{hits, misses, recycled, dropped, retained_bytes, retained_buffers,
+ *     max_bytes}
+ */
+static ERL_NIF_TERM buffer_pool_stats(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    const char *keys[] = {"hits", "misses", "recycled", "dropped", "retained_bytes", "retained_buffers",
+                          "max_bytes"};
+    uint64_t values[7];
+    enif_mutex_lock(buffer_pool.lock);
+    values[0] = buffer_pool.hits;
+    values[1] = buffer_pool.misses;
+    values[2] = buffer_pool.recycled;
+    values[3] = buffer_pool.dropped;
+    values[4] = buffer_pool.retained_bytes;
+    values[5] = buffer_pool.retained_buffers;
+    values[6] = buffer_pool.max_bytes;
+    enif_mutex_unlock(buffer_pool.lock);
+
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    for (int i = 0; i < 7; i++) {
+        enif_make_map_put(env, map, enif_make_atom(env, keys[i]), enif_make_uint64(env, values[i]), &map);
+    }
+    return map;
+}
+
+/**
+ * Sets the most bytes of free buffers the pool keeps, freeing buffers from
+ * the largest classes down until it is within the new limit.
+ *
+ * Args:
+ *   - options: Map with max_bytes (0 stops pooling)
+ *
+ * Returns:
+ *   :ok
+ */
+static ERL_NIF_TERM buffer_pool_configure(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ERL_NIF_TERM value;
+    ErlNifUInt64 max_bytes;
+    if (!enif_is_map(env, argv[0]) ||
+        !enif_get_map_value(env, argv[0], enif_make_atom(env, "max_bytes"), &value) ||
+        !enif_get_uint64(env, value, &max_bytes)) {
+        return enif_make_badarg(env);
+    }
+
+    pool_free_buffer *released = NULL;
+    enif_mutex_lock(buffer_pool.lock);
+    buffer_pool.max_bytes = (size_t)max_bytes;
+    for (int size_class = POOL_CLASSES - 1; size_class >= 0; size_class--) {
+        while (buffer_pool.retained_bytes > buffer_pool.max_bytes && buffer_pool.free[size_class] != NULL) {
+            pool_free_buffer *buffer = buffer_pool.free[size_class];
+            buffer_pool.free[size_class] = buffer->next;
+            buffer_pool.retained_bytes -= pool_class_capacity(size_class);
+            buffer_pool.retained_buffers--;
+            buffer->next = released;
+            released = buffer;
+        }
+    }
+    enif_mutex_unlock(buffer_pool.lock);
+
+    while (released != NULL) {
+        pool_free_buffer *next = released->next;
+        free(released);
+        released = next;
+    }
+    return enif_make_atom(env, "ok");
+}
@@ -7,6 +7,15 @@ if [ -f "priv/exfits_nif.so" ]; then
   exit 0
 fi
 
+# Build mode: release (the default) is optimized; debug keeps symbols and
+# skips optimization, for gdb and sanitizers
+EXFITS_BUILD="${EXFITS_BUILD:-release}"
+case "$EXFITS_BUILD" in
+  release|debug) ;;
+  *) echo "Error: EXFITS_BUILD must be release or debug, not $EXFITS_BUILD"; exit 1 ;;
+esac
+CC="${CC:-gcc}"
+
 # Prefer system CFITSIO if available
 if pkg-config --exists cfitsio; then
   CFITSIO_LIBDIR="$(pkg-config --variable=libdir cfitsio)"
@@ -28,14 +37,43 @@ else
       git clone https://github.com/HEASARC/cfitsio.git cfitsio
     fi
     cd cfitsio
-    
-    # Force disable curl to avoid compilation issues
-    # The network capabilities aren't needed for most FITS operations
-    echo "Building CFITSIO without curl support for stability"
-    ./configure --prefix=$(pwd)/local --disable-curl
-    
+
+    # Reentrant, so the NIFs can use CFITSIO from several dirty schedulers
+    # and decode tiles on several threads at once
+    CFITSIO_OPTIONS="--prefix=$(pwd)/local --enable-reentrant"
+
+    # CFITSIO's own SSE2/SSSE3 code paths, for machines known to have them
+    case "${EXFITS_CFITSIO_SIMD:-}" in
+      "") ;;
+      sse2) CFITSIO_OPTIONS="$CFITSIO_OPTIONS --enable-sse2" ;;
+      ssse3) CFITSIO_OPTIONS="$CFITSIO_OPTIONS --enable-sse2 --enable-ssse3" ;;
+      *) echo "Error: EXFITS_CFITSIO_SIMD must be sse2 or ssse3"; exit 1 ;;
+    esac
+
+    # bzip2-compressed files
+    if [ "${EXFITS_CFITSIO_BZIP2:-0}" = "1" ]; then
+      CFITSIO_OPTIONS="$CFITSIO_OPTIONS --with-bzip2"
+    fi
+
+    # curl is off unless asked for: the network drivers aren't needed for
+    # most FITS operations (ExFITS.Remote has its own), and disabling it
+    # avoids compilation issues
+    if [ "${EXFITS_CFITSIO_CURL:-0}" = "1" ]; then
+      echo "Building CFITSIO with curl support"
+    else
+      echo "Building CFITSIO without curl support for stability"
+      CFITSIO_OPTIONS="$CFITSIO_OPTIONS --disable-curl"
+    fi
+
+    if [ "$EXFITS_BUILD" = "debug" ]; then
+      CFITSIO_CFLAGS="-O0 -g"
+    else
+      CFITSIO_CFLAGS="-O2"
+    fi
+    CFLAGS="$CFITSIO_CFLAGS" ./configure $CFITSIO_OPTIONS
+
     # Apply a patch to ensure curl is properly disabled
-    if grep -q "curl_off_t" drvrnet.c; then
+    if [ "${EXFITS_CFITSIO_CURL:-0}" != "1" ] && grep -q "curl_off_t" drvrnet.c; then
       echo "Applying patch to drvrnet.c to fix curl-related definitions"
       # Create a backup
       cp drvrnet.c drvrnet.c.bak
@@ -124,10 +162,29 @@ echo "Found CFITSIO library path: $CFITSIO_LIBDIR"
 # Ensure priv directory exists (should already be created by mix task)
 mkdir -p priv
 
+# Compiler flags for the build mode. Symbols are hidden apart from the NIF
+# entry point, which erl_nif.h exports itself. The SIMD kernels pick their
+# instruction set at load time, so no -march is needed for them;
+# EXFITS_MARCH (e.g. native) still targets a specific CPU throughout.
+if [ "$EXFITS_BUILD" = "release" ]; then
+  NIF_CFLAGS="-O2 -DNDEBUG"
+  # Link-time optimization, where the compiler supports it
+  if echo 'int main(void) { return 0; }' | $CC -flto -x c - -o /dev/null >/dev/null 2>&1; then
+    NIF_CFLAGS="$NIF_CFLAGS -flto"
+  fi
+else
+  NIF_CFLAGS="-O0 -g -fno-omit-frame-pointer"
+fi
+NIF_CFLAGS="$NIF_CFLAGS -fPIC -fvisibility=hidden -Wall -DEXFITS_BUILD_MODE=$EXFITS_BUILD"
+NIF_CFLAGS="$NIF_CFLAGS ${EXFITS_MARCH:+-march=$EXFITS_MARCH} ${EXFITS_CFLAGS:-}"
+
 # Compile the NIF
-echo "Compiling exfits_nif.so..."
+echo "Compiling exfits_nif.so ($EXFITS_BUILD: $NIF_CFLAGS)..."
 if [ "$(uname)" = "Darwin" ]; then
-  gcc -dynamiclib -undefined dynamic_lookup -fPIC -o priv/exfits_nif.so c_src/exfits_nif.c -I$NIF_INCLUDE ${CFITSIO_INCDIR1:+-I$CFITSIO_INCDIR1} ${CFITSIO_INCDIR2:+-I$CFITSIO_INCDIR2} -L$CFITSIO_LIBDIR -lcfitsio
+  $CC -dynamiclib -undefined dynamic_lookup $NIF_CFLAGS -o priv/exfits_nif.so c_src/exfits_nif.c -I$NIF_INCLUDE ${CFITSIO_INCDIR1:+-I$CFITSIO_INCDIR1} ${CFITSIO_INCDIR2:+-I$CFITSIO_INCDIR2} -L$CFITSIO_LIBDIR -lcfitsio -lm
 else
-  gcc -fPIC -shared -o priv/exfits_nif.so c_src/exfits_nif.c -I$NIF_INCLUDE ${CFITSIO_INCDIR1:+-I$CFITSIO_INCDIR1} ${CFITSIO_INCDIR2:+-I$CFITSIO_INCDIR2} -L$CFITSIO_LIBDIR -lcfitsio
+  $CC -shared $NIF_CFLAGS -o priv/exfits_nif.so c_src/exfits_nif.c -I$NIF_INCLUDE ${CFITSIO_INCDIR1:+-I$CFITSIO_INCDIR1} ${CFITSIO_INCDIR2:+-I$CFITSIO_INCDIR2} -L$CFITSIO_LIBDIR -lcfitsio -lm
 fi
+
+# Record the mode, so mix compile rebuilds when it changes
+echo "$EXFITS_BUILD" > priv/exfits_nif.build
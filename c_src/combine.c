@@ -0,0 +1,304 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Bytes of input strips held at once when no strip_rows option is given
+#define COMBINE_BUDGET_BYTES (64 << 20)
+// Upper bound on the threads combining one strip
+#define MAX_COMBINE_THREADS 32
+
+enum { COMBINE_MEAN, COMBINE_MEDIAN, COMBINE_SIGMA_CLIP };
+
+// One thread's share of a strip: the pixels first..last of every frame's
+// strip, combined into out. Each worker gathers a pixel's values from the
+// frames into its own scratch space.
+typedef struct {
+    int method;
+    double sigma;
+    int iterations;
+    int nframes;
+    const double *strips;
+    size_t stride;
+    size_t first;
+    size_t last;
+    double *scratch;
+    double *out;
+} combine_worker;
+
+// Combine the n valid values of one pixel, reordering them; NaN if none
+static double combine_values(const combine_worker *worker, double *x, size_t n) {
+    if (n == 0) {
+        return NAN;
+    }
+    if (worker->method == COMBINE_MEDIAN) {
+        return median_of(x, n);
+    }
+    if (worker->method == COMBINE_SIGMA_CLIP) {
+        n = sigma_clip(x, n, worker->sigma, worker->iterations);
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        sum += x[i];
+    }
+    return n ? sum / (double)n : NAN;
+}
+
+static void *combine_strip(void *arg) {
+    combine_worker *worker = (combine_worker*)arg;
+    for (size_t p = worker->first; p < worker->last; p++) {
+        // NaN and BLANK pixels of a frame leave it out of that pixel
+        size_t n = 0;
+        for (int f = 0; f < worker->nframes; f++) {
+            double value = worker->strips[f * worker->stride + p];
+            worker->scratch[n] = value;
+            n += value == value;
+        }
+        worker->out[p] = combine_values(worker, worker->scratch, n);
+    }
+    return NULL;
+}
+
+// The BLANK an integer result marks pixels with no valid values with: the
+// stored value of the most negative physical value of a signed type, or of
+// the largest of an unsigned one, so it is the least likely to be real data
+static LONGLONG blank_for_bitpix(int bitpix) {
+    switch (bitpix) {
+        case BYTE_IMG: return 255;
+        case SBYTE_IMG: return 0;
+        case SHORT_IMG: return -32768;
+        case USHORT_IMG: return 32767;
+        case LONG_IMG: return INT32_MIN;
+        case ULONG_IMG: return INT32_MAX;
+        case ULONGLONG_IMG: return INT64_MAX;
+        default: return INT64_MIN;
+    }
+}
+
+static void close_sources(fits_source *sources, unsigned count, int *status) {
+    for (unsigned i = 0; i < count; i++) {
+        close_source(&sources[i], status);
+    }
+}
+
+/**
+ * Combines frames of the same shape pixel by pixel into a new image, such as
+ * a master bias, dark or flat, strip by strip. Each strip is a run of whole
+ * rows read from every frame in turn, combined across frames by one or more
+ * threads and written out before the next is read, so memory is bounded by
+ * the strip size times the number of frames. NaN and BLANK pixels are left
+ * out; a pixel with no valid values is NaN, or BLANK in an integer result
+ * (the header's, if it sets one, else from blank_for_bitpix).
+ *
+ * Args:
+ *   - sources: List of paths or handles of the frames
+ *   - target: Path to create (replacing any existing file) or a writable handle
+ *   - options: Map of options:
+ *       method: :median (default), :mean or :sigma_clip, the mean of the
+ *         values left after clipping around their median
+ *       sigma: Clipping threshold in standard deviations (default 3.0)
+ *       iterations: Most clipping iterations (default 5)
+ *       hdu: HDU number or EXTNAME in every frame (default: first image)
+ *       strip_rows: Rows per strip (default: 64 MiB of strips in all)
+ *       threads: Threads combining each strip (default 1)
+ *       bitpix: BITPIX of the result (default -32)
+ *       header: Map of header cards, or an ordered card list, for the result
+ *
+ * Returns:
+ *   :ok on success
+ *   {:error, :shape_mismatch} if the frames differ in shape
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM combine_frames(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ERL_NIF_TERM opts = argv[2], header = 0, value;
+    unsigned nframes;
+    if (!enif_get_list_length(env, argv[0], &nframes) || nframes == 0 || !enif_is_map(env, opts)) {
+        return enif_make_badarg(env);
+    }
+
+    combine_worker base = {COMBINE_MEDIAN, 3.0, 5, (int)nframes};
+    char method[16];
+    if (get_atom_option(env, opts, "method", method, sizeof(method))) {
+        if (strcmp(method, "mean") == 0) {
+            base.method = COMBINE_MEAN;
+        } else if (strcmp(method, "sigma_clip") == 0) {
+            base.method = COMBINE_SIGMA_CLIP;
+        } else if (strcmp(method, "median") != 0) {
+            return enif_make_badarg(env);
+        }
+    }
+    if (enif_get_map_value(env, opts, enif_make_atom(env, "sigma"), &value) &&
+        !enif_get_double(env, value, &base.sigma)) {
+        return enif_make_badarg(env);
+    }
+    int strip_rows = 0, threads = 1, bitpix = FLOAT_IMG;
+    get_int_option(env, opts, "iterations", &base.iterations);
+    get_int_option(env, opts, "strip_rows", &strip_rows);
+    get_int_option(env, opts, "threads", &threads);
+    get_int_option(env, opts, "bitpix", &bitpix);
+    if (enif_get_map_value(env, opts, enif_make_atom(env, "header"), &value)) {
+        if (!enif_is_map(env, value) && !enif_is_list(env, value)) {
+            return enif_make_badarg(env);
+        }
+        header = value;
+    }
+    if (base.sigma <= 0.0 || base.iterations < 1 || strip_rows < 0 || threads < 1) {
+        return enif_make_badarg(env);
+    }
+    if (threads > MAX_COMBINE_THREADS) {
+        threads = MAX_COMBINE_THREADS;
+    }
+
+    ERL_NIF_TERM *terms = enif_alloc((nframes + 1) * sizeof(ERL_NIF_TERM));
+    fits_source *sources = enif_alloc(nframes * sizeof(fits_source));
+    if (terms == NULL || sources == NULL) {
+        enif_free(terms);
+        enif_free(sources);
+        return make_error_status(env, MEMORY_ALLOCATION);
+    }
+    ERL_NIF_TERM list = argv[0];
+    for (unsigned i = 0; i < nframes; i++) {
+        enif_get_list_cell(env, list, &terms[i], &list);
+    }
+    terms[nframes] = argv[1];
+    if (has_repeated_handle(env, terms, nframes + 1)) {
+        enif_free(terms);
+        enif_free(sources);
+        return enif_make_badarg(env);
+    }
+
+    // Open every frame and check it against the first
+    int status = 0, naxis = 0, frame_naxis;
+    LONGLONG naxes[MAX_NAXIS], frame_naxes[MAX_NAXIS];
+    unsigned opened = 0;
+    int valid = 1, mismatch = 0;
+    for (; opened < nframes && valid && !status && !mismatch; opened++) {
+        valid = open_image_at(env, terms[opened], opts, &sources[opened], &status);
+        if (!valid || status) {
+            break;
+        }
+        get_image_shape(sources[opened].fptr, opened ? &frame_naxis : &naxis, opened ? frame_naxes : naxes,
+                        &status);
+        mismatch = opened && !status &&
+                   (frame_naxis != naxis || memcmp(frame_naxes, naxes, naxis * sizeof(LONGLONG)) != 0);
+    }
+    enif_free(terms);
+    if (!valid || status || mismatch || naxis == 0) {
+        int close_status = 0;
+        close_sources(sources, opened, &close_status);
+        enif_free(sources);
+        if (!valid) {
+            return enif_make_badarg(env);
+        }
+        if (status) {
+            return make_error_status(env, status);
+        }
+        return enif_make_tuple2(env, enif_make_atom(env, "error"),
+                                enif_make_atom(env, mismatch ? "shape_mismatch" : "no_image_data"));
+    }
+
+    // Strips are runs of whole rows of NAXIS1 pixels, in file order
+    size_t row_pixels = (size_t)naxes[0];
+    size_t rows = (size_t)(count_pixels(naxis, naxes) / naxes[0]);
+    size_t strip = strip_rows ? (size_t)strip_rows : COMBINE_BUDGET_BYTES / (nframes * row_pixels * sizeof(double));
+    strip = strip < 1 ? 1 : strip > rows ? rows : strip;
+    base.stride = strip * row_pixels;
+
+    double *strips = enif_alloc(nframes * base.stride * sizeof(double));
+    double *out = enif_alloc(base.stride * sizeof(double));
+    double *scratch = enif_alloc((size_t)threads * nframes * sizeof(double));
+    fits_source target = {NULL, NULL};
+    if (strips == NULL || out == NULL || scratch == NULL) {
+        status = MEMORY_ALLOCATION;
+    } else if (!create_source(env, argv[1], 1, &target, &status)) {
+        valid = 0;
+    }
+
+    // One card is kept free for NCOMBINE, and one for BLANK in an integer result
+    LONGLONG band, blank = 0;
+    if (valid && !status &&
+        !create_image_hdu(env, target.fptr, naxis, naxes, bitpix, header, 0, 0, bitpix > 0 ? 2 : 1, &band,
+                          &status)) {
+        valid = 0;
+    }
+    if (valid && !status && bitpix > 0) {
+        int key_status = 0;
+        if (fits_read_key_lnglng(target.fptr, "BLANK", &blank, NULL, &key_status)) {
+            blank = blank_for_bitpix(bitpix);
+            fits_update_key_lng(target.fptr, "BLANK", blank, "Pixels with no valid input", &status);
+        }
+        fits_set_imgnull(target.fptr, blank, &status);
+    }
+    base.strips = strips;
+    base.out = out;
+
+    double nulval = NAN;
+    for (size_t first_row = 0; valid && !status && first_row < rows; first_row += strip) {
+        size_t n = (rows - first_row < strip ? rows - first_row : strip) * row_pixels;
+        LONGLONG firstelem = (LONGLONG)(first_row * row_pixels) + 1;
+        for (unsigned f = 0; f < nframes && !status; f++) {
+            int anynul;
+            fits_read_img(sources[f].fptr, TDOUBLE, firstelem, n, &nulval, strips + f * base.stride, &anynul,
+                          &status);
+        }
+        if (status) {
+            break;
+        }
+
+        int nworkers = (size_t)threads > n ? (int)n : threads;
+        combine_worker workers[MAX_COMBINE_THREADS];
+        ErlNifTid tids[MAX_COMBINE_THREADS];
+        int threaded[MAX_COMBINE_THREADS] = {0};
+        for (int i = 0; i < nworkers; i++) {
+            workers[i] = base;
+            workers[i].first = n * i / nworkers;
+            workers[i].last = n * (i + 1) / nworkers;
+            workers[i].scratch = scratch + (size_t)i * nframes;
+        }
+        for (int i = 1; i < nworkers; i++) {
+            threaded[i] = enif_thread_create("exfits_combine", &tids[i], combine_strip, &workers[i], NULL) == 0;
+        }
+        combine_strip(&workers[0]);
+        for (int i = 1; i < nworkers; i++) {
+            if (threaded[i]) {
+                enif_thread_join(tids[i], NULL);
+            } else {
+                combine_strip(&workers[i]);
+            }
+        }
+
+        if (bitpix < 0) {
+            fits_write_img(target.fptr, TDOUBLE, firstelem, n, out, &status);
+            continue;
+        }
+        // NaN never compares equal, so the pixels to write as BLANK are marked
+        // with a value that would overflow any integer type anyway
+        double marker = -DBL_MAX;
+        for (size_t p = 0; p < n; p++) {
+            out[p] = out[p] == out[p] ? out[p] : marker;
+        }
+        fits_write_imgnull(target.fptr, TDOUBLE, firstelem, n, out, &marker, &status);
+    }
+
+    if (valid && !status && header) {
+        valid = write_new_header(env, target.fptr, header, 0, HEADER_AFTER_DATA, &status);
+    }
+    if (valid && !status) {
+        fits_update_key_lng(target.fptr, "NCOMBINE", nframes, "Number of frames combined", &status);
+    }
+    close_source(&target, &status);
+    close_sources(sources, nframes, &status);
+    enif_free(sources);
+    enif_free(strips);
+    enif_free(out);
+    enif_free(scratch);
+    if (!valid) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_atom(env, "ok");
+}
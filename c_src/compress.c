@@ -0,0 +1,246 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <string.h>
+
+// Upper bound on the threads used to decompress one image
+#define MAX_DECODE_THREADS 32
+
+// Look up an optional integer key in an options map
+static int get_int_option(ErlNifEnv* env, ERL_NIF_TERM opts, const char *key, int *value) {
+    ERL_NIF_TERM term;
+    if (!enif_is_map(env, opts) ||
+        !enif_get_map_value(env, opts, enif_make_atom(env, key), &term)) {
+        return 0;
+    }
+    return enif_get_int(env, term, value);
+}
+
+// Map a :compress option atom to a CFITSIO compression type
+static int compression_type_for_name(const char *name, int *comptype) {
+    static const struct { const char *name; int comptype; } types[] = {
+        {"none", NOCOMPRESS}, {"rice", RICE_1}, {"gzip", GZIP_1}, {"gzip2", GZIP_2},
+        {"hcompress", HCOMPRESS_1}, {"plio", PLIO_1},
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcmp(name, types[i].name) == 0) {
+            *comptype = types[i].comptype;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Apply the tile compression options in opts (a map with optional compress,
+// tile in Nx order, quantize_level and hcomp_scale) to the next image created
+// on fptr. Sets *compressed when compression was switched on, in which case
+// end_compression must be called once the image is written. Returns 0 for
+// malformed options.
+static int begin_compression(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM opts, int naxis,
+                             int *compressed, int *status) {
+    char name[16];
+    int comptype;
+    ERL_NIF_TERM value;
+    *compressed = 0;
+    if (!enif_is_map(env, opts) ||
+        !enif_get_map_value(env, opts, enif_make_atom(env, "compress"), &value) ||
+        enif_is_identical(value, enif_make_atom(env, "nil"))) {
+        return 1;
+    }
+    if (!enif_get_atom(env, value, name, sizeof(name), ERL_NIF_LATIN1) ||
+        !compression_type_for_name(name, &comptype)) {
+        return 0;
+    }
+    if (comptype == NOCOMPRESS) {
+        return 1;
+    }
+
+    fits_set_compression_type(fptr, comptype, status);
+    *compressed = 1;
+
+    if (enif_get_map_value(env, opts, enif_make_atom(env, "tile"), &value)) {
+        int arity;
+        const ERL_NIF_TERM *dims;
+        long tile[MAX_NAXIS];
+        if (!enif_get_tuple(env, value, &arity, &dims) || arity != naxis) {
+            return 0;
+        }
+        // Tiles are given in Nx order like shapes, CFITSIO wants NAXIS1 first
+        for (int i = 0; i < arity; i++) {
+            if (!enif_get_long(env, dims[i], &tile[arity - 1 - i]) || tile[arity - 1 - i] < 1) {
+                return 0;
+            }
+        }
+        fits_set_tile_dim(fptr, naxis, tile, status);
+    }
+
+    double number;
+    if (enif_get_map_value(env, opts, enif_make_atom(env, "quantize_level"), &value)) {
+        long whole;
+        if (enif_get_long(env, value, &whole)) {
+            number = whole;
+        } else if (!enif_get_double(env, value, &number)) {
+            return 0;
+        }
+        fits_set_quantize_level(fptr, (float)number, status);
+    }
+    if (enif_get_map_value(env, opts, enif_make_atom(env, "hcomp_scale"), &value)) {
+        long whole;
+        if (enif_get_long(env, value, &whole)) {
+            number = whole;
+        } else if (!enif_get_double(env, value, &number)) {
+            return 0;
+        }
+        fits_set_hcomp_scale(fptr, (float)number, status);
+    }
+    return 1;
+}
+
+// Height of a tile along the slowest image axis of the current,
+// tile-compressed HDU (1 when row-by-row tiles are used)
+static long tile_rows_of(fitsfile *fptr, int naxis) {
+    char keyname[FLEN_KEYWORD];
+    long tile_rows = 1;
+    int key_status = 0;
+    fits_make_keyn("ZTILE", naxis, keyname, &key_status);
+    fits_read_key(fptr, TLONG, keyname, &tile_rows, NULL, &key_status);
+    return key_status || tile_rows < 1 ? 1 : tile_rows;
+}
+
+// Switch compression back off so a handle's next image is written plainly
+static void end_compression(fitsfile *fptr, int compressed) {
+    if (compressed) {
+        int reset_status = 0;
+        fits_set_compression_type(fptr, NOCOMPRESS, &reset_status);
+    }
+}
+
+// One band of whole rows (along the slowest axis) decoded by one thread
+typedef struct {
+    const char *filename;
+    int hdunum;
+    const pixel_type *type;
+    int scale;
+    int naxis;
+    const LONGLONG *naxes;
+    long first_row;
+    long last_row;
+    unsigned char *pixels;
+    int status;
+} decode_band;
+
+// Decode one band through its own fitsfile, since a fitsfile must not be used
+// from two threads at once
+static void *decode_band_thread(void *arg) {
+    decode_band *band = arg;
+    fitsfile *fptr;
+    int status = 0;
+    long fpixel[MAX_NAXIS], lpixel[MAX_NAXIS], inc[MAX_NAXIS];
+    for (int i = 0; i < band->naxis; i++) {
+        fpixel[i] = 1;
+        lpixel[i] = band->naxes[i];
+        inc[i] = 1;
+    }
+    fpixel[band->naxis - 1] = band->first_row;
+    lpixel[band->naxis - 1] = band->last_row;
+
+    if (!fits_open_file(&fptr, band->filename, READONLY, &status)) {
+        fits_movabs_hdu(fptr, band->hdunum, NULL, &status);
+        saved_scaling saved;
+        if (!band->scale) {
+            begin_raw_read(fptr, &saved, &status);
+        }
+        fits_read_subset(fptr, band->type->datatype, fpixel, lpixel, inc, NULL, band->pixels, NULL, &status);
+        if (!band->scale) {
+            end_raw_read(fptr, &saved);
+        }
+        fits_close_file(fptr, &status);
+    }
+    band->status = status;
+    return NULL;
+}
+
+// Work out how many threads to decode the current image with: the :threads
+// option, by default 1, which means decode inline. Each extra thread opens
+// the file again, which small images do not repay, and concurrent reads on
+// the dirty schedulers already keep the cores busy.
+static int decode_thread_count(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM opts, int *status) {
+    int mode = READONLY, threads;
+    char urltype[FLEN_FILENAME];
+    int compressed = fits_is_compressed_image(fptr, status);
+    // Separate opens only see what is on disk, so a writable handle that may
+    // hold unflushed data is always decoded inline, and so is any file not
+    // on disk: reopening the name of an in-memory file does not reach it
+    fits_file_mode(fptr, &mode, status);
+    fits_file_type(fptr, urltype, status);
+    if (*status || !compressed || mode != READONLY || strcmp(urltype, "file://") != 0 || !fits_is_reentrant()) {
+        return 1;
+    }
+    if (!get_int_option(env, opts, "threads", &threads) || threads < 1) {
+        threads = 1;
+    }
+    return threads > MAX_DECODE_THREADS ? MAX_DECODE_THREADS : threads;
+}
+
+// Decode a whole tile-compressed image across several threads, each reading a
+// band of tile rows with its own file open. Tiles are independent, so the
+// bands never decode the same tile twice. Returns 0 if the image is not
+// compressed (or threading does not apply) and nothing was read; otherwise 1
+// with the outcome in status.
+static int read_tiles_in_parallel(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM opts,
+                                  const pixel_type *type, int scale, void *pixels, int *status) {
+    int threads = decode_thread_count(env, fptr, opts, status);
+    if (*status || threads < 2) {
+        return 0;
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    char filename[FLEN_FILENAME];
+    int hdunum;
+    if (get_image_shape(fptr, &naxis, naxes, status) || naxis == 0 ||
+        fits_file_name(fptr, filename, status) || fits_get_hdu_num(fptr, &hdunum) < 1) {
+        return 0;
+    }
+    // Bands start on tile boundaries along the slowest axis
+    long tile_rows = tile_rows_of(fptr, naxis);
+
+    LONGLONG rows = naxes[naxis - 1];
+    LONGLONG tiles = (rows + tile_rows - 1) / tile_rows;
+    if (tiles < threads) {
+        threads = (int)tiles;
+    }
+    if (threads < 2) {
+        return 0;
+    }
+    LONGLONG band_rows = (tiles + threads - 1) / threads * tile_rows;
+    size_t row_bytes = (size_t)(count_pixels(naxis, naxes) / rows) * type->size;
+
+    decode_band bands[MAX_DECODE_THREADS];
+    ErlNifTid tids[MAX_DECODE_THREADS];
+    int threaded[MAX_DECODE_THREADS];
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        LONGLONG first = 1 + i * band_rows;
+        if (first > rows) {
+            break;
+        }
+        bands[i] = (decode_band){filename, hdunum, type, scale, naxis, naxes, (long)first,
+                                 (long)(first + band_rows - 1 > rows ? rows : first + band_rows - 1),
+                                 (unsigned char *)pixels + (first - 1) * row_bytes, 0};
+        threaded[i] = enif_thread_create("exfits_decode", &tids[i], decode_band_thread, &bands[i], NULL) == 0;
+        if (!threaded[i]) {
+            // Fall back to decoding this band on the calling thread
+            decode_band_thread(&bands[i]);
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        if (threaded[i]) {
+            enif_thread_join(tids[i], NULL);
+        }
+        if (bands[i].status && !*status) {
+            *status = bands[i].status;
+        }
+    }
+    return 1;
+}
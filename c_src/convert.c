@@ -0,0 +1,305 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EXFITS_SIMD_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define EXFITS_SIMD_NEON 1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define EXFITS_HOST_BIG_ENDIAN 1
+#else
+#define EXFITS_HOST_BIG_ENDIAN 0
+#endif
+
+// Elements converted per pass. A block of the widest type stays in L1, so a
+// fused swap+cast touches each input byte once from memory.
+#define CONVERT_BLOCK 4096
+
+// Best byte-swap kernel the CPU supports, chosen once at load time
+enum { SIMD_NONE, SIMD_SSSE3, SIMD_AVX2, SIMD_NEON };
+static int simd_level = SIMD_NONE;
+
+static void detect_simd(void) {
+#if defined(EXFITS_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        simd_level = SIMD_AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        simd_level = SIMD_SSSE3;
+    }
+#elif defined(EXFITS_SIMD_NEON)
+    simd_level = SIMD_NEON;
+#endif
+}
+
+// Byte-reversal patterns for pshufb, repeated for both 128-bit AVX2 lanes
+static const uint8_t swap_masks[3][32] = {
+    {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+     1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+     3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+     7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8},
+};
+
+static const uint8_t *swap_mask(size_t size) {
+    return swap_masks[size == 2 ? 0 : size == 4 ? 1 : 2];
+}
+
+#if defined(EXFITS_SIMD_X86)
+// Each kernel swaps as many whole vectors as fit and returns the number of
+// elements done; the scalar loop finishes the tail.
+__attribute__((target("ssse3")))
+static size_t swap_bytes_ssse3(uint8_t *dst, const uint8_t *src, size_t n, size_t size) {
+    const __m128i mask = _mm_loadu_si128((const __m128i *)swap_mask(size));
+    size_t bytes = n * size, i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, mask));
+    }
+    return i / size;
+}
+
+__attribute__((target("avx2")))
+static size_t swap_bytes_avx2(uint8_t *dst, const uint8_t *src, size_t n, size_t size) {
+    const __m256i mask = _mm256_loadu_si256((const __m256i *)swap_mask(size));
+    size_t bytes = n * size, i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, mask));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_shuffle_epi8(b, mask));
+    }
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+    return i / size;
+}
+#endif
+
+#if defined(EXFITS_SIMD_NEON)
+static size_t swap_bytes_neon(uint8_t *dst, const uint8_t *src, size_t n, size_t size) {
+    size_t bytes = n * size, i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        v = size == 2 ? vrev16q_u8(v) : size == 4 ? vrev32q_u8(v) : vrev64q_u8(v);
+        vst1q_u8(dst + i, v);
+    }
+    return i / size;
+}
+#endif
+
+static void swap_bytes_scalar(uint8_t *dst, const uint8_t *src, size_t n, size_t size) {
+    switch (size) {
+        case 2:
+            for (size_t i = 0; i < n; i++) {
+                uint16_t v;
+                memcpy(&v, src + i * 2, 2);
+                v = __builtin_bswap16(v);
+                memcpy(dst + i * 2, &v, 2);
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < n; i++) {
+                uint32_t v;
+                memcpy(&v, src + i * 4, 4);
+                v = __builtin_bswap32(v);
+                memcpy(dst + i * 4, &v, 4);
+            }
+            break;
+        case 8:
+            for (size_t i = 0; i < n; i++) {
+                uint64_t v;
+                memcpy(&v, src + i * 8, 8);
+                v = __builtin_bswap64(v);
+                memcpy(dst + i * 8, &v, 8);
+            }
+            break;
+        default:
+            if (dst != src) {
+                memmove(dst, src, n * size);
+            }
+            break;
+    }
+}
+
+// Reverse the byte order of n elements of the given size. dst may equal src.
+static void swap_bytes(uint8_t *dst, const uint8_t *src, size_t n, size_t size) {
+    size_t done = 0;
+    if (size > 1) {
+        switch (simd_level) {
+#if defined(EXFITS_SIMD_X86)
+            case SIMD_AVX2:  done = swap_bytes_avx2(dst, src, n, size); break;
+            case SIMD_SSSE3: done = swap_bytes_ssse3(dst, src, n, size); break;
+#elif defined(EXFITS_SIMD_NEON)
+            case SIMD_NEON:  done = swap_bytes_neon(dst, src, n, size); break;
+#endif
+            default: break;
+        }
+    }
+    swap_bytes_scalar(dst + done * size, src + done * size, n - done, size);
+}
+
+// Plain element-wise casts; the compiler vectorizes these loops
+#define CAST_LOOP(SRC_T, DST_T)                                              \
+    do {                                                                     \
+        const SRC_T *s = (const SRC_T *)src;                                 \
+        DST_T *d = (DST_T *)dst;                                             \
+        for (size_t i = 0; i < n; i++) d[i] = (DST_T)s[i];                   \
+    } while (0)
+
+// Float to integer casts saturate and map NaN to 0, since out-of-range
+// conversions are undefined in C
+#define CLAMP_LOOP(SRC_T, DST_T, LO, HI)                                     \
+    do {                                                                     \
+        const SRC_T *s = (const SRC_T *)src;                                 \
+        DST_T *d = (DST_T *)dst;                                             \
+        for (size_t i = 0; i < n; i++) {                                     \
+            SRC_T v = s[i];                                                  \
+            d[i] = v != v ? 0 : v <= (SRC_T)(LO) ? (LO)                      \
+                 : v >= (SRC_T)(HI) ? (HI) : (DST_T)v;                       \
+        }                                                                    \
+    } while (0)
+
+#define CAST_FROM_INT(SRC_T)                                                 \
+    switch (dst_type) {                                                      \
+        case TBYTE:      CAST_LOOP(SRC_T, uint8_t); return 1;                \
+        case TSBYTE:     CAST_LOOP(SRC_T, int8_t); return 1;                 \
+        case TUSHORT:    CAST_LOOP(SRC_T, uint16_t); return 1;               \
+        case TSHORT:     CAST_LOOP(SRC_T, int16_t); return 1;                \
+        case TUINT:      CAST_LOOP(SRC_T, uint32_t); return 1;               \
+        case TINT:       CAST_LOOP(SRC_T, int32_t); return 1;                \
+        case TULONGLONG: CAST_LOOP(SRC_T, uint64_t); return 1;               \
+        case TLONGLONG:  CAST_LOOP(SRC_T, int64_t); return 1;                \
+        case TFLOAT:     CAST_LOOP(SRC_T, float); return 1;                  \
+        case TDOUBLE:    CAST_LOOP(SRC_T, double); return 1;                 \
+        default: return 0;                                                   \
+    }
+
+#define CAST_FROM_FLOAT(SRC_T)                                               \
+    switch (dst_type) {                                                      \
+        case TBYTE:      CLAMP_LOOP(SRC_T, uint8_t, 0, UINT8_MAX); return 1; \
+        case TSBYTE:     CLAMP_LOOP(SRC_T, int8_t, INT8_MIN, INT8_MAX); return 1; \
+        case TUSHORT:    CLAMP_LOOP(SRC_T, uint16_t, 0, UINT16_MAX); return 1; \
+        case TSHORT:     CLAMP_LOOP(SRC_T, int16_t, INT16_MIN, INT16_MAX); return 1; \
+        case TUINT:      CLAMP_LOOP(SRC_T, uint32_t, 0, UINT32_MAX); return 1; \
+        case TINT:       CLAMP_LOOP(SRC_T, int32_t, INT32_MIN, INT32_MAX); return 1; \
+        case TULONGLONG: CLAMP_LOOP(SRC_T, uint64_t, 0, UINT64_MAX); return 1; \
+        case TLONGLONG:  CLAMP_LOOP(SRC_T, int64_t, INT64_MIN, INT64_MAX); return 1; \
+        case TFLOAT:     CAST_LOOP(SRC_T, float); return 1;                  \
+        case TDOUBLE:    CAST_LOOP(SRC_T, double); return 1;                 \
+        default: return 0;                                                   \
+    }
+
+// Convert n native-endian elements between CFITSIO datatypes
+static int cast_pixels(void *dst, int dst_type, const void *src, int src_type, size_t n) {
+    switch (src_type) {
+        case TBYTE:      CAST_FROM_INT(uint8_t)
+        case TSBYTE:     CAST_FROM_INT(int8_t)
+        case TUSHORT:    CAST_FROM_INT(uint16_t)
+        case TSHORT:     CAST_FROM_INT(int16_t)
+        case TUINT:      CAST_FROM_INT(uint32_t)
+        case TINT:       CAST_FROM_INT(int32_t)
+        case TULONGLONG: CAST_FROM_INT(uint64_t)
+        case TLONGLONG:  CAST_FROM_INT(int64_t)
+        case TFLOAT:     CAST_FROM_FLOAT(float)
+        case TDOUBLE:    CAST_FROM_FLOAT(double)
+        default: return 0;
+    }
+}
+
+// Convert n elements from src to dst, swapping the source byte order first
+// when needed. Swaps go through a block-sized scratch buffer so the swap and
+// the cast are fused into one pass over the input.
+static int convert_pixels_into(uint8_t *dst, const pixel_type *to, const uint8_t *src,
+                               const pixel_type *from, size_t n, int swap) {
+    if (from->datatype == to->datatype) {
+        if (swap) {
+            swap_bytes(dst, src, n, from->size);
+        } else {
+            memcpy(dst, src, n * from->size);
+        }
+        return 1;
+    }
+    if (!swap) {
+        return cast_pixels(dst, to->datatype, src, from->datatype, n);
+    }
+
+    uint8_t *scratch = enif_alloc(CONVERT_BLOCK * from->size);
+    if (scratch == NULL) {
+        return 0;
+    }
+    for (size_t first = 0; first < n; first += CONVERT_BLOCK) {
+        size_t count = n - first < CONVERT_BLOCK ? n - first : CONVERT_BLOCK;
+        swap_bytes(scratch, src + first * from->size, count, from->size);
+        cast_pixels(dst + first * to->size, to->datatype, scratch, from->datatype, count);
+    }
+    enif_free(scratch);
+    return 1;
+}
+
+/**
+ * Converts a binary of pixels between Nx types, optionally from a foreign
+ * byte order, in a single pass.
+ *
+ * Args:
+ *   - data: Binary of pixels
+ *   - from: Nx type of the pixels in data
+ *   - to: Nx type to convert to
+ *   - byte_order: :native, :big or :little, the byte order of data
+ *
+ * Returns:
+ *   {:ok, binary} of native-endian pixels of type `to`; data itself when no
+ *   conversion is needed
+ *   {:error, :unsupported_type} if either type has no FITS equivalent
+ */
+static ERL_NIF_TERM convert_pixels(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary input;
+    pixel_buffer output;
+    pixel_type from, to;
+    char order[8];
+    if (!enif_inspect_binary(env, argv[0], &input) ||
+        !enif_get_atom(env, argv[3], order, sizeof(order), ERL_NIF_LATIN1)) {
+        return enif_make_badarg(env);
+    }
+    if (!pixel_type_for_nx(env, argv[1], &from) || !pixel_type_for_nx(env, argv[2], &to)) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "unsupported_type"));
+    }
+    if (input.size % from.size != 0) {
+        return enif_make_badarg(env);
+    }
+
+    int swap;
+    if (strcmp(order, "native") == 0) {
+        swap = 0;
+    } else if (strcmp(order, "big") == 0) {
+        swap = !EXFITS_HOST_BIG_ENDIAN;
+    } else if (strcmp(order, "little") == 0) {
+        swap = EXFITS_HOST_BIG_ENDIAN;
+    } else {
+        return enif_make_badarg(env);
+    }
+    // Single-byte pixels have no byte order
+    swap = swap && from.size > 1;
+
+    if (!swap && from.datatype == to.datatype) {
+        return enif_make_tuple2(env, enif_make_atom(env, "ok"), argv[0]);
+    }
+
+    size_t n = input.size / from.size;
+    if (!alloc_pixel_buffer(n * to.size, &output)) {
+        return make_error_status(env, MEMORY_ALLOCATION);
+    }
+    if (!convert_pixels_into(output.data, &to, input.data, &from, n, swap)) {
+        release_pixel_buffer(&output);
+        return make_error_status(env, MEMORY_ALLOCATION);
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), make_pixel_binary(env, &output));
+}
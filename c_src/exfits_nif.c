@@ -1,6 +1,429 @@
 #include <erl_nif.h>
 #include <fitsio.h>
+#include <math.h>
+#include <string.h>
 
+// An open CFITSIO file kept alive across NIF calls. The mutex serialises
+// access because CFITSIO file pointers must not be used by two threads at
+// once, and callers may share a handle between processes.
+typedef struct {
+    fitsfile *fptr;
+    ErlNifMutex *lock;
+    // In-memory files only: a file opened from a binary keeps the binary alive
+    // in source_env and reads it in place; a file being created lives in
+    // mem_buf, which CFITSIO grows and which outlives the file as the binary
+    // returned by close_memory
+    ErlNifEnv *source_env;
+    void *mem_buf;
+    size_t mem_size;
+} fits_handle;
+
+static ErlNifResourceType *FITS_HANDLE_TYPE = NULL;
+
+// Close the file when the handle is garbage collected without ExFITS.close/1
+static void fits_handle_dtor(ErlNifEnv* env, void* obj) {
+    fits_handle *handle = (fits_handle *)obj;
+    int status = 0;
+    if (handle->fptr != NULL) {
+        fits_close_file(handle->fptr, &status);
+        handle->fptr = NULL;
+    }
+    if (handle->lock != NULL) {
+        enif_mutex_destroy(handle->lock);
+        handle->lock = NULL;
+    }
+    if (handle->source_env != NULL) {
+        enif_free_env(handle->source_env);
+    } else if (handle->mem_buf != NULL) {
+        enif_free(handle->mem_buf);
+    }
+}
+
+// A file being worked on by a single NIF call: either borrowed from a handle
+// (and locked for the duration of the call) or opened from a path.
+typedef struct {
+    fitsfile *fptr;
+    fits_handle *handle;
+} fits_source;
+
+static ERL_NIF_TERM make_error_status(ErlNifEnv* env, int status) {
+    return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+}
+
+// A value as a float, or as :nan, :infinity or :neg_infinity, as Nx writes
+// them, since Erlang floats cannot hold non-finite values
+static ERL_NIF_TERM make_pixel_term(ErlNifEnv* env, double value) {
+    if (isfinite(value)) {
+        return enif_make_double(env, value);
+    }
+    return enif_make_atom(env, isnan(value) ? "nan" : value > 0 ? "infinity" : "neg_infinity");
+}
+
+// Copy an Elixir binary path into a null-terminated C string
+static int get_filename(ErlNifEnv* env, ERL_NIF_TERM term, char *filename, size_t size) {
+    ErlNifBinary bin;
+    if (!enif_inspect_binary(env, term, &bin) || bin.size >= size) {
+        return 0;
+    }
+    memcpy(filename, bin.data, bin.size);
+    filename[bin.size] = '\0';
+    return 1;
+}
+
+// Resolve a path or handle argument into an open file.
+// Returns 0 if the term is neither; CFITSIO failures are reported in status.
+static int open_source(ErlNifEnv* env, ERL_NIF_TERM term, int iomode, fits_source *src, int *status) {
+    src->fptr = NULL;
+    src->handle = NULL;
+
+    fits_handle *handle;
+    if (enif_get_resource(env, term, FITS_HANDLE_TYPE, (void **)&handle)) {
+        enif_mutex_lock(handle->lock);
+        if (handle->fptr == NULL) {
+            enif_mutex_unlock(handle->lock);
+            *status = FILE_NOT_OPENED;
+            return 1;
+        }
+        src->fptr = handle->fptr;
+        src->handle = handle;
+        return 1;
+    }
+
+    char filename[1024];
+    if (!get_filename(env, term, filename, sizeof(filename))) {
+        return 0;
+    }
+    fits_open_file(&src->fptr, filename, iomode, status);
+    return 1;
+}
+
+// Resolve a path or writable handle argument as the target of a new image HDU.
+// A path is created as a new file (removing any existing one when replace is
+// set); a handle has the new HDU appended after its current one.
+static int create_source(ErlNifEnv* env, ERL_NIF_TERM term, int replace, fits_source *src, int *status) {
+    if (enif_is_binary(env, term)) {
+        char filename[1024];
+        if (!get_filename(env, term, filename, sizeof(filename))) {
+            return 0;
+        }
+        src->fptr = NULL;
+        src->handle = NULL;
+        if (replace) {
+            remove(filename);
+        }
+        fits_create_file(&src->fptr, filename, status);
+        return 1;
+    }
+    return open_source(env, term, READWRITE, src, status);
+}
+
+// Release a source obtained from open_source or create_source. Files opened from a path are
+// closed; handles are only unlocked and stay open for the next call.
+static void close_source(fits_source *src, int *status) {
+    if (src->handle != NULL) {
+        enif_mutex_unlock(src->handle->lock);
+    } else if (src->fptr != NULL) {
+        fits_close_file(src->fptr, status);
+    }
+    src->fptr = NULL;
+    src->handle = NULL;
+}
+
+// True if the same handle appears twice among terms, as its lock would then
+// be taken twice by one call
+static int has_repeated_handle(ErlNifEnv* env, const ERL_NIF_TERM *terms, unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        fits_handle *a, *b;
+        if (!enif_get_resource(env, terms[i], FITS_HANDLE_TYPE, (void **)&a)) {
+            continue;
+        }
+        for (unsigned j = i + 1; j < count; j++) {
+            if (enif_get_resource(env, terms[j], FITS_HANDLE_TYPE, (void **)&b) && a == b) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Move to the HDU given by the :hdu option, if present: a 1-based HDU number
+// or an EXTNAME binary. Returns 0 if the option is malformed.
+static int select_hdu(ErlNifEnv* env, ERL_NIF_TERM opts, fitsfile *fptr, int *status) {
+    ERL_NIF_TERM value;
+    if (!enif_is_map(env, opts) ||
+        !enif_get_map_value(env, opts, enif_make_atom(env, "hdu"), &value) ||
+        enif_is_identical(value, enif_make_atom(env, "nil"))) {
+        return 1;
+    }
+
+    int hdunum;
+    if (enif_get_int(env, value, &hdunum)) {
+        if (hdunum < 1) {
+            return 0;
+        }
+        fits_movabs_hdu(fptr, hdunum, NULL, status);
+        return 1;
+    }
+
+    char extname[FLEN_VALUE];
+    if (!get_filename(env, value, extname, sizeof(extname))) {
+        return 0;
+    }
+    fits_movnam_hdu(fptr, ANY_HDU, extname, 0, status);
+    return 1;
+}
+
+// open_source followed by select_hdu for the NIFs that take an options map
+static int open_source_at(ErlNifEnv* env, ERL_NIF_TERM term, ERL_NIF_TERM opts, int iomode,
+                          fits_source *src, int *status) {
+    if (!enif_is_map(env, opts) || !open_source(env, term, iomode, src, status)) {
+        return 0;
+    }
+    if (*status) {
+        return 1;
+    }
+    if (!select_hdu(env, opts, src->fptr, status)) {
+        int close_status = 0;
+        close_source(src, &close_status);
+        return 0;
+    }
+    if (*status) {
+        int close_status = 0;
+        close_source(src, &close_status);
+    }
+    return 1;
+}
+
+// open_source_at for the image readers. When no :hdu option is given and the
+// current HDU holds no image data, as with the empty primary HDU in front of a
+// tile-compressed image, the first image HDU after it that does is used.
+static int open_image_at(ErlNifEnv* env, ERL_NIF_TERM term, ERL_NIF_TERM opts, fits_source *src,
+                         int *status) {
+    ERL_NIF_TERM value;
+    if (!open_source_at(env, term, opts, READONLY, src, status)) {
+        return 0;
+    }
+    if (*status || enif_get_map_value(env, opts, enif_make_atom(env, "hdu"), &value)) {
+        return 1;
+    }
+
+    int hdutype, hdunum, naxis = 0, move_status = 0;
+    fits_get_hdu_type(src->fptr, &hdutype, &move_status);
+    fits_get_img_dim(src->fptr, &naxis, &move_status);
+    if (move_status || hdutype != IMAGE_HDU || naxis != 0) {
+        return 1;
+    }
+    fits_get_hdu_num(src->fptr, &hdunum);
+    while (!fits_movrel_hdu(src->fptr, 1, &hdutype, &move_status)) {
+        if (hdutype == IMAGE_HDU && !fits_get_img_dim(src->fptr, &naxis, &move_status) && naxis > 0) {
+            return 1;
+        }
+    }
+    // No image data anywhere: stay on the original HDU
+    move_status = 0;
+    fits_movabs_hdu(src->fptr, hdunum, NULL, &move_status);
+    return 1;
+}
+
+// Look up an optional atom-valued key in an options map
+static int get_atom_option(ErlNifEnv* env, ERL_NIF_TERM opts, const char *key, char *buf, unsigned size) {
+    ERL_NIF_TERM value;
+    if (!enif_is_map(env, opts) ||
+        !enif_get_map_value(env, opts, enif_make_atom(env, key), &value)) {
+        return 0;
+    }
+    return enif_get_atom(env, value, buf, size, ERL_NIF_LATIN1);
+}
+
+// Look up an optional boolean key in an options map, falling back to a default
+static int get_bool_option(ErlNifEnv* env, ERL_NIF_TERM opts, const char *key, int default_value) {
+    ERL_NIF_TERM value;
+    if (!enif_is_map(env, opts) ||
+        !enif_get_map_value(env, opts, enif_make_atom(env, key), &value)) {
+        return default_value;
+    }
+    if (enif_is_identical(value, enif_make_atom(env, "true"))) {
+        return 1;
+    }
+    if (enif_is_identical(value, enif_make_atom(env, "false"))) {
+        return 0;
+    }
+    return default_value;
+}
+
+// A pixel type as seen from both sides: the CFITSIO datatype code used to
+// read or write it and the matching Nx type ({kind, bits})
+typedef struct {
+    int datatype;
+    size_t size;
+    const char *kind;
+    int bits;
+} pixel_type;
+
+// Map a BITPIX value (or an equivalent type from fits_get_img_equivtype)
+// to the pixel type that holds it without conversion
+static int pixel_type_for_bitpix(int bitpix, pixel_type *type) {
+    switch (bitpix) {
+        case BYTE_IMG:      *type = (pixel_type){TBYTE, 1, "u", 8}; return 1;
+        case SBYTE_IMG:     *type = (pixel_type){TSBYTE, 1, "s", 8}; return 1;
+        case SHORT_IMG:     *type = (pixel_type){TSHORT, 2, "s", 16}; return 1;
+        case USHORT_IMG:    *type = (pixel_type){TUSHORT, 2, "u", 16}; return 1;
+        case LONG_IMG:      *type = (pixel_type){TINT, 4, "s", 32}; return 1;
+        case ULONG_IMG:     *type = (pixel_type){TUINT, 4, "u", 32}; return 1;
+        case LONGLONG_IMG:  *type = (pixel_type){TLONGLONG, 8, "s", 64}; return 1;
+        case ULONGLONG_IMG: *type = (pixel_type){TULONGLONG, 8, "u", 64}; return 1;
+        case FLOAT_IMG:     *type = (pixel_type){TFLOAT, 4, "f", 32}; return 1;
+        case DOUBLE_IMG:    *type = (pixel_type){TDOUBLE, 8, "f", 64}; return 1;
+        default: return 0;
+    }
+}
+
+static ERL_NIF_TERM make_nx_type(ErlNifEnv* env, const pixel_type *type) {
+    return enif_make_tuple2(env, enif_make_atom(env, type->kind), enif_make_int(env, type->bits));
+}
+
+// Parse an Nx type tuple such as {:s, 16} into the matching pixel type
+static int pixel_type_for_nx(ErlNifEnv* env, ERL_NIF_TERM term, pixel_type *type) {
+    static const int bitpix_values[] = {BYTE_IMG, SBYTE_IMG, SHORT_IMG, USHORT_IMG, LONG_IMG, ULONG_IMG,
+                                        LONGLONG_IMG, ULONGLONG_IMG, FLOAT_IMG, DOUBLE_IMG};
+    int arity;
+    const ERL_NIF_TERM *elems;
+    char kind[4];
+    int bits;
+    if (!enif_get_tuple(env, term, &arity, &elems) || arity != 2 ||
+        !enif_get_atom(env, elems[0], kind, sizeof(kind), ERL_NIF_LATIN1) ||
+        !enif_get_int(env, elems[1], &bits)) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(bitpix_values) / sizeof(bitpix_values[0]); i++) {
+        pixel_type_for_bitpix(bitpix_values[i], type);
+        if (strcmp(type->kind, kind) == 0 && type->bits == bits) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Work out which pixel type an image is returned as.
+// "float" always converts to float32. "native" keeps the on-disk type; with
+// scale set, BZERO/BSCALE are applied and the type is the smallest one that
+// holds the physical values (e.g. BITPIX=16 with BZERO=32768 becomes u16).
+static int resolve_read_type(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM opts, int *scale,
+                             pixel_type *type, int *status) {
+    char mode[16] = "float";
+    get_atom_option(env, opts, "type", mode, sizeof(mode));
+    *scale = get_bool_option(env, opts, "scale", 1);
+
+    if (strcmp(mode, "float") == 0) {
+        *scale = 1;
+        return pixel_type_for_bitpix(FLOAT_IMG, type);
+    }
+    if (strcmp(mode, "native") != 0) {
+        return 0;
+    }
+
+    int bitpix;
+    if (*scale) {
+        fits_get_img_equivtype(fptr, &bitpix, status);
+    } else {
+        fits_get_img_type(fptr, &bitpix, status);
+    }
+    if (*status) {
+        return 1;
+    }
+    return pixel_type_for_bitpix(bitpix, type);
+}
+
+// BZERO/BSCALE of an HDU, saved while the raw stored values are being read
+typedef struct {
+    double bscale;
+    double bzero;
+} saved_scaling;
+
+// Switch off BZERO/BSCALE so reads return the raw stored values
+static void begin_raw_read(fitsfile *fptr, saved_scaling *saved, int *status) {
+    int key_status = 0;
+    saved->bscale = 1.0;
+    saved->bzero = 0.0;
+    fits_read_key(fptr, TDOUBLE, "BSCALE", &saved->bscale, NULL, &key_status);
+    key_status = 0;
+    fits_read_key(fptr, TDOUBLE, "BZERO", &saved->bzero, NULL, &key_status);
+    fits_set_bscale(fptr, 1.0, 0.0, status);
+}
+
+// Restore the HDU's scaling so a shared handle keeps reading scaled values
+static void end_raw_read(fitsfile *fptr, const saved_scaling *saved) {
+    int key_status = 0;
+    fits_set_bscale(fptr, saved->bscale, saved->bzero, &key_status);
+}
+
+// Read npixels starting at firstelem (1-based), returning the raw stored
+// values when scale is off.
+static int read_pixels_as(fitsfile *fptr, const pixel_type *type, int scale, LONGLONG firstelem,
+                          LONGLONG npixels, void *pixels, int *status) {
+    if (scale) {
+        return fits_read_img(fptr, type->datatype, firstelem, npixels, NULL, pixels, NULL, status);
+    }
+
+    saved_scaling saved;
+    begin_raw_read(fptr, &saved, status);
+    fits_read_img(fptr, type->datatype, firstelem, npixels, NULL, pixels, NULL, status);
+    end_raw_read(fptr, &saved);
+    return *status;
+}
+
+// Include the size-classed buffer pool that frame reads and writes draw from
+#include "buffer_pool.c"
+
+// Largest staging buffer used when writing pixels from an Elixir binary
+#define WRITE_CHUNK_BYTES (1 << 20)
+
+// Write npixels from an Elixir binary starting at pixel firstelem (1-based,
+// in file order).
+// CFITSIO may byte-swap the array it is given in place, which must never
+// happen to an immutable (and possibly shared) binary, so pixels are staged
+// through a bounded buffer instead of copying the whole image up front.
+// Each chunk is a whole number of bands of band pixels, so tile-compressed
+// images are only ever written in complete rows of tiles.
+static int write_pixels_at(fitsfile *fptr, int datatype, size_t elem_size, const unsigned char *data,
+                           LONGLONG firstelem, LONGLONG npixels, LONGLONG band, int *status) {
+    LONGLONG chunk = WRITE_CHUNK_BYTES / elem_size / band * band;
+    if (chunk < band) {
+        chunk = band;
+    }
+    if (chunk > npixels) {
+        chunk = npixels;
+    }
+    if (chunk == 0) {
+        return *status;
+    }
+    int size_class;
+    unsigned char *buffer = pool_take(chunk * elem_size, &size_class);
+    if (buffer == NULL) {
+        return *status = MEMORY_ALLOCATION;
+    }
+
+    for (LONGLONG first = 0; first < npixels && !*status; first += chunk) {
+        LONGLONG n = npixels - first < chunk ? npixels - first : chunk;
+        memcpy(buffer, data + first * elem_size, n * elem_size);
+        fits_write_img(fptr, datatype, firstelem + first, n, buffer, status);
+    }
+
+    pool_give(buffer, size_class);
+    return *status;
+}
+
+// Write a whole image's npixels from an Elixir binary, from the first pixel
+static int write_pixels_in_bands(fitsfile *fptr, int datatype, size_t elem_size,
+                                 const unsigned char *data, LONGLONG npixels, LONGLONG band,
+                                 int *status) {
+    return write_pixels_at(fptr, datatype, elem_size, data, 1, npixels, band, status);
+}
+
+static int write_pixels_from_binary(fitsfile *fptr, int datatype, size_t elem_size,
+                                    const unsigned char *data, LONGLONG npixels, int *status) {
+    return write_pixels_in_bands(fptr, datatype, elem_size, data, npixels, 1, status);
+}
 
 static ERL_NIF_TERM hello(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
   return enif_make_atom(env, "nif_loaded");
@@ -23,64 +446,510 @@ static ERL_NIF_TERM open_fits(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[
     return enif_make_atom(env, "ok");
 }
 
-static ERL_NIF_TERM read_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+// Open a FITS file and return a handle that later calls can reuse.
+// Mode is one of :read, :readwrite or :create.
+static ERL_NIF_TERM open_handle(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
     char filename[1024];
-    ErlNifBinary bin_filename;
-    if (!enif_inspect_binary(env, argv[0], &bin_filename) || bin_filename.size >= sizeof(filename)) {
+    char mode[16];
+    if (!get_filename(env, argv[0], filename, sizeof(filename)) ||
+        !enif_get_atom(env, argv[1], mode, sizeof(mode), ERL_NIF_LATIN1)) {
         return enif_make_badarg(env);
     }
-    memcpy(filename, bin_filename.data, bin_filename.size);
-    filename[bin_filename.size] = '\0';
+
     fitsfile *fptr;
     int status = 0;
-    if (fits_open_file(&fptr, filename, READONLY, &status)) {
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+    if (strcmp(mode, "read") == 0) {
+        fits_open_file(&fptr, filename, READONLY, &status);
+    } else if (strcmp(mode, "readwrite") == 0) {
+        fits_open_file(&fptr, filename, READWRITE, &status);
+    } else if (strcmp(mode, "create") == 0) {
+        // Same replace-on-create behaviour as write_fits_file
+        remove(filename);
+        fits_create_file(&fptr, filename, &status);
+    } else {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    fits_handle *handle = enif_alloc_resource(FITS_HANDLE_TYPE, sizeof(fits_handle));
+    memset(handle, 0, sizeof(fits_handle));
+    handle->fptr = fptr;
+    handle->lock = enif_mutex_create("exfits_handle");
+    ERL_NIF_TERM term = enif_make_resource(env, handle);
+    enif_release_resource(handle);
+
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), term);
+}
+
+// Close a handle now rather than waiting for garbage collection
+static ERL_NIF_TERM close_handle(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_handle *handle;
+    if (!enif_get_resource(env, argv[0], FITS_HANDLE_TYPE, (void **)&handle)) {
+        return enif_make_badarg(env);
+    }
+
+    int status = 0;
+    enif_mutex_lock(handle->lock);
+    if (handle->fptr != NULL) {
+        fits_close_file(handle->fptr, &status);
+        handle->fptr = NULL;
+    }
+    enif_mutex_unlock(handle->lock);
+
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM read_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], enif_make_new_map(env), &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
     }
     int bitpix, naxis;
     long naxes[2] = {1,1};
-    fits_get_img_param(fptr, 2, &bitpix, &naxis, naxes, &status);
+    fits_get_img_param(src.fptr, 2, &bitpix, &naxis, naxes, &status);
     if (status || naxis != 2) {
-        fits_close_file(fptr, &status);
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+        close_source(&src, &status);
+        return make_error_status(env, status);
     }
     long npixels = naxes[0] * naxes[1];
-    float *pixels = (float *)malloc(npixels * sizeof(float));
+    pixel_buffer bin_pixels;
+    if (!alloc_pixel_buffer(npixels * sizeof(float), &bin_pixels)) {
+        close_source(&src, &status);
+        return enif_make_atom(env, "error");
+    }
     long fpixel[2] = {1,1};
     
-    // Read all pixels as FLOAT values regardless of the actual BITPIX in the file
-    fits_read_pix(fptr, TFLOAT, fpixel, npixels, NULL, pixels, NULL, &status);
+    // Read all pixels as FLOAT values regardless of the actual BITPIX in the
+    // file, decoding straight into the binary handed back to Elixir
+    fits_read_pix(src.fptr, TFLOAT, fpixel, npixels, NULL, bin_pixels.data, NULL, &status);
     
     // Create an Erlang tuple with dimensions and binary data
     ERL_NIF_TERM width_term = enif_make_long(env, naxes[0]);
     ERL_NIF_TERM height_term = enif_make_long(env, naxes[1]);
     
-    fits_close_file(fptr, &status);
+    close_source(&src, &status);
     if (status) {
-        free(pixels);
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+        release_pixel_buffer(&bin_pixels);
+        return make_error_status(env, status);
     }
     
-    ERL_NIF_TERM result;
-    ErlNifBinary bin_pixels;
-    if (!enif_alloc_binary(npixels * sizeof(float), &bin_pixels)) {
-        free(pixels);
-        return enif_make_atom(env, "error");
-    }
-    
-    // Copy the pixel data to the binary
-    memcpy(bin_pixels.data, pixels, npixels * sizeof(float));
-    free(pixels);
-    
-    result = enif_make_binary(env, &bin_pixels);
+    ERL_NIF_TERM result = make_pixel_binary(env, &bin_pixels);
     
     // Return tuple with {ok, {width, height, data}}
     ERL_NIF_TERM dims_tuple = enif_make_tuple3(env, width_term, height_term, result);
     return enif_make_tuple2(env, enif_make_atom(env, "ok"), dims_tuple);
 }
 
+// Upper bound on NAXIS accepted by the N-dimensional read and write paths
+#define MAX_NAXIS 16
+
+// Get the dimensions of the image in the current HDU, NAXIS1 first
+static int get_image_shape(fitsfile *fptr, int *naxis, LONGLONG naxes[MAX_NAXIS], int *status) {
+    int bitpix;
+    if (fits_get_img_paramll(fptr, MAX_NAXIS, &bitpix, naxis, naxes, status)) {
+        return *status;
+    }
+    if (*naxis > MAX_NAXIS) {
+        *status = BAD_DIMEN;
+    }
+    return *status;
+}
+
+static LONGLONG count_pixels(int naxis, const LONGLONG naxes[]) {
+    if (naxis == 0) {
+        return 0;
+    }
+    LONGLONG npixels = 1;
+    for (int i = 0; i < naxis; i++) {
+        npixels *= naxes[i];
+    }
+    return npixels;
+}
+
+// Shape tuple in Nx (row-major) order, i.e. {NAXISn, ..., NAXIS1}
+static ERL_NIF_TERM make_shape(ErlNifEnv* env, int naxis, const LONGLONG naxes[]) {
+    ERL_NIF_TERM dims[MAX_NAXIS];
+    for (int i = 0; i < naxis; i++) {
+        dims[i] = enif_make_int64(env, naxes[naxis - 1 - i]);
+    }
+    return enif_make_tuple_from_array(env, dims, naxis);
+}
+
+// Include tile compression options and the parallel tile decoder
+#include "compress.c"
+
+// Read every pixel of the current image HDU into a newly allocated buffer,
+// in the pixel type selected by the options map. Returns 0 for bad options;
+// CFITSIO failures are reported in status, in which case no binary is held.
+static int read_image_data(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM opts, LONGLONG npixels,
+                           pixel_buffer *bin, pixel_type *type, int *status) {
+    int scale;
+    if (!resolve_read_type(env, fptr, opts, &scale, type, status)) {
+        return 0;
+    }
+    if (*status) {
+        return 1;
+    }
+    if (!alloc_pixel_buffer(npixels * type->size, bin)) {
+        *status = MEMORY_ALLOCATION;
+        return 1;
+    }
+    if (!read_tiles_in_parallel(env, fptr, opts, type, scale, bin->data, status) && !*status) {
+        read_pixels_as(fptr, type, scale, 1, npixels, bin->data, status);
+    }
+    if (*status) {
+        release_pixel_buffer(bin);
+    }
+    return 1;
+}
+
+// Read a 2D image with a selectable pixel type, decoding straight into the
+// result binary. Returns {:ok, {width, height, data, type}} where type is the
+// Nx type of the pixels in data.
+static ERL_NIF_TERM read_image_as(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[1], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    get_image_shape(src.fptr, &naxis, naxes, &status);
+    if (status || naxis != 2) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+
+    pixel_buffer bin_pixels;
+    pixel_type type;
+    if (!read_image_data(env, src.fptr, argv[1], naxes[0] * naxes[1], &bin_pixels, &type, &status)) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+    close_source(&src, &status);
+    if (status) {
+        release_pixel_buffer(&bin_pixels);
+        return make_error_status(env, status);
+    }
+
+    ERL_NIF_TERM result = enif_make_tuple4(env,
+                                           enif_make_int64(env, naxes[0]),
+                                           enif_make_int64(env, naxes[1]),
+                                           make_pixel_binary(env, &bin_pixels),
+                                           make_nx_type(env, &type));
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+// Read an image with any number of axes. Returns {:ok, {shape, data, type}}
+// with shape in Nx order ({NAXISn, ..., NAXIS1}) so it can be used for a
+// reshape directly.
+static ERL_NIF_TERM read_array(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[1], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    if (get_image_shape(src.fptr, &naxis, naxes, &status)) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+    if (naxis == 0) {
+        close_source(&src, &status);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_image_data"));
+    }
+
+    pixel_buffer bin_pixels;
+    pixel_type type;
+    if (!read_image_data(env, src.fptr, argv[1], count_pixels(naxis, naxes), &bin_pixels, &type, &status)) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+    close_source(&src, &status);
+    if (status) {
+        release_pixel_buffer(&bin_pixels);
+        return make_error_status(env, status);
+    }
+
+    ERL_NIF_TERM result = enif_make_tuple3(env,
+                                           make_shape(env, naxis, naxes),
+                                           make_pixel_binary(env, &bin_pixels),
+                                           make_nx_type(env, &type));
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+// Parse a tuple of naxis positive integers (FITS axis order)
+static int get_axis_tuple(ErlNifEnv* env, ERL_NIF_TERM term, int naxis, long values[MAX_NAXIS]) {
+    int arity;
+    const ERL_NIF_TERM *elems;
+    if (!enif_get_tuple(env, term, &arity, &elems) || arity != naxis) {
+        return 0;
+    }
+    for (int i = 0; i < arity; i++) {
+        if (!enif_get_long(env, elems[i], &values[i]) || values[i] < 1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Read a rectangular, optionally strided, section of an image with
+// fits_read_subset. Only the rows (or, for tile-compressed images, the tiles)
+// overlapping the section are read and decoded. start, stop and step are
+// tuples in FITS axis order with 1-based inclusive pixel coordinates.
+// Returns {:ok, {shape, data, type}} like read_array.
+static ERL_NIF_TERM read_section(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[4], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    if (get_image_shape(src.fptr, &naxis, naxes, &status)) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+
+    long fpixel[MAX_NAXIS], lpixel[MAX_NAXIS], inc[MAX_NAXIS];
+    if (naxis == 0 ||
+        !get_axis_tuple(env, argv[1], naxis, fpixel) ||
+        !get_axis_tuple(env, argv[2], naxis, lpixel) ||
+        !get_axis_tuple(env, argv[3], naxis, inc)) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+
+    // Size of the section along each axis, NAXIS1 first
+    LONGLONG dims[MAX_NAXIS];
+    for (int i = 0; i < naxis; i++) {
+        if (fpixel[i] > lpixel[i] || lpixel[i] > naxes[i]) {
+            close_source(&src, &status);
+            return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "invalid_section"));
+        }
+        dims[i] = (lpixel[i] - fpixel[i]) / inc[i] + 1;
+    }
+
+    pixel_type type;
+    int scale;
+    if (!resolve_read_type(env, src.fptr, argv[4], &scale, &type, &status)) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+
+    pixel_buffer bin_pixels;
+    if (!status && !alloc_pixel_buffer(count_pixels(naxis, dims) * type.size, &bin_pixels)) {
+        status = MEMORY_ALLOCATION;
+    }
+    if (status) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+
+    saved_scaling saved;
+    if (!scale) {
+        begin_raw_read(src.fptr, &saved, &status);
+    }
+    fits_read_subset(src.fptr, type.datatype, fpixel, lpixel, inc, NULL, bin_pixels.data, NULL, &status);
+    if (!scale) {
+        end_raw_read(src.fptr, &saved);
+    }
+    close_source(&src, &status);
+    if (status) {
+        release_pixel_buffer(&bin_pixels);
+        return make_error_status(env, status);
+    }
+
+    ERL_NIF_TERM result = enif_make_tuple3(env,
+                                           make_shape(env, naxis, dims),
+                                           make_pixel_binary(env, &bin_pixels),
+                                           make_nx_type(env, &type));
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+// Get the shape of the image without reading any pixels.
+// Returns {:ok, shape} with shape in Nx order.
+static ERL_NIF_TERM image_shape(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[1], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    get_image_shape(src.fptr, &naxis, naxes, &status);
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), make_shape(env, naxis, naxes));
+}
+
+// Read a run of npixels pixels starting at firstelem (1-based, in file
+// order). Used to walk an image in bounded chunks from one open handle.
+// Returns {:ok, {data, type}}.
+static ERL_NIF_TERM read_pixels(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifSInt64 firstelem, npixels;
+    if (!enif_get_int64(env, argv[1], &firstelem) || firstelem < 1 ||
+        !enif_get_int64(env, argv[2], &npixels) || npixels < 0) {
+        return enif_make_badarg(env);
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[3], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    pixel_type type;
+    int scale;
+    if (!resolve_read_type(env, src.fptr, argv[3], &scale, &type, &status)) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+
+    pixel_buffer bin_pixels;
+    if (!status && !alloc_pixel_buffer(npixels * type.size, &bin_pixels)) {
+        status = MEMORY_ALLOCATION;
+    }
+    if (status) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+
+    if (npixels > 0) {
+        read_pixels_as(src.fptr, &type, scale, firstelem, npixels, bin_pixels.data, &status);
+    }
+    close_source(&src, &status);
+    if (status) {
+        release_pixel_buffer(&bin_pixels);
+        return make_error_status(env, status);
+    }
+
+    ERL_NIF_TERM result = enif_make_tuple2(env, make_pixel_binary(env, &bin_pixels), make_nx_type(env, &type));
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+static const char *hdu_type_name(int hdutype) {
+    switch (hdutype) {
+        case IMAGE_HDU: return "image";
+        case ASCII_TBL: return "ascii_table";
+        case BINARY_TBL: return "binary_table";
+        default: return "unknown";
+    }
+}
+
+// Describe the HDU the file is currently positioned on
+static ERL_NIF_TERM describe_hdu(ErlNifEnv* env, fitsfile *fptr, int index, int *status) {
+    int hdutype;
+    fits_get_hdu_type(fptr, &hdutype, status);
+
+    ERL_NIF_TERM info = enif_make_new_map(env);
+    enif_make_map_put(env, info, enif_make_atom(env, "index"), enif_make_int(env, index), &info);
+    enif_make_map_put(env, info, enif_make_atom(env, "type"),
+                      enif_make_atom(env, hdu_type_name(hdutype)), &info);
+
+    char extname[FLEN_VALUE];
+    int key_status = 0;
+    ERL_NIF_TERM name_term = enif_make_atom(env, "nil");
+    if (fits_read_key(fptr, TSTRING, "EXTNAME", extname, NULL, &key_status) == 0) {
+        size_t len = strlen(extname);
+        unsigned char *name = enif_make_new_binary(env, len, &name_term);
+        memcpy(name, extname, len);
+    }
+    enif_make_map_put(env, info, enif_make_atom(env, "extname"), name_term, &info);
+
+    if (hdutype == IMAGE_HDU) {
+        int bitpix, naxis;
+        LONGLONG naxes[MAX_NAXIS];
+        fits_get_img_type(fptr, &bitpix, status);
+        get_image_shape(fptr, &naxis, naxes, status);
+        enif_make_map_put(env, info, enif_make_atom(env, "bitpix"), enif_make_int(env, bitpix), &info);
+        enif_make_map_put(env, info, enif_make_atom(env, "shape"), make_shape(env, naxis, naxes), &info);
+    } else {
+        LONGLONG nrows;
+        int ncols;
+        fits_get_num_rowsll(fptr, &nrows, status);
+        fits_get_num_cols(fptr, &ncols, status);
+        enif_make_map_put(env, info, enif_make_atom(env, "rows"), enif_make_int64(env, nrows), &info);
+        enif_make_map_put(env, info, enif_make_atom(env, "columns"), enif_make_int(env, ncols), &info);
+    }
+    return info;
+}
+
+// List every HDU in the file in one open.
+// Returns {:ok, [%{index, type, extname, ...}]}.
+static ERL_NIF_TERM list_hdus(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_source(env, argv[0], READONLY, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    // A handle is put back on the HDU it was on
+    int current, nhdus;
+    fits_get_hdu_num(src.fptr, &current);
+    fits_get_num_hdus(src.fptr, &nhdus, &status);
+
+    ERL_NIF_TERM list = enif_make_list(env, 0);
+    for (int i = nhdus; i >= 1 && !status; i--) {
+        fits_movabs_hdu(src.fptr, i, NULL, &status);
+        if (!status) {
+            list = enif_make_list_cell(env, describe_hdu(env, src.fptr, i, &status), list);
+        }
+    }
+
+    int move_status = 0;
+    fits_movabs_hdu(src.fptr, current, NULL, &move_status);
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), list);
+}
+
 static ERL_NIF_TERM write_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
-    char filename[1024];
-    ErlNifBinary bin_filename, bin_data;
+    ErlNifBinary bin_data;
     long width, height;
     int bitpix = FLOAT_IMG; // Default to float
     
@@ -89,13 +958,6 @@ static ERL_NIF_TERM write_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM arg
         return enif_make_badarg(env);
     }
     
-    // Get filename
-    if (!enif_inspect_binary(env, argv[0], &bin_filename) || bin_filename.size >= sizeof(filename)) {
-        return enif_make_badarg(env);
-    }
-    memcpy(filename, bin_filename.data, bin_filename.size);
-    filename[bin_filename.size] = '\0';
-    
     // Get pixel data
     if (!enif_inspect_binary(env, argv[1], &bin_data)) {
         return enif_make_badarg(env);
@@ -121,67 +983,91 @@ static ERL_NIF_TERM write_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM arg
                                enif_make_atom(env, "dimensions_mismatch"));
     }
     
-    fitsfile *fptr;
+    // Create a new file from a path, or append an image HDU to a handle
+    fits_source src;
     int status = 0;
     long naxes[2] = {width, height};
-    if (fits_create_file(&fptr, filename, &status)) {
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+    if (!create_source(env, argv[0], 0, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
     }
     
     // Create image with the specified bitpix (or default FLOAT_IMG)
-    if (fits_create_img(fptr, bitpix, 2, naxes, &status)) {
-        fits_close_file(fptr, &status);
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+    if (fits_create_img(src.fptr, bitpix, 2, naxes, &status)) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
     }
     
-    long fpixel[2] = {1,1};
     // Calculate total number of pixels
     long npixels = width * height;
     
     // We always write as TFLOAT since that's our internal format
-    if (fits_write_pix(fptr, TFLOAT, fpixel, npixels, bin_data.data, &status)) {
-        fits_close_file(fptr, &status);
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+    if (write_pixels_from_binary(src.fptr, TFLOAT, sizeof(float), bin_data.data, npixels, &status)) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
     }
     
-    fits_close_file(fptr, &status);
+    close_source(&src, &status);
     if (status) {
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
+        return make_error_status(env, status);
     }
     return enif_make_atom(env, "ok");
 }
 
 
-static ERL_NIF_TERM read_header(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
-    char filename[1024];
-    ErlNifBinary bin_filename;
-    
-    // Get filename
-    if (!enif_inspect_binary(env, argv[0], &bin_filename) || bin_filename.size >= sizeof(filename)) {
-        return enif_make_badarg(env);
+// Convert a card's value field, as split off by fits_parse_value, to a term:
+// strings (quotes removed) as charlists, then floats and integers, falling
+// back to the raw value text
+static ERL_NIF_TERM make_card_value(ErlNifEnv* env, char *value) {
+    if (strncmp(value, "'", 1) == 0) {
+        // String value (remove quotes)
+        size_t len = strlen(value);
+        if (len >= 2 && value[0] == '\'' && value[len-1] == '\'') {
+            value[len-1] = '\0';  // Remove trailing quote
+            return enif_make_string(env, value+1, ERL_NIF_LATIN1);
+        }
+        return enif_make_string(env, value, ERL_NIF_LATIN1);
     }
-    memcpy(filename, bin_filename.data, bin_filename.size);
-    filename[bin_filename.size] = '\0';
-    
-    fitsfile *fptr;
-    int status = 0;
-    
-    // Open the FITS file
-    if (fits_open_file(&fptr, filename, READONLY, &status)) {
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                               enif_make_int(env, status));
+    if (strchr(value, '.') != NULL) {
+        // Float value
+        double dval;
+        sscanf(value, "%lf", &dval);
+        return enif_make_double(env, dval);
     }
-    
-    // Get number of keys in header
-    int nkeys, keypos, hdutype;
-    if (fits_get_hdrpos(fptr, &nkeys, &keypos, &status)) {
-        fits_close_file(fptr, &status);
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                               enif_make_int(env, status));
+    // Try as integer, fall back to string
+    char *endptr;
+    long ival = strtol(value, &endptr, 10);
+    if (*endptr == '\0') {
+        return enif_make_long(env, ival);
     }
-    
+    return enif_make_string(env, value, ERL_NIF_LATIN1);
+}
+
+// A keyword as a map key: an atom, or a binary when binary_keys is set so
+// arbitrary headers cannot fill the atom table
+static ERL_NIF_TERM make_card_key(ErlNifEnv* env, const char *key, int binary_keys) {
+    if (!binary_keys) {
+        return enif_make_atom(env, key);
+    }
+    ERL_NIF_TERM term;
+    size_t len = strlen(key);
+    memcpy(enif_make_new_binary(env, len, &term), key, len);
+    return term;
+}
+
+// Read every keyword of the current HDU, except COMMENT, HISTORY and blank
+// cards, into a map of keys to values. Returns the CFITSIO status.
+static int read_header_map(ErlNifEnv* env, fitsfile *fptr, int binary_keys, ERL_NIF_TERM *header_map,
+                           int *status) {
+    int nkeys, keypos;
+    if (fits_get_hdrpos(fptr, &nkeys, &keypos, status)) {
+        return *status;
+    }
+
     // Create an empty map to store header data
-    ERL_NIF_TERM header_map = enif_make_new_map(env);
+    *header_map = enif_make_new_map(env);
     
     // Read each keyword
     for (int i = 1; i <= nkeys; i++) {
@@ -191,117 +1077,240 @@ static ERL_NIF_TERM read_header(ErlNifEnv* env, int argc, const ERL_NIF_TERM arg
         int keylen;
         
         // Read the next header card
-        if (fits_read_record(fptr, i, card, &status)) {
-            fits_close_file(fptr, &status);
-            return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                                   enif_make_int(env, status));
+        if (fits_read_record(fptr, i, card, status)) {
+            return *status;
         }
         
         // Parse the card to get keyword name and value
-        if (fits_get_keyname(card, key, &keylen, &status) == 0) {
+        if (fits_get_keyname(card, key, &keylen, status) == 0) {
             // Skip COMMENT, HISTORY, and blank keywords
             if (strcmp(key, "COMMENT") != 0 && strcmp(key, "HISTORY") != 0 && strlen(key) > 0) {
-                int value_type;
-                fits_parse_value(card, value, comment, &status);
-                
-                // Convert keyword to atom and value to appropriate Erlang term
-                ERL_NIF_TERM key_term = enif_make_atom(env, key);
-                ERL_NIF_TERM value_term;
-                
-                // Determine the type of value and convert accordingly
-                if (strncmp(value, "'", 1) == 0) {
-                    // String value (remove quotes)
-                    size_t len = strlen(value);
-                    if (len >= 2 && value[0] == '\'' && value[len-1] == '\'') {
-                        value[len-1] = '\0';  // Remove trailing quote
-                        value_term = enif_make_string(env, value+1, ERL_NIF_LATIN1);
-                    } else {
-                        value_term = enif_make_string(env, value, ERL_NIF_LATIN1);
-                    }
-                } else if (strchr(value, '.') != NULL) {
-                    // Float value
-                    double dval;
-                    sscanf(value, "%lf", &dval);
-                    value_term = enif_make_double(env, dval);
-                } else {
-                    // Try as integer, fall back to string
-                    char *endptr;
-                    long ival = strtol(value, &endptr, 10);
-                    if (*endptr == '\0') {
-                        value_term = enif_make_long(env, ival);
-                    } else {
-                        value_term = enif_make_string(env, value, ERL_NIF_LATIN1);
-                    }
-                }
-                
-                // Add to map
-                enif_make_map_put(env, header_map, key_term, value_term, &header_map);
+                fits_parse_value(card, value, comment, status);
+                enif_make_map_put(env, *header_map, make_card_key(env, key, binary_keys),
+                                  make_card_value(env, value), header_map);
             }
         }
     }
+    return *status;
+}
+
+// Look up only the listed keywords (atoms or binaries), each with one keyword
+// search instead of parsing every card. Keywords missing from the header are
+// left out of the map, and each one found is keyed as it was asked for.
+// Returns 0 if keys is not a list of keyword names.
+static int read_header_keys(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM keys, int binary_keys,
+                            ERL_NIF_TERM *header_map, int *status) {
+    ERL_NIF_TERM head, tail = keys;
+    *header_map = enif_make_new_map(env);
+    if (!enif_is_list(env, keys)) {
+        return 0;
+    }
+    while (enif_get_list_cell(env, tail, &head, &tail)) {
+        char key[FLEN_KEYWORD], card[FLEN_CARD], value[FLEN_VALUE], comment[FLEN_COMMENT];
+        ErlNifBinary bin;
+        if (enif_inspect_binary(env, head, &bin)) {
+            if (bin.size == 0 || bin.size >= sizeof(key)) {
+                return 0;
+            }
+            memcpy(key, bin.data, bin.size);
+            key[bin.size] = '\0';
+        } else if (!enif_get_atom(env, head, key, sizeof(key), ERL_NIF_LATIN1)) {
+            return 0;
+        }
+
+        if (fits_read_card(fptr, key, card, status)) {
+            if (*status != KEY_NO_EXIST) {
+                return 1;
+            }
+            *status = 0;
+            continue;
+        }
+        if (fits_parse_value(card, value, comment, status)) {
+            return 1;
+        }
+        enif_make_map_put(env, *header_map, make_card_key(env, key, binary_keys),
+                          make_card_value(env, value), header_map);
+    }
+    return 1;
+}
+
+// Every card of the current HDU in order, as {key, value, comment} tuples,
+// with COMMENT and HISTORY cards as {key, text}; blank cards are left out.
+// Unlike the map, logical values come back as booleans and undefined ones as
+// nil, so the list can be written back with write_header_cards unchanged.
+static int read_header_cards(ErlNifEnv* env, fitsfile *fptr, int binary_keys, ERL_NIF_TERM *card_list,
+                             int *status) {
+    int nkeys, keypos, count = 0;
+    if (fits_get_hdrpos(fptr, &nkeys, &keypos, status)) {
+        return *status;
+    }
+    ERL_NIF_TERM *terms = enif_alloc(sizeof(ERL_NIF_TERM) * (nkeys > 0 ? nkeys : 1));
+    for (int i = 1; i <= nkeys; i++) {
+        char card[FLEN_CARD], key[FLEN_KEYWORD], value[FLEN_VALUE], comment[FLEN_COMMENT];
+        int keylen;
+        if (fits_read_record(fptr, i, card, status) || fits_get_keyname(card, key, &keylen, status)) {
+            break;
+        }
+        if (key[0] == '\0') {
+            continue;
+        }
+        ERL_NIF_TERM key_term = make_card_key(env, key, binary_keys);
+        if (strcmp(key, "COMMENT") == 0 || strcmp(key, "HISTORY") == 0) {
+            // Commentary text starts after the 8-character keyword field
+            size_t len = strlen(card);
+            while (len > 8 && card[len - 1] == ' ') {
+                len--;
+            }
+            card[len] = '\0';
+            terms[count++] = enif_make_tuple2(env, key_term,
+                                              enif_make_string(env, len > 8 ? card + 8 : "", ERL_NIF_LATIN1));
+            continue;
+        }
+        if (fits_parse_value(card, value, comment, status)) {
+            break;
+        }
+        ERL_NIF_TERM value_term;
+        if (strcmp(value, "T") == 0 || strcmp(value, "F") == 0) {
+            value_term = enif_make_atom(env, value[0] == 'T' ? "true" : "false");
+        } else if (value[0] == '\0') {
+            value_term = enif_make_atom(env, "nil");
+        } else {
+            value_term = make_card_value(env, value);
+        }
+        terms[count++] = enif_make_tuple3(env, key_term, value_term, enif_make_string(env, comment, ERL_NIF_LATIN1));
+    }
+    *card_list = enif_make_list_from_array(env, terms, count);
+    enif_free(terms);
+    return *status;
+}
+
+// The current HDU's header as stored: every card (COMMENT and HISTORY
+// included) and END, blank-padded to whole 2880-byte blocks
+static int read_header_blocks(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM *blocks, int *status) {
+    char *cards = NULL;
+    int nkeys;
+    if (fits_hdr2str(fptr, 0, NULL, 0, &cards, &nkeys, status)) {
+        return *status;
+    }
+    size_t length = strlen(cards);
+    size_t padded = (length + 2879) / 2880 * 2880;
+    unsigned char *out = enif_make_new_binary(env, padded, blocks);
+    memcpy(out, cards, length);
+    memset(out + length, ' ', padded - length);
+    fits_free_memory(cards, status);
+    return *status;
+}
+
+static ERL_NIF_TERM read_header(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
     
-    fits_close_file(fptr, &status);
+    // Open the FITS file, or borrow it from a handle, and move to the
+    // requested HDU when an options map is given
+    ERL_NIF_TERM opts = argc > 1 ? argv[1] : enif_make_new_map(env);
+    if (!open_source_at(env, argv[0], opts, READONLY, &src, &status)) {
+        return enif_make_badarg(env);
+    }
     if (status) {
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                               enif_make_int(env, status));
+        return make_error_status(env, status);
+    }
+    fitsfile *fptr = src.fptr;
+    
+    // keys: only look up the listed keywords; raw: return the header
+    // blocks unparsed; format: :cards returns an ordered card list;
+    // key_type: :binary keys the map by binaries
+    char key_type[8], format[8];
+    int binary_keys = get_atom_option(env, opts, "key_type", key_type, sizeof(key_type)) &&
+                      strcmp(key_type, "binary") == 0;
+    ERL_NIF_TERM header_map, keys;
+    if (get_bool_option(env, opts, "raw", 0)) {
+        read_header_blocks(env, fptr, &header_map, &status);
+    } else if (get_atom_option(env, opts, "format", format, sizeof(format)) && strcmp(format, "cards") == 0) {
+        read_header_cards(env, fptr, binary_keys, &header_map, &status);
+    } else if (enif_get_map_value(env, opts, enif_make_atom(env, "keys"), &keys)) {
+        if (!read_header_keys(env, fptr, keys, binary_keys, &header_map, &status)) {
+            close_source(&src, &status);
+            return enif_make_badarg(env);
+        }
+    } else {
+        read_header_map(env, fptr, binary_keys, &header_map, &status);
+    }
+    if (status) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
     }
     
     return enif_make_tuple2(env, enif_make_atom(env, "ok"), header_map);
 }
 
+// Which part of a header a writer should write (see header_pass_of)
+#define HEADER_BEFORE_DATA 1
+#define HEADER_AFTER_DATA 2
+#define HEADER_ALL (HEADER_BEFORE_DATA | HEADER_AFTER_DATA)
+
+// Defined with the other header writers in write_fits.c
+static int write_card_list(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM cards, int append, int pass,
+                           int *status);
+
 // Write header cards to a FITS file
 static ERL_NIF_TERM write_header_cards(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
-    char filename[1024];
-    ErlNifBinary bin_filename;
-    
-    // Get filename
-    if (!enif_inspect_binary(env, argv[0], &bin_filename) || bin_filename.size >= sizeof(filename)) {
-        return enif_make_badarg(env);
-    }
-    memcpy(filename, bin_filename.data, bin_filename.size);
-    filename[bin_filename.size] = '\0';
-    
-    // Get header map
-    if (!enif_is_map(env, argv[1])) {
+    // Get header map or ordered card list
+    if (!enif_is_map(env, argv[1]) && !enif_is_list(env, argv[1])) {
         return enif_make_badarg(env);
     }
     ERL_NIF_TERM header_map = argv[1];
     
-    // Open the FITS file for updating
-    fitsfile *fptr;
+    // Open the FITS file for updating, or borrow it from a handle, and move
+    // to the requested HDU when an options map is given
+    fits_source src;
     int status = 0;
-    
-    // Check if file exists
-    FILE *f = fopen(filename, "r");
-    if (f == NULL) {
+    ERL_NIF_TERM opts = argc > 2 ? argv[2] : enif_make_new_map(env);
+    if (!open_source_at(env, argv[0], opts, READWRITE, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status == FILE_NOT_OPENED && src.handle == NULL) {
+        // CFITSIO reports a missing file as FILE_NOT_OPENED
         return enif_make_tuple2(env, enif_make_atom(env, "error"), 
                                enif_make_atom(env, "file_not_found"));
     }
-    fclose(f);
-    
-    if (fits_open_file(&fptr, filename, READWRITE, &status)) {
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                               enif_make_int(env, status));
+    if (status) {
+        return make_error_status(env, status);
     }
+    fitsfile *fptr = src.fptr;
     
-    // Move to the primary HDU
-    if (fits_movabs_hdu(fptr, 1, NULL, &status)) {
-        fits_close_file(fptr, &status);
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                               enif_make_int(env, status));
+    // Without an :hdu option a freshly opened path is at the primary HDU and
+    // a handle keeps whichever HDU it was last positioned on
+    
+    // A card list keeps its order, including COMMENT and HISTORY cards, and
+    // is written in a single pass over the header
+    if (enif_is_list(env, header_map)) {
+        int valid = write_card_list(env, fptr, header_map, 0, HEADER_ALL, &status);
+        close_source(&src, &status);
+        if (!valid) {
+            return enif_make_badarg(env);
+        }
+        if (status) {
+            return make_error_status(env, status);
+        }
+        return enif_make_atom(env, "ok");
     }
     
     // Get map size
     size_t map_size;
     if (!enif_get_map_size(env, header_map, &map_size)) {
-        fits_close_file(fptr, &status);
+        close_source(&src, &status);
         return enif_make_badarg(env);
     }
     
     // Get iterator
     ErlNifMapIterator iter;
     if (!enif_map_iterator_create(env, header_map, &iter, ERL_NIF_MAP_ITERATOR_FIRST)) {
-        fits_close_file(fptr, &status);
+        close_source(&src, &status);
         return enif_make_badarg(env);
     }
     
@@ -340,44 +1349,20 @@ static ERL_NIF_TERM write_header_cards(ErlNifEnv* env, int argc, const ERL_NIF_T
             if (enif_get_long(env, value, &ival)) {
                 // Integer value
                 fits_update_key(fptr, TLONG, key_str, &ival, NULL, &key_status);
-                if (key_status) {
-                    // Log the error for debugging
-                    char error_text[FLEN_STATUS];
-                    fits_get_errstatus(key_status, error_text);
-                    fprintf(stderr, "FITS error updating key '%s' with value %ld: %d (%s)\n", 
-                            key_str, ival, key_status, error_text);
-                }
             } else if (enif_get_double(env, value, &dval)) {
                 // Double value
                 fits_update_key(fptr, TDOUBLE, key_str, &dval, NULL, &key_status);
-                if (key_status) {
-                    // Log the error for debugging
-                    char error_text[FLEN_STATUS];
-                    fits_get_errstatus(key_status, error_text);
-                    fprintf(stderr, "FITS error updating key '%s' with value %f: %d (%s)\n", 
-                            key_str, dval, key_status, error_text);
-                }
             }
         } else if (enif_is_binary(env, value) || enif_is_list(env, value)) {
             // String value - could be binary or char list
             char value_str[FLEN_VALUE];
             if (enif_get_string(env, value, value_str, sizeof(value_str), ERL_NIF_LATIN1) > 0) {
                 fits_update_key(fptr, TSTRING, key_str, value_str, NULL, &key_status);
-                if (key_status) {
-                    // Log the error for debugging
-                    char error_text[FLEN_STATUS];
-                    fits_get_errstatus(key_status, error_text);
-                    fprintf(stderr, "FITS error updating key '%s' with string value: %d (%s)\n", 
-                            key_str, key_status, error_text);
-                }
             }
         }
         
-        // Use main status only for critical errors
-        if (key_status > 0) {
-            // Non-critical errors in individual key updates don't abort the whole process
-            fprintf(stderr, "Warning: Failed to update key '%s', continuing with others\n", key_str);
-        } 
+        // Non-critical errors in individual key updates (key_status) don't
+        // abort the whole process
         
         // Only abort for serious issues
         if (status > 0) {
@@ -386,11 +1371,10 @@ static ERL_NIF_TERM write_header_cards(ErlNifEnv* env, int argc, const ERL_NIF_T
     } while (enif_map_iterator_next(env, &iter));
     
     enif_map_iterator_destroy(env, &iter);
-    fits_close_file(fptr, &status);
+    close_source(&src, &status);
     
     if (status) {
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                               enif_make_int(env, status));
+        return make_error_status(env, status);
     }
     
     return enif_make_atom(env, "ok");
@@ -399,17 +1383,155 @@ static ERL_NIF_TERM write_header_cards(ErlNifEnv* env, int argc, const ERL_NIF_T
 // Include the write_fits_file function
 #include "write_fits.c"
 
+// Include the table column reader
+#include "read_table.c"
+
+// Include the byte-swap and type-conversion kernels
+#include "convert.c"
+
+// Include the image statistics kernels
+#include "stats.c"
+
+// Include the native worker pool behind read_many
+#include "read_pool.c"
+
+// Include the memory-mapped image reader
+#include "mmap_read.c"
+
+// Include the in-memory file encoder and decoder
+#include "memfile.c"
+
+// Include the CFITSIO driver for files read by byte range
+#include "range_driver.c"
+
+// Include the yielding list packer and unpacker
+#include "lists.c"
+
+// Include the frame combiner
+#include "combine.c"
+
+// Include the celestial WCS transforms and the reprojection kernel
+#include "wcs.c"
+
+// The build mode is passed by build_cfitsio.sh as a bare word
+#define EXFITS_STRINGIFY(x) #x
+#define EXFITS_MODE_NAME(x) EXFITS_STRINGIFY(x)
+#ifndef EXFITS_BUILD_MODE
+#define EXFITS_BUILD_MODE unknown
+#endif
+
+// NIF: build_info() -> %{mode, simd, cfitsio_version, reentrant}: how the
+// library was built and what it found on this machine when it loaded
+static ERL_NIF_TERM build_info(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    const char *simd_names[] = {"none", "ssse3", "avx2", "neon"};
+    float version;
+    fits_get_version(&version);
+
+    ERL_NIF_TERM info = enif_make_new_map(env);
+    enif_make_map_put(env, info, enif_make_atom(env, "mode"),
+                      enif_make_atom(env, EXFITS_MODE_NAME(EXFITS_BUILD_MODE)), &info);
+    enif_make_map_put(env, info, enif_make_atom(env, "simd"), enif_make_atom(env, simd_names[simd_level]), &info);
+    enif_make_map_put(env, info, enif_make_atom(env, "cfitsio_version"), enif_make_double(env, version), &info);
+    enif_make_map_put(env, info, enif_make_atom(env, "reentrant"),
+                      enif_make_atom(env, fits_is_reentrant() ? "true" : "false"), &info);
+    return info;
+}
+
+// Every NIF that touches a file does blocking CFITSIO disk I/O, so it runs on a
+// dirty I/O scheduler instead of stalling a normal BEAM scheduler.
+// convert_pixels and wcs_transform are pure CPU work over whole arrays and run
+// on a dirty CPU scheduler for the same reason. pool_start and pool_submit only create threads
+// and queue work, while pool_stop waits for reads in progress to finish. The
+// in-memory file NIFs parse and flush whole files without touching the disk,
+// so they run on dirty CPU schedulers. Reads from a remote file block on
+// dirty I/O schedulers until its fetcher answers; range_reply only hands the
+// answer over and runs on a normal scheduler. pack_rows and unpack_rows stay
+// on normal schedulers and yield each timeslice, rescheduling themselves.
+// The buffer pool NIFs only read counters or free a bounded set of buffers.
 static ErlNifFunc nif_funcs[] = {
     {"hello", 0, hello},
-    {"open_fits", 1, open_fits},
-    {"read_image", 1, read_image},
-    {"read_header", 1, read_header},
-    {"write_image", 4, write_image},
-    {"write_image", 5, write_image},
-    {"write_header_cards", 2, write_header_cards},
-    {"write_fits_file", 4, write_fits_file},
-    {"write_fits_file", 5, write_fits_file},
-    {"write_fits_file", 6, write_fits_file}
+    {"build_info", 0, build_info},
+    {"open_fits", 1, open_fits, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"open_handle", 2, open_handle, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"close_handle", 1, close_handle, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_image", 1, read_image, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_image", 2, read_image_as, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_array", 2, read_array, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_section", 5, read_section, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"image_shape", 2, image_shape, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_pixels", 4, read_pixels, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_header", 1, read_header, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_header", 2, read_header, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"list_hdus", 1, list_hdus, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_image", 4, write_image, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_image", 5, write_image, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_header_cards", 2, write_header_cards, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_header_cards", 3, write_header_cards, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_fits_file", 4, write_fits_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_fits_file", 5, write_fits_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_fits_file", 6, write_fits_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_fits_file", 7, write_fits_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_array", 6, write_array, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_array", 7, write_array, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_extensions", 3, write_extensions, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"copy_file", 3, copy_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"begin_image", 5, begin_image, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"write_image_chunk", 4, write_image_chunk, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"finish_image", 3, finish_image, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_table", 3, read_table, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"convert_pixels", 4, convert_pixels, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"image_stats", 2, image_stats, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"combine_frames", 3, combine_frames, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"read_wcs", 2, read_wcs, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"wcs_transform", 3, wcs_transform, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"reproject", 4, reproject, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"pool_start", 1, pool_start},
+    {"pool_submit", 4, pool_submit},
+    {"pool_stop", 1, pool_stop, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"map_image", 2, map_image, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"open_memory", 1, open_memory, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"create_memory", 1, create_memory, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"close_memory", 1, close_memory, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"open_remote", 3, open_remote, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"range_reply", 3, range_reply},
+    {"buffer_pool_stats", 0, buffer_pool_stats},
+    {"buffer_pool_configure", 1, buffer_pool_configure},
+    {"pack_rows", 1, pack_rows},
+    {"unpack_rows", 3, unpack_rows}
 };
 
-ERL_NIF_INIT(Elixir.ExFITS.NIF, nif_funcs, NULL, NULL, NULL, NULL);
\ No newline at end of file
+static int load(ErlNifEnv* env, void** priv_data, ERL_NIF_TERM load_info) {
+    if (!init_buffer_pool(env)) {
+        return -1;
+    }
+    FITS_HANDLE_TYPE = enif_open_resource_type(env, NULL, "fits_handle", fits_handle_dtor,
+                                               ERL_NIF_RT_CREATE, NULL);
+    if (FITS_HANDLE_TYPE == NULL) {
+        return -1;
+    }
+    READ_POOL_TYPE = enif_open_resource_type(env, NULL, "read_pool", read_pool_dtor,
+                                             ERL_NIF_RT_CREATE, NULL);
+    finished_threads_lock = enif_mutex_create("exfits_read_pool_finished");
+    if (READ_POOL_TYPE == NULL || finished_threads_lock == NULL) {
+        return -1;
+    }
+    MAPPED_REGION_TYPE = enif_open_resource_type(env, NULL, "mapped_region", mapped_region_dtor,
+                                                 ERL_NIF_RT_CREATE, NULL);
+    if (MAPPED_REGION_TYPE == NULL) {
+        return -1;
+    }
+    ErlNifResourceTypeInit remote_init = {remote_file_dtor, NULL, remote_file_down};
+    REMOTE_FILE_TYPE = enif_open_resource_type_x(env, "remote_file", &remote_init, ERL_NIF_RT_CREATE, NULL);
+    if (REMOTE_FILE_TYPE == NULL || register_remote_driver() != 0) {
+        return -1;
+    }
+    PACKED_ROWS_TYPE = enif_open_resource_type(env, NULL, "packed_rows", packed_rows_dtor,
+                                            ERL_NIF_RT_CREATE, NULL);
+    if (PACKED_ROWS_TYPE == NULL) {
+        return -1;
+    }
+    detect_simd();
+    return 0;
+}
+
+ERL_NIF_INIT(Elixir.ExFITS.NIF, nif_funcs, load, NULL, NULL, NULL);
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include <erl_nif.h>
+#include <math.h>
+#include <string.h>
+
+// Pixels walked between checks of the time used, and the length of a
+// scheduler timeslice in microseconds. A NIF on a normal scheduler should
+// return or yield within about a millisecond.
+#define LIST_SLICE_PIXELS 4096
+#define TIMESLICE_USEC 1000
+
+// The float32 binary a list of rows is packed into, owned by the resource
+// until the last slice hands it to the caller
+typedef struct {
+    ErlNifBinary bin;
+    int owned;
+    unsigned width;
+    unsigned height;
+    size_t next;
+    unsigned col;
+} packed_rows;
+
+static ErlNifResourceType *PACKED_ROWS_TYPE = NULL;
+
+static void packed_rows_dtor(ErlNifEnv* env, void* obj) {
+    packed_rows *packed = (packed_rows*)obj;
+    if (packed->owned) {
+        enif_release_binary(&packed->bin);
+    }
+}
+
+// Charge the time since *since to the calling process and restart the clock.
+// Returns true once the timeslice is used up and the NIF should yield.
+static int timeslice_spent(ErlNifEnv* env, ErlNifTime *since) {
+    ErlNifTime now = enif_monotonic_time(ERL_NIF_USEC);
+    ErlNifTime percent = (now - *since) * 100 / TIMESLICE_USEC;
+    *since = now;
+    return enif_consume_timeslice(env, percent < 1 ? 1 : percent > 100 ? 100 : (int)percent);
+}
+
+// A pixel value from a float or an integer, as <<x::float-32>> accepts both,
+// or from one of the atoms make_pixel_term gives non-finite values
+static int get_pixel_value(ErlNifEnv* env, ERL_NIF_TERM term, double *value) {
+    ErlNifSInt64 integer;
+    char name[16];
+    if (enif_get_double(env, term, value)) {
+        return 1;
+    }
+    if (enif_get_int64(env, term, &integer)) {
+        *value = (double)integer;
+        return 1;
+    }
+    if (!enif_get_atom(env, term, name, sizeof(name), ERL_NIF_LATIN1)) {
+        return 0;
+    }
+    if (strcmp(name, "nan") == 0) {
+        *value = NAN;
+    } else if (strcmp(name, "infinity") == 0) {
+        *value = INFINITY;
+    } else if (strcmp(name, "neg_infinity") == 0) {
+        *value = -INFINITY;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Pack the rest of the rows, starting with the rest of the current row.
+// argv is {packed, rows, row}; rescheduled with the same shape when the
+// timeslice runs out.
+static ERL_NIF_TERM pack_rows_slice(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    packed_rows *packed;
+    if (!enif_get_resource(env, argv[0], PACKED_ROWS_TYPE, (void**)&packed)) {
+        return enif_make_badarg(env);
+    }
+    ERL_NIF_TERM rows = argv[1], row = argv[2], head;
+    float *out = (float*)packed->bin.data;
+    ErlNifTime since = enif_monotonic_time(ERL_NIF_USEC);
+
+    for (;;) {
+        for (int n = 0; n < LIST_SLICE_PIXELS; n++) {
+            if (enif_get_list_cell(env, row, &head, &row)) {
+                double value;
+                if (packed->col == packed->width) {
+                    return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "ragged_rows"));
+                }
+                if (!get_pixel_value(env, head, &value)) {
+                    return enif_make_badarg(env);
+                }
+                out[packed->next++] = (float)value;
+                packed->col++;
+                continue;
+            }
+            if (!enif_is_empty_list(env, row)) {
+                return enif_make_badarg(env);
+            }
+            if (packed->col != packed->width) {
+                return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "ragged_rows"));
+            }
+            if (!enif_get_list_cell(env, rows, &row, &rows)) {
+                // The outer list was counted up front, so every pixel is filled
+                ERL_NIF_TERM binary = enif_make_binary(env, &packed->bin);
+                packed->owned = 0;
+                return enif_make_tuple2(env, enif_make_atom(env, "ok"),
+                                        enif_make_tuple3(env, binary, enif_make_uint(env, packed->width),
+                                                         enif_make_uint(env, packed->height)));
+            }
+            if (!enif_is_list(env, row)) {
+                return enif_make_badarg(env);
+            }
+            packed->col = 0;
+        }
+        if (timeslice_spent(env, &since)) {
+            ERL_NIF_TERM args[3] = {argv[0], rows, row};
+            return enif_schedule_nif(env, "pack_rows", 0, pack_rows_slice, 3, args);
+        }
+    }
+}
+
+/*
+ * Pack a list of equal-length rows of numbers into a native-endian float32
+ * binary, in one walk over the lists, yielding the scheduler as it goes.
+ *
+ * Arguments:
+ *   argv[0]: List of rows, each a list of floats, integers, or :nan,
+ *     :infinity and :neg_infinity
+ *
+ * Returns:
+ *   {:ok, {binary, width, height}}
+ *   {:error, :ragged_rows} if the rows differ in length
+ */
+static ERL_NIF_TERM pack_rows(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    unsigned height, width;
+    ERL_NIF_TERM first, rest;
+    if (!enif_get_list_length(env, argv[0], &height) || !enif_get_list_cell(env, argv[0], &first, &rest) ||
+        !enif_get_list_length(env, first, &width)) {
+        return enif_make_badarg(env);
+    }
+
+    packed_rows *packed = enif_alloc_resource(PACKED_ROWS_TYPE, sizeof(packed_rows));
+    if (packed == NULL) {
+        return enif_make_badarg(env);
+    }
+    memset(packed, 0, sizeof(packed_rows));
+    packed->width = width;
+    packed->height = height;
+    if (!enif_alloc_binary((size_t)width * height * sizeof(float), &packed->bin)) {
+        enif_release_resource(packed);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "enomem"));
+    }
+    packed->owned = 1;
+
+    ERL_NIF_TERM args[3] = {enif_make_resource(env, packed), rest, first};
+    enif_release_resource(packed);
+    return pack_rows_slice(env, 3, args);
+}
+
+// Unpack the pixels before index into rows, from the last pixel back, so each
+// list is built by prepending. argv is {binary, width, index, row, rows};
+// rescheduled with the same shape when the timeslice runs out.
+static ERL_NIF_TERM unpack_rows_slice(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary bin;
+    unsigned width;
+    ErlNifUInt64 index;
+    if (!enif_inspect_binary(env, argv[0], &bin) || !enif_get_uint(env, argv[1], &width) ||
+        !enif_get_uint64(env, argv[2], &index)) {
+        return enif_make_badarg(env);
+    }
+    ERL_NIF_TERM row = argv[3], rows = argv[4];
+    ErlNifTime since = enif_monotonic_time(ERL_NIF_USEC);
+
+    while (index > 0) {
+        for (int n = 0; n < LIST_SLICE_PIXELS && index > 0; n++) {
+            float value;
+            index--;
+            // Sub-binaries need not be aligned for a float load
+            memcpy(&value, bin.data + index * sizeof(float), sizeof(float));
+            row = enif_make_list_cell(env, make_pixel_term(env, value), row);
+            if (index % width == 0) {
+                rows = enif_make_list_cell(env, row, rows);
+                row = enif_make_list(env, 0);
+            }
+        }
+        if (index > 0 && timeslice_spent(env, &since)) {
+            ERL_NIF_TERM args[5] = {argv[0], argv[1], enif_make_uint64(env, index), row, rows};
+            return enif_schedule_nif(env, "unpack_rows", 0, unpack_rows_slice, 5, args);
+        }
+    }
+    return rows;
+}
+
+/*
+ * Unpack a native-endian float32 binary into a list of rows of floats,
+ * yielding the scheduler as it goes. NaN and infinite pixels become :nan,
+ * :infinity and :neg_infinity.
+ *
+ * Arguments:
+ *   argv[0]: Binary of at least width * height float32 pixels
+ *   argv[1]: Width of a row
+ *   argv[2]: Number of rows
+ *
+ * Returns:
+ *   List of height rows of width floats each ([] if either is 0)
+ */
+static ERL_NIF_TERM unpack_rows(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary bin;
+    unsigned width, height;
+    if (!enif_inspect_binary(env, argv[0], &bin) || !enif_get_uint(env, argv[1], &width) ||
+        !enif_get_uint(env, argv[2], &height) || bin.size / sizeof(float) / (width ? width : 1) < height) {
+        return enif_make_badarg(env);
+    }
+    if (width == 0 || height == 0) {
+        return enif_make_list(env, 0);
+    }
+
+    ERL_NIF_TERM args[5] = {argv[0], argv[1], enif_make_uint64(env, (ErlNifUInt64)width * height),
+                            enif_make_list(env, 0), enif_make_list(env, 0)};
+    return unpack_rows_slice(env, 5, args);
+}
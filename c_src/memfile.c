@@ -0,0 +1,146 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <string.h>
+
+// Smallest buffer a new in-memory file starts with, and the least it grows by
+#define MEMFILE_MIN_SIZE (2880 * 10)
+
+static ERL_NIF_TERM make_memory_handle(ErlNifEnv* env, fits_handle *handle) {
+    handle->lock = enif_mutex_create("exfits_handle");
+    ERL_NIF_TERM term = enif_make_resource(env, handle);
+    enif_release_resource(handle);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), term);
+}
+
+/**
+ * Opens a FITS file held in a binary as a read-only handle, without writing it
+ * to disk or copying it: CFITSIO reads the binary's bytes in place, and the
+ * handle keeps the binary alive until it is closed and collected.
+ *
+ * Args:
+ *   - data: Binary with the contents of a FITS file
+ *
+ * Returns:
+ *   {:ok, handle} on success
+ *   {:error, status} on failure
+ */
+static ERL_NIF_TERM open_memory(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (!enif_is_binary(env, argv[0])) {
+        return enif_make_badarg(env);
+    }
+
+    fits_handle *handle = enif_alloc_resource(FITS_HANDLE_TYPE, sizeof(fits_handle));
+    memset(handle, 0, sizeof(fits_handle));
+
+    // Copying a large binary into another environment only takes a reference
+    // to it, so the bytes CFITSIO reads are the caller's own
+    ErlNifBinary bin;
+    handle->source_env = enif_alloc_env();
+    enif_inspect_binary(handle->source_env, enif_make_copy(handle->source_env, argv[0]), &bin);
+    handle->mem_buf = bin.data;
+    handle->mem_size = bin.size;
+
+    int status = 0;
+    fits_open_memfile(&handle->fptr, "memory", READONLY, &handle->mem_buf, &handle->mem_size, 0, NULL,
+                      &status);
+    if (status) {
+        handle->fptr = NULL;
+        enif_release_resource(handle);
+        return make_error_status(env, status);
+    }
+    return make_memory_handle(env, handle);
+}
+
+/**
+ * Creates an empty in-memory FITS file and returns a writable handle to it.
+ * The write NIFs append HDUs to it as to a handle opened with mode :create,
+ * and close_memory returns the finished file.
+ *
+ * Args:
+ *   - size_hint: Expected size of the file in bytes, so the buffer can be
+ *     allocated once up front
+ *
+ * Returns:
+ *   {:ok, handle} on success
+ *   {:error, status} on failure
+ */
+static ERL_NIF_TERM create_memory(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifUInt64 size_hint;
+    if (!enif_get_uint64(env, argv[0], &size_hint)) {
+        return enif_make_badarg(env);
+    }
+
+    // Round up to whole blocks; files larger than the hint grow by a quarter
+    // of it at a time so a bad hint does not mean one realloc per block
+    size_t size = size_hint < MEMFILE_MIN_SIZE ? MEMFILE_MIN_SIZE : (size_t)size_hint;
+    size = (size + 2879) / 2880 * 2880;
+    size_t delta = size / 4 < MEMFILE_MIN_SIZE ? MEMFILE_MIN_SIZE : size / 4;
+
+    fits_handle *handle = enif_alloc_resource(FITS_HANDLE_TYPE, sizeof(fits_handle));
+    memset(handle, 0, sizeof(fits_handle));
+    handle->mem_buf = enif_alloc(size);
+    if (handle->mem_buf == NULL) {
+        enif_release_resource(handle);
+        return make_error_status(env, MEMORY_ALLOCATION);
+    }
+    handle->mem_size = size;
+
+    int status = 0;
+    fits_create_memfile(&handle->fptr, &handle->mem_buf, &handle->mem_size, delta, enif_realloc, &status);
+    if (status) {
+        handle->fptr = NULL;
+        enif_release_resource(handle);
+        return make_error_status(env, status);
+    }
+    return make_memory_handle(env, handle);
+}
+
+/**
+ * Closes a handle from create_memory and returns the file written through it.
+ * The binary is a view of CFITSIO's own buffer, so nothing is copied.
+ *
+ * Args:
+ *   - handle: Handle returned by create_memory
+ *
+ * Returns:
+ *   {:ok, binary} on success
+ *   {:error, status} on failure
+ */
+static ERL_NIF_TERM close_memory(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_handle *handle;
+    if (!enif_get_resource(env, argv[0], FITS_HANDLE_TYPE, (void **)&handle)) {
+        return enif_make_badarg(env);
+    }
+
+    enif_mutex_lock(handle->lock);
+    if (handle->mem_buf == NULL || handle->source_env != NULL) {
+        enif_mutex_unlock(handle->lock);
+        return enif_make_badarg(env);
+    }
+    if (handle->fptr == NULL) {
+        enif_mutex_unlock(handle->lock);
+        return make_error_status(env, FILE_NOT_OPENED);
+    }
+
+    // The buffer is allocated in steps, so the file ends where the last HDU's
+    // (padded) data unit does rather than at mem_size
+    int status = 0, nhdus = 0;
+    LONGLONG headstart, datastart, dataend = 0;
+    fits_flush_file(handle->fptr, &status);
+    fits_get_num_hdus(handle->fptr, &nhdus, &status);
+    if (!status && nhdus > 0) {
+        fits_movabs_hdu(handle->fptr, nhdus, NULL, &status);
+        fits_get_hduaddrll(handle->fptr, &headstart, &datastart, &dataend, &status);
+    }
+    fits_close_file(handle->fptr, &status);
+    handle->fptr = NULL;
+    enif_mutex_unlock(handle->lock);
+
+    if (status) {
+        return make_error_status(env, status);
+    }
+    // The binary keeps the handle, and so the buffer, alive. The file is
+    // closed, so CFITSIO can no longer move the buffer under it.
+    ERL_NIF_TERM data = enif_make_resource_binary(env, handle, handle->mem_buf, (size_t)dataend);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), data);
+}
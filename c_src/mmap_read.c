@@ -0,0 +1,115 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read-only mapping of a file region, kept alive by the binaries over it
+typedef struct {
+    void *addr;
+    size_t length;
+} mapped_region;
+
+static ErlNifResourceType *MAPPED_REGION_TYPE = NULL;
+
+static void mapped_region_dtor(ErlNifEnv* env, void* obj) {
+    mapped_region *region = (mapped_region*)obj;
+    if (region->addr != NULL) {
+        munmap(region->addr, region->length);
+    }
+}
+
+// Map length bytes of the file at offset (any alignment) and return them as a
+// binary backed by the mapping, without reading anything yet
+static int map_file_region(ErlNifEnv* env, const char *filename, LONGLONG offset, size_t length,
+                           ERL_NIF_TERM *binary) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (LONGLONG)st.st_size < offset + (LONGLONG)length) {
+        close(fd);
+        return 0;
+    }
+
+    // mmap offsets must be page-aligned; FITS data starts on 2880-byte blocks
+    long page = sysconf(_SC_PAGESIZE);
+    LONGLONG aligned = offset - offset % page;
+    size_t lead = (size_t)(offset - aligned);
+    void *addr = mmap(NULL, lead + length, PROT_READ, MAP_SHARED, fd, (off_t)aligned);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return 0;
+    }
+
+    mapped_region *region = enif_alloc_resource(MAPPED_REGION_TYPE, sizeof(mapped_region));
+    region->addr = addr;
+    region->length = lead + length;
+    *binary = enif_make_resource_binary(env, region, (unsigned char *)addr + lead, length);
+    enif_release_resource(region);
+    return 1;
+}
+
+// NIF: map_image(source, opts) -> {:ok, {shape, data, type, {bscale, bzero}}}
+// data holds the stored, big-endian pixels of an uncompressed image, mapped
+// straight from the file. type is the Nx type of the stored values (BZERO and
+// BSCALE are not applied) and the scaling is returned alongside.
+static ERL_NIF_TERM map_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[1], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis, bitpix, compressed, mode = READONLY, key_status = 0;
+    LONGLONG naxes[MAX_NAXIS], headstart, datastart, dataend;
+    char filetype[FLEN_FILENAME], filename[FLEN_FILENAME];
+    double bscale = 1.0, bzero = 0.0;
+    get_image_shape(src.fptr, &naxis, naxes, &status);
+    fits_get_img_type(src.fptr, &bitpix, &status);
+    compressed = fits_is_compressed_image(src.fptr, &status);
+    fits_file_type(src.fptr, filetype, &status);
+    fits_file_name(src.fptr, filename, &status);
+    fits_file_mode(src.fptr, &mode, &status);
+    fits_get_hduaddrll(src.fptr, &headstart, &datastart, &dataend, &status);
+    fits_read_key(src.fptr, TDOUBLE, "BSCALE", &bscale, NULL, &key_status);
+    key_status = 0;
+    fits_read_key(src.fptr, TDOUBLE, "BZERO", &bzero, NULL, &key_status);
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    if (naxis == 0) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_image_data"));
+    }
+
+    // Only plain disk files hold the pixels as-is; a writable handle may also
+    // have pixels that are not flushed yet
+    pixel_type type;
+    if (compressed || strcmp(filetype, "file://") != 0 || mode != READONLY ||
+        !pixel_type_for_bitpix(bitpix, &type)) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "not_mappable"));
+    }
+
+    size_t length = (size_t)count_pixels(naxis, naxes) * type.size;
+    ERL_NIF_TERM data;
+    if (length == 0) {
+        enif_make_new_binary(env, 0, &data);
+    } else if (!map_file_region(env, filename, datastart, length, &data)) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "mmap_failed"));
+    }
+
+    ERL_NIF_TERM result = enif_make_tuple4(env,
+                                           make_shape(env, naxis, naxes),
+                                           data,
+                                           make_nx_type(env, &type),
+                                           enif_make_tuple2(env, enif_make_double(env, bscale),
+                                                            enif_make_double(env, bzero)));
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
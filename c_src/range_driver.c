@@ -0,0 +1,463 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Declared in CFITSIO's internal fitsio2.h, which is not meant to be included
+// by applications
+int fits_init_cfitsio(void);
+int fits_register_driver(char *prefix, int (*init)(void), int (*fitsshutdown)(void),
+                         int (*setoptions)(int option), int (*getoptions)(int *options),
+                         int (*getversion)(int *version),
+                         int (*checkfile)(char *urltype, char *infile, char *outfile),
+                         int (*fitsopen)(char *filename, int rwmode, int *driverhandle),
+                         int (*fitscreate)(char *filename, int *driverhandle),
+                         int (*fitstruncate)(int driverhandle, LONGLONG filesize),
+                         int (*fitsclose)(int driverhandle), int (*fremove)(char *filename),
+                         int (*size)(int driverhandle, LONGLONG *size), int (*flush)(int driverhandle),
+                         int (*seek)(int driverhandle, LONGLONG offset),
+                         int (*fitsread)(int driverhandle, void *buffer, long nbytes),
+                         int (*fitswrite)(int driverhandle, void *buffer, long nbytes));
+
+// URL prefix CFITSIO routes to this driver; the rest of the name is a slot
+// number in remote_files
+#define REMOTE_PREFIX "exfitsrange://"
+// Upper bound on remote files open at once
+#define MAX_REMOTE_FILES 1024
+
+// One cached block of a remote file
+typedef struct {
+    LONGLONG index;       // block number, or -1 if the slot is empty
+    size_t length;        // bytes held, less than block_size only for the last block
+    unsigned long used;   // LRU tick
+    unsigned char *data;
+} range_block;
+
+// A read-only file whose bytes are fetched on demand, by byte range, from an
+// Elixir process. Each CFITSIO read that misses the block cache sends the
+// fetcher {:exfits_range, remote, request, offset, length} and blocks (on a
+// dirty scheduler) until the fetcher answers through range_reply/3.
+typedef struct {
+    ErlNifMutex *lock;
+    ErlNifCond *replied;
+    ErlNifPid fetcher;
+    int fetcher_down;
+
+    LONGLONG size;
+    LONGLONG pos;
+    size_t block_size;
+    int read_ahead;
+    int nblocks;
+    range_block *blocks;
+    unsigned long tick;
+
+    // The fetch in flight: its request number and, once answered, the reply
+    unsigned long request;
+    int waiting;
+    ErlNifEnv *reply_env;
+    ERL_NIF_TERM reply;
+
+    // Set once CFITSIO has opened the slot; guarded by remote_files_lock
+    int opened;
+} remote_file;
+
+static ErlNifResourceType *REMOTE_FILE_TYPE = NULL;
+
+// Open remote files by driver handle. Each slot holds a resource reference
+// from open_remote until CFITSIO closes the file.
+static remote_file *remote_files[MAX_REMOTE_FILES];
+static ErlNifMutex *remote_files_lock = NULL;
+
+static void remote_file_dtor(ErlNifEnv* env, void* obj) {
+    remote_file *remote = (remote_file*)obj;
+    if (remote->blocks != NULL) {
+        for (int i = 0; i < remote->nblocks; i++) {
+            enif_free(remote->blocks[i].data);
+        }
+        enif_free(remote->blocks);
+    }
+    if (remote->reply_env != NULL) {
+        enif_free_env(remote->reply_env);
+    }
+    if (remote->replied != NULL) {
+        enif_cond_destroy(remote->replied);
+    }
+    if (remote->lock != NULL) {
+        enif_mutex_destroy(remote->lock);
+    }
+}
+
+// Fail the fetch in flight, and every later one, once the fetcher is gone
+static void remote_file_down(ErlNifEnv* env, void* obj, ErlNifPid* pid, ErlNifMonitor* mon) {
+    remote_file *remote = (remote_file*)obj;
+    enif_mutex_lock(remote->lock);
+    remote->fetcher_down = 1;
+    enif_cond_broadcast(remote->replied);
+    enif_mutex_unlock(remote->lock);
+}
+
+static remote_file *remote_file_at(int driverhandle) {
+    if (driverhandle < 0 || driverhandle >= MAX_REMOTE_FILES) {
+        return NULL;
+    }
+    enif_mutex_lock(remote_files_lock);
+    remote_file *remote = remote_files[driverhandle];
+    enif_mutex_unlock(remote_files_lock);
+    return remote;
+}
+
+// Ask the fetcher for length bytes at offset and copy them to out.
+// Returns 0 or a CFITSIO status.
+static int remote_fetch(remote_file *remote, LONGLONG offset, size_t length, unsigned char *out) {
+    ErlNifEnv *msg_env = enif_alloc_env();
+    enif_mutex_lock(remote->lock);
+    if (remote->fetcher_down) {
+        enif_mutex_unlock(remote->lock);
+        enif_free_env(msg_env);
+        return READ_ERROR;
+    }
+    unsigned long request = ++remote->request;
+    remote->waiting = 1;
+    ERL_NIF_TERM msg = enif_make_tuple5(msg_env, enif_make_atom(msg_env, "exfits_range"),
+                                        enif_make_resource(msg_env, remote),
+                                        enif_make_uint64(msg_env, request),
+                                        enif_make_int64(msg_env, offset),
+                                        enif_make_uint64(msg_env, length));
+    enif_send(NULL, &remote->fetcher, msg_env, msg);
+    enif_free_env(msg_env);
+
+    while (remote->waiting && !remote->fetcher_down) {
+        enif_cond_wait(remote->replied, remote->lock);
+    }
+    int status = READ_ERROR;
+    ErlNifBinary data;
+    if (!remote->waiting && enif_inspect_binary(remote->reply_env, remote->reply, &data) &&
+        data.size == length) {
+        memcpy(out, data.data, length);
+        status = 0;
+    }
+    remote->waiting = 0;
+    if (remote->reply_env != NULL) {
+        enif_free_env(remote->reply_env);
+        remote->reply_env = NULL;
+    }
+    enif_mutex_unlock(remote->lock);
+    return status;
+}
+
+static range_block *find_block(remote_file *remote, LONGLONG index) {
+    for (int i = 0; i < remote->nblocks; i++) {
+        if (remote->blocks[i].index == index) {
+            remote->blocks[i].used = ++remote->tick;
+            return &remote->blocks[i];
+        }
+    }
+    return NULL;
+}
+
+// The empty or least recently used block slot
+static range_block *victim_block(remote_file *remote) {
+    range_block *victim = &remote->blocks[0];
+    for (int i = 0; i < remote->nblocks && victim->index >= 0; i++) {
+        if (remote->blocks[i].index < 0 || remote->blocks[i].used < victim->used) {
+            victim = &remote->blocks[i];
+        }
+    }
+    return victim;
+}
+
+// Fetch blocks first..last into the cache in one request, reading ahead to
+// read_ahead blocks and stopping early at a block that is already cached
+static int fill_blocks(remote_file *remote, LONGLONG first, LONGLONG last) {
+    LONGLONG nfile_blocks = (remote->size + remote->block_size - 1) / remote->block_size;
+    LONGLONG count = last - first + 1;
+    if (count < remote->read_ahead) {
+        count = remote->read_ahead;
+    }
+    if (count > remote->nblocks) {
+        count = remote->nblocks;
+    }
+    if (first + count > nfile_blocks) {
+        count = nfile_blocks - first;
+    }
+    for (LONGLONG i = 1; i < count; i++) {
+        if (find_block(remote, first + i) != NULL) {
+            count = i;
+            break;
+        }
+    }
+
+    LONGLONG offset = first * remote->block_size;
+    LONGLONG end = (first + count) * remote->block_size;
+    if (end > remote->size) {
+        end = remote->size;
+    }
+    size_t length = (size_t)(end - offset);
+    unsigned char *data = enif_alloc(length);
+    if (data == NULL) {
+        return MEMORY_ALLOCATION;
+    }
+    int status = remote_fetch(remote, offset, length, data);
+    for (LONGLONG i = 0; !status && i < count; i++) {
+        range_block *block = victim_block(remote);
+        if (block->data == NULL) {
+            block->data = enif_alloc(remote->block_size);
+        }
+        size_t start = (size_t)(i * remote->block_size);
+        block->index = first + i;
+        block->length = length - start < remote->block_size ? length - start : remote->block_size;
+        block->used = ++remote->tick;
+        memcpy(block->data, data + start, block->length);
+    }
+    enif_free(data);
+    return status;
+}
+
+static int remote_driver_init(void) {
+    return 0;
+}
+
+static int remote_driver_checkfile(char *urltype, char *infile, char *outfile) {
+    return 0;
+}
+
+// A slot holds one reference and its file state is used unlocked by one
+// fitsfile, so it is opened only once: reopening its name, say from another
+// thread, fails instead of sharing the slot and freeing it on close
+static int remote_driver_open(char *filename, int rwmode, int *driverhandle) {
+    char *end;
+    long slot = strtol(filename, &end, 10);
+    if (rwmode != READONLY || end == filename || slot < 0 || slot >= MAX_REMOTE_FILES) {
+        return FILE_NOT_OPENED;
+    }
+    enif_mutex_lock(remote_files_lock);
+    remote_file *remote = remote_files[slot];
+    int first_open = remote != NULL && !remote->opened;
+    if (first_open) {
+        remote->opened = 1;
+    }
+    enif_mutex_unlock(remote_files_lock);
+    if (!first_open) {
+        return FILE_NOT_OPENED;
+    }
+    *driverhandle = (int)slot;
+    return 0;
+}
+
+// Give up a slot and the reference that kept its remote file alive. With
+// expected set, only if the slot still holds that file.
+static void release_remote_slot(int slot, remote_file *expected) {
+    enif_mutex_lock(remote_files_lock);
+    remote_file *remote = remote_files[slot];
+    if (expected != NULL && remote != expected) {
+        remote = NULL;
+    } else {
+        remote_files[slot] = NULL;
+    }
+    enif_mutex_unlock(remote_files_lock);
+    if (remote != NULL) {
+        enif_release_resource(remote);
+    }
+}
+
+static int remote_driver_close(int driverhandle) {
+    if (driverhandle < 0 || driverhandle >= MAX_REMOTE_FILES) {
+        return FILE_NOT_CLOSED;
+    }
+    release_remote_slot(driverhandle, NULL);
+    return 0;
+}
+
+static int remote_driver_size(int driverhandle, LONGLONG *size) {
+    remote_file *remote = remote_file_at(driverhandle);
+    if (remote == NULL) {
+        return READ_ERROR;
+    }
+    *size = remote->size;
+    return 0;
+}
+
+static int remote_driver_flush(int driverhandle) {
+    return 0;
+}
+
+static int remote_driver_seek(int driverhandle, LONGLONG offset) {
+    remote_file *remote = remote_file_at(driverhandle);
+    if (remote == NULL || offset > remote->size) {
+        return END_OF_FILE;
+    }
+    remote->pos = offset;
+    return 0;
+}
+
+static int remote_driver_read(int driverhandle, void *buffer, long nbytes) {
+    remote_file *remote = remote_file_at(driverhandle);
+    if (remote == NULL) {
+        return READ_ERROR;
+    }
+    if (remote->pos + nbytes > remote->size) {
+        return END_OF_FILE;
+    }
+
+    unsigned char *out = buffer;
+    // Reads larger than the whole cache (the pixels of a big image) would
+    // only churn it, so they are fetched straight into the caller's buffer
+    if ((size_t)nbytes >= remote->block_size * remote->nblocks) {
+        int status = remote_fetch(remote, remote->pos, (size_t)nbytes, out);
+        if (!status) {
+            remote->pos += nbytes;
+        }
+        return status;
+    }
+
+    while (nbytes > 0) {
+        LONGLONG index = remote->pos / remote->block_size;
+        range_block *block = find_block(remote, index);
+        if (block == NULL) {
+            int status = fill_blocks(remote, index, (remote->pos + nbytes - 1) / remote->block_size);
+            if (status) {
+                return status;
+            }
+            block = find_block(remote, index);
+        }
+        size_t within = (size_t)(remote->pos - index * remote->block_size);
+        size_t n = block->length - within;
+        if (n > (size_t)nbytes) {
+            n = (size_t)nbytes;
+        }
+        memcpy(out, block->data + within, n);
+        out += n;
+        remote->pos += n;
+        nbytes -= (long)n;
+    }
+    return 0;
+}
+
+static int remote_driver_write(int driverhandle, void *buffer, long nbytes) {
+    return WRITE_ERROR;
+}
+
+// Register the driver with CFITSIO. Called once from load; CFITSIO must be
+// initialised first or it resets its driver table over ours.
+static int register_remote_driver(void) {
+    remote_files_lock = enif_mutex_create("exfits_remote_files");
+    if (remote_files_lock == NULL) {
+        return -1;
+    }
+    fits_init_cfitsio();
+    return fits_register_driver(REMOTE_PREFIX, remote_driver_init, NULL, NULL, NULL, NULL,
+                                remote_driver_checkfile, remote_driver_open, NULL, NULL,
+                                remote_driver_close, NULL, remote_driver_size, remote_driver_flush,
+                                remote_driver_seek, remote_driver_read, remote_driver_write);
+}
+
+/**
+ * Opens a remote FITS file read-only, fetching its bytes by range from an
+ * Elixir process, and returns a handle the read NIFs accept like any other.
+ *
+ * Args:
+ *   - fetcher: Pid of the process answering {:exfits_range, remote, request,
+ *     offset, length} messages with range_reply/3
+ *   - size: Size of the file in bytes
+ *   - options: Map with optional block_size (bytes per cached block, default
+ *     65536), read_ahead (blocks fetched at least per miss, default 4) and
+ *     cache_blocks (blocks cached, default 64)
+ *
+ * Returns:
+ *   {:ok, handle} on success
+ *   {:error, :too_many_files} if MAX_REMOTE_FILES remote files are open
+ *   {:error, status} on failure
+ */
+static ERL_NIF_TERM open_remote(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifPid fetcher;
+    ErlNifSInt64 size;
+    if (!enif_get_local_pid(env, argv[0], &fetcher) || !enif_get_int64(env, argv[1], &size) || size < 0 ||
+        !enif_is_map(env, argv[2])) {
+        return enif_make_badarg(env);
+    }
+    int block_size = 65536, read_ahead = 4, cache_blocks = 64;
+    get_int_option(env, argv[2], "block_size", &block_size);
+    get_int_option(env, argv[2], "read_ahead", &read_ahead);
+    get_int_option(env, argv[2], "cache_blocks", &cache_blocks);
+    if (block_size < 2880 || read_ahead < 1 || cache_blocks < 1 || read_ahead > cache_blocks) {
+        return enif_make_badarg(env);
+    }
+
+    remote_file *remote = enif_alloc_resource(REMOTE_FILE_TYPE, sizeof(remote_file));
+    memset(remote, 0, sizeof(remote_file));
+    remote->lock = enif_mutex_create("exfits_remote_file");
+    remote->replied = enif_cond_create("exfits_remote_file_replied");
+    remote->fetcher = fetcher;
+    remote->size = size;
+    remote->block_size = (size_t)block_size;
+    remote->read_ahead = read_ahead;
+    remote->nblocks = cache_blocks;
+    remote->blocks = enif_alloc(sizeof(range_block) * cache_blocks);
+    for (int i = 0; i < cache_blocks; i++) {
+        remote->blocks[i].index = -1;
+        remote->blocks[i].data = NULL;
+    }
+    if (enif_monitor_process(env, remote, &fetcher, NULL) != 0) {
+        enif_release_resource(remote);
+        return enif_make_badarg(env);
+    }
+
+    // The slot's reference is released by the driver's close
+    int slot = -1;
+    enif_mutex_lock(remote_files_lock);
+    for (int i = 0; i < MAX_REMOTE_FILES && slot < 0; i++) {
+        if (remote_files[i] == NULL) {
+            slot = i;
+            remote_files[i] = remote;
+        }
+    }
+    enif_mutex_unlock(remote_files_lock);
+    if (slot < 0) {
+        enif_release_resource(remote);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "too_many_files"));
+    }
+
+    char filename[32];
+    snprintf(filename, sizeof(filename), REMOTE_PREFIX "%d", slot);
+    fitsfile *fptr = NULL;
+    int status = 0;
+    fits_open_file(&fptr, filename, READONLY, &status);
+    if (status) {
+        // CFITSIO closes the driver handle itself unless the open failed
+        // early, after which the slot may already belong to another file
+        release_remote_slot(slot, remote);
+        return make_error_status(env, status);
+    }
+
+    fits_handle *handle = enif_alloc_resource(FITS_HANDLE_TYPE, sizeof(fits_handle));
+    memset(handle, 0, sizeof(fits_handle));
+    handle->fptr = fptr;
+    handle->lock = enif_mutex_create("exfits_handle");
+    ERL_NIF_TERM term = enif_make_resource(env, handle);
+    enif_release_resource(handle);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), term);
+}
+
+// NIF: range_reply(remote, request, data) -> :ok, where data is the requested
+// bytes or {:error, reason}. Replies to requests no longer waited on are
+// dropped.
+static ERL_NIF_TERM range_reply(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    remote_file *remote;
+    ErlNifUInt64 request;
+    if (!enif_get_resource(env, argv[0], REMOTE_FILE_TYPE, (void**)&remote) ||
+        !enif_get_uint64(env, argv[1], &request)) {
+        return enif_make_badarg(env);
+    }
+
+    enif_mutex_lock(remote->lock);
+    if (remote->waiting && remote->request == request) {
+        // Copying the reply binary only takes a reference to it
+        remote->reply_env = enif_alloc_env();
+        remote->reply = enif_make_copy(remote->reply_env, argv[2]);
+        remote->waiting = 0;
+        enif_cond_broadcast(remote->replied);
+    }
+    enif_mutex_unlock(remote->lock);
+    return enif_make_atom(env, "ok");
+}
@@ -0,0 +1,330 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <string.h>
+
+// Upper bound on the worker threads of one read pool
+#define MAX_POOL_THREADS 64
+
+// One queued file read. The path, options and reply ref are copied into the
+// job's own environment, which is also where the reply is built and sent from.
+typedef struct read_job {
+    struct read_job *next;
+    ErlNifEnv *env;
+    ErlNifPid caller;
+    ERL_NIF_TERM ref;
+    ERL_NIF_TERM path;
+    ERL_NIF_TERM opts;
+} read_job;
+
+// A fixed set of native threads reading whole files off a shared queue, so a
+// batch of reads runs outside the BEAM schedulers. The pool is shared by its
+// workers and the read_pool_ref resource Elixir holds, and freed by whichever
+// lets go of it last (refs counts them).
+typedef struct {
+    ErlNifMutex *lock;
+    ErlNifCond *work;
+    read_job *head;
+    read_job *tail;
+    int stopping;
+    int abandoned;
+    int refs;
+    int nthreads;
+    ErlNifTid threads[MAX_POOL_THREADS];
+} read_pool;
+
+typedef struct {
+    read_pool *pool;
+} read_pool_ref;
+
+static ErlNifResourceType *READ_POOL_TYPE = NULL;
+
+// Workers of pools that were garbage collected without pool_stop. Each adds
+// itself just before it returns, and is joined by the next pool_start or
+// pool_stop, so a joined thread never has more than its return left to run
+// and no scheduler waits on a read in progress.
+typedef struct finished_thread {
+    struct finished_thread *next;
+    ErlNifTid tid;
+} finished_thread;
+
+static ErlNifMutex *finished_threads_lock = NULL;
+static finished_thread *finished_threads = NULL;
+
+static void reap_finished_threads(void) {
+    enif_mutex_lock(finished_threads_lock);
+    finished_thread *thread = finished_threads;
+    finished_threads = NULL;
+    enif_mutex_unlock(finished_threads_lock);
+    while (thread != NULL) {
+        finished_thread *next = thread->next;
+        enif_thread_join(thread->tid, NULL);
+        enif_free(thread);
+        thread = next;
+    }
+}
+
+static void free_read_job(read_job *job) {
+    enif_free_env(job->env);
+    enif_free(job);
+}
+
+// Read the header and pixels of the first image HDU with data (or the :hdu
+// option) into a result term in env, in the same shape as read_array/2.
+// The header can be limited to the :keys option and the pixels skipped with
+// data: false.
+static ERL_NIF_TERM read_pool_file(ErlNifEnv* env, ERL_NIF_TERM path, ERL_NIF_TERM opts) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, path, opts, &src, &status)) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "badarg"));
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    ERL_NIF_TERM result = enif_make_new_map(env), keys;
+    if (get_bool_option(env, opts, "header", 1)) {
+        ERL_NIF_TERM header_map;
+        if (enif_get_map_value(env, opts, enif_make_atom(env, "keys"), &keys)) {
+            if (!read_header_keys(env, src.fptr, keys, 0, &header_map, &status)) {
+                close_source(&src, &status);
+                return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "badarg"));
+            }
+        } else {
+            read_header_map(env, src.fptr, 0, &header_map, &status);
+        }
+        if (status) {
+            close_source(&src, &status);
+            return make_error_status(env, status);
+        }
+        enif_make_map_put(env, result, enif_make_atom(env, "header"), header_map, &result);
+    }
+
+    // data: false stops at the header, so no pixel is ever read
+    if (!get_bool_option(env, opts, "data", 1)) {
+        close_source(&src, &status);
+        if (status) {
+            return make_error_status(env, status);
+        }
+        return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    if (get_image_shape(src.fptr, &naxis, naxes, &status)) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+    if (naxis == 0) {
+        close_source(&src, &status);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_image_data"));
+    }
+
+    pixel_buffer bin_pixels;
+    pixel_type type;
+    if (!read_image_data(env, src.fptr, opts, count_pixels(naxis, naxes), &bin_pixels, &type, &status)) {
+        close_source(&src, &status);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "badarg"));
+    }
+    close_source(&src, &status);
+    if (status) {
+        release_pixel_buffer(&bin_pixels);
+        return make_error_status(env, status);
+    }
+
+    enif_make_map_put(env, result, enif_make_atom(env, "shape"), make_shape(env, naxis, naxes), &result);
+    enif_make_map_put(env, result, enif_make_atom(env, "data"), make_pixel_binary(env, &bin_pixels), &result);
+    enif_make_map_put(env, result, enif_make_atom(env, "type"), make_nx_type(env, &type), &result);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+static void free_read_jobs(read_job *job) {
+    while (job != NULL) {
+        read_job *next = job->next;
+        free_read_job(job);
+        job = next;
+    }
+}
+
+// Let go of one reference to the pool, freeing it and the jobs nobody started
+// after the last
+static void release_read_pool(read_pool *pool) {
+    enif_mutex_lock(pool->lock);
+    int last = --pool->refs == 0;
+    enif_mutex_unlock(pool->lock);
+    if (last) {
+        free_read_jobs(pool->head);
+        enif_cond_destroy(pool->work);
+        enif_mutex_destroy(pool->lock);
+        enif_free(pool);
+    }
+}
+
+// Take jobs off the queue until the pool stops, replying to each caller with
+// {:exfits_read, ref, result}
+static void *read_pool_worker(void *arg) {
+    read_pool *pool = arg;
+    for (;;) {
+        enif_mutex_lock(pool->lock);
+        while (pool->head == NULL && !pool->stopping) {
+            enif_cond_wait(pool->work, pool->lock);
+        }
+        if (pool->stopping) {
+            int abandoned = pool->abandoned;
+            enif_mutex_unlock(pool->lock);
+            // Nobody joins the workers of an abandoned pool, so each queues
+            // itself to be joined once it has returned
+            finished_thread *thread = abandoned ? enif_alloc(sizeof(finished_thread)) : NULL;
+            if (thread != NULL) {
+                thread->tid = enif_thread_self();
+                enif_mutex_lock(finished_threads_lock);
+                thread->next = finished_threads;
+                finished_threads = thread;
+                enif_mutex_unlock(finished_threads_lock);
+            }
+            release_read_pool(pool);
+            return NULL;
+        }
+        read_job *job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        enif_mutex_unlock(pool->lock);
+
+        ERL_NIF_TERM result = read_pool_file(job->env, job->path, job->opts);
+        ERL_NIF_TERM msg = enif_make_tuple3(job->env, enif_make_atom(job->env, "exfits_read"), job->ref, result);
+        enif_send(NULL, &job->caller, job->env, msg);
+        free_read_job(job);
+    }
+}
+
+// Stop the workers, wait for the reads in progress to finish and drop the
+// jobs nobody has started. Safe to call more than once. Blocks, so only for
+// pool_stop on a dirty scheduler.
+static void stop_read_pool(read_pool *pool) {
+    enif_mutex_lock(pool->lock);
+    int nthreads = pool->nthreads;
+    pool->stopping = 1;
+    pool->nthreads = 0;
+    enif_cond_broadcast(pool->work);
+    enif_mutex_unlock(pool->lock);
+
+    for (int i = 0; i < nthreads; i++) {
+        enif_thread_join(pool->threads[i], NULL);
+    }
+
+    enif_mutex_lock(pool->lock);
+    read_job *job = pool->head;
+    pool->head = pool->tail = NULL;
+    enif_mutex_unlock(pool->lock);
+    free_read_jobs(job);
+}
+
+// The destructor may run on a normal scheduler, so it only tells the workers
+// to stop after their current read, without waiting for them
+static void read_pool_dtor(ErlNifEnv* env, void* obj) {
+    read_pool *pool = ((read_pool_ref*)obj)->pool;
+    if (pool == NULL) {
+        return;
+    }
+    enif_mutex_lock(pool->lock);
+    pool->abandoned = pool->nthreads > 0;
+    pool->stopping = 1;
+    pool->nthreads = 0;
+    enif_cond_broadcast(pool->work);
+    enif_mutex_unlock(pool->lock);
+    release_read_pool(pool);
+}
+
+// NIF: pool_start(threads) -> {:ok, pool}
+static ERL_NIF_TERM pool_start(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    int threads;
+    if (!enif_get_int(env, argv[0], &threads) || threads < 1) {
+        return enif_make_badarg(env);
+    }
+    if (threads > MAX_POOL_THREADS) {
+        threads = MAX_POOL_THREADS;
+    }
+    // A CFITSIO built without --enable-reentrant shares state between files,
+    // so its reads must not overlap
+    if (!fits_is_reentrant()) {
+        threads = 1;
+    }
+
+    reap_finished_threads();
+    read_pool *pool = enif_alloc(sizeof(read_pool));
+    if (pool == NULL) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "enomem"));
+    }
+    memset(pool, 0, sizeof(read_pool));
+    pool->lock = enif_mutex_create("exfits_read_pool");
+    pool->work = enif_cond_create("exfits_read_pool_work");
+    // The resource's reference, then one per worker
+    pool->refs = 1;
+    enif_mutex_lock(pool->lock);
+    for (int i = 0; i < threads; i++) {
+        if (enif_thread_create("exfits_read_pool", &pool->threads[i], read_pool_worker, pool, NULL) != 0) {
+            break;
+        }
+        pool->nthreads++;
+        pool->refs++;
+    }
+    enif_mutex_unlock(pool->lock);
+
+    read_pool_ref *ref = enif_alloc_resource(READ_POOL_TYPE, sizeof(read_pool_ref));
+    ref->pool = pool;
+    if (pool->nthreads == 0) {
+        enif_release_resource(ref);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "thread_create_failed"));
+    }
+
+    ERL_NIF_TERM term = enif_make_resource(env, ref);
+    enif_release_resource(ref);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), term);
+}
+
+// NIF: pool_submit(pool, ref, path, opts) -> :ok | {:error, :stopped}
+static ERL_NIF_TERM pool_submit(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    read_pool_ref *ref;
+    if (!enif_get_resource(env, argv[0], READ_POOL_TYPE, (void**)&ref) ||
+        !enif_is_ref(env, argv[1]) || !enif_is_map(env, argv[3])) {
+        return enif_make_badarg(env);
+    }
+    read_pool *pool = ref->pool;
+
+    read_job *job = enif_alloc(sizeof(read_job));
+    job->next = NULL;
+    job->env = enif_alloc_env();
+    enif_self(env, &job->caller);
+    job->ref = enif_make_copy(job->env, argv[1]);
+    job->path = enif_make_copy(job->env, argv[2]);
+    job->opts = enif_make_copy(job->env, argv[3]);
+
+    enif_mutex_lock(pool->lock);
+    if (pool->stopping) {
+        enif_mutex_unlock(pool->lock);
+        free_read_job(job);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "stopped"));
+    }
+    if (pool->tail != NULL) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    enif_cond_signal(pool->work);
+    enif_mutex_unlock(pool->lock);
+    return enif_make_atom(env, "ok");
+}
+
+// NIF: pool_stop(pool) -> :ok, once every read in progress has replied
+static ERL_NIF_TERM pool_stop(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    read_pool_ref *ref;
+    if (!enif_get_resource(env, argv[0], READ_POOL_TYPE, (void**)&ref)) {
+        return enif_make_badarg(env);
+    }
+    stop_read_pool(ref->pool);
+    reap_finished_threads();
+    return enif_make_atom(env, "ok");
+}
@@ -0,0 +1,241 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <string.h>
+
+// Rows of a string column read by one CFITSIO call
+#define STRING_CHUNK_ROWS 4096
+
+// Move to the first table HDU at or after the current one. Used when a table
+// read is given no :hdu option and the file is positioned on an image, which
+// is the usual case for a catalog stored after an empty primary HDU.
+static int move_to_table(fitsfile *fptr, int *status) {
+    int hdutype;
+    fits_get_hdu_type(fptr, &hdutype, status);
+    while (!*status && hdutype == IMAGE_HDU) {
+        fits_movrel_hdu(fptr, 1, &hdutype, status);
+    }
+    return *status;
+}
+
+// Map a column's equivalent type code to the pixel type it is read into.
+// 32-bit columns are reported by CFITSIO as TLONG/TULONG but are read as
+// TINT/TUINT so they stay 4 bytes wide on LP64 platforms.
+static int pixel_type_for_column(int typecode, pixel_type *type) {
+    switch (typecode) {
+        case TBYTE:       *type = (pixel_type){TBYTE, 1, "u", 8}; return 1;
+        case TSBYTE:      *type = (pixel_type){TSBYTE, 1, "s", 8}; return 1;
+        case TLOGICAL:    *type = (pixel_type){TLOGICAL, 1, "u", 8}; return 1;
+        case TSHORT:      *type = (pixel_type){TSHORT, 2, "s", 16}; return 1;
+        case TUSHORT:     *type = (pixel_type){TUSHORT, 2, "u", 16}; return 1;
+        case TINT:
+        case TLONG:       *type = (pixel_type){TINT, 4, "s", 32}; return 1;
+        case TUINT:
+        case TULONG:      *type = (pixel_type){TUINT, 4, "u", 32}; return 1;
+        case TLONGLONG:   *type = (pixel_type){TLONGLONG, 8, "s", 64}; return 1;
+        case TULONGLONG:  *type = (pixel_type){TULONGLONG, 8, "u", 64}; return 1;
+        case TFLOAT:      *type = (pixel_type){TFLOAT, 4, "f", 32}; return 1;
+        case TDOUBLE:     *type = (pixel_type){TDOUBLE, 8, "f", 64}; return 1;
+        case TCOMPLEX:    *type = (pixel_type){TCOMPLEX, 8, "c", 64}; return 1;
+        case TDBLCOMPLEX: *type = (pixel_type){TDBLCOMPLEX, 16, "c", 128}; return 1;
+        default: return 0;
+    }
+}
+
+// Read a string column as a list of binaries with trailing blanks removed,
+// STRING_CHUNK_ROWS rows per CFITSIO call
+static ERL_NIF_TERM read_string_column(ErlNifEnv* env, fitsfile *fptr, int colnum, long width,
+                                       LONGLONG firstrow, LONGLONG nrows, int *status) {
+    LONGLONG chunk = nrows < STRING_CHUNK_ROWS ? nrows : STRING_CHUNK_ROWS;
+    char *buffer = enif_alloc(chunk * (width + 1) + 1);
+    char **rows = enif_alloc((chunk + 1) * sizeof(char *));
+    ERL_NIF_TERM list = enif_make_list(env, 0);
+    if (buffer == NULL || rows == NULL) {
+        enif_free(buffer);
+        enif_free(rows);
+        *status = MEMORY_ALLOCATION;
+        return list;
+    }
+    for (LONGLONG i = 0; i < chunk; i++) {
+        rows[i] = buffer + i * (width + 1);
+    }
+
+    // Walk the chunks, and the rows in each, backwards so the list can be
+    // built by prepending
+    for (LONGLONG end = firstrow + nrows; end > firstrow && !*status; end -= chunk) {
+        LONGLONG first = end - chunk > firstrow ? end - chunk : firstrow;
+        if (fits_read_col_str(fptr, colnum, first, 1, end - first, NULL, rows, NULL, status)) {
+            break;
+        }
+        for (LONGLONG i = end - first - 1; i >= 0; i--) {
+            size_t len = strlen(rows[i]);
+            while (len > 0 && rows[i][len - 1] == ' ') {
+                len--;
+            }
+            ERL_NIF_TERM value;
+            memcpy(enif_make_new_binary(env, len, &value), rows[i], len);
+            list = enif_make_list_cell(env, value, list);
+        }
+    }
+
+    enif_free(rows);
+    enif_free(buffer);
+    return list;
+}
+
+// Read one column into a map %{name, data, type, repeat}. Numeric columns
+// come back as one contiguous binary of nrows * repeat values; string columns
+// as a list of binaries with type :string.
+static ERL_NIF_TERM read_column(ErlNifEnv* env, fitsfile *fptr, int colnum, LONGLONG firstrow,
+                                LONGLONG nrows, int *status) {
+    char keyname[FLEN_KEYWORD], name[FLEN_VALUE] = "";
+    int typecode, key_status = 0;
+    long repeat, width;
+    fits_make_keyn("TTYPE", colnum, keyname, &key_status);
+    fits_read_key(fptr, TSTRING, keyname, name, NULL, &key_status);
+    fits_get_eqcoltype(fptr, colnum, &typecode, &repeat, &width, status);
+    if (*status) {
+        return 0;
+    }
+
+    ERL_NIF_TERM name_term, data_term, type_term;
+    memcpy(enif_make_new_binary(env, strlen(name), &name_term), name, strlen(name));
+
+    if (typecode == TSTRING) {
+        data_term = read_string_column(env, fptr, colnum, width, firstrow, nrows, status);
+        type_term = enif_make_atom(env, "string");
+        repeat = 1;
+    } else {
+        pixel_type type;
+        if (!pixel_type_for_column(typecode, &type)) {
+            // Bit and variable-length array columns are not supported
+            *status = BAD_TFORM;
+            return 0;
+        }
+        // Complex values are stored as interleaved (real, imaginary) pairs
+        LONGLONG nelem = nrows * repeat;
+        ErlNifBinary bin;
+        if (!enif_alloc_binary(nelem * type.size, &bin)) {
+            *status = MEMORY_ALLOCATION;
+            return 0;
+        }
+        if (nelem > 0 &&
+            fits_read_col(fptr, type.datatype, colnum, firstrow, 1, nelem, NULL, bin.data, NULL, status)) {
+            enif_release_binary(&bin);
+            return 0;
+        }
+        data_term = enif_make_binary(env, &bin);
+        type_term = make_nx_type(env, &type);
+    }
+
+    ERL_NIF_TERM column = enif_make_new_map(env);
+    enif_make_map_put(env, column, enif_make_atom(env, "name"), name_term, &column);
+    enif_make_map_put(env, column, enif_make_atom(env, "data"), data_term, &column);
+    enif_make_map_put(env, column, enif_make_atom(env, "type"), type_term, &column);
+    enif_make_map_put(env, column, enif_make_atom(env, "repeat"), enif_make_long(env, repeat), &column);
+    return column;
+}
+
+/**
+ * Reads columns of a binary or ASCII table, one contiguous binary per column.
+ *
+ * Args:
+ *   - source: Path or handle
+ *   - columns: List of column names (binaries), or nil for every column
+ *   - options: Map with optional hdu, first_row (1-based, default 1) and
+ *     rows (default: all remaining rows)
+ *
+ * Returns:
+ *   {:ok, [%{name, data, type, repeat}]} in the requested column order
+ *   {:error, :column_not_found} if a requested column does not exist; other
+ *   lookup failures, such as an ambiguous name template, as {:error, status}
+ *   {:error, status} on failure
+ */
+static ERL_NIF_TERM read_table(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ERL_NIF_TERM value;
+    ErlNifSInt64 firstrow = 1, nrows = -1;
+    if (enif_is_map(env, argv[2])) {
+        if (enif_get_map_value(env, argv[2], enif_make_atom(env, "first_row"), &value) &&
+            (!enif_get_int64(env, value, &firstrow) || firstrow < 1)) {
+            return enif_make_badarg(env);
+        }
+        if (enif_get_map_value(env, argv[2], enif_make_atom(env, "rows"), &value) &&
+            (!enif_get_int64(env, value, &nrows) || nrows < 0)) {
+            return enif_make_badarg(env);
+        }
+    }
+    int all_columns = enif_is_identical(argv[1], enif_make_atom(env, "nil"));
+    if (!all_columns && !enif_is_list(env, argv[1])) {
+        return enif_make_badarg(env);
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!open_source_at(env, argv[0], argv[2], READONLY, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    ERL_NIF_TERM hdu_opt;
+    if (!enif_get_map_value(env, argv[2], enif_make_atom(env, "hdu"), &hdu_opt)) {
+        move_to_table(src.fptr, &status);
+    }
+
+    LONGLONG total_rows = 0;
+    int ncols = 0;
+    fits_get_num_rowsll(src.fptr, &total_rows, &status);
+    fits_get_num_cols(src.fptr, &ncols, &status);
+    if (status) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+    if (firstrow > total_rows + 1) {
+        firstrow = total_rows + 1;
+    }
+    if (nrows < 0 || firstrow + nrows - 1 > total_rows) {
+        nrows = total_rows - firstrow + 1;
+    }
+
+    ERL_NIF_TERM columns = enif_make_list(env, 0);
+    if (all_columns) {
+        for (int colnum = ncols; colnum >= 1 && !status; colnum--) {
+            ERL_NIF_TERM column = read_column(env, src.fptr, colnum, firstrow, nrows, &status);
+            if (!status) {
+                columns = enif_make_list_cell(env, column, columns);
+            }
+        }
+    } else {
+        ERL_NIF_TERM head, tail = argv[1];
+        while (!status && enif_get_list_cell(env, tail, &head, &tail)) {
+            char name[FLEN_VALUE];
+            int colnum;
+            if (!get_filename(env, head, name, sizeof(name))) {
+                close_source(&src, &status);
+                return enif_make_badarg(env);
+            }
+            // An ambiguous template (COL_NOT_UNIQUE) and other failures are
+            // reported with their status
+            if (fits_get_colnum(src.fptr, CASEINSEN, name, &colnum, &status)) {
+                int colnum_status = status;
+                close_source(&src, &status);
+                if (colnum_status == COL_NOT_FOUND) {
+                    return enif_make_tuple2(env, enif_make_atom(env, "error"),
+                                            enif_make_atom(env, "column_not_found"));
+                }
+                return make_error_status(env, colnum_status);
+            }
+            ERL_NIF_TERM column = read_column(env, src.fptr, colnum, firstrow, nrows, &status);
+            if (!status) {
+                columns = enif_make_list_cell(env, column, columns);
+            }
+        }
+        enif_make_reverse_list(env, columns, &columns);
+    }
+
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), columns);
+}
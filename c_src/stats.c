@@ -0,0 +1,694 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// The largest number of pixels read and reduced at once, as doubles. Small
+// enough that both passes over a chunk run from L2.
+#define STATS_CHUNK_PIXELS 65536
+// Upper bound on the threads reducing one image
+#define MAX_STATS_THREADS 32
+
+// Count, min, max, mean and sum of squared deviations of the valid pixels seen
+// so far, in the form Chan et al. merge in parallel
+typedef struct {
+    uint64_t count;
+    uint64_t nulls;
+    double min;
+    double max;
+    double mean;
+    double m2;
+} stats_moments;
+
+// One band of the section, along its slowest axis, reduced by one thread.
+// Each band accumulates its own moments, histogram and kept values, which
+// are merged once every band is done.
+typedef struct {
+    // The file and HDU a thread opens for itself
+    const char *filename;
+    int hdunum;
+    int naxis;
+    long fpixel[MAX_NAXIS];
+    long lpixel[MAX_NAXIS];
+    long chunk_rows;
+    double *buffer;
+
+    // Histogram over a fixed range, counted while streaming (or bins = 0)
+    int bins;
+    double lo;
+    double hi;
+    uint64_t *counts;
+
+    // Valid pixels, kept for the median, sigma clipping or a histogram over
+    // the data range (or keep = 0)
+    int keep;
+    double *values;
+    size_t nvalues;
+    size_t capacity;
+
+    stats_moments moments;
+    int status;
+} stats_band;
+
+static void init_moments(stats_moments *m) {
+    m->count = 0;
+    m->nulls = 0;
+    m->min = INFINITY;
+    m->max = -INFINITY;
+    m->mean = 0.0;
+    m->m2 = 0.0;
+}
+
+// Fold the moments of b into a
+static void merge_moments(stats_moments *a, const stats_moments *b) {
+    a->nulls += b->nulls;
+    if (b->count == 0) {
+        return;
+    }
+    double n = (double)a->count + (double)b->count;
+    double delta = b->mean - a->mean;
+    a->mean += delta * (double)b->count / n;
+    a->m2 += b->m2 + delta * delta * (double)a->count * (double)b->count / n;
+    a->count += b->count;
+    a->min = b->min < a->min ? b->min : a->min;
+    a->max = b->max > a->max ? b->max : a->max;
+}
+
+#if defined(EXFITS_SIMD_X86)
+// Each kernel reduces as many whole vectors as fit into the running values
+// and returns the number of elements done; the scalar loop finishes the tail.
+// NaN (which BLANK pixels are read as) is masked out of the sums by an
+// ordered compare, and minpd/maxpd return their second operand, the running
+// value, when the pixel is NaN.
+__attribute__((target("avx2")))
+static size_t sum_valid_avx2(const double *x, size_t n, uint64_t *valid, double *sum, double *lo,
+                             double *hi) {
+    __m256d s = _mm256_setzero_pd(), count = _mm256_setzero_pd();
+    __m256d mn = _mm256_set1_pd(INFINITY), mx = _mm256_set1_pd(-INFINITY);
+    const __m256d one = _mm256_set1_pd(1.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(x + i);
+        __m256d ok = _mm256_cmp_pd(v, v, _CMP_ORD_Q);
+        s = _mm256_add_pd(s, _mm256_and_pd(v, ok));
+        count = _mm256_add_pd(count, _mm256_and_pd(one, ok));
+        mn = _mm256_min_pd(v, mn);
+        mx = _mm256_max_pd(v, mx);
+    }
+    double lanes[4][4];
+    _mm256_storeu_pd(lanes[0], s);
+    _mm256_storeu_pd(lanes[1], count);
+    _mm256_storeu_pd(lanes[2], mn);
+    _mm256_storeu_pd(lanes[3], mx);
+    for (int l = 0; l < 4; l++) {
+        *sum += lanes[0][l];
+        *valid += (uint64_t)lanes[1][l];
+        *lo = lanes[2][l] < *lo ? lanes[2][l] : *lo;
+        *hi = lanes[3][l] > *hi ? lanes[3][l] : *hi;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t squared_deviations_avx2(const double *x, size_t n, double mean, double *m2) {
+    __m256d acc = _mm256_setzero_pd();
+    const __m256d center = _mm256_set1_pd(mean);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(x + i);
+        __m256d d = _mm256_and_pd(_mm256_sub_pd(v, center), _mm256_cmp_pd(v, v, _CMP_ORD_Q));
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(d, d));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    *m2 += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return i;
+}
+#endif
+
+#if defined(EXFITS_SIMD_NEON)
+// vminq/vmaxq propagate NaN, so the running values are selected by compare
+static size_t sum_valid_neon(const double *x, size_t n, uint64_t *valid, double *sum, double *lo,
+                             double *hi) {
+    float64x2_t s = vdupq_n_f64(0.0), mn = vdupq_n_f64(INFINITY), mx = vdupq_n_f64(-INFINITY);
+    uint64x2_t count = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t v = vld1q_f64(x + i);
+        uint64x2_t ok = vceqq_f64(v, v);
+        s = vaddq_f64(s, vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(v), ok)));
+        count = vsubq_u64(count, ok);
+        mn = vbslq_f64(vcltq_f64(v, mn), v, mn);
+        mx = vbslq_f64(vcgtq_f64(v, mx), v, mx);
+    }
+    *sum += vaddvq_f64(s);
+    *valid += vaddvq_u64(count);
+    *lo = vminvq_f64(mn) < *lo ? vminvq_f64(mn) : *lo;
+    *hi = vmaxvq_f64(mx) > *hi ? vmaxvq_f64(mx) : *hi;
+    return i;
+}
+
+static size_t squared_deviations_neon(const double *x, size_t n, double mean, double *m2) {
+    float64x2_t acc = vdupq_n_f64(0.0);
+    const float64x2_t center = vdupq_n_f64(mean);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t v = vld1q_f64(x + i);
+        uint64x2_t ok = vceqq_f64(v, v);
+        float64x2_t d = vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(vsubq_f64(v, center)), ok));
+        acc = vfmaq_f64(acc, d, d);
+    }
+    *m2 += vaddvq_f64(acc);
+    return i;
+}
+#endif
+
+// Count, sum, min and max of the values that are not NaN
+static void sum_valid(const double *x, size_t n, uint64_t *valid, double *sum, double *lo, double *hi) {
+    size_t done = 0;
+    *valid = 0;
+    *sum = 0.0;
+    *lo = INFINITY;
+    *hi = -INFINITY;
+    switch (simd_level) {
+#if defined(EXFITS_SIMD_X86)
+        case SIMD_AVX2: done = sum_valid_avx2(x, n, valid, sum, lo, hi); break;
+#elif defined(EXFITS_SIMD_NEON)
+        case SIMD_NEON: done = sum_valid_neon(x, n, valid, sum, lo, hi); break;
+#endif
+        default: break;
+    }
+    for (size_t i = done; i < n; i++) {
+        int ok = x[i] == x[i];
+        *valid += ok;
+        *sum += ok ? x[i] : 0.0;
+        *lo = x[i] < *lo ? x[i] : *lo;
+        *hi = x[i] > *hi ? x[i] : *hi;
+    }
+}
+
+// Sum of squared deviations from mean of the values that are not NaN
+static double squared_deviations(const double *x, size_t n, double mean) {
+    size_t done = 0;
+    double m2 = 0.0;
+    switch (simd_level) {
+#if defined(EXFITS_SIMD_X86)
+        case SIMD_AVX2: done = squared_deviations_avx2(x, n, mean, &m2); break;
+#elif defined(EXFITS_SIMD_NEON)
+        case SIMD_NEON: done = squared_deviations_neon(x, n, mean, &m2); break;
+#endif
+        default: break;
+    }
+    for (size_t i = done; i < n; i++) {
+        double d = x[i] == x[i] ? x[i] - mean : 0.0;
+        m2 += d * d;
+    }
+    return m2;
+}
+
+// Moments of n pixels in two passes over them, both from cache for a chunk,
+// skipping NaN
+static void chunk_moments(const double *x, size_t n, stats_moments *m) {
+    uint64_t valid;
+    double sum, lo, hi;
+    sum_valid(x, n, &valid, &sum, &lo, &hi);
+    init_moments(m);
+    m->nulls = n - valid;
+    if (valid == 0) {
+        return;
+    }
+    m->count = valid;
+    m->min = lo;
+    m->max = hi;
+    m->mean = sum / (double)valid;
+    m->m2 = squared_deviations(x, n, m->mean);
+}
+
+// Count n values into bins over [lo, hi], the last bin including hi. NaN
+// fails both range checks. The bin is clamped before it is made an int, since
+// over an infinite data range the position can be NaN or infinite.
+static void count_bins(const double *x, size_t n, int bins, double lo, double hi, uint64_t *counts) {
+    double scale = bins / (hi - lo);
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] >= lo && x[i] <= hi) {
+            double at = hi > lo ? (x[i] - lo) * scale : 0.0;
+            counts[at >= bins ? bins - 1 : at > 0.0 ? (int)at : 0]++;
+        }
+    }
+}
+
+// Append the valid pixels of a chunk to the band's kept values
+static int keep_values(stats_band *band, const double *x, size_t n) {
+    if (band->nvalues + n > band->capacity) {
+        size_t capacity = band->capacity ? band->capacity * 2 : STATS_CHUNK_PIXELS;
+        while (capacity < band->nvalues + n) {
+            capacity *= 2;
+        }
+        double *values = enif_realloc(band->values, capacity * sizeof(double));
+        if (values == NULL) {
+            return 0;
+        }
+        band->values = values;
+        band->capacity = capacity;
+    }
+    double *out = band->values + band->nvalues;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        out[kept] = x[i];
+        kept += x[i] == x[i];
+    }
+    band->nvalues += kept;
+    return 1;
+}
+
+// Read and reduce a band a chunk of rows at a time
+static void reduce_band(stats_band *band, fitsfile *fptr) {
+    int status = 0;
+    long fpixel[MAX_NAXIS], lpixel[MAX_NAXIS], inc[MAX_NAXIS];
+    memcpy(fpixel, band->fpixel, sizeof(fpixel));
+    memcpy(lpixel, band->lpixel, sizeof(lpixel));
+    for (int i = 0; i < band->naxis; i++) {
+        inc[i] = 1;
+    }
+    int last = band->naxis - 1;
+    double nulval = NAN;
+    init_moments(&band->moments);
+
+    for (long row = band->fpixel[last]; row <= band->lpixel[last] && !status; row += band->chunk_rows) {
+        fpixel[last] = row;
+        lpixel[last] = row + band->chunk_rows - 1 > band->lpixel[last] ? band->lpixel[last]
+                                                                          : row + band->chunk_rows - 1;
+        size_t n = 1;
+        for (int i = 0; i < band->naxis; i++) {
+            n *= (size_t)(lpixel[i] - fpixel[i] + 1);
+        }
+        int anynul;
+        fits_read_subset(fptr, TDOUBLE, fpixel, lpixel, inc, &nulval, band->buffer, &anynul, &status);
+        if (status) {
+            break;
+        }
+
+        stats_moments chunk;
+        chunk_moments(band->buffer, n, &chunk);
+        merge_moments(&band->moments, &chunk);
+        if (band->counts != NULL) {
+            count_bins(band->buffer, n, band->bins, band->lo, band->hi, band->counts);
+        }
+        if (band->keep && !keep_values(band, band->buffer, n)) {
+            status = MEMORY_ALLOCATION;
+        }
+    }
+    band->status = status;
+}
+
+// Reduce one band through its own fitsfile, since a fitsfile must not be used
+// from two threads at once
+static void *reduce_band_thread(void *arg) {
+    stats_band *band = arg;
+    fitsfile *fptr;
+    int status = 0;
+    if (fits_open_file(&fptr, band->filename, READONLY, &status)) {
+        band->status = status;
+        return NULL;
+    }
+    fits_movabs_hdu(fptr, band->hdunum, NULL, &status);
+    if (status) {
+        band->status = status;
+    } else {
+        reduce_band(band, fptr);
+    }
+    fits_close_file(fptr, &status);
+    return NULL;
+}
+
+static void swap_values(double *a, double *b) {
+    double t = *a;
+    *a = *b;
+    *b = t;
+}
+
+// Move the k-th smallest of n values to x[k], with smaller ones before it and
+// larger ones after (Wirth's selection, with a median-of-three pivot)
+static void select_kth(double *x, size_t n, size_t k) {
+    long long lo = 0, hi = (long long)n - 1, kk = (long long)k;
+    while (lo < hi) {
+        double a = x[lo], b = x[kk], c = x[hi];
+        double pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+        long long i = lo, j = hi;
+        do {
+            while (x[i] < pivot) i++;
+            while (pivot < x[j]) j--;
+            if (i <= j) {
+                swap_values(&x[i], &x[j]);
+                i++;
+                j--;
+            }
+        } while (i <= j);
+        if (j < kk) lo = i;
+        if (kk < i) hi = j;
+    }
+}
+
+// Median of n > 0 values, reordering them
+static double median_of(double *x, size_t n) {
+    size_t k = n / 2;
+    select_kth(x, n, k);
+    if (n % 2) {
+        return x[k];
+    }
+    // The other middle value is the largest of the lower half
+    double below = x[0];
+    for (size_t i = 1; i < k; i++) {
+        below = x[i] > below ? x[i] : below;
+    }
+    return (below + x[k]) / 2.0;
+}
+
+// A statistic of count values, nil when there are none. Infinite pixels are
+// counted, so a sum, mean or extreme can be non-finite and comes back as an
+// atom from make_pixel_term.
+static ERL_NIF_TERM make_stat(ErlNifEnv* env, uint64_t count, double value) {
+    return count > 0 ? make_pixel_term(env, value) : enif_make_atom(env, "nil");
+}
+
+static ERL_NIF_TERM make_moments_map(ErlNifEnv* env, const stats_moments *m) {
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    enif_make_map_put(env, map, enif_make_atom(env, "count"), enif_make_uint64(env, m->count), &map);
+    enif_make_map_put(env, map, enif_make_atom(env, "mean"), make_stat(env, m->count, m->mean), &map);
+    enif_make_map_put(env, map, enif_make_atom(env, "stddev"),
+                      make_stat(env, m->count, sqrt(m->m2 / (double)(m->count ? m->count : 1))), &map);
+    return map;
+}
+
+// Iteratively reject values more than sigma standard deviations from the
+// median, compacting them in place, until none are rejected or after
+// iterations rounds. Returns the number of values left.
+static size_t sigma_clip(double *x, size_t n, double sigma, int iterations) {
+    for (int round = 0; round < iterations && n > 0; round++) {
+        double median = median_of(x, n);
+        stats_moments m;
+        chunk_moments(x, n, &m);
+        double spread = sigma * sqrt(m.m2 / (double)n);
+        size_t kept = 0;
+        for (size_t i = 0; i < n; i++) {
+            x[kept] = x[i];
+            kept += fabs(x[i] - median) <= spread;
+        }
+        if (kept == n) {
+            break;
+        }
+        n = kept;
+    }
+    return n;
+}
+
+static void free_band(stats_band *band) {
+    if (band->counts != NULL) {
+        enif_free(band->counts);
+    }
+    if (band->values != NULL) {
+        enif_free(band->values);
+    }
+    if (band->buffer != NULL) {
+        enif_free(band->buffer);
+    }
+}
+
+// A clip or range option from a float or an integer
+static int get_stats_number(ErlNifEnv* env, ERL_NIF_TERM term, double *value) {
+    long whole;
+    if (enif_get_long(env, term, &whole)) {
+        *value = whole;
+        return 1;
+    }
+    return enif_get_double(env, term, value);
+}
+
+/**
+ * Computes statistics of an image, or a section of it, in native code:
+ * count, min, max, mean and standard deviation in one streaming pass, plus
+ * optionally the median, sigma-clipped statistics and a histogram. NaN and
+ * BLANK pixels are skipped and counted as nulls. Values are physical, with
+ * BSCALE and BZERO applied.
+ *
+ * Args:
+ *   - source: Path to the FITS file, or a handle
+ *   - options: Map with optional
+ *       hdu: HDU number or EXTNAME (default: the first image HDU with data)
+ *       start, stop: 1-based inclusive section corners, NAXIS1 first
+ *       median: also compute the median (default false)
+ *       clip: sigma to clip at, for sigma-clipped statistics
+ *       clip_iterations: most clipping rounds (default 5)
+ *       histogram: number of bins
+ *       range: {lo, hi} of the histogram (default: the data range)
+ *       threads: threads reducing bands of rows of a file on disk (default 1)
+ *
+ * The median, clipping and a histogram without a range need the valid
+ * pixels, which are kept (as doubles) in native memory.
+ *
+ * Returns:
+ *   {:ok, %{count, nulls, min, max, mean, stddev}} plus median, clipped
+ *     (%{count, mean, median, stddev}) and histogram (%{counts, range}) when
+ *     requested; statistics of no pixels are nil
+ *   {:error, :invalid_section} if the section lies outside the image
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM image_stats(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ERL_NIF_TERM opts = argv[1], value;
+    if (!enif_is_map(env, opts)) {
+        return enif_make_badarg(env);
+    }
+    int want_median = get_bool_option(env, opts, "median", 0);
+    double sigma = 0.0;
+    int clip = enif_get_map_value(env, opts, enif_make_atom(env, "clip"), &value);
+    if (clip && !get_stats_number(env, value, &sigma)) {
+        return enif_make_badarg(env);
+    }
+    int iterations = 5, bins = 0, threads = 1;
+    get_int_option(env, opts, "clip_iterations", &iterations);
+    get_int_option(env, opts, "histogram", &bins);
+    get_int_option(env, opts, "threads", &threads);
+    double range_lo = 0.0, range_hi = 0.0;
+    int has_range = 0;
+    if (enif_get_map_value(env, opts, enif_make_atom(env, "range"), &value)) {
+        int arity;
+        const ERL_NIF_TERM *bounds;
+        if (!enif_get_tuple(env, value, &arity, &bounds) || arity != 2 ||
+            !get_stats_number(env, bounds[0], &range_lo) || !get_stats_number(env, bounds[1], &range_hi) ||
+            range_hi < range_lo) {
+            return enif_make_badarg(env);
+        }
+        has_range = 1;
+    }
+    if (bins < 0 || iterations < 1 || (clip && sigma <= 0.0)) {
+        return enif_make_badarg(env);
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], opts, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    if (get_image_shape(src.fptr, &naxis, naxes, &status)) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+    if (naxis == 0) {
+        close_source(&src, &status);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_image_data"));
+    }
+
+    // The section, NAXIS1 first; the whole image by default
+    long fpixel[MAX_NAXIS], lpixel[MAX_NAXIS];
+    for (int i = 0; i < naxis; i++) {
+        fpixel[i] = 1;
+        lpixel[i] = (long)naxes[i];
+    }
+    if ((enif_get_map_value(env, opts, enif_make_atom(env, "start"), &value) &&
+         !get_axis_tuple(env, value, naxis, fpixel)) ||
+        (enif_get_map_value(env, opts, enif_make_atom(env, "stop"), &value) &&
+         !get_axis_tuple(env, value, naxis, lpixel))) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+    for (int i = 0; i < naxis; i++) {
+        if (fpixel[i] > lpixel[i] || lpixel[i] > naxes[i]) {
+            close_source(&src, &status);
+            return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "invalid_section"));
+        }
+    }
+
+    // Rows per read: whole rows of tiles for a compressed image, so no tile
+    // is decoded more than twice
+    int last = naxis - 1;
+    long rows = lpixel[last] - fpixel[last] + 1;
+    LONGLONG row_pixels = 1;
+    for (int i = 0; i < last; i++) {
+        row_pixels *= lpixel[i] - fpixel[i] + 1;
+    }
+    long chunk_rows = (long)(STATS_CHUNK_PIXELS / row_pixels);
+    if (fits_is_compressed_image(src.fptr, &status)) {
+        long tile_rows = tile_rows_of(src.fptr, naxis);
+        chunk_rows = chunk_rows / tile_rows * tile_rows;
+        if (chunk_rows < tile_rows) {
+            chunk_rows = tile_rows;
+        }
+    }
+    if (chunk_rows < 1) {
+        chunk_rows = 1;
+    }
+
+    // Bands on their own threads need their own open of the same file, which
+    // only sees what is on disk, so only read-only disk files are split
+    char filename[FLEN_FILENAME], urltype[FLEN_FILENAME];
+    int hdunum = 0, mode = READONLY, probe_status = 0;
+    fits_file_mode(src.fptr, &mode, &probe_status);
+    fits_file_type(src.fptr, urltype, &probe_status);
+    fits_file_name(src.fptr, filename, &probe_status);
+    fits_get_hdu_num(src.fptr, &hdunum);
+    if (probe_status || mode != READONLY || strcmp(urltype, "file://") != 0 || !fits_is_reentrant()) {
+        threads = 1;
+    }
+    threads = threads < 1 ? 1 : threads > MAX_STATS_THREADS ? MAX_STATS_THREADS : threads;
+    long band_rows = (rows + threads - 1) / threads;
+    band_rows = (band_rows + chunk_rows - 1) / chunk_rows * chunk_rows;
+    threads = (int)((rows + band_rows - 1) / band_rows);
+
+    int keep = want_median || clip || (bins > 0 && !has_range);
+    stats_band bands[MAX_STATS_THREADS];
+    ErlNifTid tids[MAX_STATS_THREADS];
+    int threaded[MAX_STATS_THREADS];
+    memset(bands, 0, sizeof(stats_band) * threads);
+    for (int i = 0; i < threads && !status; i++) {
+        stats_band *band = &bands[i];
+        band->filename = filename;
+        band->hdunum = hdunum;
+        band->naxis = naxis;
+        memcpy(band->fpixel, fpixel, sizeof(fpixel));
+        memcpy(band->lpixel, lpixel, sizeof(lpixel));
+        band->fpixel[last] = fpixel[last] + i * band_rows;
+        band->lpixel[last] = band->fpixel[last] + band_rows - 1 > lpixel[last] ? lpixel[last]
+                                                                                : band->fpixel[last] + band_rows - 1;
+        band->chunk_rows = chunk_rows;
+        band->keep = keep;
+        band->buffer = enif_alloc(sizeof(double) * (size_t)(chunk_rows * row_pixels));
+        if (bins > 0 && has_range) {
+            band->bins = bins;
+            band->lo = range_lo;
+            band->hi = range_hi;
+            band->counts = enif_alloc(sizeof(uint64_t) * bins);
+            if (band->counts != NULL) {
+                memset(band->counts, 0, sizeof(uint64_t) * bins);
+            }
+        }
+        if (band->buffer == NULL || (band->bins > 0 && band->counts == NULL)) {
+            status = MEMORY_ALLOCATION;
+        }
+    }
+
+    if (!status && threads == 1) {
+        reduce_band(&bands[0], src.fptr);
+    } else if (!status) {
+        for (int i = 0; i < threads; i++) {
+            threaded[i] = enif_thread_create("exfits_stats", &tids[i], reduce_band_thread, &bands[i], NULL) == 0;
+            if (!threaded[i]) {
+                // Fall back to reducing this band on the calling thread
+                reduce_band(&bands[i], src.fptr);
+            }
+        }
+        for (int i = 0; i < threads; i++) {
+            if (threaded[i]) {
+                enif_thread_join(tids[i], NULL);
+            }
+        }
+    }
+    close_source(&src, &status);
+
+    // Merge the bands into the first
+    stats_band *total = &bands[0];
+    for (int i = 0; i < threads; i++) {
+        if (bands[i].status && !status) {
+            status = bands[i].status;
+        }
+        if (i == 0 || status) {
+            continue;
+        }
+        merge_moments(&total->moments, &bands[i].moments);
+        if (total->counts != NULL) {
+            for (int b = 0; b < bins; b++) {
+                total->counts[b] += bands[i].counts[b];
+            }
+        }
+        if (keep && bands[i].nvalues > 0) {
+            if (!keep_values(total, bands[i].values, bands[i].nvalues)) {
+                status = MEMORY_ALLOCATION;
+            }
+        }
+    }
+    if (status) {
+        for (int i = 0; i < threads; i++) {
+            free_band(&bands[i]);
+        }
+        return make_error_status(env, status);
+    }
+
+    const stats_moments *m = &total->moments;
+    ERL_NIF_TERM result = make_moments_map(env, m);
+    enif_make_map_put(env, result, enif_make_atom(env, "nulls"), enif_make_uint64(env, m->nulls), &result);
+    enif_make_map_put(env, result, enif_make_atom(env, "min"), make_stat(env, m->count, m->min), &result);
+    enif_make_map_put(env, result, enif_make_atom(env, "max"), make_stat(env, m->count, m->max), &result);
+
+    // A histogram over the data range is counted from the kept values
+    if (bins > 0) {
+        double lo = has_range ? range_lo : m->min, hi = has_range ? range_hi : m->max;
+        if (total->counts == NULL) {
+            total->counts = enif_alloc(sizeof(uint64_t) * bins);
+            if (total->counts == NULL) {
+                for (int i = 0; i < threads; i++) {
+                    free_band(&bands[i]);
+                }
+                return make_error_status(env, MEMORY_ALLOCATION);
+            }
+            memset(total->counts, 0, sizeof(uint64_t) * bins);
+            if (m->count > 0) {
+                count_bins(total->values, total->nvalues, bins, lo, hi, total->counts);
+            }
+        }
+        ERL_NIF_TERM counts = enif_make_list(env, 0);
+        for (int b = bins - 1; b >= 0; b--) {
+            counts = enif_make_list_cell(env, enif_make_uint64(env, total->counts[b]), counts);
+        }
+        ERL_NIF_TERM histogram = enif_make_new_map(env);
+        enif_make_map_put(env, histogram, enif_make_atom(env, "counts"), counts, &histogram);
+        enif_make_map_put(env, histogram, enif_make_atom(env, "range"),
+                          enif_make_tuple2(env, make_stat(env, m->count || has_range, lo),
+                                           make_stat(env, m->count || has_range, hi)), &histogram);
+        enif_make_map_put(env, result, enif_make_atom(env, "histogram"), histogram, &result);
+    }
+    if (want_median) {
+        double median = total->nvalues > 0 ? median_of(total->values, total->nvalues) : 0.0;
+        enif_make_map_put(env, result, enif_make_atom(env, "median"), make_stat(env, total->nvalues, median),
+                          &result);
+    }
+    if (clip) {
+        size_t n = sigma_clip(total->values, total->nvalues, sigma, iterations);
+        stats_moments clipped;
+        chunk_moments(total->values, n, &clipped);
+        ERL_NIF_TERM clipped_map = make_moments_map(env, &clipped);
+        double median = n > 0 ? median_of(total->values, n) : 0.0;
+        enif_make_map_put(env, clipped_map, enif_make_atom(env, "median"), make_stat(env, n, median), &clipped_map);
+        enif_make_map_put(env, result, enif_make_atom(env, "clipped"), clipped_map, &result);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        free_band(&bands[i]);
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
@@ -0,0 +1,554 @@
+#include <erl_nif.h>
+#include <fitsio.h>
+#include <math.h>
+#include <string.h>
+
+// Upper bound on the threads of one reprojection
+#define MAX_REPROJECT_THREADS 32
+
+#define WCS_PI 3.14159265358979323846
+#define WCS_D2R (WCS_PI / 180.0)
+#define WCS_R2D (180.0 / WCS_PI)
+
+enum { WCS_TAN, WCS_SIN };
+
+// A celestial WCS of two axes, longitude first, in the zenithal projections
+// TAN and SIN: the reference point crval (degrees) at pixel crpix, and the
+// CD matrix from pixel offsets to intermediate world coordinates (degrees)
+// with its inverse. SIN is the plain orthographic form, without PV terms.
+typedef struct {
+    int projection;
+    double crval[2];
+    double crpix[2];
+    double cd[2][2];
+    double inv[2][2];
+    double lonpole;
+} wcs_params;
+
+static const char *wcs_projection_names[] = {"tan", "sin"};
+
+// Invert the CD matrix; 0 if it is singular
+static int wcs_invert(wcs_params *w) {
+    double det = w->cd[0][0] * w->cd[1][1] - w->cd[0][1] * w->cd[1][0];
+    if (det == 0.0 || det != det) {
+        return 0;
+    }
+    w->inv[0][0] = w->cd[1][1] / det;
+    w->inv[0][1] = -w->cd[0][1] / det;
+    w->inv[1][0] = -w->cd[1][0] / det;
+    w->inv[1][1] = w->cd[0][0] / det;
+    return 1;
+}
+
+// FITS pixel coordinates (1-based, pixel centers on integers) to world
+// coordinates in degrees, with the longitude in [0, 360). Returns 0 for
+// pixels outside the projection, which are left as NaN.
+static int wcs_pixel_to_world(const wcs_params *w, double px, double py, double *lon, double *lat) {
+    double dx = px - w->crpix[0], dy = py - w->crpix[1];
+    double x = w->cd[0][0] * dx + w->cd[0][1] * dy;
+    double y = w->cd[1][0] * dx + w->cd[1][1] * dy;
+    double r = sqrt(x * x + y * y);
+    double phi = r == 0.0 ? 0.0 : atan2(x, -y);
+    double st, ct;
+    *lon = *lat = NAN;
+    if (w->projection == WCS_TAN) {
+        double h = sqrt(WCS_R2D * WCS_R2D + r * r);
+        st = WCS_R2D / h;
+        ct = r / h;
+    } else {
+        ct = r * WCS_D2R;
+        if (ct > 1.0) {
+            return 0;
+        }
+        st = sqrt(1.0 - ct * ct);
+    }
+
+    // Native spherical to celestial, with the native pole at lonpole. Angles
+    // come from atan2 rather than asin, which loses precision near 90 degrees.
+    double d0 = w->crval[1] * WCS_D2R, dphi = phi - w->lonpole * WCS_D2R;
+    double sd0 = sin(d0), cd0 = cos(d0);
+    double a = -ct * sin(dphi), b = st * cd0 - ct * sd0 * cos(dphi);
+    *lat = atan2(st * sd0 + ct * cd0 * cos(dphi), sqrt(a * a + b * b)) * WCS_R2D;
+    *lon = w->crval[0] + atan2(a, b) * WCS_R2D;
+    *lon = fmod(*lon, 360.0);
+    if (*lon < 0.0) {
+        *lon += 360.0;
+    }
+    return 1;
+}
+
+// World coordinates in degrees to FITS pixel coordinates. Returns 0 for
+// points the projection does not reach (the far hemisphere, or beyond the
+// horizon of TAN), which are left as NaN.
+static int wcs_world_to_pixel(const wcs_params *w, double lon, double lat, double *px, double *py) {
+    double d0 = w->crval[1] * WCS_D2R, da = (lon - w->crval[0]) * WCS_D2R, d = lat * WCS_D2R;
+    double sd = sin(d), cd = cos(d), sd0 = sin(d0), cd0 = cos(d0);
+    double a = -cd * sin(da), b = sd * cd0 - cd * sd0 * cos(da);
+    double phi = w->lonpole * WCS_D2R + atan2(a, b);
+    // As above, theta is kept as its sine and cosine rather than asin'd
+    double sin_theta = sd * sd0 + cd * cd0 * cos(da), cos_theta = sqrt(a * a + b * b);
+    *px = *py = NAN;
+    double r;
+    if (w->projection == WCS_TAN) {
+        if (sin_theta <= 0.0) {
+            return 0;
+        }
+        r = WCS_R2D * cos_theta / sin_theta;
+    } else {
+        if (sin_theta < 0.0) {
+            return 0;
+        }
+        r = WCS_R2D * cos_theta;
+    }
+
+    double x = r * sin(phi), y = -r * cos(phi);
+    *px = w->inv[0][0] * x + w->inv[0][1] * y + w->crpix[0];
+    *py = w->inv[1][0] * x + w->inv[1][1] * y + w->crpix[1];
+    return 1;
+}
+
+// Read a double keyword, leaving *value alone when the keyword is absent
+static void read_wcs_key(fitsfile *fptr, const char *key, double *value, int *found, int *status) {
+    int key_status = 0;
+    double v;
+    fits_read_key(fptr, TDOUBLE, key, &v, NULL, &key_status);
+    if (key_status == 0) {
+        *value = v;
+        *found = 1;
+    } else if (key_status != KEY_NO_EXIST && key_status != VALUE_UNDEFINED) {
+        *status = key_status;
+    }
+}
+
+// Read the celestial WCS of the current HDU. The CD matrix is taken from
+// CDi_j, or built from PCi_j and CDELTi, or from CDELTi and CROTA2, the
+// order in which the FITS WCS papers rank them. Returns 0 if the header has
+// no TAN or SIN celestial WCS with longitude first; CFITSIO failures are
+// reported in status.
+static int read_wcs_params(fitsfile *fptr, wcs_params *w, int *status) {
+    char ctype[2][FLEN_VALUE];
+    for (int i = 0; i < 2; i++) {
+        int key_status = 0;
+        char key[FLEN_KEYWORD];
+        snprintf(key, sizeof(key), "CTYPE%d", i + 1);
+        if (fits_read_key(fptr, TSTRING, key, ctype[i], NULL, &key_status)) {
+            return 0;
+        }
+    }
+    // Longitude types are RA, GLON, ELON and the like; the latitude axis
+    // must pair with them and share the projection code
+    if (strlen(ctype[0]) < 8 || strlen(ctype[1]) < 8 || strncmp(ctype[0] + 4, ctype[1] + 4, 4) != 0 ||
+        strncmp(ctype[0], "DEC", 3) == 0 || strncmp(ctype[0] + 1, "LAT", 3) == 0 ||
+        (strncmp(ctype[1], "DEC", 3) != 0 && strncmp(ctype[1] + 1, "LAT", 3) != 0)) {
+        return 0;
+    }
+    if (strncmp(ctype[0] + 4, "-TAN", 4) == 0) {
+        w->projection = WCS_TAN;
+    } else if (strncmp(ctype[0] + 4, "-SIN", 4) == 0) {
+        w->projection = WCS_SIN;
+    } else {
+        return 0;
+    }
+
+    int found = 0, has_cd = 0, has_pc = 0;
+    w->crval[0] = w->crval[1] = 0.0;
+    w->crpix[0] = w->crpix[1] = 0.0;
+    w->lonpole = 180.0;
+    read_wcs_key(fptr, "CRVAL1", &w->crval[0], &found, status);
+    read_wcs_key(fptr, "CRVAL2", &w->crval[1], &found, status);
+    read_wcs_key(fptr, "CRPIX1", &w->crpix[0], &found, status);
+    read_wcs_key(fptr, "CRPIX2", &w->crpix[1], &found, status);
+    read_wcs_key(fptr, "LONPOLE", &w->lonpole, &found, status);
+
+    double pc[2][2] = {{1.0, 0.0}, {0.0, 1.0}}, cdelt[2] = {1.0, 1.0}, crota = 0.0;
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            char key[FLEN_KEYWORD];
+            w->cd[i][j] = 0.0;
+            snprintf(key, sizeof(key), "CD%d_%d", i + 1, j + 1);
+            read_wcs_key(fptr, key, &w->cd[i][j], &has_cd, status);
+            snprintf(key, sizeof(key), "PC%d_%d", i + 1, j + 1);
+            read_wcs_key(fptr, key, &pc[i][j], &has_pc, status);
+        }
+    }
+    read_wcs_key(fptr, "CDELT1", &cdelt[0], &found, status);
+    read_wcs_key(fptr, "CDELT2", &cdelt[1], &found, status);
+    read_wcs_key(fptr, "CROTA2", &crota, &found, status);
+    if (*status) {
+        return 0;
+    }
+
+    if (!has_cd && has_pc) {
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                w->cd[i][j] = cdelt[i] * pc[i][j];
+            }
+        }
+    } else if (!has_cd) {
+        double c = cos(crota * WCS_D2R), s = sin(crota * WCS_D2R);
+        w->cd[0][0] = cdelt[0] * c;
+        w->cd[0][1] = -cdelt[1] * s;
+        w->cd[1][0] = cdelt[0] * s;
+        w->cd[1][1] = cdelt[1] * c;
+    }
+    return wcs_invert(w);
+}
+
+static ERL_NIF_TERM make_wcs_pair(ErlNifEnv* env, const double v[2]) {
+    return enif_make_tuple2(env, enif_make_double(env, v[0]), enif_make_double(env, v[1]));
+}
+
+// %{projection, crval, crpix, cd, lonpole}, as ExFITS.WCS holds it
+static ERL_NIF_TERM make_wcs_map(ErlNifEnv* env, const wcs_params *w) {
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    enif_make_map_put(env, map, enif_make_atom(env, "projection"),
+                      enif_make_atom(env, wcs_projection_names[w->projection]), &map);
+    enif_make_map_put(env, map, enif_make_atom(env, "crval"), make_wcs_pair(env, w->crval), &map);
+    enif_make_map_put(env, map, enif_make_atom(env, "crpix"), make_wcs_pair(env, w->crpix), &map);
+    enif_make_map_put(env, map, enif_make_atom(env, "cd"),
+                      enif_make_tuple2(env, make_wcs_pair(env, w->cd[0]), make_wcs_pair(env, w->cd[1])), &map);
+    enif_make_map_put(env, map, enif_make_atom(env, "lonpole"), enif_make_double(env, w->lonpole), &map);
+    return map;
+}
+
+// A number from a float or an integer
+static int get_wcs_number(ErlNifEnv* env, ERL_NIF_TERM term, double *value) {
+    ErlNifSInt64 integer;
+    if (enif_get_double(env, term, value)) {
+        return 1;
+    }
+    if (enif_get_int64(env, term, &integer)) {
+        *value = (double)integer;
+        return 1;
+    }
+    return 0;
+}
+
+static int get_wcs_pair(ErlNifEnv* env, ERL_NIF_TERM term, double v[2]) {
+    int arity;
+    const ERL_NIF_TERM *elems;
+    return enif_get_tuple(env, term, &arity, &elems) && arity == 2 && get_wcs_number(env, elems[0], &v[0]) &&
+           get_wcs_number(env, elems[1], &v[1]);
+}
+
+// Parse a map from make_wcs_map, or an ExFITS.WCS struct, which is one
+static int get_wcs_params(ErlNifEnv* env, ERL_NIF_TERM term, wcs_params *w) {
+    ERL_NIF_TERM value;
+    const ERL_NIF_TERM *rows;
+    int arity;
+    char projection[8];
+    if (!enif_is_map(env, term) ||
+        !enif_get_map_value(env, term, enif_make_atom(env, "projection"), &value) ||
+        !enif_get_atom(env, value, projection, sizeof(projection), ERL_NIF_LATIN1)) {
+        return 0;
+    }
+    if (strcmp(projection, "tan") == 0) {
+        w->projection = WCS_TAN;
+    } else if (strcmp(projection, "sin") == 0) {
+        w->projection = WCS_SIN;
+    } else {
+        return 0;
+    }
+    w->lonpole = 180.0;
+    if (enif_get_map_value(env, term, enif_make_atom(env, "lonpole"), &value) &&
+        !enif_is_identical(value, enif_make_atom(env, "nil")) && !get_wcs_number(env, value, &w->lonpole)) {
+        return 0;
+    }
+    return enif_get_map_value(env, term, enif_make_atom(env, "crval"), &value) &&
+           get_wcs_pair(env, value, w->crval) &&
+           enif_get_map_value(env, term, enif_make_atom(env, "crpix"), &value) &&
+           get_wcs_pair(env, value, w->crpix) &&
+           enif_get_map_value(env, term, enif_make_atom(env, "cd"), &value) &&
+           enif_get_tuple(env, value, &arity, &rows) && arity == 2 && get_wcs_pair(env, rows[0], w->cd[0]) &&
+           get_wcs_pair(env, rows[1], w->cd[1]) && wcs_invert(w);
+}
+
+/**
+ * Reads the celestial WCS of an image HDU.
+ *
+ * Args:
+ *   - source: Path or handle
+ *   - options: Map with hdu (default: first image)
+ *
+ * Returns:
+ *   {:ok, %{projection, crval, crpix, cd, lonpole}}
+ *   {:error, :no_celestial_wcs} if the header has no TAN or SIN WCS
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM read_wcs(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[1], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    wcs_params w;
+    int found = read_wcs_params(src.fptr, &w, &status);
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    if (!found) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_celestial_wcs"));
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), make_wcs_map(env, &w));
+}
+
+/**
+ * Transforms a batch of coordinate pairs between pixel and world coordinates.
+ *
+ * Args:
+ *   - wcs: Map from read_wcs
+ *   - direction: :to_world or :to_pixel
+ *   - coords: Binary of native-endian float64 pairs, {x, y} or {lon, lat}
+ *
+ * Returns:
+ *   {:ok, binary} of as many pairs, NaN for points outside the projection
+ */
+static ERL_NIF_TERM wcs_transform(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    wcs_params w;
+    ErlNifBinary coords, out;
+    char direction[16];
+    if (!get_wcs_params(env, argv[0], &w) ||
+        !enif_get_atom(env, argv[1], direction, sizeof(direction), ERL_NIF_LATIN1) ||
+        (strcmp(direction, "to_world") != 0 && strcmp(direction, "to_pixel") != 0) ||
+        !enif_inspect_binary(env, argv[2], &coords) || coords.size % (2 * sizeof(double)) != 0) {
+        return enif_make_badarg(env);
+    }
+    if (!enif_alloc_binary(coords.size, &out)) {
+        return make_error_status(env, MEMORY_ALLOCATION);
+    }
+
+    int to_world = direction[3] == 'w';
+    size_t n = coords.size / (2 * sizeof(double));
+    double *result = (double*)out.data;
+    for (size_t i = 0; i < n; i++) {
+        double a, b;
+        // Sub-binaries need not be aligned for a double load
+        memcpy(&a, coords.data + 2 * i * sizeof(double), sizeof(double));
+        memcpy(&b, coords.data + (2 * i + 1) * sizeof(double), sizeof(double));
+        if (to_world) {
+            wcs_pixel_to_world(&w, a, b, &result[2 * i], &result[2 * i + 1]);
+        } else {
+            wcs_world_to_pixel(&w, a, b, &result[2 * i], &result[2 * i + 1]);
+        }
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), enif_make_binary(env, &out));
+}
+
+// One thread's share of a reprojection: output rows first..last, each pixel
+// mapped through the target WCS to the sky and back through the source's
+// into the source pixels held in image (width x height, whose first pixel
+// is source pixel (x0, y0)), and sampled there.
+typedef struct {
+    const wcs_params *target;
+    const wcs_params *source;
+    const double *image;
+    long width;
+    long height;
+    long x0;
+    long y0;
+    long out_width;
+    long first;
+    long last;
+    int nearest;
+    float *out;
+} reproject_worker;
+
+// Sample the source at 0-based position (x, y) in the image held. Bilinear
+// sampling needs the four pixels around it; within half a pixel of the edge
+// the nearest pixel is used. NaN off the image, or where a pixel used is NaN.
+static double sample_image(const reproject_worker *worker, double x, double y) {
+    if (!(x > -0.5 && y > -0.5 && x < worker->width - 0.5 && y < worker->height - 0.5)) {
+        return NAN;
+    }
+    long ix = (long)floor(x), iy = (long)floor(y);
+    if (worker->nearest || ix < 0 || iy < 0 || ix + 1 >= worker->width || iy + 1 >= worker->height) {
+        return worker->image[lround(y) * worker->width + lround(x)];
+    }
+    double fx = x - ix, fy = y - iy;
+    const double *p = worker->image + iy * worker->width + ix;
+    return (p[0] * (1.0 - fx) + p[1] * fx) * (1.0 - fy) +
+           (p[worker->width] * (1.0 - fx) + p[worker->width + 1] * fx) * fy;
+}
+
+static void *reproject_rows(void *arg) {
+    reproject_worker *worker = (reproject_worker*)arg;
+    for (long row = worker->first; row < worker->last; row++) {
+        float *out = worker->out + row * worker->out_width;
+        for (long col = 0; col < worker->out_width; col++) {
+            double lon, lat, sx, sy;
+            double value = NAN;
+            if (wcs_pixel_to_world(worker->target, col + 1.0, row + 1.0, &lon, &lat) &&
+                wcs_world_to_pixel(worker->source, lon, lat, &sx, &sy)) {
+                value = sample_image(worker, sx - worker->x0, sy - worker->y0);
+            }
+            out[col] = (float)value;
+        }
+    }
+    return NULL;
+}
+
+// Extend the box lo..hi of source pixels to hold where output pixel (px, py)
+// lands; 0 if it lands outside the source projection
+static int grow_footprint(const wcs_params *target, const wcs_params *source, double px, double py,
+                          double lo[2], double hi[2]) {
+    double lon, lat, sx, sy;
+    if (!wcs_pixel_to_world(target, px, py, &lon, &lat) || !wcs_world_to_pixel(source, lon, lat, &sx, &sy)) {
+        return 0;
+    }
+    lo[0] = sx < lo[0] ? sx : lo[0];
+    lo[1] = sy < lo[1] ? sy : lo[1];
+    hi[0] = sx > hi[0] ? sx : hi[0];
+    hi[1] = sy > hi[1] ? sy : hi[1];
+    return 1;
+}
+
+/**
+ * Reprojects the first plane of an image onto a target WCS and shape, for
+ * mosaicking images onto a common grid. Only the source pixels under the
+ * edges of the output, as mapped through both WCS, are read; the rows of
+ * the output are then divided among threads.
+ *
+ * Args:
+ *   - source: Path or handle
+ *   - wcs: Map from read_wcs giving the target grid
+ *   - shape: {height, width} of the output, in Nx order
+ *   - options: Map of options:
+ *       hdu: HDU number or EXTNAME (default: first image)
+ *       interpolation: :bilinear (default) or :nearest
+ *       threads: Threads computing the output (default 1)
+ *
+ * Returns:
+ *   {:ok, {shape, binary}} of float32 pixels, NaN where the source does not
+ *   cover the output
+ *   {:error, :no_celestial_wcs} if the source has no TAN or SIN WCS
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM reproject(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    wcs_params target, source;
+    const ERL_NIF_TERM *dims;
+    int arity, threads = 1;
+    ErlNifSInt64 out_height, out_width;
+    char interpolation[16] = "bilinear";
+    if (!get_wcs_params(env, argv[1], &target) || !enif_get_tuple(env, argv[2], &arity, &dims) || arity != 2 ||
+        !enif_get_int64(env, dims[0], &out_height) || !enif_get_int64(env, dims[1], &out_width) ||
+        out_height < 1 || out_width < 1 || !enif_is_map(env, argv[3])) {
+        return enif_make_badarg(env);
+    }
+    get_atom_option(env, argv[3], "interpolation", interpolation, sizeof(interpolation));
+    get_int_option(env, argv[3], "threads", &threads);
+    if ((strcmp(interpolation, "bilinear") != 0 && strcmp(interpolation, "nearest") != 0) || threads < 1) {
+        return enif_make_badarg(env);
+    }
+    if (threads > MAX_REPROJECT_THREADS) {
+        threads = MAX_REPROJECT_THREADS;
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!open_image_at(env, argv[0], argv[3], &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis = 0;
+    LONGLONG naxes[MAX_NAXIS];
+    int found = !get_image_shape(src.fptr, &naxis, naxes, &status) && read_wcs_params(src.fptr, &source, &status);
+    if (status || !found || naxis < 2) {
+        close_source(&src, &status);
+        if (status) {
+            return make_error_status(env, status);
+        }
+        return enif_make_tuple2(env, enif_make_atom(env, "error"),
+                                enif_make_atom(env, found ? "no_image_data" : "no_celestial_wcs"));
+    }
+
+    // Bound the source pixels needed by mapping the edges of the output; if
+    // any edge pixel misses the source projection, read the whole plane
+    double lo[2] = {INFINITY, INFINITY}, hi[2] = {-INFINITY, -INFINITY};
+    int bounded = 1;
+    for (ErlNifSInt64 col = 1; col <= out_width && bounded; col++) {
+        bounded = grow_footprint(&target, &source, (double)col, 1.0, lo, hi) &&
+                  grow_footprint(&target, &source, (double)col, (double)out_height, lo, hi);
+    }
+    for (ErlNifSInt64 row = 2; row < out_height && bounded; row++) {
+        bounded = grow_footprint(&target, &source, 1.0, (double)row, lo, hi) &&
+                  grow_footprint(&target, &source, (double)out_width, (double)row, lo, hi);
+    }
+    long fpixel[MAX_NAXIS], lpixel[MAX_NAXIS], inc[MAX_NAXIS];
+    for (int i = 0; i < naxis; i++) {
+        fpixel[i] = 1;
+        lpixel[i] = i < 2 ? (long)naxes[i] : 1;
+        inc[i] = 1;
+    }
+    for (int i = 0; i < 2 && bounded; i++) {
+        // One pixel of margin for the bilinear neighbours
+        double first = floor(lo[i]) - 1.0, last = ceil(hi[i]) + 1.0;
+        fpixel[i] = first < 1.0 ? 1 : first > (double)naxes[i] ? (long)naxes[i] + 1 : (long)first;
+        lpixel[i] = last > (double)naxes[i] ? (long)naxes[i] : last < 1.0 ? 0 : (long)last;
+    }
+    int covered = fpixel[0] <= lpixel[0] && fpixel[1] <= lpixel[1];
+
+    reproject_worker base = {&target, &source, NULL, lpixel[0] - fpixel[0] + 1, lpixel[1] - fpixel[1] + 1,
+                             fpixel[0], fpixel[1], (long)out_width, 0, 0,
+                             strcmp(interpolation, "nearest") == 0, NULL};
+    size_t npixels = (size_t)out_width * (size_t)out_height;
+    double *image = covered ? enif_alloc((size_t)base.width * (size_t)base.height * sizeof(double)) : NULL;
+    pixel_buffer bin_pixels;
+    if ((covered && image == NULL) || !alloc_pixel_buffer(npixels * sizeof(float), &bin_pixels)) {
+        enif_free(image);
+        close_source(&src, &status);
+        return make_error_status(env, MEMORY_ALLOCATION);
+    }
+    if (covered) {
+        double nulval = NAN;
+        int anynul;
+        fits_read_subset(src.fptr, TDOUBLE, fpixel, lpixel, inc, &nulval, image, &anynul, &status);
+    }
+    close_source(&src, &status);
+    if (status) {
+        enif_free(image);
+        release_pixel_buffer(&bin_pixels);
+        return make_error_status(env, status);
+    }
+
+    base.image = image;
+    base.out = (float*)bin_pixels.data;
+    if (!covered) {
+        for (size_t i = 0; i < npixels; i++) {
+            base.out[i] = NAN;
+        }
+    } else {
+        int nworkers = threads > out_height ? (int)out_height : threads;
+        reproject_worker workers[MAX_REPROJECT_THREADS];
+        ErlNifTid tids[MAX_REPROJECT_THREADS];
+        int threaded[MAX_REPROJECT_THREADS] = {0};
+        for (int i = 0; i < nworkers; i++) {
+            workers[i] = base;
+            workers[i].first = (long)(out_height * i / nworkers);
+            workers[i].last = (long)(out_height * (i + 1) / nworkers);
+        }
+        for (int i = 1; i < nworkers; i++) {
+            threaded[i] = enif_thread_create("exfits_reproject", &tids[i], reproject_rows, &workers[i], NULL) == 0;
+        }
+        reproject_rows(&workers[0]);
+        for (int i = 1; i < nworkers; i++) {
+            if (threaded[i]) {
+                enif_thread_join(tids[i], NULL);
+            } else {
+                reproject_rows(&workers[i]);
+            }
+        }
+    }
+    enif_free(image);
+
+    LONGLONG out_naxes[2] = {out_width, out_height};
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"),
+                            enif_make_tuple2(env, make_shape(env, 2, out_naxes), make_pixel_binary(env, &bin_pixels)));
+}
@@ -1,56 +1,314 @@
 #include <erl_nif.h>
 #include <fitsio.h>
-#include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
 
-// Function to debug binary float data
-static void debug_float_data(void* data, size_t nbytes, const char* label) {
-    if (data == NULL) {
-        fprintf(stderr, "ERROR: %s - data pointer is NULL\n", label);
-        return;
+// Skip structural keywords that CFITSIO already wrote for the new HDU
+static int is_structural_key(const char *key) {
+    const char* skip_keys[] = {"SIMPLE", "XTENSION", "BITPIX", "NAXIS", "PCOUNT", "GCOUNT", "END", NULL};
+    for (int i = 0; skip_keys[i] != NULL; i++) {
+        if (strcmp(key, skip_keys[i]) == 0) {
+            return 1;
+        }
     }
-    
-    fprintf(stderr, "=== Debugging %s ===\n", label);
-    fprintf(stderr, "Memory address: %p, Size: %zu bytes\n", data, nbytes);
-    
-    // Print first few values as floats
-    float* fdata = (float*)data;
-    size_t nvalues = nbytes / sizeof(float);
-    size_t max_display = nvalues < 10 ? nvalues : 10;
-    
-    fprintf(stderr, "First %zu float values:\n", max_display);
-    for (size_t i = 0; i < max_display; i++) {
-        fprintf(stderr, "[%zu]: %f\n", i, fdata[i]);
+    // NAXIS1, NAXIS2, ... for any number of axes
+    if (strncmp(key, "NAXIS", 5) == 0 && key[5] >= '0' && key[5] <= '9') {
+        return 1;
     }
-    
-    // Print as bytes for binary inspection
-    unsigned char* bdata = (unsigned char*)data;
-    fprintf(stderr, "First 40 bytes in hex:\n");
-    for (size_t i = 0; i < 40 && i < nbytes; i++) {
-        fprintf(stderr, "%02x ", bdata[i]);
-        if ((i+1) % 4 == 0) fprintf(stderr, " "); // Group by 4 bytes (float32)
-        if ((i+1) % 16 == 0) fprintf(stderr, "\n");
-    }
-    fprintf(stderr, "\n");
-    
-    // Check for all zeros
-    size_t zero_count = 0;
-    for (size_t i = 0; i < nbytes; i++) {
-        if (bdata[i] == 0) zero_count++;
+    return 0;
+}
+
+// Scaling keywords go in after the pixels, so the given pixel values are
+// stored unchanged rather than scaled by CFITSIO; everything else is written
+// first, before the data unit exists
+static int header_pass_of(const char *key) {
+    return strcmp(key, "BSCALE") == 0 || strcmp(key, "BZERO") == 0 ? HEADER_AFTER_DATA : HEADER_BEFORE_DATA;
+}
+
+// Copy a binary or charlist into buf, truncating it to fit
+static int get_header_text(ErlNifEnv *env, ERL_NIF_TERM term, char *buf, size_t size) {
+    ErlNifBinary bin;
+    if (enif_inspect_binary(env, term, &bin)) {
+        size_t len = bin.size < size - 1 ? bin.size : size - 1;
+        memcpy(buf, bin.data, len);
+        buf[len] = '\0';
+        return 1;
     }
-    
-    if (zero_count == nbytes) {
-        fprintf(stderr, "WARNING: All bytes are zero!\n");
+    return enif_get_string(env, term, buf, (unsigned)size, ERL_NIF_LATIN1) > 0;
+}
+
+// A keyword given as an atom or a binary
+static int get_key_text(ErlNifEnv *env, ERL_NIF_TERM term, char *buf, size_t size) {
+    ErlNifBinary bin;
+    if (enif_inspect_binary(env, term, &bin)) {
+        if (bin.size >= size) {
+            return 0;
+        }
+        memcpy(buf, bin.data, bin.size);
+        buf[bin.size] = '\0';
+        return 1;
+    }
+    return enif_get_atom(env, term, buf, (unsigned)size, ERL_NIF_LATIN1) > 0;
+}
+
+// Append a keyword without searching the header, or update it in place
+static void put_key(fitsfile *fptr, int append, int datatype, const char *key, void *value,
+                    const char *comment, int *status) {
+    if (append) {
+        fits_write_key(fptr, datatype, key, value, comment, status);
     } else {
-        float zero_percent = ((float)zero_count / nbytes) * 100.0;
-        fprintf(stderr, "Zero bytes: %zu/%zu (%.2f%%)\n", zero_count, nbytes, zero_percent);
+        fits_update_key(fptr, datatype, key, value, comment, status);
+    }
+}
+
+// Write one keyword from a term: an integer, float, string (binary or
+// charlist), boolean, or nil for an undefined value. Returns 0 for any other
+// term; CFITSIO failures are reported in status.
+static int write_card_value(ErlNifEnv *env, fitsfile *fptr, const char *key, ERL_NIF_TERM value,
+                            const char *comment, int append, int *status) {
+    long ival;
+    double dval;
+    char value_str[FLEN_VALUE];
+    if (enif_get_long(env, value, &ival)) {
+        put_key(fptr, append, TLONG, key, &ival, comment, status);
+    } else if (enif_get_double(env, value, &dval)) {
+        put_key(fptr, append, TDOUBLE, key, &dval, comment, status);
+    } else if (enif_is_identical(value, enif_make_atom(env, "true")) ||
+               enif_is_identical(value, enif_make_atom(env, "false"))) {
+        int logical = enif_is_identical(value, enif_make_atom(env, "true"));
+        put_key(fptr, append, TLOGICAL, key, &logical, comment, status);
+    } else if (enif_is_identical(value, enif_make_atom(env, "nil"))) {
+        if (append) {
+            fits_write_key_null(fptr, key, comment, status);
+        } else {
+            fits_update_key_null(fptr, key, comment, status);
+        }
+    } else if ((enif_is_binary(env, value) || enif_is_list(env, value)) &&
+               get_header_text(env, value, value_str, sizeof(value_str))) {
+        put_key(fptr, append, TSTRING, key, value_str, comment, status);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Helper function to write a header map of keyword atoms to values into the
+// current HDU, updating keywords that already exist. pass selects the
+// keywords to write (see HEADER_BEFORE_DATA). Returns 0 if the map cannot be
+// iterated.
+static int write_header_map(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM header_map, int pass) {
+    // Get iterator for the header map
+    ErlNifMapIterator iter;
+    if (!enif_map_iterator_create(env, header_map, &iter, ERL_NIF_MAP_ITERATOR_FIRST)) {
+        return 0;
     }
     
-    fprintf(stderr, "=== End debug %s ===\n\n", label);
+    // Iterate through all header cards
+    do {
+        ERL_NIF_TERM key, value;
+        if (!enif_map_iterator_get_pair(env, &iter, &key, &value)) {
+            continue;
+        }
+        
+        // Get key as a string
+        char key_str[FLEN_KEYWORD];
+        if (!enif_get_atom(env, key, key_str, sizeof(key_str), ERL_NIF_LATIN1)) {
+            continue;
+        }
+        
+        if (is_structural_key(key_str) || !(header_pass_of(key_str) & pass)) {
+            continue;
+        }
+        
+        // Non-critical errors in individual header updates don't stop the
+        // process, so key_status is deliberately not propagated, and values
+        // of other types are skipped
+        int key_status = 0;
+        write_card_value(env, fptr, key_str, value, NULL, 0, &key_status);
+    } while (enif_map_iterator_next(env, &iter));
+    
+    enif_map_iterator_destroy(env, &iter);
+    return 1;
+}
+
+// The keywords of a header with their record numbers, sorted for lookup, so
+// updating a header from a card list reads it once instead of searching it
+// once per card: an existing keyword is reached by moving straight to its
+// record. Cards are only ever appended or modified in place, so the record
+// numbers stay valid while the list is written.
+typedef struct {
+    char key[FLEN_KEYWORD];
+    int pos;
+} header_key;
+
+typedef struct {
+    header_key *keys;
+    int count;
+    int capacity;
+} key_set;
+
+static int compare_keys(const void *a, const void *b) {
+    return strcasecmp(((const header_key *)a)->key, ((const header_key *)b)->key);
+}
+
+static int load_key_set(fitsfile *fptr, key_set *set, int *status) {
+    int nkeys, keypos;
+    set->keys = NULL;
+    set->count = 0;
+    set->capacity = 0;
+    if (fits_get_hdrpos(fptr, &nkeys, &keypos, status) || nkeys == 0) {
+        return *status;
+    }
+    set->keys = enif_alloc((size_t)nkeys * sizeof(header_key));
+    if (set->keys == NULL) {
+        return *status = MEMORY_ALLOCATION;
+    }
+    set->capacity = nkeys;
+    for (int i = 1; i <= nkeys; i++) {
+        char card[FLEN_CARD];
+        int keylen, key_status = 0;
+        if (fits_read_record(fptr, i, card, status)) {
+            return *status;
+        }
+        if (fits_get_keyname(card, set->keys[set->count].key, &keylen, &key_status) == 0) {
+            set->keys[set->count++].pos = i;
+        }
+    }
+    qsort(set->keys, set->count, sizeof(header_key), compare_keys);
+    return *status;
+}
+
+static const header_key *find_key(const key_set *set, const char *key) {
+    header_key probe;
+    if (set->count == 0) {
+        return NULL;
+    }
+    strncpy(probe.key, key, FLEN_KEYWORD - 1);
+    probe.key[FLEN_KEYWORD - 1] = '\0';
+    return bsearch(&probe, set->keys, set->count, sizeof(header_key), compare_keys);
+}
+
+// Record a keyword just appended as the header's last record, so a later
+// card with the same keyword updates it instead of adding a second one
+static void add_appended_key(fitsfile *fptr, key_set *set, const char *key, int *status) {
+    int nkeys, keypos;
+    if (*status || fits_get_hdrpos(fptr, &nkeys, &keypos, status)) {
+        return;
+    }
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 16;
+        header_key *keys = enif_realloc(set->keys, (size_t)capacity * sizeof(header_key));
+        if (keys == NULL) {
+            *status = MEMORY_ALLOCATION;
+            return;
+        }
+        set->keys = keys;
+        set->capacity = capacity;
+    }
+    int at = set->count;
+    while (at > 0 && strcasecmp(set->keys[at - 1].key, key) > 0) {
+        at--;
+    }
+    memmove(&set->keys[at + 1], &set->keys[at], (size_t)(set->count - at) * sizeof(header_key));
+    strncpy(set->keys[at].key, key, FLEN_KEYWORD - 1);
+    set->keys[at].key[FLEN_KEYWORD - 1] = '\0';
+    set->keys[at].pos = nkeys;
+    set->count++;
+}
+
+static void free_key_set(key_set *set) {
+    if (set->keys != NULL) {
+        enif_free(set->keys);
+    }
+}
+
+// Write an ordered list of header cards in one pass. Each element is a raw
+// card binary, {key, value}, {key, value, comment}, or {:COMMENT, text} /
+// {:HISTORY, text}; keys are atoms or binaries and values are as for
+// write_card_value. Keywords already in the header, including ones earlier
+// in the list, are updated in place and the rest appended; with append set
+// (a freshly created HDU) the header is not read first. COMMENT and HISTORY
+// cards are always appended. pass selects the keywords to write. Returns 0
+// for a malformed element.
+static int write_card_list(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM cards, int append, int pass,
+                           int *status) {
+    key_set existing = {NULL, 0, 0};
+    if (!append && load_key_set(fptr, &existing, status)) {
+        free_key_set(&existing);
+        return 1;
+    }
+
+    int ok = 1;
+    ERL_NIF_TERM head, tail = cards;
+    while (!*status && enif_get_list_cell(env, tail, &head, &tail)) {
+        char key[FLEN_KEYWORD], text[FLEN_CARD], comment[FLEN_COMMENT];
+        int arity, keylen, key_status = 0;
+        const ERL_NIF_TERM *elems;
+        const header_key *found;
+
+        if (enif_is_binary(env, head)) {
+            // A raw card, written as given
+            get_header_text(env, head, text, sizeof(text));
+            if (fits_get_keyname(text, key, &keylen, &key_status) || is_structural_key(key) ||
+                !(header_pass_of(key) & pass)) {
+                continue;
+            }
+            if (key[0] == '\0' || strcmp(key, "COMMENT") == 0 || strcmp(key, "HISTORY") == 0) {
+                fits_write_record(fptr, text, &key_status);
+            } else if ((found = find_key(&existing, key)) != NULL) {
+                // Start the keyword search at its record
+                fits_movabs_key(fptr, found->pos, &key_status);
+                fits_update_card(fptr, key, text, &key_status);
+            } else if (!fits_write_record(fptr, text, &key_status)) {
+                add_appended_key(fptr, &existing, key, status);
+            }
+            continue;
+        }
+
+        if (!enif_get_tuple(env, head, &arity, &elems) || arity < 2 || arity > 3 ||
+            !get_key_text(env, elems[0], key, sizeof(key)) ||
+            (arity == 3 && !get_header_text(env, elems[2], comment, sizeof(comment)))) {
+            ok = 0;
+            break;
+        }
+        if (is_structural_key(key) || !(header_pass_of(key) & pass)) {
+            continue;
+        }
+        if (strcmp(key, "COMMENT") == 0 || strcmp(key, "HISTORY") == 0) {
+            if (!get_header_text(env, elems[1], text, sizeof(text))) {
+                ok = 0;
+                break;
+            }
+            if (key[0] == 'C') {
+                fits_write_comment(fptr, text, &key_status);
+            } else {
+                fits_write_history(fptr, text, &key_status);
+            }
+            continue;
+        }
+        found = find_key(&existing, key);
+        if (found != NULL) {
+            fits_movabs_key(fptr, found->pos, &key_status);
+        }
+        // As with maps, a card CFITSIO rejects is skipped rather than failing
+        // the whole header
+        if (!write_card_value(env, fptr, key, elems[1], arity == 3 ? comment : NULL, found == NULL,
+                              &key_status)) {
+            ok = 0;
+            break;
+        }
+        if (found == NULL && !key_status) {
+            add_appended_key(fptr, &existing, key, status);
+        }
+    }
+    free_key_set(&existing);
+    return ok;
 }
 
-// Helper function to write header cards to a FITS file
-static int write_header_to_fits(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM headers, int *status) {
+// Helper function to write a list of raw 80-character header cards to a FITS
+// file. pass selects the keywords to write.
+static int write_header_to_fits(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM headers, int pass, int *status) {
     unsigned int num_cards;
     if (!enif_get_list_length(env, headers, &num_cards)) {
         return 0;
@@ -63,7 +321,14 @@ static int write_header_to_fits(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM hea
         }
 
         char card[81];
-        if (enif_get_string(env, head, card, sizeof(card), ERL_NIF_LATIN1)) {
+        if (get_header_text(env, head, card, sizeof(card))) {
+            // CFITSIO writes the structural keywords and END itself
+            char key[FLEN_KEYWORD];
+            int keylen, key_status = 0;
+            if (fits_get_keyname(card, key, &keylen, &key_status) == 0 &&
+                (is_structural_key(key) || !(header_pass_of(key) & pass))) {
+                continue;
+            }
             fits_write_record(fptr, card, status);
             if (*status) {
                 return 0;
@@ -76,51 +341,68 @@ static int write_header_to_fits(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM hea
     return 1;
 }
 
+// Number of cards a header map or card list will add, for fits_set_hdrsize
+static int header_card_count(ErlNifEnv *env, ERL_NIF_TERM header) {
+    size_t map_size;
+    unsigned int length;
+    if (header && enif_get_map_size(env, header, &map_size)) {
+        return (int)map_size;
+    }
+    if (header && enif_get_list_length(env, header, &length)) {
+        return (int)length;
+    }
+    return 0;
+}
+
+// Write part of a new HDU's header from a map or an ordered card list
+// (header) and a list of raw cards (cards); either may be 0. Returns 0 if
+// either is malformed.
+static int write_new_header(ErlNifEnv *env, fitsfile *fptr, ERL_NIF_TERM header, ERL_NIF_TERM cards,
+                            int pass, int *status) {
+    if (header && enif_is_map(env, header) && !write_header_map(env, fptr, header, pass)) {
+        return 0;
+    }
+    if (header && !enif_is_map(env, header) && !write_card_list(env, fptr, header, 1, pass, status)) {
+        return 0;
+    }
+    if (cards && !write_header_to_fits(env, fptr, cards, pass, status) && !*status) {
+        return 0;
+    }
+    return 1;
+}
+
 /**
- * Writes a FITS file from Elixir data.
- * 
- * This function handles both single and multi-extension FITS files.
- * It supports various data types and can handle 2D and 3D arrays.
+ * Writes a 2D float32 image and its header in a single operation.
  * 
  * Args:
- *   - filename: Path to output FITS file
- *   - data: List of image data (for multi-extension) or a single image tensor
- *   - headers: List of header card lists (for multi-extension) or a single list of header cards
- *   - bitpix: FITS BITPIX value (-32 for float, 16 for INT16, etc.)
- *   - options: Optional map with additional settings
- *   - multi: Boolean flag indicating if this is a multi-extension file (true) or single (false)
+ *   - target: Path to create (replacing any existing file) or a writable handle
+ *   - data: Binary of native-endian float32 pixels
+ *   - width, height: Image dimensions
+ *   - bitpix: (Optional) FITS BITPIX value to store the pixels as (default -32)
+ *   - header: (Optional) Map of header keywords to values, or an ordered card list
+ *   - options: (Optional) Map of tile compression options, as for write_array
  * 
  * Returns:
- *   {:ok, filename} on success
+ *   :ok on success
  *   {:error, reason} on failure
  */
 // writes both image data and header
 static ERL_NIF_TERM write_fits_file(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
-    char filename[1024];
-    ErlNifBinary bin_filename, bin_data;
+    ErlNifBinary bin_data;
     long width, height;
     int bitpix = FLOAT_IMG; // Default to float
     
-    // Check arguments (filename, data, width, height, [optional]bitpix, [optional]header)
-    if (argc < 4 || argc > 6) {
+    // Check arguments (filename, data, width, height, [optional]bitpix, [optional]header,
+    // [optional]compression options)
+    if (argc < 4 || argc > 7) {
         return enif_make_badarg(env);
     }
     
-    // Get filename
-    if (!enif_inspect_binary(env, argv[0], &bin_filename) || bin_filename.size >= sizeof(filename)) {
-        return enif_make_badarg(env);
-    }
-    memcpy(filename, bin_filename.data, bin_filename.size);
-    filename[bin_filename.size] = '\0';
-    
     // Get pixel data
     if (!enif_inspect_binary(env, argv[1], &bin_data)) {
         return enif_make_badarg(env);
     }
     
-    // Debug the binary data
-    debug_float_data(bin_data.data, bin_data.size, "input data");
-    
     // Get width and height
     if (!enif_get_long(env, argv[2], &width) || !enif_get_long(env, argv[3], &height)) {
         return enif_make_badarg(env);
@@ -139,8 +421,8 @@ static ERL_NIF_TERM write_fits_file(ErlNifEnv* env, int argc, const ERL_NIF_TERM
     ERL_NIF_TERM header_map = 0;
     int has_header = 0;
     
-    if (argc == 6) {
-        if (!enif_is_map(env, argv[5])) {
+    if (argc >= 6) {
+        if (!enif_is_map(env, argv[5]) && !enif_is_list(env, argv[5])) {
             return enif_make_badarg(env);
         }
         header_map = argv[5];
@@ -149,160 +431,547 @@ static ERL_NIF_TERM write_fits_file(ErlNifEnv* env, int argc, const ERL_NIF_TERM
     
     // Validate dimensions for float data (4 bytes per value)
     if (width * height * sizeof(float) != bin_data.size) {
-        fprintf(stderr, "ERROR: Dimensions mismatch - width=%ld, height=%ld, expected bytes=%ld, actual bytes=%zu\n",
-                width, height, width * height * sizeof(float), bin_data.size);
         return enif_make_tuple2(env, enif_make_atom(env, "error"), 
                                enif_make_atom(env, "dimensions_mismatch"));
     }
     
-    // Print debugging info
-    fprintf(stderr, "Creating FITS file: %s\n", filename);
-    fprintf(stderr, "Dimensions: %ldx%ld (%ld pixels)\n", width, height, width * height);
-    fprintf(stderr, "BITPIX: %d\n", bitpix);
-    
-    // Create a copy of the data that we can work with safely
-    float *pixels = (float *)malloc(bin_data.size);
-    if (pixels == NULL) {
-        fprintf(stderr, "Failed to allocate memory for pixel data\n");
-        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
-                               enif_make_atom(env, "memory_allocation_failure"));
-    }
-    memcpy(pixels, bin_data.data, bin_data.size);
-    
-    // Debug the copied data to make sure it's good
-    debug_float_data(pixels, bin_data.size, "copied data");
-    
-    // Create the new FITS file
-    fitsfile *fptr;
+    // Create the new FITS file, replacing any existing file with the same
+    // name, or append a new image HDU to a handle
+    fits_source src;
     int status = 0;
     long naxes[2] = {width, height};
+    if (!create_source(env, argv[0], 1, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    fitsfile *fptr = src.fptr;
     
-    // Remove any existing file with the same name
-    remove(filename);
-    
-    // Create the file
-    if (fits_create_file(&fptr, filename, &status)) {
-        char error_text[FLEN_STATUS];
-        fits_get_errstatus(status, error_text);
-        fprintf(stderr, "Error creating FITS file: %s (status=%d)\n", error_text, status);
-        free(pixels);
+    if (status) {
         return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
     }
     
-    // Create image with the specified bitpix
-    if (fits_create_img(fptr, bitpix, 2, naxes, &status)) {
-        char error_text[FLEN_STATUS];
-        fits_get_errstatus(status, error_text);
-        fprintf(stderr, "Error creating image: %s (status=%d)\n", error_text, status);
-        fits_close_file(fptr, &status);
-        free(pixels);
+    // Create image with the specified bitpix, tile-compressed if requested
+    int compressed = 0;
+    if (argc == 7 && (!enif_is_map(env, argv[6]) ||
+                      !begin_compression(env, fptr, argv[6], 2, &compressed, &status))) {
+        end_compression(fptr, compressed);
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+    fits_create_img(fptr, bitpix, 2, naxes, &status);
+    end_compression(fptr, compressed);
+    if (status) {
+        close_source(&src, &status);
         return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
     }
     
+    // Write the header before the pixels, into space reserved up front, so the
+    // data unit is never moved to make room for more header blocks
+    if (has_header) {
+        fits_set_hdrsize(fptr, header_card_count(env, header_map), &status);
+        if (!write_new_header(env, fptr, header_map, 0, HEADER_BEFORE_DATA, &status)) {
+            close_source(&src, &status);
+            return enif_make_badarg(env);
+        }
+    }
+    
     // Write pixel data
-    long fpixel[2] = {1, 1}; // FITS uses 1-based indexing
     long npixels = width * height;
+    LONGLONG band = compressed ? tile_rows_of(fptr, 2) * width : 1;
     
-    // Always write data as float (TFLOAT) since that's what we have from Elixir
-    fprintf(stderr, "Writing %ld pixels as TFLOAT\n", npixels);
-    
-    if (fits_write_pix(fptr, TFLOAT, fpixel, npixels, pixels, &status)) {
-        char error_text[FLEN_STATUS];
-        fits_get_errstatus(status, error_text);
-        fprintf(stderr, "Error writing pixels: %s (status=%d)\n", error_text, status);
-        fits_close_file(fptr, &status);
-        free(pixels);
+    // Always write data as float (TFLOAT) since that's what we have from Elixir.
+    // The binary is staged in bounded chunks rather than copied whole.
+    if (status || write_pixels_in_bands(fptr, TFLOAT, sizeof(float), bin_data.data, npixels, band, &status)) {
+        close_source(&src, &status);
         return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
     }
     
-    // Free the pixel data since we're done with it
-    free(pixels);
-    
-    // Write header cards if provided
+    // Scaling keywords go in last
     if (has_header) {
-        // Skip certain keywords that we shouldn't modify
-        const char* skip_keys[] = {"SIMPLE", "BITPIX", "NAXIS", "NAXIS1", "NAXIS2", "NAXIS3", "END", NULL};
-        
-        // Get iterator for the header map
-        ErlNifMapIterator iter;
-        if (!enif_map_iterator_create(env, header_map, &iter, ERL_NIF_MAP_ITERATOR_FIRST)) {
-            fits_close_file(fptr, &status);
-            return enif_make_badarg(env);
-        }
-        
-        fprintf(stderr, "Writing header cards\n");
-        
-        // Iterate through all header cards
-        do {
-            ERL_NIF_TERM key, value;
-            if (!enif_map_iterator_get_pair(env, &iter, &key, &value)) {
-                continue;
-            }
-            
-            // Get key as a string
-            char key_str[FLEN_KEYWORD];
-            if (!enif_get_atom(env, key, key_str, sizeof(key_str), ERL_NIF_LATIN1)) {
-                continue;
-            }
-            
-            // Skip structural keywords
-            int skip = 0;
-            for (int i = 0; skip_keys[i] != NULL; i++) {
-                if (strcmp(key_str, skip_keys[i]) == 0) {
-                    skip = 1;
-                    break;
-                }
-            }
-            if (skip) {
-                fprintf(stderr, "Skipping header key: %s\n", key_str);
-                continue;
-            }
-            
-            // Update header based on value type
-            int key_status = 0; // Separate status for each key update
-            if (enif_is_number(env, value)) {
-                double dval;
-                long ival;
-                
-                if (enif_get_long(env, value, &ival)) {
-                    // Integer value
-                    fprintf(stderr, "Updating header key %s = %ld (integer)\n", key_str, ival);
-                    fits_update_key(fptr, TLONG, key_str, &ival, NULL, &key_status);
-                } else if (enif_get_double(env, value, &dval)) {
-                    // Double value
-                    fprintf(stderr, "Updating header key %s = %f (double)\n", key_str, dval);
-                    fits_update_key(fptr, TDOUBLE, key_str, &dval, NULL, &key_status);
-                }
-            } else if (enif_is_binary(env, value) || enif_is_list(env, value)) {
-                // String value - could be binary or char list
-                char value_str[FLEN_VALUE];
-                if (enif_get_string(env, value, value_str, sizeof(value_str), ERL_NIF_LATIN1) > 0) {
-                    fprintf(stderr, "Updating header key %s = '%s' (string)\n", key_str, value_str);
-                    fits_update_key(fptr, TSTRING, key_str, value_str, NULL, &key_status);
-                }
-            }
-            
-            // Non-critical errors in individual header updates don't stop the process
-            if (key_status) {
-                char error_text[FLEN_STATUS];
-                fits_get_errstatus(key_status, error_text);
-                fprintf(stderr, "Warning: Failed to update header key '%s': %s (%d)\n", 
-                        key_str, error_text, key_status);
-            }
-        } while (enif_map_iterator_next(env, &iter));
-        
-        enif_map_iterator_destroy(env, &iter);
+        write_new_header(env, fptr, header_map, 0, HEADER_AFTER_DATA, &status);
     }
     
     // Close file and return result
-    fits_close_file(fptr, &status);
+    close_source(&src, &status);
     if (status) {
-        char error_text[FLEN_STATUS];
-        fits_get_errstatus(status, error_text);
-        fprintf(stderr, "Error closing file: %s (status=%d)\n", error_text, status);
         return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_int(env, status));
     }
     
-    fprintf(stderr, "Successfully wrote FITS file: %s\n", filename);
+    return enif_make_atom(env, "ok");
+}
+
+// Parse a shape tuple in Nx order into FITS axis lengths, NAXIS1 first
+static int get_shape_tuple(ErlNifEnv* env, ERL_NIF_TERM term, int *naxis, LONGLONG naxes[MAX_NAXIS]) {
+    int arity;
+    const ERL_NIF_TERM *dims;
+    if (!enif_get_tuple(env, term, &arity, &dims) || arity < 1 || arity > MAX_NAXIS) {
+        return 0;
+    }
+    // FITS stores the fastest-varying axis first, the reverse of Nx
+    for (int i = 0; i < arity; i++) {
+        ErlNifSInt64 dim;
+        if (!enif_get_int64(env, dims[i], &dim) || dim < 1) {
+            return 0;
+        }
+        naxes[arity - 1 - i] = dim;
+    }
+    *naxis = arity;
+    return 1;
+}
+
+// Append an empty image HDU and write the part of its header that goes before
+// the data, from a map or ordered card list and/or a list of raw cards (either
+// may be 0), with room for extra_cards more. compress_opts is a map of tile
+// compression options (see begin_compression) or 0. Sets *band to the pixels
+// in one row of tiles for a compressed image, 1 otherwise. Returns 0 if a
+// header or compression argument is malformed; CFITSIO failures are reported
+// in status.
+static int create_image_hdu(ErlNifEnv* env, fitsfile *fptr, int naxis, LONGLONG naxes[], int bitpix,
+                            ERL_NIF_TERM header_map, ERL_NIF_TERM cards, ERL_NIF_TERM compress_opts,
+                            int extra_cards, LONGLONG *band, int *status) {
+    int compressed = 0;
+    if (compress_opts && !begin_compression(env, fptr, compress_opts, naxis, &compressed, status)) {
+        end_compression(fptr, compressed);
+        return 0;
+    }
+    // The compression settings only apply when the HDU is created
+    fits_create_imgll(fptr, bitpix, naxis, naxes, status);
+    end_compression(fptr, compressed);
+
+    if (*status) {
+        return 1;
+    }
+
+    fits_set_hdrsize(fptr, header_card_count(env, header_map) + header_card_count(env, cards) + extra_cards,
+                     status);
+    *band = compressed ? tile_rows_of(fptr, naxis) * (count_pixels(naxis, naxes) / naxes[naxis - 1]) : 1;
+    return write_new_header(env, fptr, header_map, cards, HEADER_BEFORE_DATA, status);
+}
+
+// Append an image HDU holding the given pixels, with its header from a map or
+// ordered card list and/or a list of raw cards (either may be 0). The header
+// space is reserved and filled before the pixels are written. compress_opts
+// is a map of tile compression options (see begin_compression) or 0. Returns 0
+// if a header or compression argument is malformed; CFITSIO failures are
+// reported in status.
+static int write_image_hdu(ErlNifEnv* env, fitsfile *fptr, const ErlNifBinary *data, int naxis,
+                           LONGLONG naxes[], const pixel_type *type, int bitpix,
+                           ERL_NIF_TERM header_map, ERL_NIF_TERM cards, ERL_NIF_TERM compress_opts,
+                           int *status) {
+    // One extra card leaves room for the EXTNAME write_extensions adds
+    LONGLONG band;
+    if (!create_image_hdu(env, fptr, naxis, naxes, bitpix, header_map, cards, compress_opts, 1, &band, status)) {
+        return 0;
+    }
+    if (*status ||
+        write_pixels_in_bands(fptr, type->datatype, type->size, data->data,
+                              count_pixels(naxis, naxes), band, status)) {
+        return 1;
+    }
+    return write_new_header(env, fptr, header_map, cards, HEADER_AFTER_DATA, status);
+}
+
+/**
+ * Writes an image with any number of axes, plus optional header cards.
+ *
+ * Args:
+ *   - target: Path to create (replacing any existing file) or a writable handle
+ *   - data: Binary of pixels in row-major order
+ *   - shape: Tuple of dimensions in Nx order ({NAXISn, ..., NAXIS1})
+ *   - type: Nx type of the pixels in data, e.g. {:f, 32} or {:u, 16}
+ *   - bitpix: FITS BITPIX value to store the pixels as
+ *   - header: Map of header cards, or an ordered card list (may be empty)
+ *   - options: (Optional) Map of tile compression options: compress (:rice,
+ *     :gzip, :gzip2, :hcompress, :plio or :none), tile (Nx order),
+ *     quantize_level and hcomp_scale
+ *
+ * Returns:
+ *   :ok on success
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM write_array(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary bin_data;
+    int naxis, bitpix;
+    LONGLONG naxes[MAX_NAXIS];
+    pixel_type type;
+    if (!enif_inspect_binary(env, argv[1], &bin_data) ||
+        !get_shape_tuple(env, argv[2], &naxis, naxes) ||
+        !pixel_type_for_nx(env, argv[3], &type) ||
+        !enif_get_int(env, argv[4], &bitpix) ||
+        !(enif_is_map(env, argv[5]) || enif_is_list(env, argv[5])) ||
+        (argc == 7 && !enif_is_map(env, argv[6]))) {
+        return enif_make_badarg(env);
+    }
+    if ((size_t)count_pixels(naxis, naxes) * type.size != bin_data.size) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), 
+                               enif_make_atom(env, "dimensions_mismatch"));
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!create_source(env, argv[0], 1, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    if (!write_image_hdu(env, src.fptr, &bin_data, naxis, naxes, &type, bitpix, argv[5], 0,
+                         argc == 7 ? argv[6] : 0, &status)) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_atom(env, "ok");
+}
+
+// Fetch a required key from an extension description map
+static int get_ext_value(ErlNifEnv* env, ERL_NIF_TERM ext, const char *key, ERL_NIF_TERM *value) {
+    return enif_get_map_value(env, ext, enif_make_atom(env, key), value);
+}
+
+/**
+ * Writes a multi-extension FITS file in a single open.
+ *
+ * Args:
+ *   - target: Path to create (replacing any existing file) or a writable handle
+ *   - primary_header: Map of header cards, or an ordered card list, for the
+ *     empty primary HDU
+ *   - extensions: List of maps, one per image extension, with keys
+ *       data, shape (Nx order), type (Nx type of data), bitpix, and
+ *       optionally header (map or ordered card list), cards (list of raw
+ *       header cards), extname
+ *       and the tile compression options taken by write_array
+ *
+ * A path always gets an empty primary HDU first; a handle only gets one if
+ * its file has no HDUs yet, otherwise the extensions are appended.
+ *
+ * Returns:
+ *   :ok on success
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM write_extensions(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    unsigned int next;
+    if (!(enif_is_map(env, argv[1]) || enif_is_list(env, argv[1])) ||
+        !enif_get_list_length(env, argv[2], &next)) {
+        return enif_make_badarg(env);
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!create_source(env, argv[0], 1, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int nhdus = 0;
+    fits_get_num_hdus(src.fptr, &nhdus, &status);
+    if (!status && nhdus == 0) {
+        fits_create_img(src.fptr, BYTE_IMG, 0, NULL, &status);
+        if (!status && !write_new_header(env, src.fptr, argv[1], 0, HEADER_ALL, &status)) {
+            close_source(&src, &status);
+            return enif_make_badarg(env);
+        }
+    }
+
+    ERL_NIF_TERM head, tail = argv[2];
+    while (!status && enif_get_list_cell(env, tail, &head, &tail)) {
+        ERL_NIF_TERM data_term, shape_term, type_term, bitpix_term, header, cards, extname;
+        ErlNifBinary bin_data;
+        int naxis, bitpix;
+        LONGLONG naxes[MAX_NAXIS];
+        pixel_type type;
+        if (!enif_is_map(env, head) ||
+            !get_ext_value(env, head, "data", &data_term) || !enif_inspect_binary(env, data_term, &bin_data) ||
+            !get_ext_value(env, head, "shape", &shape_term) || !get_shape_tuple(env, shape_term, &naxis, naxes) ||
+            !get_ext_value(env, head, "type", &type_term) || !pixel_type_for_nx(env, type_term, &type) ||
+            !get_ext_value(env, head, "bitpix", &bitpix_term) || !enif_get_int(env, bitpix_term, &bitpix)) {
+            close_source(&src, &status);
+            return enif_make_badarg(env);
+        }
+        if ((size_t)count_pixels(naxis, naxes) * type.size != bin_data.size) {
+            close_source(&src, &status);
+            return enif_make_tuple2(env, enif_make_atom(env, "error"), 
+                                   enif_make_atom(env, "dimensions_mismatch"));
+        }
+        if (!get_ext_value(env, head, "header", &header)) {
+            header = enif_make_new_map(env);
+        }
+        if (!get_ext_value(env, head, "cards", &cards)) {
+            cards = 0;
+        }
+
+        if (!write_image_hdu(env, src.fptr, &bin_data, naxis, naxes, &type, bitpix, header, cards, head, &status)) {
+            close_source(&src, &status);
+            return enif_make_badarg(env);
+        }
+
+        char extname_str[FLEN_VALUE];
+        if (!status && get_ext_value(env, head, "extname", &extname) &&
+            get_filename(env, extname, extname_str, sizeof(extname_str))) {
+            fits_update_key(src.fptr, TSTRING, "EXTNAME", extname_str, NULL, &status);
+        }
+    }
+
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_atom(env, "ok");
+}
+
+// Apply header edits from a map or an ordered card list to an HDU whose
+// header already exists. Returns 0 if the edits are malformed.
+static int edit_header(ErlNifEnv* env, fitsfile *fptr, ERL_NIF_TERM edits, int *status) {
+    if (enif_is_map(env, edits)) {
+        return write_header_map(env, fptr, edits, HEADER_ALL);
+    }
+    return write_card_list(env, fptr, edits, 0, HEADER_ALL, status);
+}
+
+/**
+ * Copies every HDU of a FITS file block for block, without decoding any
+ * pixels, so integer and tile-compressed data are copied exactly.
+ *
+ * Args:
+ *   - source: Path to the FITS file to copy, or a handle
+ *   - target: Path to create (replacing any existing file) or a writable handle
+ *     to append the HDUs to, other than the source handle
+ *   - options: Map with optional header (map or ordered card list of edits)
+ *     and hdu (1-based number or EXTNAME of the HDU the edits apply to,
+ *     default 1)
+ *
+ * Returns:
+ *   :ok on success
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM copy_file(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ERL_NIF_TERM edits = 0, value;
+    int edit_hdu = 1;
+    if (!enif_is_map(env, argv[2])) {
+        return enif_make_badarg(env);
+    }
+    if (enif_get_map_value(env, argv[2], enif_make_atom(env, "header"), &value)) {
+        if (!enif_is_map(env, value) && !enif_is_list(env, value)) {
+            return enif_make_badarg(env);
+        }
+        edits = value;
+    }
+
+    if (has_repeated_handle(env, argv, 2)) {
+        return enif_make_badarg(env);
+    }
+
+    // Resolve the hdu option as the readers do, so an EXTNAME names the HDU
+    // to edit as well as a number
+    fits_source in, out;
+    int status = 0;
+    if (!open_source_at(env, argv[0], argv[2], READONLY, &in, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+    if (enif_get_map_value(env, argv[2], enif_make_atom(env, "hdu"), &value) &&
+        !enif_is_identical(value, enif_make_atom(env, "nil"))) {
+        fits_get_hdu_num(in.fptr, &edit_hdu);
+    }
+    if (!create_source(env, argv[1], 1, &out, &status)) {
+        close_source(&in, &status);
+        return enif_make_badarg(env);
+    }
+
+    int nhdus = 0, valid = 1;
+    fits_get_num_hdus(in.fptr, &nhdus, &status);
+    for (int i = 1; i <= nhdus && !status && valid; i++) {
+        fits_movabs_hdu(in.fptr, i, NULL, &status);
+        if (edits == 0 || i != edit_hdu) {
+            fits_copy_hdu(in.fptr, out.fptr, 0, &status);
+            continue;
+        }
+        // Edit the header between copying it and copying the data unit, while
+        // it can still grow without moving any data
+        fits_copy_header(in.fptr, out.fptr, &status);
+        if (!status) {
+            valid = edit_header(env, out.fptr, edits, &status);
+        }
+        fits_copy_data(in.fptr, out.fptr, &status);
+    }
+
+    close_source(&out, &status);
+    close_source(&in, &status);
+    if (!valid) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_atom(env, "ok");
+}
+
+/**
+ * Starts an image HDU whose pixels are written afterwards, a chunk at a time,
+ * with write_image_chunk, so the whole image never has to be in memory.
+ *
+ * Args:
+ *   - target: Writable handle to append the HDU to (or a path to create)
+ *   - shape: Tuple of dimensions in Nx order ({NAXISn, ..., NAXIS1})
+ *   - bitpix: FITS BITPIX value to store the pixels as
+ *   - header: Map of header cards, or an ordered card list (may be empty).
+ *     BSCALE and BZERO are only written by finish_image.
+ *   - options: Map of tile compression options, as for write_array, plus
+ *     reserve_cards (header space kept free for finish_image, default 36)
+ *
+ * Returns:
+ *   {:ok, band} where band is the number of pixels chunks of a compressed
+ *     image must be a multiple of (1 when uncompressed)
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM begin_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    int naxis, bitpix, reserve_cards = 36;
+    LONGLONG naxes[MAX_NAXIS];
+    if (!get_shape_tuple(env, argv[1], &naxis, naxes) ||
+        !enif_get_int(env, argv[2], &bitpix) ||
+        !(enif_is_map(env, argv[3]) || enif_is_list(env, argv[3])) ||
+        !enif_is_map(env, argv[4])) {
+        return enif_make_badarg(env);
+    }
+    get_int_option(env, argv[4], "reserve_cards", &reserve_cards);
+
+    fits_source src;
+    int status = 0;
+    if (!create_source(env, argv[0], 1, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    LONGLONG band = 1;
+    if (!create_image_hdu(env, src.fptr, naxis, naxes, bitpix, argv[3], 0, argv[4], reserve_cards, &band,
+                          &status)) {
+        close_source(&src, &status);
+        return enif_make_badarg(env);
+    }
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), enif_make_int64(env, band));
+}
+
+/**
+ * Writes one chunk of pixels into the image HDU a handle is positioned on,
+ * straight to the file.
+ *
+ * Args:
+ *   - target: Handle positioned on the image, as left by begin_image
+ *   - firstelem: 1-based index, in file order, of the chunk's first pixel
+ *   - data: Binary of pixels in row-major order
+ *   - type: Nx type of the pixels in data
+ *
+ * Returns:
+ *   :ok on success
+ *   {:error, :out_of_bounds} if the chunk runs past the end of the image
+ *   {:error, :unaligned_chunk} if a compressed image's chunk does not start
+ *     on, and cover whole, rows of tiles (except at the end)
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM write_image_chunk(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifSInt64 firstelem;
+    ErlNifBinary bin_data;
+    pixel_type type;
+    if (!enif_get_int64(env, argv[1], &firstelem) || firstelem < 1 ||
+        !enif_inspect_binary(env, argv[2], &bin_data) ||
+        !pixel_type_for_nx(env, argv[3], &type) ||
+        bin_data.size % type.size != 0) {
+        return enif_make_badarg(env);
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!open_source(env, argv[0], READWRITE, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int naxis;
+    LONGLONG naxes[MAX_NAXIS];
+    LONGLONG npixels = bin_data.size / type.size;
+    get_image_shape(src.fptr, &naxis, naxes, &status);
+    if (status) {
+        close_source(&src, &status);
+        return make_error_status(env, status);
+    }
+    LONGLONG total = count_pixels(naxis, naxes);
+    if (naxis == 0 || firstelem - 1 + npixels > total) {
+        close_source(&src, &status);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "out_of_bounds"));
+    }
+
+    LONGLONG band = fits_is_compressed_image(src.fptr, &status) ?
+                    tile_rows_of(src.fptr, naxis) * (total / naxes[naxis - 1]) : 1;
+    if ((firstelem - 1) % band != 0 || (npixels % band != 0 && firstelem - 1 + npixels != total)) {
+        close_source(&src, &status);
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "unaligned_chunk"));
+    }
+
+    write_pixels_at(src.fptr, type.datatype, type.size, bin_data.data, firstelem, npixels, band, &status);
+    // Hand the chunk to the OS now rather than when CFITSIO's buffers are
+    // next reused, so it reaches disk while later chunks are produced
+    fits_flush_buffer(src.fptr, 0, &status);
+    close_source(&src, &status);
+    if (status) {
+        return make_error_status(env, status);
+    }
+    return enif_make_atom(env, "ok");
+}
+
+/**
+ * Completes an image started with begin_image: writes the scaling keywords of
+ * its original header, now that the pixels are stored, then any final header
+ * edits such as the exposure end time.
+ *
+ * Args:
+ *   - target: Handle positioned on the image
+ *   - header: The header given to begin_image
+ *   - edits: Map or ordered card list of cards to add or update (may be empty)
+ *
+ * Returns:
+ *   :ok on success
+ *   {:error, reason} on failure
+ */
+static ERL_NIF_TERM finish_image(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (!(enif_is_map(env, argv[1]) || enif_is_list(env, argv[1])) ||
+        !(enif_is_map(env, argv[2]) || enif_is_list(env, argv[2]))) {
+        return enif_make_badarg(env);
+    }
+
+    fits_source src;
+    int status = 0;
+    if (!open_source(env, argv[0], READWRITE, &src, &status)) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
+
+    int valid = write_new_header(env, src.fptr, argv[1], 0, HEADER_AFTER_DATA, &status);
+    if (valid && !status) {
+        valid = edit_header(env, src.fptr, argv[2], &status);
+    }
+    close_source(&src, &status);
+    if (!valid) {
+        return enif_make_badarg(env);
+    }
+    if (status) {
+        return make_error_status(env, status);
+    }
     return enif_make_atom(env, "ok");
 }
@@ -31,7 +31,10 @@ defmodule ExFITS do
   ```
   """
 
+  alias ExFITS.HeaderCache
   alias ExFITS.NIF
+  alias ExFITS.Telemetry
+  alias ExFITS.WCS
 
   @doc """
   Open a FITS file to verify it exists and is a valid FITS file.
@@ -50,11 +53,72 @@ defmodule ExFITS do
   end
 
   @doc """
-  Read image data from a FITS file.
+  Open a FITS file and return a handle that can be passed to the read, write
+  and header functions in place of a path.
+
+  The file stays open until close/1 is called or the handle is garbage
+  collected, so repeated operations skip reopening the file and re-parsing
+  its header. A handle may be shared between processes; calls on it are
+  serialised.
 
   ## Parameters
 
   - path: Path to the FITS file
+  - options: Keyword list of options:
+    - mode: :read (default), :readwrite, or :create to create a new file
+
+  ## Returns
+
+  - {:ok, handle} on success
+  - {:error, status} on failure
+  """
+  def open(path, options) when is_binary(path) and is_list(options) do
+    mode = Keyword.get(options, :mode, :read)
+    Telemetry.span(:open, :open, path, 0, fn -> NIF.open_handle(path, mode) end)
+  end
+
+  @doc """
+  Close a handle returned by open/2.
+
+  ## Returns
+
+  - :ok on success
+  - {:error, status} on failure
+  """
+  def close(handle) when is_reference(handle) do
+    NIF.close_handle(handle)
+  end
+
+  @doc """
+  Open a FITS file, pass the handle to `fun`, and close it afterwards.
+
+  ## Parameters
+
+  - path: Path to the FITS file
+  - options: Options for open/2
+  - fun: Function receiving the handle
+
+  ## Returns
+
+  - The result of `fun`
+  - {:error, status} if the file could not be opened
+  """
+  def with_handle(path, options \\ [], fun) when is_binary(path) and is_function(fun, 1) do
+    with {:ok, handle} <- open(path, options) do
+      try do
+        fun.(handle)
+      after
+        close(handle)
+      end
+    end
+  end
+
+  @doc """
+  Read image data from a FITS file.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
 
   ## Returns
 
@@ -62,15 +126,508 @@ defmodule ExFITS do
   - {:ok, data} when using older NIF version (for backward compatibility)
   - {:error, status} on failure
   """
-  def read_image(path) when is_binary(path) do
-    case NIF.read_image(path) do
-      {:ok, {width, height, data}} when is_integer(width) and is_integer(height) and is_binary(data) ->
-        {:ok, {width, height, data}}
-      {:ok, data} when is_binary(data) ->
-        # Handle backward compatibility
-        IO.puts("Warning: Using older NIF version without dimension information")
-        {:ok, data}
-      error -> error
+  def read_image(path) when is_binary(path) or is_reference(path) do
+    Telemetry.span(:read, :read_image, path, fn ->
+      case NIF.read_image(path) do
+        {:ok, {width, height, data}} when is_integer(width) and is_integer(height) and is_binary(data) ->
+          {:ok, {width, height, data}}
+        {:ok, data} when is_binary(data) ->
+          # Handle backward compatibility
+          {:ok, data}
+        error -> error
+      end
+    end)
+  end
+
+  @doc """
+  Read image data from a FITS file in a selectable pixel type.
+
+  With `type: :native` the pixels are returned in the file's own BITPIX type
+  instead of being converted to float32, so 16-bit frames stay 2 bytes per
+  pixel. The returned type is an Nx type such as `{:u, 16}`.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - options: Keyword list of options:
+    - type: :float (default) or :native
+    - scale: Apply BZERO/BSCALE in :native mode (default: true). With scaling,
+      unsigned data stored with the usual BZERO offset comes back as {:u, 16},
+      {:u, 32} or {:u, 64}; without it the raw stored integers are returned.
+    - hdu: HDU to read, as a 1-based number or an EXTNAME string (default: the
+      primary HDU for a path, the handle's current HDU for a handle; a handle
+      stays on the selected HDU afterwards). Without it, an HDU with no image
+      data, such as the empty primary HDU of a `.fits.fz` file, is skipped in
+      favour of the next image HDU.
+    - threads: Number of native threads used to decompress a tile-compressed
+      image (default: 1). Each thread decodes a band of tiles through its
+      own file open, which pays off for large images read one at a time.
+
+  ## Returns
+
+  - {:ok, {width, height, data, type}} on success
+  - {:error, status} on failure
+  """
+  def read_image(path, options) when (is_binary(path) or is_reference(path)) and is_list(options) do
+    Telemetry.span(:read, :read_image, path, fn -> NIF.read_image(path, Map.new(options)) end)
+  end
+
+  @doc """
+  Read an image with any number of axes from a FITS file.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - options: Keyword list of options, as for read_image/2:
+    - type: :float (default) or :native
+    - scale: Apply BZERO/BSCALE in :native mode (default: true)
+    - hdu: HDU number or EXTNAME to read
+    - threads: Decompression threads for tile-compressed images
+
+  ## Returns
+
+  - {:ok, %{shape: shape, data: data, type: type}} where shape is in Nx order
+    (`{NAXISn, ..., NAXIS1}`) and type is the Nx type of the pixels in data
+  - {:error, :no_image_data} if the HDU has NAXIS = 0
+  - {:error, status} on failure
+  """
+  def read_array(path, options \\ []) when (is_binary(path) or is_reference(path)) and is_list(options) do
+    Telemetry.span(:read, :read_array, path, fn ->
+      with {:ok, {shape, data, type}} <- NIF.read_array(path, Map.new(options)) do
+        {:ok, %{shape: shape, data: data, type: type}}
+      end
+    end)
+  end
+
+  @doc """
+  Map the pixels of an uncompressed image straight from the file.
+
+  Nothing is read up front: the returned binary is backed by a read-only
+  memory mapping of the image's data region, so pages are loaded on first
+  access and shared, through the page cache, by every process mapping the
+  same file. The mapping lives as long as the binary (or any sub-binary of
+  it) is referenced.
+
+  The pixels are the stored values exactly as in the file, which means big-endian
+  and without BZERO/BSCALE applied. Use convert_pixels/4 with
+  `byte_order: :big` for a native-endian copy. The file must not be
+  truncated or rewritten while it is mapped.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a read-only handle from open/2
+  - options: Keyword list of options
+    - hdu: HDU number or EXTNAME to map (default: the first image HDU with data)
+
+  ## Returns
+
+  - {:ok, %{shape: shape, data: data, type: type, byte_order: :big, bscale: bscale, bzero: bzero}}
+    with shape in Nx order and type the Nx type of the stored values
+  - {:error, :not_mappable} for tile-compressed images, files that are not
+    plain disk files (e.g. gzipped) and writable handles
+  - {:error, :no_image_data} if the HDU has NAXIS = 0
+  - {:error, reason} on failure
+
+  ## Example
+
+      {:ok, bias} = ExFITS.map_array("calib/bias.fits")
+      {:ok, pixels} = ExFITS.convert_pixels(bias.data, bias.type, {:f, 32}, byte_order: :big)
+  """
+  def map_array(path, options \\ []) when (is_binary(path) or is_reference(path)) and is_list(options) do
+    Telemetry.span(:read, :map_array, path, 0, fn ->
+      with {:ok, {shape, data, type, {bscale, bzero}}} <- NIF.map_image(path, Map.new(options)) do
+        {:ok, %{shape: shape, data: data, type: type, byte_order: :big, bscale: bscale, bzero: bzero}}
+      end
+    end)
+  end
+
+  @doc """
+  Read a rectangular section of an image, optionally with a stride.
+
+  Only the part of the file covering the section is read and decoded; for
+  tile-compressed images only the overlapping tiles are decompressed.
+  Coordinates follow the FITS convention used by CFITSIO image sections:
+  1-based, inclusive, and in FITS axis order (`{x, y, ...}`, NAXIS1 first).
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - start: Tuple with the first pixel of the section on each axis
+  - stop: Tuple with the last pixel of the section on each axis
+  - step: Tuple with the stride on each axis (default: 1 on every axis)
+  - options: Keyword list of options, as for read_image/2
+
+  ## Returns
+
+  - {:ok, %{shape: shape, data: data, type: type}} as for read_array/2
+  - {:error, :invalid_section} if the section lies outside the image
+  - {:error, status} on failure
+
+  ## Example
+
+      # 256x256 postage stamp with its lower-left corner at pixel (1000, 2000)
+      ExFITS.read_section("frame.fits", {1000, 2000}, {1255, 2255})
+  """
+  def read_section(path, start, stop, step \\ nil, options \\ [])
+      when (is_binary(path) or is_reference(path)) and is_tuple(start) and is_tuple(stop) do
+    step = step || Tuple.duplicate(1, tuple_size(start))
+
+    Telemetry.span(:read, :read_section, path, fn ->
+      with {:ok, {shape, data, type}} <- NIF.read_section(path, start, stop, step, Map.new(options)) do
+        {:ok, %{shape: shape, data: data, type: type}}
+      end
+    end)
+  end
+
+  @doc """
+  Report how the NIF library was built and what it found at load time.
+
+  ## Returns
+
+  A map of:
+
+  - mode: :release or :debug, from the build (see the README)
+  - simd: SIMD level the conversion and statistics kernels use: :avx2,
+    :ssse3, :neon or :none
+  - cfitsio_version: Version of the CFITSIO library linked in
+  - reentrant: Whether that CFITSIO was built thread-safe; when it was not,
+    the native thread pools and multi-threaded reads use one thread
+  """
+  def build_info, do: NIF.build_info()
+
+  @doc """
+  Compute statistics of an image, or a section of one, without building the
+  pixels in Elixir.
+
+  The pixels are read in chunks and reduced natively on a dirty scheduler:
+  one streaming pass gives the count, min, max, mean and standard deviation.
+  NaN and BLANK pixels are skipped and counted as nulls. The median and
+  sigma clipping need the valid pixels kept in native memory, and so does a
+  histogram without a range (it is binned over min..max after the pass).
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - options: Keyword list of options:
+    - hdu: HDU number or EXTNAME (default: first image)
+    - start, stop: Tuples of 1-based inclusive pixel coordinates of a
+      section, as for read_section/5 (default: the whole image)
+    - median: Also compute the median (default: false)
+    - clip: Sigma-clip around the median at this many standard deviations
+    - clip_iterations: Most clipping iterations (default: 5)
+    - histogram: Number of histogram bins (default: no histogram)
+    - range: {lo, hi} range of the histogram (default: {min, max})
+    - threads: Threads reducing bands of rows in parallel, each with its own
+      file handle; used for uncompressed or compressed files on disk opened
+      read-only (default: 1)
+
+  ## Returns
+
+  - {:ok, stats} with count, nulls, min, max, mean and stddev, plus median,
+    clipped (count, mean, median and stddev after clipping) and histogram
+    (counts and range) when requested; statistics of no pixels are nil.
+    Infinite pixels are counted, so a statistic they reach is :infinity,
+    :neg_infinity or :nan, as in binary_to_lists/3
+  - {:error, :invalid_section} if the section lies outside the image
+  - {:error, reason} on failure
+
+  ## Example
+
+      {:ok, %{median: sky, clipped: %{stddev: noise}}} = ExFITS.stats("frame.fits", median: true, clip: 3.0)
+  """
+  def stats(path, options \\ []) when (is_binary(path) or is_reference(path)) and is_list(options) do
+    Telemetry.span(:read, :stats, path, fn ->
+      NIF.image_stats(path, Map.new(options))
+    end)
+  end
+
+  @doc """
+  Combine frames of the same shape pixel by pixel into a new image, as for a
+  master bias, dark or flat.
+
+  The frames are read together in strips of whole rows, and each strip is
+  combined natively across frames and written out before the next is read.
+  Memory is bounded by the strip size times the number of frames rather
+  than the size of every image. NaN and BLANK pixels are left out of the
+  combination; a pixel with no valid values is NaN, or BLANK in an integer
+  result. That BLANK is the header's when it sets one, else the most
+  negative value of a signed type or the largest of an unsigned one. The
+  result records the number of frames in NCOMBINE.
+
+  ## Parameters
+
+  - paths: List of paths, or handles from open/2, of the frames
+  - target: Path of the file to create (replacing any existing one), or a
+    writable handle to append the result to
+  - options: Keyword list of options:
+    - method: :median, :mean or :sigma_clip, the mean of the values left
+      after sigma-clipping around their median (default: :median)
+    - sigma: Clipping threshold in standard deviations (default: 3.0)
+    - iterations: Most clipping iterations (default: 5)
+    - hdu: HDU number or EXTNAME to read in every frame (default: first image)
+    - strip_rows: Rows per strip (default: 64 MiB of strips in all)
+    - threads: Threads combining each strip (default: schedulers online)
+    - bitpix: FITS BITPIX value of the result (default: -32)
+    - header: Map of header cards, or an ordered card list as for
+      write_header/3, for the result (default: none)
+
+  ## Returns
+
+  - :ok on success
+  - {:error, :shape_mismatch} if the frames differ in shape
+  - {:error, reason} on failure
+
+  ## Example
+
+      :ok = ExFITS.combine(Path.wildcard("bias/*.fits"), "master_bias.fits", method: :sigma_clip)
+  """
+  def combine(paths, target, options \\ []) when is_list(paths) and (is_binary(target) or is_reference(target)) do
+    options =
+      options
+      |> Keyword.put_new_lazy(:threads, &System.schedulers_online/0)
+      |> Keyword.update(:sigma, 3.0, &(&1 * 1.0))
+      |> Map.new()
+
+    Telemetry.span(:write, :combine, target, 0, fn ->
+      NIF.combine_frames(paths, target, options)
+    end)
+  end
+
+  # Points sampled around the edge of a sky region to bound it in pixels
+  @region_samples 64
+
+  @doc """
+  Read the pixels of an image within a radius of a sky position.
+
+  The circle is mapped through the image's celestial WCS (see
+  `ExFITS.WCS`) by sampling its edge, and only the section of pixels that
+  bounds it is read, as by read_section/5. Pixels outside the circle but
+  inside the section are returned too. For images with more than two axes,
+  the section is taken from the first plane.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - ra, dec: Center of the region in degrees
+  - radius: Radius of the region in degrees
+  - options: Keyword list of options, as for read_section/5
+
+  ## Returns
+
+  - {:ok, %{shape: shape, data: data, type: type, origin: {x, y}, wcs: wcs}}
+    where origin is the 1-based pixel of the section's first pixel in the
+    image and wcs is the image's WCS shifted to the section
+  - {:error, :outside_image} if the region does not overlap the image
+  - {:error, :outside_projection} if part of the region is beyond the
+    projection's reach
+  - {:error, :no_celestial_wcs} if the image has no TAN or SIN WCS
+  - {:error, reason} on failure
+
+  ## Example
+
+      # Cutout of one arcminute around M31
+      {:ok, %{data: data, wcs: wcs}} = ExFITS.read_sky_region("field.fits", 10.6847, 41.2690, 1 / 60)
+  """
+  def read_sky_region(path, ra, dec, radius, options \\ [])
+      when (is_binary(path) or is_reference(path)) and is_number(ra) and is_number(dec) and is_number(radius) and
+             radius > 0 do
+    Telemetry.span(:read, :read_sky_region, path, fn ->
+      if is_binary(path) do
+        with_handle(path, [], &sky_region(&1, ra, dec, radius, options))
+      else
+        sky_region(path, ra, dec, radius, options)
+      end
+    end)
+  end
+
+  defp sky_region(handle, ra, dec, radius, options) do
+    hdu_options = Map.new(Keyword.take(options, [:hdu]))
+
+    with {:ok, wcs} <- NIF.read_wcs(handle, hdu_options),
+         {:ok, shape} <- NIF.image_shape(handle, hdu_options),
+         {:ok, first, last} <- sky_region_box(struct!(WCS, wcs), shape, ra, dec, radius),
+         step = Tuple.duplicate(1, tuple_size(first)),
+         {:ok, {shape, data, type}} <- NIF.read_section(handle, first, last, step, Map.new(options)) do
+      {x0, y0} = {elem(first, 0), elem(first, 1)}
+      {cx, cy} = wcs.crpix
+      section_wcs = struct!(WCS, %{wcs | crpix: {cx - x0 + 1, cy - y0 + 1}})
+      {:ok, %{shape: shape, data: data, type: type, origin: {x0, y0}, wcs: section_wcs}}
+    end
+  end
+
+  # First and last pixels of the section holding the circle, NAXIS1 first.
+  # Pixel n covers n - 0.5 up to n + 0.5.
+  defp sky_region_box(wcs, shape, ra, dec, radius) do
+    case shape |> Tuple.to_list() |> Enum.reverse() do
+      [width, height | planes] ->
+        pixels = WCS.world_to_pixel(wcs, [{ra, dec} | sky_circle(ra, dec, radius)])
+
+        if Enum.any?(pixels, &is_nil/1) do
+          {:error, :outside_projection}
+        else
+          {xs, ys} = Enum.unzip(pixels)
+          {x0, x1} = {max(floor(Enum.min(xs) + 0.5), 1), min(ceil(Enum.max(xs) - 0.5), width)}
+          {y0, y1} = {max(floor(Enum.min(ys) + 0.5), 1), min(ceil(Enum.max(ys) - 0.5), height)}
+          ones = Enum.map(planes, fn _ -> 1 end)
+
+          if x0 > x1 or y0 > y1 do
+            {:error, :outside_image}
+          else
+            {:ok, List.to_tuple([x0, y0 | ones]), List.to_tuple([x1, y1 | ones])}
+          end
+        end
+
+      _ ->
+        {:error, :no_image_data}
+    end
+  end
+
+  # Points at the given angular distance from (ra, dec), by position angle
+  defp sky_circle(ra, dec, radius) do
+    {d, r} = {dec * :math.pi() / 180, radius * :math.pi() / 180}
+
+    for i <- 0..(@region_samples - 1) do
+      angle = 2 * :math.pi() * i / @region_samples
+      lat = :math.asin(:math.sin(d) * :math.cos(r) + :math.cos(d) * :math.sin(r) * :math.cos(angle))
+
+      lon =
+        ra * :math.pi() / 180 +
+          :math.atan2(:math.sin(angle) * :math.sin(r) * :math.cos(d), :math.cos(r) - :math.sin(d) * :math.sin(lat))
+
+      {lon * 180 / :math.pi(), lat * 180 / :math.pi()}
+    end
+  end
+
+  @doc """
+  Resample an image onto another celestial WCS and shape, natively.
+
+  Each output pixel is mapped through the target WCS to the sky and back
+  through the image's own WCS, and the image is sampled there. Only the
+  source pixels under the output's footprint are read, and the output rows
+  are divided among native threads. Output pixels the image does not cover
+  are NaN, so reprojected tiles can be written out and merged into a mosaic
+  with combine/3, which leaves NaN pixels out. Flux is not conserved: this
+  is interpolation, not drizzling.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - wcs: `ExFITS.WCS` of the output grid, for example read from a reference
+    image or built by hand
+  - shape: Shape of the output in Nx order (`{height, width}`)
+  - options: Keyword list of options:
+    - hdu: HDU number or EXTNAME (default: first image); the first plane of
+      images with more than two axes is used
+    - interpolation: :bilinear (default) or :nearest
+    - threads: Threads computing the output (default: schedulers online)
+
+  ## Returns
+
+  - {:ok, %{shape: shape, data: data, type: {:f, 32}}}
+  - {:error, :no_celestial_wcs} if the image has no TAN or SIN WCS
+  - {:error, reason} on failure
+
+  ## Example
+
+      {:ok, grid} = ExFITS.WCS.read("mosaic_reference.fits")
+
+      tiles =
+        for {path, i} <- Enum.with_index(Path.wildcard("tiles/*.fits")) do
+          {:ok, %{data: data}} = ExFITS.reproject(path, grid, {4096, 4096})
+          tile = "reprojected_\#{i}.fits"
+          :ok = ExFITS.write_array(tile, data, {4096, 4096})
+          tile
+        end
+
+      :ok = ExFITS.combine(tiles, "mosaic.fits", method: :mean)
+  """
+  def reproject(path, %WCS{} = wcs, shape, options \\ [])
+      when (is_binary(path) or is_reference(path)) and is_tuple(shape) and is_list(options) do
+    options =
+      options
+      |> Keyword.put_new_lazy(:threads, &System.schedulers_online/0)
+      |> Map.new()
+
+    Telemetry.span(:read, :reproject, path, fn ->
+      with {:ok, {shape, data}} <- NIF.reproject(path, wcs, shape, options) do
+        {:ok, %{shape: shape, data: data, type: {:f, 32}}}
+      end
+    end)
+  end
+
+  @doc """
+  Stream an image as chunks of whole rows.
+
+  The file is opened once when the stream starts and closed when it halts,
+  and each chunk is read with its own NIF call, so memory is bounded by the
+  chunk size rather than the image size. A row is one line of NAXIS1 pixels;
+  for images with more than two axes the rows of every plane follow one
+  another in file order.
+
+  The stream raises if a read fails.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2 (left open afterwards)
+  - rows_per_chunk: Number of rows in each chunk (the last chunk may be shorter)
+  - options: Keyword list of options, as for read_image/2
+
+  ## Returns
+
+  - A Stream of binaries holding `rows_per_chunk * NAXIS1` pixels each
+
+  ## Example
+
+      "big.fits"
+      |> ExFITS.stream_rows(512, type: :native)
+      |> Task.async_stream(&reduce_chunk/1)
+  """
+  def stream_rows(path, rows_per_chunk, options \\ [])
+      when (is_binary(path) or is_reference(path)) and is_integer(rows_per_chunk) and rows_per_chunk > 0 do
+    read_options = Map.new(options)
+
+    Stream.resource(
+      fn -> start_row_stream(path, read_options) end,
+      fn %{next_row: next_row, rows: rows} = state ->
+        if next_row >= rows do
+          {:halt, state}
+        else
+          count = min(rows_per_chunk, rows - next_row)
+          first_pixel = next_row * state.row_length + 1
+
+          case NIF.read_pixels(state.handle, first_pixel, count * state.row_length, read_options) do
+            {:ok, {data, _type}} -> {[data], %{state | next_row: next_row + count}}
+            {:error, reason} -> raise "ExFITS.stream_rows failed to read rows: #{inspect(reason)}"
+          end
+        end
+      end,
+      fn state -> if state.owned, do: close(state.handle) end
+    )
+  end
+
+  defp start_row_stream(path, read_options) do
+    {handle, owned} =
+      if is_reference(path) do
+        {path, false}
+      else
+        case open(path, mode: :read) do
+          {:ok, handle} -> {handle, true}
+          {:error, reason} -> raise "ExFITS.stream_rows could not open #{path}: #{inspect(reason)}"
+        end
+      end
+
+    case NIF.image_shape(handle, read_options) do
+      {:ok, {}} ->
+        %{handle: handle, owned: owned, next_row: 0, rows: 0, row_length: 0}
+
+      {:ok, shape} ->
+        row_length = elem(shape, tuple_size(shape) - 1)
+        pixels = shape |> Tuple.to_list() |> Enum.product()
+        %{handle: handle, owned: owned, next_row: 0, rows: div(pixels, row_length), row_length: row_length}
+
+      {:error, reason} ->
+        if owned, do: close(handle)
+        raise "ExFITS.stream_rows could not read the image shape: #{inspect(reason)}"
     end
   end
 
@@ -79,23 +636,191 @@ defmodule ExFITS do
 
   ## Parameters
 
-  - path: Path to the FITS file
+  - path: Path to the FITS file, or a handle from open/2
+
+  ## Returns
+
+  - {:ok, header} where header is a map of keyword-value pairs
+  - {:error, status} on failure
+  """
+  def read_header(path) when is_binary(path) or is_reference(path) do
+    Telemetry.span(:read, :read_header, path, 0, fn ->
+      cached_header(path, [], fn -> NIF.read_header(path) end)
+    end)
+  end
+
+  @doc """
+  Read header data from a selected HDU of a FITS file.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - options: Keyword list of options:
+    - hdu: HDU to read, as a 1-based number or an EXTNAME string
+    - keys: Only look up these keywords (atoms or binaries). Each one is a
+      single keyword search, so a few keys from a long header skip parsing
+      every card. Keys missing from the header are left out of the map.
+    - key_type: :atom (default) or :binary. With :binary the map is keyed by
+      binaries, so headers with arbitrary keywords cannot fill the atom table.
+    - raw: Return the header unparsed, as its 2880-byte blocks (default:
+      false). See ExFITS.Header for parsing them lazily.
+    - format: :map (default), or :cards for every card in header order as
+      `{key, value, comment}` tuples, with COMMENT and HISTORY cards as
+      `{key, text}`. Logical values are booleans and undefined values nil, so
+      the list can be passed back to write_header/3.
+    - cache: Use ExFITS.HeaderCache when it is running (default: true)
 
   ## Returns
 
   - {:ok, header} where header is a map of keyword-value pairs
+  - {:ok, cards} with `format: :cards`, a list of cards in header order
+  - {:ok, blocks} with `raw: true`, a binary of whole header blocks
   - {:error, status} on failure
+
+  ## Example
+
+      {:ok, %{"DATE-OBS" => date, "EXPTIME" => exptime}} =
+        ExFITS.read_header("frame.fits", keys: ["DATE-OBS", "EXPTIME"], key_type: :binary)
   """
-  def read_header(path) when is_binary(path) do
-    NIF.read_header(path)
+  def read_header(path, options) when (is_binary(path) or is_reference(path)) and is_list(options) do
+    Telemetry.span(:read, :read_header, path, 0, fn ->
+      cached_header(path, options, fn -> NIF.read_header(path, options |> Keyword.delete(:cache) |> Map.new()) end)
+    end)
+  end
+
+  # Serve path header reads from ExFITS.HeaderCache while it runs
+  defp cached_header(path, options, read_fun) when is_binary(path) do
+    if Keyword.get(options, :cache, true) and HeaderCache.enabled?() do
+      HeaderCache.fetch(path, options, read_fun)
+    else
+      read_fun.()
+    end
+  end
+
+  defp cached_header(_handle, _options, read_fun), do: read_fun.()
+
+  @doc """
+  Write header cards to an existing HDU.
+
+  A card list keeps its order and may hold COMMENT and HISTORY cards. The
+  header is read once for the keywords it already has, with their
+  positions: those are updated in place and the rest appended, so writing a
+  long header is a single pass. A keyword repeated in the list is updated,
+  not written twice. Each element of the list is one of:
+
+  - `{key, value}` or `{key, value, comment}`: keys are atoms or binaries,
+    values integers, floats, strings, booleans or nil for an undefined value
+  - `{:COMMENT, text}` or `{:HISTORY, text}`: appended as commentary cards
+  - an 80-character binary: a raw card, written as given
+
+  A map is written as before, with each keyword updated separately.
+  Structural keywords (SIMPLE, BITPIX, NAXISn, ...) are always skipped.
+
+  ## Parameters
+
+  - path: Path to the FITS file to update, or a writable handle from open/2
+  - cards: Ordered card list, or a map of keywords to values
+  - options: Keyword list of options:
+    - hdu: HDU to update, as a 1-based number or an EXTNAME string
+
+  ## Returns
+
+  - :ok on success
+  - {:error, :file_not_found} if the path does not exist
+  - {:error, status} on failure
+
+  ## Example
+
+      ExFITS.write_header("frame.fits", [
+        {:OBSERVER, "Hubble", "who took the frame"},
+        {:FLATCOR, true},
+        {:HISTORY, "Flat-fielded with flat_r.fits"}
+      ])
+  """
+  def write_header(path, cards, options \\ [])
+      when (is_binary(path) or is_reference(path)) and (is_list(cards) or is_map(cards)) and is_list(options) do
+    Telemetry.span(:write, :write_header_cards, path, 0, fn ->
+      NIF.write_header_cards(path, cards, Map.new(options))
+    end)
+  end
+
+  # A keyword's value in a header map or ordered card list
+  defp header_value(header, key) when is_map(header), do: Map.get(header, key)
+
+  defp header_value(cards, key) when is_list(cards) do
+    name = Atom.to_string(key)
+
+    Enum.find_value(cards, fn
+      {card_key, value} when card_key == key or card_key == name -> value
+      {card_key, value, _comment} when card_key == key or card_key == name -> value
+      _card -> nil
+    end)
+  end
+
+  @doc """
+  List the HDUs in a FITS file.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+
+  ## Returns
+
+  - {:ok, hdus} where each entry is a map with :index (1-based), :type
+    (:image, :ascii_table or :binary_table) and :extname (nil if unset), plus
+    :bitpix and :shape for images or :rows and :columns for tables
+  - {:error, status} on failure
+  """
+  def list_hdus(path) when is_binary(path) or is_reference(path) do
+    NIF.list_hdus(path)
+  end
+
+  @doc """
+  Read columns of a table HDU in bulk.
+
+  Every numeric column is decoded by CFITSIO in a single call into one binary
+  of native-endian values, so a column of a million rows costs one NIF call
+  rather than a million.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - options: Keyword list of options:
+    - columns: List of column names to read (default: all columns)
+    - first_row: 1-based first row to read (default: 1)
+    - rows: Number of rows to read (default: all remaining rows)
+    - hdu: HDU number or EXTNAME of the table (default: the first table HDU)
+
+  ## Returns
+
+  - {:ok, columns} where columns maps each column name to
+    `%{data: data, type: type, repeat: repeat}`. Numeric data is a binary of
+    rows * repeat values of the given Nx type; character columns have type
+    :string and a list of binaries as data.
+  - {:error, :column_not_found} if a requested column does not exist
+  - {:error, status} on failure, including a name template that matches
+    more than one column (CFITSIO status 237)
+  """
+  def read_table(path, options \\ []) when (is_binary(path) or is_reference(path)) and is_list(options) do
+    {columns, read_options} = Keyword.pop(options, :columns)
+
+    Telemetry.span(:read, :read_table, path, fn ->
+      with {:ok, list} <- NIF.read_table(path, columns, Map.new(read_options)) do
+        {:ok, Map.new(list, fn %{name: name} = column -> {name, Map.delete(column, :name)} end)}
+      end
+    end)
   end
 
   @doc """
   Read both header and image data from a FITS file.
 
+  A path is opened once and both reads share the open file. While
+  ExFITS.HeaderCache runs, the header of an unchanged file comes from the
+  cache instead.
+
   ## Parameters
 
-  - path: Path to the FITS file
+  - path: Path to the FITS file, or a handle from open/2
 
   ## Returns
 
@@ -104,20 +829,273 @@ defmodule ExFITS do
   - {:error, status} on failure
   """
   def read(path) when is_binary(path) do
-    with {:ok, header} <- read_header(path),
-         read_result <- read_image(path) do
-      case read_result do
-        {:ok, {width, height, data}} ->
+    if HeaderCache.enabled?() do
+      # The header may come from the cache, so only the image needs the file
+      with {:ok, header} <- read_header(path) do
+        image_with_header(header, read_image(path))
+      end
+    else
+      with_handle(path, &read/1)
+    end
+  end
+
+  def read(path) when is_reference(path) do
+    with {:ok, header} <- read_header(path) do
+      image_with_header(header, read_image(path))
+    end
+  end
+
+  defp image_with_header(header, read_result) do
+    case read_result do
+      {:ok, {width, height, data}} ->
+        {:ok, %{header: header, data: data, width: width, height: height}}
+      {:ok, data} ->
+        # Backward compatibility - try to get dimensions from header
+        try do
+          {width, height} = get_dimensions(header)
           {:ok, %{header: header, data: data, width: width, height: height}}
-        {:ok, data} ->
-          # Backward compatibility - try to get dimensions from header
-          try do
-            {width, height} = get_dimensions(header)
-            {:ok, %{header: header, data: data, width: width, height: height}}
-          rescue
-            _ -> {:ok, %{header: header, data: data}}
+        rescue
+          _ -> {:ok, %{header: header, data: data}}
+        end
+      error -> error
+    end
+  end
+
+  @doc """
+  Decode a FITS file held in memory, e.g. the body of an HTTP request,
+  without writing it to disk.
+
+  CFITSIO reads the binary in place rather than a copy of it.
+
+  ## Parameters
+
+  - binary: Contents of a FITS file
+  - options: Keyword list of options, as for read_array/2, plus
+    - key_type: :binary to key the header by binaries, as for read_header/2
+
+  ## Returns
+
+  - {:ok, %{header: header, shape: shape, data: data, type: type}} for the
+    first image HDU with data (or the :hdu option)
+  - {:error, :no_image_data} if there is no image
+  - {:error, status} on failure
+  """
+  def decode(binary, options \\ []) when is_binary(binary) and is_list(options) do
+    Telemetry.span(:read, :decode, :memory, byte_size(binary), fn ->
+      with {:ok, handle} <- NIF.open_memory(binary) do
+        try do
+          # Reading the image first leaves the handle on its HDU for the header
+          with {:ok, image} <- read_array(handle, Keyword.delete(options, :key_type)),
+               {:ok, header} <- read_header(handle, Keyword.take(options, [:key_type])) do
+            {:ok, Map.put(image, :header, header)}
           end
-        error -> error
+        after
+          close(handle)
+        end
+      end
+    end)
+  end
+
+  @doc """
+  Encode an image and its header as a FITS file in memory, e.g. to serve it
+  over HTTP, without writing it to disk.
+
+  The file is written into a buffer sized from the image up front, and the
+  returned binary is that buffer itself rather than a copy.
+
+  ## Parameters
+
+  - image: Map with :shape (Nx order), :data and :type, as returned by
+    read_array/2 or decode/2
+  - header: Map of header cards, or an ordered card list as for
+    write_header/3 (default: the image's :header, if any)
+  - options: Keyword list of options, as for write_array/4 (except :type and
+    :header, which come from image and header)
+
+  ## Returns
+
+  - {:ok, binary} with the contents of the FITS file
+  - {:error, :dimensions_mismatch} if data does not match shape and type
+  - {:error, status} on failure
+  """
+  def encode(%{shape: shape, data: data, type: type} = image, header \\ nil, options \\ [])
+      when is_binary(data) and is_list(options) do
+    header = header || Map.get(image, :header, %{})
+    # Room for the pixels plus a few header blocks
+    size_hint = byte_size(data) + 4 * 2880
+
+    Telemetry.span(:write, :encode, :memory, byte_size(data), fn ->
+      with {:ok, handle} <- NIF.create_memory(size_hint) do
+        try do
+          with :ok <- write_array(handle, data, shape, Keyword.merge(options, type: type, header: header)) do
+            NIF.close_memory(handle)
+          end
+        after
+          close(handle)
+        end
+      end
+    end)
+  end
+
+  @doc """
+  Read the header and image of many FITS files in parallel.
+
+  The files are read by a pool of native threads, outside the BEAM
+  schedulers, and each result is sent back to the calling process as soon
+  as it is ready. The calling process only blocks in `receive`, so
+  schedulers stay free however many reads are running. Only `:max_in_flight`
+  files are queued or being read at once, which bounds memory for lists
+  of any length.
+
+  ## Parameters
+
+  - paths: Enumerable of paths to FITS files
+  - options: Keyword list of options
+    - concurrency: Number of reader threads (default: System.schedulers_online())
+    - max_in_flight: Most files queued, being read or holding back a later
+      result at once (default: 2 * concurrency)
+    - header: Also read each image's header (default: true)
+    - keys: Only look up these header keywords, as for read_header/2
+    - data: Read the pixels (default: true); with `data: false` each
+      result is {:ok, %{header: header}} and nothing past the header is read
+    - type, scale, hdu: As for read_array/2
+    - threads: Decompression threads per tile-compressed image (default: 1)
+
+  ## Returns
+
+  - A list with one result per path, in the order of paths. Each one is
+    {:ok, %{header: header, shape: shape, data: data, type: type}} as for
+    read_array/2, or {:error, reason}
+
+  ## Example
+
+      "night/*.fits"
+      |> Path.wildcard()
+      |> ExFITS.read_many(concurrency: 8)
+  """
+  def read_many(paths, options \\ []) when is_list(options) do
+    paths
+    |> stream_many(Keyword.put(options, :ordered, true))
+    |> Enum.map(fn {_path, result} -> result end)
+  end
+
+  @doc """
+  Stream the results of reading many FITS files in parallel, as read_many/2.
+
+  Reads are only submitted as results are consumed, so a halted stream
+  stops reading. Already running reads finish before the stream returns.
+  Paths are taken one at a time as reads are submitted, so they can come
+  from an unbounded stream.
+
+  ## Parameters
+
+  - paths: Enumerable of paths to FITS files, consumed lazily
+  - options: Keyword list of options, as for read_many/2, plus
+    - ordered: Emit results in the order of paths instead of as they
+      complete (default: false)
+
+  ## Returns
+
+  - A Stream of {path, result} tuples, with result as for read_many/2
+
+  ## Example
+
+      paths
+      |> ExFITS.stream_many(concurrency: 16, type: :native)
+      |> Stream.each(fn {path, {:ok, image}} -> index(path, image) end)
+      |> Stream.run()
+  """
+  def stream_many(paths, options \\ []) when is_list(options) do
+    {ordered, options} = Keyword.pop(options, :ordered, false)
+    {concurrency, options} = Keyword.pop(options, :concurrency, System.schedulers_online())
+    {max_in_flight, options} = Keyword.pop(options, :max_in_flight, 2 * concurrency)
+    read_options = options |> Keyword.put_new(:threads, 1) |> Map.new()
+
+    Stream.resource(
+      fn ->
+        {:ok, pool} = NIF.pool_start(concurrency)
+
+        # Suspend the enumeration before its first element, so each path is
+        # pulled only when there is room to submit it
+        {:suspended, nil, pending} = Enumerable.reduce(paths, {:suspend, nil}, fn path, _acc -> {:suspend, path} end)
+
+        %{pool: pool, pending: pending, submitted: 0, in_flight: %{}, done: %{}, next: 0,
+          window: max(max_in_flight, 1), ordered: ordered, options: read_options}
+      end,
+      &next_many/1,
+      &stop_many/1
+    )
+  end
+
+  defp next_many(state) do
+    state = submit_many(state)
+
+    cond do
+      state.ordered and is_map_key(state.done, state.next) ->
+        take_ordered(state, [])
+
+      state.in_flight == %{} ->
+        {:halt, state}
+
+      true ->
+        in_flight = state.in_flight
+
+        receive do
+          {:exfits_read, ref, result} when is_map_key(in_flight, ref) ->
+            {{index, path}, in_flight} = Map.pop(in_flight, ref)
+            state = %{state | in_flight: in_flight}
+
+            if state.ordered do
+              {[], %{state | done: Map.put(state.done, index, {path, result})}}
+            else
+              {[{path, result}], state}
+            end
+        end
+    end
+  end
+
+  # Queue reads until the window is full. When ordered, results waiting on an
+  # earlier file count against the window too, so the backlog stays bounded.
+  defp submit_many(%{pending: pending, submitted: index} = state) when is_function(pending) do
+    if map_size(state.in_flight) < state.window and
+         (not state.ordered or index < state.next + state.window) do
+      case pending.({:cont, nil}) do
+        {:suspended, path, pending} ->
+          ref = make_ref()
+          :ok = NIF.pool_submit(state.pool, ref, path, state.options)
+          in_flight = Map.put(state.in_flight, ref, {index, path})
+          submit_many(%{state | pending: pending, submitted: index + 1, in_flight: in_flight})
+
+        {:done, _acc} ->
+          %{state | pending: :done}
+      end
+    else
+      state
+    end
+  end
+
+  defp submit_many(state), do: state
+
+  defp take_ordered(state, acc) do
+    case Map.pop(state.done, state.next) do
+      {nil, _done} -> {Enum.reverse(acc), state}
+      {entry, done} -> take_ordered(%{state | done: done, next: state.next + 1}, [entry | acc])
+    end
+  end
+
+  defp stop_many(state) do
+    :ok = NIF.pool_stop(state.pool)
+
+    # Let a half-consumed path stream release what it holds, such as a file
+    if is_function(state.pending), do: state.pending.({:halt, nil})
+
+    # Reads that were running when the stream halted have replied by now;
+    # drop their messages so they do not linger in the mailbox
+    for {ref, _entry} <- state.in_flight do
+      receive do
+        {:exfits_read, ^ref, _result} -> :ok
+      after
+        0 -> :ok
       end
     end
   end
@@ -127,7 +1105,8 @@ defmodule ExFITS do
 
   ## Parameters
 
-  - path: Path to create the new FITS file
+  - path: Path to create the new FITS file, or a handle opened with mode :create
+    or :readwrite to append an image HDU to
   - data: Binary containing float32 pixel data
   - width: Width of the image in pixels
   - height: Height of the image in pixels
@@ -137,37 +1116,140 @@ defmodule ExFITS do
   - :ok on success
   - {:error, status} or {:error, :dimensions_mismatch} on failure
   """
-  def write_image(path, data, width, height) when is_binary(path) and is_integer(width) and is_integer(height) do
-    NIF.write_image(path, data, width, height)
+  def write_image(path, data, width, height) when (is_binary(path) or is_reference(path)) and is_integer(width) and is_integer(height) do
+    Telemetry.span(:write, :write_image, path, byte_size(data), fn ->
+      NIF.write_image(path, data, width, height)
+    end)
+  end
+
+  @doc """
+  Write an image with any number of axes to a new FITS file.
+
+  ## Parameters
+
+  - path: Path to create the new FITS file, or a writable handle to append an image HDU to
+  - data: Binary of pixels in row-major order
+  - shape: Tuple of dimensions in Nx order (`{NAXISn, ..., NAXIS1}`)
+  - options: Keyword list of options:
+    - type: Nx type of the pixels in data (default: {:f, 32})
+    - bitpix: FITS BITPIX value to store the pixels as (default: matches type)
+    - header: Map of header cards, or an ordered card list as for
+      write_header/3, to include (default: %{})
+    - compress: Tile-compress the image with :rice, :gzip, :gzip2, :hcompress
+      or :plio (default: uncompressed). A new file gets an empty primary HDU
+      with the compressed image after it, as in a `.fits.fz` file.
+    - tile: Tile dimensions in Nx order (default: one image row per tile)
+    - quantize_level: Quantization of float pixels (CFITSIO default: 4);
+      0 compresses floats losslessly
+    - hcomp_scale: HCOMPRESS scale factor (default: 0, lossless)
+
+  ## Returns
+
+  - :ok on success
+  - {:error, :dimensions_mismatch} if data does not match shape and type
+  - {:error, status} on failure
+  """
+  def write_array(path, data, shape, options \\ []) when (is_binary(path) or is_reference(path)) and is_binary(data) and is_tuple(shape) do
+    type = Keyword.get(options, :type, {:f, 32})
+    bitpix = Keyword.get(options, :bitpix) || bitpix_for_type(type)
+    header = Keyword.get(options, :header, %{})
+
+    Telemetry.span(:write, :write_array, path, byte_size(data), fn ->
+      NIF.write_array(path, data, shape, type, bitpix, header, compression_options(options))
+    end)
+  end
+
+  defp compression_options(options) do
+    options
+    |> Keyword.take([:compress, :tile, :quantize_level, :hcomp_scale])
+    |> Map.new()
+  end
+
+  @doc """
+  BITPIX value that stores pixels of the given Nx type without conversion.
+
+  Unsigned 16/32/64-bit and signed 8-bit types use CFITSIO's equivalent
+  image types (20, 40, 80 and 10), which are stored as the matching FITS
+  BITPIX with the standard BZERO offset.
+  """
+  def bitpix_for_type({:u, 8}), do: 8
+  def bitpix_for_type({:s, 8}), do: 10
+  def bitpix_for_type({:s, 16}), do: 16
+  def bitpix_for_type({:u, 16}), do: 20
+  def bitpix_for_type({:s, 32}), do: 32
+  def bitpix_for_type({:u, 32}), do: 40
+  def bitpix_for_type({:s, 64}), do: 64
+  def bitpix_for_type({:u, 64}), do: 80
+  def bitpix_for_type({:f, 32}), do: -32
+  def bitpix_for_type({:f, 64}), do: -64
+
+  @doc """
+  Write a multi-extension FITS file in a single file open.
+
+  The file gets an empty primary HDU followed by one image extension per
+  entry in `extensions`.
+
+  ## Parameters
+
+  - path: Path to create the new FITS file, or a writable handle to append extensions to
+  - extensions: List of maps, one per extension:
+    - data: Binary of pixels in row-major order
+    - shape: Tuple of dimensions in Nx order
+    - type: Nx type of the pixels in data (default: {:f, 32})
+    - bitpix: FITS BITPIX value to store the pixels as (default: matches type)
+    - header: Map of header cards, or an ordered card list (default: %{})
+    - extname: EXTNAME of the extension (optional)
+    - compress, tile, quantize_level, hcomp_scale: tile compression, as for
+      write_array/4 (optional)
+  - options: Keyword list of options:
+    - primary_header: Map of header cards, or an ordered card list, for the
+      primary HDU (default: %{})
+
+  ## Returns
+
+  - :ok on success
+  - {:error, :dimensions_mismatch} or {:error, status} on failure
+  """
+  def write_extensions(path, extensions, options \\ []) when (is_binary(path) or is_reference(path)) and is_list(extensions) do
+    extensions =
+      Enum.map(extensions, fn ext ->
+        type = Map.get(ext, :type, {:f, 32})
+
+        ext
+        |> Map.put(:type, type)
+        |> Map.put_new_lazy(:bitpix, fn -> bitpix_for_type(type) end)
+        |> Map.put_new(:header, %{})
+      end)
+
+    bytes = Enum.reduce(extensions, 0, fn %{data: data}, acc -> acc + byte_size(data) end)
+
+    Telemetry.span(:write, :write_extensions, path, bytes, fn ->
+      NIF.write_extensions(path, Keyword.get(options, :primary_header, %{}), extensions)
+    end)
   end
 
   @doc """
   Create a 2D image from a list of lists of floats.
 
+  The rows are packed natively in one pass over the lists, yielding the
+  scheduler periodically, so large images neither allocate a binary per
+  pixel nor block other processes.
+
   ## Parameters
 
-  - data: A list of lists of floats, where each inner list represents a row
+  - data: A list of lists of floats, where each inner list represents a row;
+    :nan, :infinity and :neg_infinity stand for non-finite pixels
 
   ## Returns
 
   - {binary, width, height} tuple containing the binary data and dimensions
   """
   def create_image_from_lists(data) when is_list(data) and is_list(hd(data)) do
-    height = length(data)
-    width = length(hd(data))
-
-    # Verify all rows have the same width
-    if Enum.any?(data, fn row -> length(row) != width end) do
-      raise ArgumentError, "All rows must have the same length"
+    # Packed natively in one walk, into native endianness (same as CFITSIO)
+    case NIF.pack_rows(data) do
+      {:ok, image} -> image
+      {:error, :ragged_rows} -> raise ArgumentError, "All rows must have the same length"
     end
-
-    # Flatten and convert to binary using native endianness (same as CFITSIO)
-    binary = data
-    |> List.flatten()
-    |> Enum.map(fn x -> <<x::float-32-native>> end)
-    |> IO.iodata_to_binary()
-
-    {binary, width, height}
   end
 
   @doc """
@@ -220,40 +1302,24 @@ defmodule ExFITS do
   - {:error, reason} on failure
   """
   def copy(source_path, dest_path, preserve_bitpix \\ true) when is_binary(source_path) and is_binary(dest_path) do
-    with {:ok, header} <- read_header(source_path),
-         read_result <- read_image(source_path) do
-
+    with {:ok, %{header: header, data: data} = image} <- read(source_path) do
       # Get the original BITPIX value if we're preserving it
       bitpix = if preserve_bitpix, do: Map.get(header, :BITPIX, -32), else: -32 # Default to float if not preserving
 
-      case read_result do
-        {:ok, {width, height, data}} ->
-          # Write with the original BITPIX value
-          case NIF.write_image(dest_path, data, width, height, bitpix) do
-            :ok ->
-              # If image write is successful, copy the header cards
-              case copy_header_cards(source_path, dest_path, header) do
-                :ok -> :ok
-                error -> error
-              end
-            error -> error
-          end
-
-        {:ok, data} ->
-          # No dimensions, get them from the header
-          {width, height} = get_dimensions(header)
-          case NIF.write_image(dest_path, data, width, height, bitpix) do
-            :ok ->
-              # If image write is successful, copy the header cards
-              case copy_header_cards(source_path, dest_path, header) do
-                :ok -> :ok
-                error -> error
-              end
-            error -> error
-          end
+      # No dimensions with older NIF versions, get them from the header
+      {width, height} =
+        case image do
+          %{width: width, height: height} -> {width, height}
+          _ -> get_dimensions(header)
+        end
 
-        error -> error
-      end
+      # Write the image and its header cards through a single open of the destination
+      with_handle(dest_path, [mode: :create], fn dest ->
+        case NIF.write_image(dest, data, width, height, bitpix) do
+          :ok -> copy_header_cards(source_path, dest, header)
+          error -> error
+        end
+      end)
     end
   end
 
@@ -263,33 +1329,28 @@ defmodule ExFITS do
   ## Parameters
 
   - source_path: Path to the source FITS file (not used directly, header is passed separately)
-  - dest_path: Path to the destination FITS file to update
-  - header: Map containing header cards to copy
+  - dest_path: Path to the destination FITS file to update, or a writable handle
+  - header: Map containing header cards to copy, or an ordered card list as
+    for write_header/3
 
   ## Returns
 
   - :ok on success
+  - {:error, :file_not_found} if the destination does not exist
   - {:error, reason} on failure
   """
-  def copy_header_cards(_source_path, dest_path, header) when is_binary(dest_path) and is_map(header) do
-    # Make sure the file exists before trying to update it
-    if File.exists?(dest_path) do
-      # Use the NIF function to write the header cards
-      result = NIF.write_header_cards(dest_path, header)
-
-      # Debug output
-      IO.puts("Writing header cards to #{dest_path}: #{inspect(result)}")
-
-      result
-    else
-      IO.puts("Cannot write header cards: file #{dest_path} does not exist")
-      {:error, :file_not_found}
-    end
+  def copy_header_cards(_source_path, dest_path, header) when (is_binary(dest_path) or is_reference(dest_path)) and (is_map(header) or is_list(header)) do
+    # The NIF reports a missing destination itself, so no separate existence check is needed
+    Telemetry.span(:write, :write_header_cards, dest_path, 0, fn ->
+      NIF.write_header_cards(dest_path, header)
+    end)
   end
 
   @doc """
   Convert binary float data from a FITS file to a list of lists.
 
+  The lists are built natively, yielding the scheduler periodically.
+
   ## Parameters
 
   - binary: Binary data from read_image/1
@@ -298,16 +1359,11 @@ defmodule ExFITS do
 
   ## Returns
 
-  - List of lists representing the 2D image
+  - List of lists representing the 2D image, with NaN and infinite pixels
+    as :nan, :infinity and :neg_infinity, as Nx represents them
   """
   def binary_to_lists(binary, width, height) do
-    for row <- 0..(height-1) do
-      for col <- 0..(width-1) do
-        offset = (row * width + col) * 4
-        <<value::float-32-native>> = binary_part(binary, offset, 4)
-        value
-      end
-    end
+    NIF.unpack_rows(binary, width, height)
   end
 
   @doc """
@@ -319,9 +1375,11 @@ defmodule ExFITS do
   - data: Binary containing float32 pixel data
   - width: Width of the image in pixels
   - height: Height of the image in pixels
-  - header: Map of header cards to include
+  - header: Map of header cards, or an ordered card list as for write_header/3
   - options: Keyword list of options:
     - bitpix: FITS BITPIX value (default: value from header or -32 for float)
+    - compress, tile, quantize_level, hcomp_scale: tile compression, as for
+      write_array/4
 
   ## Returns
 
@@ -331,22 +1389,33 @@ defmodule ExFITS do
   def write_fits(path, data, width, height, header, options \\ []) do
     # Get bitpix from options, header, or default to -32 (float)
     bitpix = Keyword.get(options, :bitpix) ||
-             Map.get(header, :BITPIX) ||
+             header_value(header, :BITPIX) ||
              -32
 
     # Write the file with image data and header in a single operation
-    NIF.write_fits_file(path, data, width, height, bitpix, header)
+    Telemetry.span(:write, :write_fits, path, byte_size(data), fn ->
+      NIF.write_fits_file(path, data, width, height, bitpix, header, compression_options(options))
+    end)
   end
 
   @doc """
   Copy a FITS file with header preservation in a single operation.
 
+  By default every HDU is copied block for block in native code, without
+  decoding any pixels, so integer, scaled and tile-compressed images are
+  copied exactly and the copy is bound by I/O rather than CPU.
+
   ## Parameters
 
   - source_path: Path to the source FITS file
   - dest_path: Path to the destination FITS file
   - options: Keyword list of options:
-    - preserve_bitpix: Whether to preserve the original bit depth (default: true)
+    - preserve_bitpix: Whether to preserve the original bit depth (default: true).
+      With false, the primary image is decoded and rewritten as float32
+    - header: Header edits to apply to the copy, as a map or an ordered card
+      list as for write_header/3
+    - hdu: HDU number or EXTNAME of the HDU the header edits apply to
+      (default: 1)
 
   ## Returns
 
@@ -355,28 +1424,28 @@ defmodule ExFITS do
   """
   def copy_with_header(source_path, dest_path, options \\ []) do
     preserve_bitpix = Keyword.get(options, :preserve_bitpix, true)
+    edits = Keyword.get(options, :header)
 
-    with {:ok, header} <- read_header(source_path),
-         {:ok, {width, height, data}} <- read_image(source_path) do
+    if preserve_bitpix do
+      copy_options = options |> Keyword.take([:header, :hdu]) |> Map.new()
 
-      # Get the original BITPIX value if we're preserving it
-      bitpix = if preserve_bitpix, do: Map.get(header, :BITPIX, -32), else: -32
-
-      # Write the destination file with all header information
-      write_fits(dest_path, data, width, height, header, bitpix: bitpix)
+      Telemetry.span(:write, :copy_with_header, dest_path, 0, fn ->
+        NIF.copy_file(source_path, dest_path, copy_options)
+      end)
     else
-      {:ok, data} ->
+      with {:ok, %{header: header, data: data} = image} <- read(source_path) do
         # Backward compatibility - try to get dimensions from header
-        with {:ok, header} <- read_header(source_path),
-             {width, height} <- get_dimensions(header) do
-          # Get the original BITPIX value if we're preserving it
-          bitpix = if preserve_bitpix, do: Map.get(header, :BITPIX, -32), else: -32
+        {width, height} =
+          case image do
+            %{width: width, height: height} -> {width, height}
+            _ -> get_dimensions(header)
+          end
 
-          # Write the destination file with all header information
-          write_fits(dest_path, data, width, height, header, bitpix: bitpix)
+        # Write the destination file with all header information
+        with :ok <- write_fits(dest_path, data, width, height, header, bitpix: -32) do
+          if edits, do: write_header(dest_path, edits), else: :ok
         end
-
-      error -> error
+      end
     end
   end
 
@@ -386,22 +1455,41 @@ defmodule ExFITS do
   ## Parameters
 
   - path: Path to the FITS file
-  - options: Optional map of options (for future expansion)
+  - options: Optional map of options:
+    - :type - :float (default) for an :f32 tensor, :native for a tensor in the
+      file's own BITPIX type, or an Nx type such as {:f, 64} to convert the
+      native pixels to in a single native pass
+    - :scale - Apply BZERO/BSCALE in :native mode (default: true)
+    - :backend - Nx backend to create the tensor on, e.g.
+      `{EXLA.Backend, client: :cuda}`. The pixels are handed to the backend's
+      host-to-device transfer directly, with no intermediate tensor.
+
+  The pixel binary is allocated once by the NIF and becomes the tensor's
+  backing binary without further copies on the default binary backend.
 
   ## Returns
 
   - {:ok, tensor} where tensor is an Nx tensor containing the image data
   - {:error, reason} on failure
   """
-  def to_nx(path, _options \\ %{}) do
+  def to_nx(path, options \\ %{}) do
     if Code.ensure_loaded?(Nx) do
-      with {:ok, {width, height, data}} <- read_image(path) do
-        # Convert binary data to Nx tensor with proper shape
-        # FITS data is stored in big-endian format, ensure proper conversion
+      type = Map.get(options, :type, :float)
+      read_type = if type == :float, do: :float, else: :native
+      read_options = [type: read_type, scale: Map.get(options, :scale, true)]
+
+      # CFITSIO returns native-endian pixels, so only a type cast may be needed
+      with {:ok, %{shape: shape, data: data, type: file_type}} <- read_array(path, read_options),
+           nx_type = if(is_tuple(type), do: type, else: file_type),
+           {:ok, data} <- NIF.convert_pixels(data, file_type, nx_type, :native) do
+        from_binary_options = case Map.get(options, :backend) do
+          nil -> []
+          backend -> [backend: backend]
+        end
+
         tensor = data
-          |> maybe_swap_endianness()
-          |> Nx.from_binary(:f32)
-          |> Nx.reshape({height, width})
+          |> Nx.from_binary(nx_type, from_binary_options)
+          |> Nx.reshape(shape)
 
         {:ok, tensor}
       end
@@ -410,15 +1498,57 @@ defmodule ExFITS do
     end
   end
 
+  @doc """
+  Read table columns as Nx tensors.
+
+  Takes the same options as read_table/2. Scalar columns become tensors of
+  shape `{rows}` and vector columns `{rows, repeat}`. Character columns are
+  returned as lists of binaries, and complex columns as {:c, 64} or {:c, 128}
+  tensors.
+
+  ## Returns
+
+  - {:ok, %{name => tensor}}
+  - {:error, reason} on failure
+  """
+  def table_to_nx(path, options \\ []) do
+    if Code.ensure_loaded?(Nx) do
+      with {:ok, columns} <- read_table(path, options) do
+        {:ok, Map.new(columns, fn {name, column} -> {name, column_to_nx(column)} end)}
+      end
+    else
+      {:error, :nx_not_available}
+    end
+  end
+
+  defp column_to_nx(%{type: :string, data: data}), do: data
+
+  defp column_to_nx(%{type: type, data: data, repeat: repeat}) do
+    tensor = Nx.from_binary(data, type)
+
+    if repeat == 1 do
+      tensor
+    else
+      Nx.reshape(tensor, {div(Nx.size(tensor), repeat), repeat})
+    end
+  end
+
   @doc """
   Write an Nx tensor to a FITS file.
 
+  Tensors of any rank are written with one FITS axis per tensor dimension,
+  NAXIS1 being the last (fastest-varying) dimension.
+
+  The tensor's binary is passed to CFITSIO as is, without a conversion pass in
+  Elixir.
+
   ## Parameters
 
   - tensor: Nx tensor containing the image data
   - path: Path to create the new FITS file
   - options: Optional map of options:
-    - :bitpix - FITS BITPIX value (default: -32 for float)
+    - :bitpix - FITS BITPIX value (default: matches the tensor type; types
+      with no FITS equivalent such as :f16 are written as -32)
     - :header - Map of header keywords to add
 
   ## Returns
@@ -434,49 +1564,65 @@ defmodule ExFITS do
   """
   def write_nx(tensor, path, options \\ %{}) do
     if Code.ensure_loaded?(Nx) do
-      # Get the shape of the tensor
-      shape = Nx.shape(tensor)
-
-      # Extract dimensions based on shape
-      {height, width} = case shape do
-        {h, w} -> {h, w}
-        {h, w, _} -> {h, w}  # For 3D tensors, flatten the last dimension
-        {h} -> {h, 1}        # For 1D tensors, treat as single row
-        _ -> raise ArgumentError, "Unsupported tensor shape: #{inspect(shape)}"
+      # Scalars are written as a single pixel
+      shape = case Nx.shape(tensor) do
+        {} -> {1}
+        shape -> shape
       end
 
-      # Convert to binary data in float32 format and handle endianness
-      data = tensor
-        |> Nx.as_type(:f32)
-        |> Nx.to_binary()
-        |> maybe_swap_endianness() # Ensure proper byte order for FITS
+      # The tensor's own binary goes straight to CFITSIO, which handles the
+      # FITS byte order and any conversion to a different BITPIX
+      {data, type} = tensor_binary(tensor)
 
       # Get header if provided or create basic headers
       header = Map.get(options, :header, %{})
 
-      # Get bitpix from options or default to float (-32)
-      bitpix = Map.get(options, :bitpix, -32)
+      # Get bitpix from options or default to the tensor's own type
+      bitpix = Map.get(options, :bitpix) || bitpix_for_type(type)
 
       # Write to file
-      write_fits(path, data, width, height, header, bitpix: bitpix)
+      write_array(path, data, shape, type: type, bitpix: bitpix, header: header)
     else
       {:error, :nx_not_available}
     end
   end
 
-  # Helper to swap endianness if needed
-  # FITS uses big-endian format, but Nx typically works with the system's native endianness
-  defp maybe_swap_endianness(data) do
-    case :erlang.system_info(:endian) do
-      :little -> swap_float32_endianness(data)
-      :big -> data  # FITS uses big-endian format
+  @fits_types [{:u, 8}, {:s, 8}, {:s, 16}, {:u, 16}, {:s, 32}, {:u, 32}, {:s, 64}, {:u, 64}, {:f, 32}, {:f, 64}]
+
+  # Types with no FITS equivalent (f16, bf16, complex) are written as float32
+  defp tensor_binary(tensor) do
+    case Nx.type(tensor) do
+      type when type in @fits_types -> {Nx.to_binary(tensor), type}
+      _other -> {tensor |> Nx.as_type(:f32) |> Nx.to_binary(), {:f, 32}}
     end
   end
 
-  # Swap byte order for each 4-byte float
-  defp swap_float32_endianness(data) do
-    for <<a::8, b::8, c::8, d::8 <- data>>, into: <<>> do
-      <<d::8, c::8, b::8, a::8>>
-    end
+  @doc """
+  Convert a binary of pixels to another Nx type and/or from a foreign byte order.
+
+  Runs natively in a single pass using SIMD byte swapping where the CPU
+  supports it, so it is suitable for whole frames. Use `byte_order: :big`
+  for raw FITS data, which is stored big-endian.
+
+  ## Parameters
+
+  - data: Binary of pixels
+  - from: Nx type of the pixels in data
+  - to: Nx type to convert to
+  - options: Keyword list of options:
+    - byte_order: :native (default), :big or :little, the byte order of data
+
+  ## Returns
+
+  - {:ok, binary} of native-endian pixels of type `to`
+  - {:error, :unsupported_type} if either type has no FITS equivalent
+
+  ## Example
+
+      # Big-endian 16-bit pixels to native float32
+      {:ok, floats} = ExFITS.convert_pixels(raw, {:s, 16}, {:f, 32}, byte_order: :big)
+  """
+  def convert_pixels(data, from, to, options \\ []) when is_binary(data) do
+    NIF.convert_pixels(data, from, to, Keyword.get(options, :byte_order, :native))
   end
 end
@@ -0,0 +1,57 @@
+defmodule ExFITS.BufferPool do
+  @moduledoc """
+  The native pool of pixel buffers that frame reads and writes draw from.
+
+  Reads of 64 KiB or more (read_array/2, read_image/2, read_section/5,
+  stream_rows/3 chunks, read_many/2 and convert_pixels/4 results) decode
+  into page-aligned buffers from the pool, handed to Elixir as binaries over
+  the buffer. When the last binary referencing a buffer is garbage collected,
+  the buffer goes back to the pool instead of to the allocator, ready for the
+  next read of a similar size. Writes stage their pixels through the pool
+  too. A steady stream of same-sized frames then stops allocating after the
+  first few.
+
+  Buffers are kept in size classes, four per power of two, so one class
+  serves sizes within a quarter of each other. The pool keeps up to
+  `:max_bytes` of free buffers (default: 256 MiB) and frees any returned
+  beyond that.
+
+  A binary over a pooled buffer keeps the whole buffer alive, as does any
+  sub-binary of it; use `:binary.copy/1` to keep a small part of a frame for
+  a long time.
+  """
+
+  alias ExFITS.NIF
+
+  @doc """
+  Return the pool's counters and size.
+
+  ## Returns
+
+  A map of:
+
+  - hits: Buffers taken from the pool
+  - misses: Buffers allocated because the pool had none of the class
+  - recycled: Buffers returned and kept
+  - dropped: Buffers returned and freed because the pool was full
+  - retained_bytes, retained_buffers: Free buffers held now
+  - max_bytes: The most bytes of free buffers held
+  """
+  def stats, do: NIF.buffer_pool_stats()
+
+  @doc """
+  Configure the pool.
+
+  ## Options
+
+  - max_bytes: The most bytes of free buffers to keep; 0 stops pooling.
+    Buffers beyond a lowered limit are freed at once, largest first.
+
+  ## Returns
+
+  - :ok
+  """
+  def configure(options) when is_list(options) do
+    NIF.buffer_pool_configure(%{max_bytes: Keyword.fetch!(options, :max_bytes)})
+  end
+end
@@ -0,0 +1,180 @@
+defmodule ExFITS.Header do
+  @moduledoc """
+  Lazy parsing of the raw header blocks returned by
+  `ExFITS.read_header(path, raw: true)`.
+
+  A header is a sequence of 80-byte cards padded to 2880-byte blocks. The
+  functions here slice cards out of the blocks and only parse the ones that
+  are asked for, so looking up a few keywords costs a scan of the card names
+  rather than a parse of every card. Keys are binaries and values are parsed
+  as FITS defines them:
+
+  - strings come back as binaries, with the quotes, the doubled `''`
+    escapes and any trailing blanks removed
+  - `T` and `F` come back as `true` and `false`
+  - integers and floats are numbers; `D` exponents are accepted
+  - undefined values are `nil`, and complex values are returned as their text
+
+  ## Example
+
+      {:ok, blocks} = ExFITS.read_header("frame.fits", raw: true)
+      ExFITS.Header.get(blocks, "EXPTIME")
+      #=> 30.0
+  """
+
+  @card_size 80
+
+  @doc """
+  List the cards of a header up to, and not including, END.
+
+  ## Returns
+
+  - A list of 80-byte card binaries
+  """
+  def cards(blocks) when is_binary(blocks) do
+    take_cards(blocks, [])
+  end
+
+  defp take_cards(<<"END     ", _::binary-size(72), _rest::binary>>, acc), do: Enum.reverse(acc)
+  defp take_cards(<<card::binary-size(@card_size), rest::binary>>, acc), do: take_cards(rest, [card | acc])
+  defp take_cards(_rest, acc), do: Enum.reverse(acc)
+
+  @doc """
+  Look up one keyword, parsing only its card.
+
+  ## Returns
+
+  - {:ok, value} for the first card with the keyword
+  - :error if the header has no such keyword
+  """
+  def fetch(blocks, key) when is_binary(blocks) and is_binary(key) do
+    key = String.upcase(key)
+
+    blocks
+    |> cards()
+    |> Enum.find_value(:error, fn card ->
+      if card_key(card) == key, do: {:ok, elem(parse_card(card), 1)}
+    end)
+  end
+
+  @doc """
+  Look up one keyword, returning default when the header does not have it.
+  """
+  def get(blocks, key, default \\ nil) when is_binary(blocks) and is_binary(key) do
+    case fetch(blocks, key) do
+      {:ok, value} -> value
+      :error -> default
+    end
+  end
+
+  @doc """
+  Parse every keyword of a header into a map, skipping COMMENT, HISTORY and
+  blank cards. When a keyword repeats, the first card wins, as with fetch/2.
+
+  ## Returns
+
+  - A map of binary keywords to values
+  """
+  def to_map(blocks) when is_binary(blocks) do
+    blocks
+    |> cards()
+    |> Enum.reduce(%{}, fn card, acc ->
+      case parse_card(card) do
+        {key, _value, _comment} when key in ["", "COMMENT", "HISTORY"] -> acc
+        {key, value, _comment} -> Map.put_new(acc, key, value)
+      end
+    end)
+  end
+
+  @doc """
+  Parse one 80-byte card.
+
+  ## Returns
+
+  - {key, value, comment}, where cards without a value (COMMENT, HISTORY,
+    blank) have a nil value and their text as the comment
+  """
+  def parse_card(card) when is_binary(card) do
+    key = card_key(card)
+
+    case value_field(card) do
+      nil -> {key, nil, card |> binary_part(8, byte_size(card) - 8) |> String.trim()}
+      field -> parse_value(key, String.trim_leading(field))
+    end
+  end
+
+  # The keyword of a card; HIERARCH keywords are returned without the prefix
+  defp card_key(<<"HIERARCH ", rest::binary>>) do
+    case :binary.split(rest, "=") do
+      [key, _value] -> String.trim(key)
+      [_no_value] -> "HIERARCH"
+    end
+  end
+
+  defp card_key(<<key::binary-size(8), _rest::binary>>), do: String.trim_trailing(key)
+  defp card_key(card), do: String.trim_trailing(card)
+
+  # The text after the value indicator, or nil for commentary cards
+  defp value_field(<<"HIERARCH ", rest::binary>>) do
+    case :binary.split(rest, "=") do
+      [_key, value] -> value
+      [_no_value] -> nil
+    end
+  end
+
+  defp value_field(<<_key::binary-size(8), "= ", value::binary>>), do: value
+  defp value_field(_card), do: nil
+
+  defp parse_value(key, "'" <> rest) do
+    {string, after_string} = take_string(rest, [])
+    {key, String.trim_trailing(string), comment_of(after_string)}
+  end
+
+  defp parse_value(key, field) do
+    {text, comment} =
+      case :binary.split(field, "/") do
+        [text, comment] -> {String.trim(text), String.trim(comment)}
+        [text] -> {String.trim(text), ""}
+      end
+
+    {key, parse_scalar(text), comment}
+  end
+
+  # A quoted string ends at the first quote that is not doubled
+  defp take_string("''" <> rest, acc), do: take_string(rest, [?' | acc])
+  defp take_string("'" <> rest, acc), do: {acc |> Enum.reverse() |> IO.iodata_to_binary(), rest}
+  defp take_string(<<char, rest::binary>>, acc), do: take_string(rest, [char | acc])
+  defp take_string("", acc), do: {acc |> Enum.reverse() |> IO.iodata_to_binary(), ""}
+
+  defp comment_of(rest) do
+    case :binary.split(rest, "/") do
+      [_blank, comment] -> String.trim(comment)
+      [_no_comment] -> ""
+    end
+  end
+
+  defp parse_scalar(""), do: nil
+  defp parse_scalar("T"), do: true
+  defp parse_scalar("F"), do: false
+
+  defp parse_scalar(text) do
+    case Integer.parse(text) do
+      {integer, ""} -> integer
+      _ -> parse_float(text)
+    end
+  end
+
+  # FITS allows "1.", ".5" and D exponents, which Float.parse/1 does not
+  defp parse_float(text) do
+    normalized =
+      text
+      |> String.replace(["D", "d"], "E")
+      |> String.replace(~r/^([+-]?)\./, "\\g{1}0.")
+      |> String.replace(~r/\.(?!\d)/, ".0")
+
+    case Float.parse(normalized) do
+      {float, ""} -> float
+      _ -> text
+    end
+  end
+end
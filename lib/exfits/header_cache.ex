@@ -0,0 +1,182 @@
+defmodule ExFITS.HeaderCache do
+  @moduledoc """
+  An optional ETS cache of parsed headers, for services that read the
+  metadata of the same files over and over.
+
+  The cache is off until it is started, typically in the application's
+  supervision tree:
+
+      children = [
+        {ExFITS.HeaderCache, max_bytes: 32 * 1024 * 1024}
+      ]
+
+  While it runs, `ExFITS.read_header/1,2` on a path is served from the cache
+  when the file is unchanged, without opening it through CFITSIO. So are the
+  header reads of `ExFITS.read/1`, `ExFITS.copy/3` and
+  `ExFITS.copy_with_header/3`. Pass `cache: false` to read_header/2 to
+  bypass it. Reads through a handle are never cached.
+
+  Entries are keyed by the expanded path, the read options and the file's
+  mtime, size and inode, so a rewritten or replaced file is read afresh.
+  File mtimes have a resolution of one second, so a rewrite that keeps the
+  size and inode within the same second as the cached read is not noticed.
+
+  Lookups go straight to ETS from the calling process; only inserts and
+  eviction go through the cache process. When the headers held exceed
+  `:max_bytes` (measured approximately, as their external term size), the
+  least recently used ones are evicted.
+
+  ## Options
+
+  - max_bytes: Memory cap for cached headers (default: 64 MiB)
+  """
+
+  use GenServer
+
+  @table __MODULE__
+  @lru Module.concat(__MODULE__, LRU)
+  @default_max_bytes 64 * 1024 * 1024
+
+  @doc """
+  Start the cache process and its tables.
+  """
+  def start_link(options \\ []) do
+    GenServer.start_link(__MODULE__, options, name: __MODULE__)
+  end
+
+  @doc """
+  Whether the cache is running.
+  """
+  def enabled? do
+    :ets.whereis(@table) != :undefined
+  end
+
+  @doc """
+  Return the cached header for path and options, or call read_fun and cache
+  its result if it is `{:ok, header}`.
+
+  Files that cannot be stat'ed are read through read_fun uncached.
+  """
+  def fetch(path, options, read_fun) when is_binary(path) and is_function(read_fun, 0) do
+    case cache_key(path, options) do
+      {:ok, key} ->
+        case lookup(key) do
+          {:ok, header} ->
+            {:ok, header}
+
+          :miss ->
+            with {:ok, header} <- read_fun.() do
+              GenServer.cast(__MODULE__, {:put, key, header})
+              {:ok, header}
+            end
+        end
+
+      :error ->
+        read_fun.()
+    end
+  end
+
+  @doc """
+  Drop every cached header.
+  """
+  def clear do
+    GenServer.call(__MODULE__, :clear)
+  end
+
+  defp cache_key(path, options) do
+    case File.stat(path, time: :posix) do
+      {:ok, %File.Stat{mtime: mtime, size: size, inode: inode}} ->
+        {:ok, {Path.expand(path), options |> Keyword.delete(:cache) |> Enum.sort(), mtime, size, inode}}
+
+      {:error, _reason} ->
+        :error
+    end
+  end
+
+  defp lookup(key) do
+    case :ets.lookup(@table, key) do
+      [{^key, header, _bytes, tick}] ->
+        touch(key, tick)
+        {:ok, header}
+
+      [] ->
+        :miss
+    end
+  rescue
+    # The cache stopped between enabled?/0 and the lookup
+    ArgumentError -> :miss
+  end
+
+  # Move an entry to the most recently used end. Concurrent hits may leave
+  # stale LRU rows behind; eviction skips them.
+  defp touch(key, tick) do
+    new_tick = :erlang.unique_integer([:monotonic])
+
+    if :ets.update_element(@table, key, {4, new_tick}) do
+      :ets.insert(@lru, {new_tick, key})
+      :ets.delete(@lru, tick)
+    end
+  end
+
+  @impl true
+  def init(options) do
+    :ets.new(@table, [:set, :public, :named_table, read_concurrency: true, write_concurrency: true])
+    :ets.new(@lru, [:ordered_set, :public, :named_table, write_concurrency: true])
+    {:ok, %{bytes: 0, max_bytes: Keyword.get(options, :max_bytes, @default_max_bytes)}}
+  end
+
+  @impl true
+  def handle_cast({:put, key, header}, state) do
+    bytes = :erlang.external_size(header)
+
+    if bytes > state.max_bytes do
+      {:noreply, state}
+    else
+      state = remove(key, state)
+      tick = :erlang.unique_integer([:monotonic])
+      :ets.insert(@table, {key, header, bytes, tick})
+      :ets.insert(@lru, {tick, key})
+      {:noreply, evict(%{state | bytes: state.bytes + bytes})}
+    end
+  end
+
+  @impl true
+  def handle_call(:clear, _from, state) do
+    :ets.delete_all_objects(@table)
+    :ets.delete_all_objects(@lru)
+    {:reply, :ok, %{state | bytes: 0}}
+  end
+
+  defp remove(key, state) do
+    case :ets.take(@table, key) do
+      [{^key, _header, bytes, tick}] ->
+        :ets.delete(@lru, tick)
+        %{state | bytes: state.bytes - bytes}
+
+      [] ->
+        state
+    end
+  end
+
+  # Drop least recently used entries until the cache is under its cap
+  defp evict(%{bytes: bytes, max_bytes: max_bytes} = state) when bytes <= max_bytes, do: state
+
+  defp evict(state) do
+    case :ets.first(@lru) do
+      :"$end_of_table" ->
+        state
+
+      tick ->
+        [{^tick, key}] = :ets.take(@lru, tick)
+
+        case :ets.lookup(@table, key) do
+          [{^key, _header, bytes, ^tick}] ->
+            :ets.delete(@table, key)
+            evict(%{state | bytes: state.bytes - bytes})
+
+          _stale ->
+            evict(state)
+        end
+    end
+  end
+end
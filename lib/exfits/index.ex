@@ -0,0 +1,277 @@
+defmodule ExFITS.Index do
+  @moduledoc """
+  Build a columnar index of header keywords over directory trees of FITS
+  files, and read it back.
+
+  build/3 walks the trees lazily and scans the files on the native read pool
+  behind `ExFITS.stream_many/2`. Each file is opened only far enough to read
+  its header. No pixel is read, and only the configured keywords are looked
+  up. The values are collected into one column per keyword and written to a
+  compact file with one row per file, sorted by path.
+
+  `mix exfits.index` runs build/3 from the command line.
+
+  ## File format
+
+  All integers are little-endian.
+
+      "EXFITSIX" version::8 rows::64 columns::32
+      per column: name_size::16 name type::8 payload_size::64 payload
+
+  The first column is always `"path"`. A payload starts with a validity
+  bitmap of `ceil(rows / 8)` bytes, least significant bit first, with a 1
+  bit for each row that has a value. It is followed by the values:
+
+  - type 1, integer: rows signed 64-bit integers
+  - type 2, float: rows 64-bit floats
+  - type 3, string: rows + 1 unsigned 32-bit offsets into the UTF-8 bytes
+    that follow
+
+  Missing values are stored as 0 or as empty strings. Each column holds
+  the widest type among its values: integers, then floats, then strings.
+  Numbers in a column that also holds strings are stored as text.
+
+  Every payload is sized, so a reader can skip the columns it does not
+  need; read/2 does this with the `:columns` option.
+  """
+
+  import Bitwise
+
+  @magic "EXFITSIX"
+  @version 1
+  @integer 1
+  @float 2
+  @string 3
+  @default_extensions [".fits", ".fit", ".fts", ".fz", ".fits.gz"]
+
+  @doc """
+  Scan the headers of every FITS file under roots and write an index of
+  the given keywords to output.
+
+  ## Parameters
+
+  - roots: A directory or file path, or a list of them
+  - output: Path of the index file to write
+  - options: Keyword list of options:
+    - keys: Header keywords to index (required)
+    - hdu: HDU to read each header from (default: the first image HDU with
+      data, as for read_array/2)
+    - extensions: File name endings to index (default: .fits, .fit,
+      .fts, .fz and .fits.gz)
+    - concurrency, max_in_flight: As for `ExFITS.read_many/2`
+
+  ## Returns
+
+  - {:ok, %{files: count, failed: [{path, reason}]}} once the index is
+    written; files whose header could not be read are left out
+  - {:error, reason} if the index cannot be written
+
+  The walk and the scan are streamed, but the indexed values of every file
+  are held in memory until they are sorted and written, a few times the
+  size of the index itself.
+  """
+  def build(roots, output, options) when is_binary(output) and is_list(options) do
+    keys = options |> Keyword.fetch!(:keys) |> Enum.map(&(&1 |> to_string() |> String.upcase()))
+    key_atoms = Enum.map(keys, &String.to_atom/1)
+
+    scan_options =
+      options
+      |> Keyword.take([:hdu, :concurrency, :max_in_flight])
+      |> Keyword.merge(keys: keys, data: false)
+
+    {rows, failed} =
+      roots
+      |> files(options)
+      |> ExFITS.stream_many(scan_options)
+      |> Enum.reduce({[], []}, fn
+        {path, {:ok, %{header: header}}}, {rows, failed} ->
+          {[[path | Enum.map(key_atoms, &Map.get(header, &1))] | rows], failed}
+
+        {path, {:error, reason}}, {rows, failed} ->
+          {rows, [{path, reason} | failed]}
+      end)
+
+    count = length(rows)
+    names = ["path" | keys]
+
+    with :ok <- File.write(output, encode(names, count, transpose(rows, length(names)))) do
+      {:ok, %{files: count, failed: Enum.reverse(failed)}}
+    end
+  end
+
+  @doc """
+  Stream the paths of the FITS files under roots, walking directories as
+  the stream is consumed.
+
+  ## Options
+
+  - extensions: File name endings to include (default: .fits, .fit, .fts,
+    .fz and .fits.gz)
+  """
+  def files(roots, options \\ []) do
+    extensions = Keyword.get(options, :extensions, @default_extensions)
+
+    roots
+    |> List.wrap()
+    |> Stream.flat_map(&walk/1)
+    |> Stream.filter(fn path -> String.ends_with?(path, extensions) end)
+  end
+
+  # Depth-first, with each directory's entries in name order. Listing a
+  # file fails with :enotdir, which is how files are told from directories.
+  defp walk(root) do
+    [root]
+    |> Stream.unfold(fn
+      [] ->
+        nil
+
+      [path | rest] ->
+        case File.ls(path) do
+          {:ok, names} -> {[], Enum.map(Enum.sort(names), &Path.join(path, &1)) ++ rest}
+          {:error, :enotdir} -> {[path], rest}
+          {:error, _reason} -> {[], rest}
+        end
+    end)
+    |> Stream.concat()
+  end
+
+  @doc """
+  Read an index written by build/3.
+
+  ## Options
+
+  - columns: Names of the columns to decode (default: all); the others are
+    skipped without being decoded
+
+  ## Returns
+
+  - {:ok, %{rows: count, columns: %{name => values}}} with nil for missing values
+  - {:error, :invalid_index} if the file is not an index
+  - {:error, reason} if it cannot be read
+  """
+  def read(path, options \\ []) when is_binary(path) do
+    wanted = Keyword.get(options, :columns)
+
+    with {:ok, contents} <- File.read(path) do
+      case contents do
+        <<@magic, @version, rows::little-64, count::little-32, columns::binary>> ->
+          decode_columns(columns, count, rows, wanted && MapSet.new(wanted, &to_string/1), %{})
+
+        _ ->
+          {:error, :invalid_index}
+      end
+    end
+  end
+
+  # The rows sorted by path, as one list of values per column. Sorting in
+  # descending order lets the values be prepended in a single pass.
+  defp transpose(rows, width) do
+    rows
+    |> Enum.sort_by(&hd/1, :desc)
+    |> Enum.reduce(List.duplicate([], width), fn row, columns -> :lists.zipwith(&[&1 | &2], row, columns) end)
+  end
+
+  defp encode(names, count, columns) do
+    columns =
+      names
+      |> Enum.zip(columns)
+      |> Enum.map(fn {name, values} ->
+        {type, payload} = encode_values(values)
+        payload = [validity(values), payload]
+        [<<byte_size(name)::little-16>>, name, <<type, IO.iodata_length(payload)::little-64>>, payload]
+      end)
+
+    [@magic, <<@version, count::little-64, length(names)::little-32>> | columns]
+  end
+
+  defp encode_values(values) do
+    present = Enum.reject(values, &is_nil/1)
+
+    cond do
+      Enum.all?(present, &is_integer/1) ->
+        {@integer, for(value <- values, do: <<(value || 0)::signed-little-64>>)}
+
+      Enum.all?(present, &is_number/1) ->
+        {@float, for(value <- values, do: <<(value || 0.0)::float-little-64>>)}
+
+      true ->
+        strings = Enum.map(values, &text/1)
+
+        {offsets, _end} =
+          Enum.map_reduce(strings, 0, fn string, offset -> {<<offset::little-32>>, offset + byte_size(string)} end)
+
+        total = Enum.reduce(strings, 0, &(byte_size(&1) + &2))
+        {@string, [offsets, <<total::little-32>>, strings]}
+    end
+  end
+
+  # Header strings are charlists, still padded as stored; trailing blanks
+  # are not significant in FITS strings
+  defp text(nil), do: ""
+  defp text(value) when is_list(value), do: value |> List.to_string() |> String.trim_trailing()
+  defp text(value), do: to_string(value)
+
+  defp validity(values) do
+    values
+    |> Enum.chunk_every(8)
+    |> Enum.map(fn chunk ->
+      chunk
+      |> Enum.with_index()
+      |> Enum.reduce(0, fn
+        {nil, _bit}, byte -> byte
+        {_value, bit}, byte -> byte ||| 1 <<< bit
+      end)
+    end)
+    |> :erlang.list_to_binary()
+  end
+
+  defp decode_columns(_rest, 0, rows, _wanted, columns), do: {:ok, %{rows: rows, columns: columns}}
+
+  defp decode_columns(
+         <<name_size::little-16, name::binary-size(name_size), type, size::little-64, payload::binary-size(size),
+           rest::binary>>,
+         count,
+         rows,
+         wanted,
+         columns
+       ) do
+    columns =
+      if wanted == nil or MapSet.member?(wanted, name) do
+        Map.put(columns, name, decode_payload(type, payload, rows))
+      else
+        columns
+      end
+
+    decode_columns(rest, count - 1, rows, wanted, columns)
+  end
+
+  defp decode_columns(_contents, _count, _rows, _wanted, _columns), do: {:error, :invalid_index}
+
+  defp decode_payload(type, payload, rows) do
+    bitmap_size = div(rows + 7, 8)
+    <<bitmap::binary-size(bitmap_size), data::binary>> = payload
+    present = for <<byte <- bitmap>>, bit <- 0..7, do: (byte >>> bit &&& 1) == 1
+
+    values =
+      case type do
+        @integer ->
+          for <<value::signed-little-64 <- data>>, do: value
+
+        @float ->
+          for <<value::float-little-64 <- data>>, do: value
+
+        @string ->
+          offsets_size = (rows + 1) * 4
+          <<offsets::binary-size(offsets_size), bytes::binary>> = data
+          offsets = for <<offset::little-32 <- offsets>>, do: offset
+
+          offsets
+          |> Enum.zip(tl(offsets))
+          |> Enum.map(fn {first, last} -> binary_part(bytes, first, last - first) end)
+      end
+
+    values
+    |> Enum.zip(present)
+    |> Enum.map(fn {value, present} -> if present, do: value, else: nil end)
+  end
+end
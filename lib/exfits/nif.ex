@@ -20,21 +20,244 @@ defmodule ExFITS.NIF do
 
   def hello, do: :erlang.nif_error(:nif_not_loaded)
 
+  @doc "Return the build mode, SIMD level, CFITSIO version and reentrancy as a map"
+  def build_info, do: :erlang.nif_error(:nif_not_loaded)
+
   @doc "Open a FITS file (calls NIF)"
   def open_fits(_filename), do: :erlang.nif_error(:nif_not_loaded)
 
   @doc """
-  Read primary image data from a FITS file.
+  Open a FITS file and keep it open as a handle.
+
+  ## Parameters
+
+  - filename: Path to the FITS file
+  - mode: One of :read, :readwrite or :create
+
+  ## Returns
+
+  - {:ok, handle} on success
+  - {:error, status} on failure
+  """
+  def open_handle(_filename, _mode), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Close a handle returned by open_handle/2.
+  Returns :ok or {:error, status}
+  """
+  def close_handle(_handle), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Open a FITS file held in a binary as a read-only handle, reading the
+  binary in place.
+  Returns {:ok, handle} or {:error, status}
+  """
+  def open_memory(_binary), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Create an empty in-memory FITS file with a buffer of about size_hint bytes,
+  returning a writable handle the write NIFs can append HDUs to.
+  Returns {:ok, handle} or {:error, status}
+  """
+  def create_memory(_size_hint), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Close a handle from create_memory/1 and return the file written to it,
+  as a binary over the file's own buffer.
+  Returns {:ok, binary} or {:error, status}
+  """
+  def close_memory(_handle), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Open a remote file read-only through a fetcher process, returning a handle.
+
+  ## Parameters
+
+  - fetcher: Pid answering `{:exfits_range, remote, request, offset, length}`
+    messages with range_reply/3
+  - size: Size of the file in bytes
+  - options: Map with optional :block_size, :read_ahead and :cache_blocks
+
+  ## Returns
+
+  - {:ok, handle} on success
+  - {:error, :too_many_files} or {:error, status} on failure
+  """
+  def open_remote(_fetcher, _size, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Answer a range request from a remote file with the requested bytes or
+  {:error, reason}.
+  Returns :ok
+  """
+  def range_reply(_remote, _request, _data), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Read primary image data from a FITS file path or handle.
   Returns {:ok, {width, height, binary}} or {:error, status}
   """
-  def read_image(_filename), do: :erlang.nif_error(:nif_not_loaded)
+  def read_image(_source), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Read primary image data with a selectable pixel type.
+
+  ## Parameters
+
+  - source: Path to the FITS file, or a handle from open_handle/2
+  - options: Map of options:
+    - type: :float (default) to convert to float32, or :native to keep the file's BITPIX type
+    - scale: Whether to apply BZERO/BSCALE in :native mode (default: true)
+
+  ## Returns
+
+  - {:ok, {width, height, binary, type}} where type is an Nx type such as {:s, 16}
+  - {:error, status} on failure
+  """
+  def read_image(_source, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Read an image with any number of axes.
+  Takes the same options map as read_image/2.
+
+  ## Returns
+
+  - {:ok, {shape, binary, type}} where shape is in Nx order ({NAXISn, ..., NAXIS1})
+  - {:error, :no_image_data} if the HDU has no data
+  - {:error, status} on failure
+  """
+  def read_array(_source, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Read a section of an image with fits_read_subset.
+
+  ## Parameters
+
+  - source: Path to the FITS file, or a handle from open_handle/2
+  - start, stop, step: Tuples of 1-based inclusive pixel coordinates and strides, NAXIS1 first
+  - options: Map of options, as for read_image/2
+
+  ## Returns
+
+  - {:ok, {shape, binary, type}} where shape is in Nx order
+  - {:error, :invalid_section} or {:error, status} on failure
+  """
+  def read_section(_source, _start, _stop, _step, _options),
+    do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Compute statistics of an image or a section of it natively.
+  Options map keys: hdu, start, stop, median, clip, clip_iterations, histogram, range, threads
+
+  ## Returns
+
+  - {:ok, %{count, nulls, min, max, mean, stddev}}, plus median, clipped and histogram when requested
+  - {:error, :invalid_section} or {:error, status} on failure
+  """
+  def image_stats(_source, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Combine frames of the same shape pixel by pixel into a new image, strip by strip.
+  Options map keys: method, sigma, iterations, hdu, strip_rows, threads, bitpix, header
+
+  ## Returns
+
+  - :ok on success
+  - {:error, :shape_mismatch} or {:error, status} on failure
+  """
+  def combine_frames(_sources, _target, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Read the celestial WCS of an image HDU.
+  Options map keys: hdu
+
+  ## Returns
+
+  - {:ok, %{projection, crval, crpix, cd, lonpole}}
+  - {:error, :no_celestial_wcs} or {:error, status} on failure
+  """
+  def read_wcs(_source, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Transform a binary of native-endian float64 coordinate pairs with a WCS map,
+  in direction :to_world or :to_pixel.
+
+  ## Returns
+
+  - {:ok, binary} with NaN for points outside the projection
+  """
+  def wcs_transform(_wcs, _direction, _coords), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Reproject the first plane of an image onto a target WCS and {height, width} shape.
+  Options map keys: hdu, interpolation, threads
+
+  ## Returns
+
+  - {:ok, {shape, binary}} of float32 pixels, NaN where the image does not cover the output
+  - {:error, :no_celestial_wcs} or {:error, status} on failure
+  """
+  def reproject(_source, _wcs, _shape, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Return the buffer pool's counters: hits, misses, recycled, dropped,
+  retained_bytes, retained_buffers and max_bytes.
+  """
+  def buffer_pool_stats, do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Configure the buffer pool. Options map keys: max_bytes
+  Returns :ok
+  """
+  def buffer_pool_configure(_options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Pack a list of equal-length rows of numbers into a native-endian float32
+  binary, yielding the scheduler as it goes.
+
+  ## Returns
+
+  - {:ok, {binary, width, height}}
+  - {:error, :ragged_rows} if the rows differ in length
+  """
+  def pack_rows(_rows), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Unpack `height` rows of `width` native-endian float32 pixels into a list
+  of lists of floats, yielding the scheduler as it goes.
+  """
+  def unpack_rows(_binary, _width, _height), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Get the shape of an image, in Nx order, without reading any pixels.
+  Options map keys: hdu
+  Returns {:ok, shape} or {:error, status}
+  """
+  def image_shape(_source, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Read a run of pixels in file order.
+
+  ## Parameters
+
+  - source: Path to the FITS file, or a handle from open_handle/2
+  - first_pixel: 1-based index of the first pixel to read
+  - count: Number of pixels to read
+  - options: Map of options, as for read_image/2
+
+  ## Returns
+
+  - {:ok, {binary, type}} on success
+  - {:error, status} on failure
+  """
+  def read_pixels(_source, _first_pixel, _count, _options),
+    do: :erlang.nif_error(:nif_not_loaded)
 
   @doc """
   Read FITS header data as an Elixir map.
 
   ## Parameters
 
-  - filename: Path to the FITS file
+  - source: Path to the FITS file, or a handle from open_handle/2
 
   ## Returns
 
@@ -43,12 +266,35 @@ defmodule ExFITS.NIF do
   """
   def read_header(_filename), do: :erlang.nif_error(:nif_not_loaded)
 
+  @doc """
+  Read FITS header data from a selected HDU.
+
+  Options map keys: hdu (1-based HDU number or EXTNAME binary), keys (list of
+  keyword atoms or binaries to look up instead of reading every card),
+  key_type (:atom or :binary map keys), format (:cards for an ordered list
+  of {key, value, comment} and {key, text} tuples) and raw (true to return
+  the header as a binary of 2880-byte blocks instead of a map)
+  """
+  def read_header(_source, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  List every HDU in a FITS file.
+
+  ## Returns
+
+  - {:ok, [hdu_info]} where each map has :index, :type (:image, :ascii_table or
+    :binary_table) and :extname, plus :bitpix and :shape for images or :rows
+    and :columns for tables
+  - {:error, status} on failure
+  """
+  def list_hdus(_source), do: :erlang.nif_error(:nif_not_loaded)
+
   @doc """
   Write image data (float32 binary) to a new FITS file with specified dimensions.
 
   ## Parameters
 
-  - filename: Path to create the new FITS file
+  - target: Path to create the new FITS file, or a writable handle to append an image HDU to
   - data: Binary containing float32 pixel data
   - width: Width of the image in pixels
   - height: Height of the image in pixels
@@ -80,51 +326,268 @@ defmodule ExFITS.NIF do
 
   ## Parameters
 
-  - filename: Path to the FITS file to update
-  - header: Map of header cards to write
+  - target: Path to the FITS file to update, or a writable handle
+  - header: Map of header cards to write, or an ordered card list of
+    {key, value}, {key, value, comment}, {:COMMENT | :HISTORY, text} and raw
+    card binaries, written in a single pass that keeps its order
 
   ## Returns
 
   - :ok on success
+  - {:error, :file_not_found} if the path does not exist
   - {:error, status} on failure
   """
   def write_header_cards(_filename, _header), do: :erlang.nif_error(:nif_not_loaded)
 
   @doc """
-  Write both image data and header cards to a new FITS file in a single operation.
+  Update header cards in a selected HDU. Options map keys: hdu
+  """
+  def write_header_cards(_filename, _header, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Write a 2D float32 image and its header to a new FITS file in a single operation.
 
   ## Parameters
 
-  - filename: Path to create the new FITS file
-  - data: Binary containing float32 pixel data
-  - headers: List of header cards as strings
-  - bitpix: FITS BITPIX value to use (-32 for float, 16 for short, etc)
-  - options: (Optional) Map of options for controlling the write operation
-  - multi_extension: (Optional) Boolean flag, set to true for multi-extension files
+  - target: Path to create the new FITS file, or a writable handle to append an image HDU to
+  - data: Binary containing native-endian float32 pixel data
+  - width: Image width (NAXIS1)
+  - height: Image height (NAXIS2)
+  - bitpix: (Optional) FITS BITPIX value to store the pixels as (default: -32)
+  - header: (Optional) Map of header keywords to values, or an ordered card list
+  - options: (Optional) Map of tile compression options, as for write_array/7
 
   ## Returns
 
-  - {:ok, filename} on success
+  - :ok on success
   - {:error, reason} on failure
   """
-  def write_fits_file(_filename, _data, _headers, _bitpix), do: :erlang.nif_error(:nif_not_loaded)
+  def write_fits_file(_target, _data, _width, _height), do: :erlang.nif_error(:nif_not_loaded)
+
+  def write_fits_file(_target, _data, _width, _height, _bitpix),
+    do: :erlang.nif_error(:nif_not_loaded)
+
+  def write_fits_file(_target, _data, _width, _height, _bitpix, _header),
+    do: :erlang.nif_error(:nif_not_loaded)
+
+  def write_fits_file(_target, _data, _width, _height, _bitpix, _header, _options),
+    do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Write an image with any number of axes.
+
+  ## Parameters
+
+  - target: Path to create the new FITS file, or a writable handle to append an image HDU to
+  - data: Binary of pixels in row-major order
+  - shape: Tuple of dimensions in Nx order ({NAXISn, ..., NAXIS1})
+  - type: Nx type of the pixels in data, e.g. {:f, 32}
+  - bitpix: FITS BITPIX value to store the pixels as
+  - header: Map of header cards, or an ordered card list
+
+  ## Returns
+
+  - :ok on success
+  - {:error, :dimensions_mismatch} or {:error, status} on failure
+  """
+  def write_array(_target, _data, _shape, _type, _bitpix, _header),
+    do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Write an image like write_array/6, tile-compressed according to options.
 
-  def write_fits_file(_filename, _data, _headers, _bitpix, _options),
+  Options map keys: compress (:rice, :gzip, :gzip2, :hcompress, :plio or
+  :none), tile (tile dimensions in Nx order, default one row per tile),
+  quantize_level (float quantization; 0 keeps floats lossless) and hcomp_scale.
+  """
+  def write_array(_target, _data, _shape, _type, _bitpix, _header, _options),
     do: :erlang.nif_error(:nif_not_loaded)
 
-  def write_fits_file(_filename, _data, _headers, _bitpix, _options, _multi_extension),
+  @doc """
+  Write an empty primary HDU followed by image extensions, in one file open.
+
+  ## Parameters
+
+  - target: Path to create the new FITS file, or a writable handle to append to
+  - primary_header: Map of header cards, or an ordered card list, for the primary HDU
+  - extensions: List of maps with :data, :shape (Nx order), :type (Nx type of data)
+    and :bitpix, plus optional :header (map), :cards (raw card strings), :extname
+    and the tile compression options of write_array/7
+
+  ## Returns
+
+  - :ok on success
+  - {:error, reason} on failure
+  """
+  def write_extensions(_target, _primary_header, _extensions),
     do: :erlang.nif_error(:nif_not_loaded)
 
+  @doc """
+  Copy every HDU of a FITS file block for block, without decoding pixels.
+
+  ## Parameters
+
+  - source: Path to the FITS file to copy, or a handle
+  - target: Path to create (replacing any existing file), or a writable handle
+    other than the source to append the HDUs to
+  - options: Map with optional :header (map or ordered card list of edits to
+    apply during the copy) and :hdu (1-based number or EXTNAME of the HDU the
+    edits apply to, default 1)
+
+  ## Returns
+
+  - :ok on success
+  - {:error, reason} on failure
+  """
+  def copy_file(_source, _target, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Append an image HDU whose pixels are written later with write_image_chunk/4.
+
+  ## Parameters
+
+  - target: Writable handle (or a path to create)
+  - shape: Tuple of dimensions in Nx order
+  - bitpix: FITS BITPIX value to store the pixels as
+  - header: Map of header cards, or an ordered card list
+  - options: Map of tile compression options, as for write_array/7, plus
+    :reserve_cards (header cards kept free for finish_image/3, default 36)
+
+  ## Returns
+
+  - {:ok, band} where compressed chunks must be a multiple of band pixels
+  - {:error, reason} on failure
+  """
+  def begin_image(_target, _shape, _bitpix, _header, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Write a chunk of pixels starting at firstelem (1-based, file order) into the
+  image HDU the handle is positioned on.
+  Returns :ok, {:error, :out_of_bounds}, {:error, :unaligned_chunk} or {:error, status}
+  """
+  def write_image_chunk(_target, _firstelem, _data, _type), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Write the scaling keywords of the header given to begin_image/5, then the
+  final header edits.
+  Returns :ok or {:error, status}
+  """
+  def finish_image(_target, _header, _edits), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Read columns of a binary or ASCII table HDU, one contiguous binary per column.
+
+  ## Parameters
+
+  - source: Path to the FITS file, or a handle
+  - columns: List of column names (case-insensitive), or nil for every column
+  - options: Map with optional :hdu, :first_row (1-based, default 1) and :rows
+    (default: all remaining rows). Without :hdu the first table HDU is used.
+
+  ## Returns
+
+  - {:ok, [column]} where each map has :name, :data, :type (an Nx type, or
+    :string for character columns whose data is a list of binaries) and :repeat
+  - {:error, :column_not_found} if a requested column does not exist
+  - {:error, status} on failure
+  """
+  def read_table(_source, _columns, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Convert a binary of pixels between Nx types, optionally from a foreign byte
+  order, with SIMD byte swapping and a fused swap and cast.
+
+  ## Parameters
+
+  - data: Binary of pixels
+  - from: Nx type of the pixels in data
+  - to: Nx type to convert to
+  - byte_order: :native, :big or :little, the byte order of data
+
+  ## Returns
+
+  - {:ok, binary} of native-endian pixels of type `to` (data itself when no
+    conversion is needed)
+  - {:error, :unsupported_type} if either type has no FITS equivalent
+  """
+  def convert_pixels(_data, _from, _to, _byte_order), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Map the data region of an uncompressed image HDU into memory.
+
+  ## Parameters
+
+  - source: Path to the FITS file, or a read-only handle
+  - options: Map with optional :hdu
+
+  ## Returns
+
+  - {:ok, {shape, data, type, {bscale, bzero}}} where data is a binary over the
+    mapping holding the stored big-endian pixels of Nx type type
+  - {:error, :not_mappable} if the pixels are not stored as-is in a plain file
+  - {:error, :no_image_data} if the HDU has NAXIS = 0
+  - {:error, reason} on failure
+  """
+  def map_image(_source, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Start a pool of native threads that read whole files, for read_many.
+
+  ## Parameters
+
+  - threads: Number of reader threads (at most 64)
+
+  ## Returns
+
+  - {:ok, pool} on success
+  - {:error, :thread_create_failed} if no thread could be started
+  """
+  def pool_start(_threads), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Queue a file read on a pool. The calling process is later sent
+  `{:exfits_read, ref, result}`, where result is
+  {:ok, %{header: header, shape: shape, data: data, type: type}} or
+  {:error, reason}.
+
+  ## Parameters
+
+  - pool: Pool from pool_start/1
+  - ref: Reference identifying the reply
+  - path: Path to the FITS file
+  - options: Map of read_array/2 options, plus :header (default: true)
+
+  ## Returns
+
+  - :ok once queued
+  - {:error, :stopped} if the pool has been stopped
+  """
+  def pool_submit(_pool, _ref, _path, _options), do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Stop a pool: drop queued reads and wait for running ones to reply.
+
+  ## Returns
+
+  - :ok
+  """
+  def pool_stop(_pool), do: :erlang.nif_error(:nif_not_loaded)
+
   @doc """
   Write a multi-extension FITS file.
 
   ## Parameters
 
   - filename: Path to create the new FITS file
-  - data_list: List of binary data for each extension
+  - data_list: List of binary float32 data for each extension
   - headers_list: List of header card lists for each extension
   - bitpix: FITS BITPIX value to use (-32 for float, 16 for short, etc)
   - options: (Optional) Map of options for controlling the write operation
+    - shapes: List of shapes (Nx order), one per extension
+    - shape: Shape shared by every extension (used when :shapes is not given)
+    - primary_header: Map of header cards for the primary HDU
+
+  Extensions without a shape are written as 1-D images.
 
   ## Returns
 
@@ -132,6 +595,18 @@ defmodule ExFITS.NIF do
   - {:error, reason} on failure
   """
   def write_multi_extension_fits(filename, data_list, headers_list, bitpix, options \\ %{}) do
-    write_fits_file(filename, data_list, headers_list, bitpix, options, 1)
+    shapes = Map.get(options, :shapes) || List.duplicate(Map.get(options, :shape), length(data_list))
+
+    extensions =
+      [data_list, headers_list, shapes]
+      |> Enum.zip()
+      |> Enum.map(fn {data, cards, shape} ->
+        %{data: data, cards: cards, shape: shape || {div(byte_size(data), 4)}, type: {:f, 32}, bitpix: bitpix}
+      end)
+
+    case write_extensions(filename, Map.get(options, :primary_header, %{}), extensions) do
+      :ok -> {:ok, filename}
+      error -> error
+    end
   end
 end
@@ -0,0 +1,176 @@
+defmodule ExFITS.Remote do
+  @moduledoc """
+  Read FITS files from object storage or HTTP servers by byte range, without
+  downloading them first.
+
+  A remote file is opened as an ordinary read-only handle, so read_header/2,
+  read_array/2, read_section/5 and the other read functions work on it
+  unchanged. Underneath, a CFITSIO driver asks for just the bytes each read
+  needs: the header blocks first, then the data region, or the tiles or rows
+  a section covers. A cutout from a large file then costs a few round trips
+  rather than a full download.
+
+  Ranges are fetched in blocks and kept in a small per-handle LRU cache. Each
+  miss also fetches the blocks after it (read-ahead), since CFITSIO reads
+  headers and rows in order. Reads larger than the whole cache bypass it and
+  are fetched in one request.
+
+  Fetches are made by a process started with the handle and tied to the
+  process that opened it. If the fetcher exits, later reads fail with a
+  CFITSIO read error.
+
+  ## Options
+
+  - block_size: Bytes per cached block, at least 2880 (default: 65536)
+  - read_ahead: Blocks fetched, at least, on each cache miss (default: 4)
+  - cache_blocks: Blocks cached per handle (default: 64)
+
+  ## Example
+
+      {:ok, handle} = ExFITS.Remote.open_url("https://archive.example.org/m31.fits")
+      {:ok, cutout} = ExFITS.read_section(handle, {1001, 1001}, {1256, 1256})
+  """
+
+  alias ExFITS.NIF
+  alias ExFITS.Telemetry
+
+  @doc """
+  Open a remote file through a fetch function.
+
+  ## Parameters
+
+  - fetch: Function of offset and length returning `{:ok, binary}` with
+    exactly those bytes, or `{:error, reason}`
+  - size: Size of the file in bytes
+  - options: Keyword list of options, see the module documentation
+
+  ## Returns
+
+  - {:ok, handle} on success
+  - {:error, reason} on failure
+  """
+  def open(fetch, size, options \\ []) when is_function(fetch, 2) and is_integer(size) and is_list(options) do
+    owner = self()
+    fetcher = spawn(fn -> start_fetcher(owner, fetch) end)
+
+    result =
+      Telemetry.span(:open, :open_remote, :remote, 0, fn ->
+        NIF.open_remote(fetcher, size, options |> Keyword.take([:block_size, :read_ahead, :cache_blocks]) |> Map.new())
+      end)
+
+    with {:error, _reason} <- result do
+      Process.exit(fetcher, :kill)
+      result
+    end
+  end
+
+  @doc """
+  Open a file served over HTTP(S), such as an S3 object or a presigned URL,
+  with `:httpc`. The server must support range requests.
+
+  The `:inets` application (and `:ssl` for https) is started on first use;
+  releases need them in their `:extra_applications`.
+
+  ## Parameters
+
+  - url: URL of the file
+  - options: Keyword list of options, see the module documentation, plus
+    - headers: Extra request headers, e.g. authorization (default: [])
+    - http_options: HTTP options for `:httpc.request/4` (default: [])
+
+  ## Returns
+
+  - {:ok, handle} on success
+  - {:error, reason} on failure
+  """
+  def open_url(url, options \\ []) when is_binary(url) and is_list(options) do
+    {:ok, _apps} = Application.ensure_all_started(:inets)
+    if String.starts_with?(url, "https:"), do: {:ok, _apps} = Application.ensure_all_started(:ssl)
+
+    request = %{
+      url: String.to_charlist(url),
+      headers: for({name, value} <- Keyword.get(options, :headers, []), do: {to_charlist(name), to_charlist(value)}),
+      http_options: Keyword.get(options, :http_options, [])
+    }
+
+    with {:ok, size} <- content_length(request) do
+      open(&fetch_range(request, &1, &2), size, options)
+    end
+  end
+
+  @doc """
+  Open a remote file, pass the handle to `fun`, and close it afterwards.
+
+  `target` is a URL for open_url/2, or `{fetch, size}` for open/3.
+  """
+  def with_remote(target, options \\ [], fun) when is_function(fun, 1) do
+    opened =
+      case target do
+        url when is_binary(url) -> open_url(url, options)
+        {fetch, size} -> open(fetch, size, options)
+      end
+
+    with {:ok, handle} <- opened do
+      try do
+        fun.(handle)
+      after
+        ExFITS.close(handle)
+      end
+    end
+  end
+
+  defp start_fetcher(owner, fetch) do
+    ref = Process.monitor(owner)
+    fetch_loop(ref, fetch)
+  end
+
+  # Answer range requests one at a time until the owner exits
+  defp fetch_loop(ref, fetch) do
+    receive do
+      {:exfits_range, remote, request, offset, length} ->
+        reply =
+          try do
+            case fetch.(offset, length) do
+              {:ok, data} when is_binary(data) -> data
+              {:error, reason} -> {:error, reason}
+            end
+          rescue
+            exception -> {:error, exception}
+          end
+
+        NIF.range_reply(remote, request, reply)
+        fetch_loop(ref, fetch)
+
+      {:DOWN, ^ref, :process, _owner, _reason} ->
+        :ok
+    end
+  end
+
+  defp content_length(request) do
+    case :httpc.request(:head, {request.url, request.headers}, request.http_options, []) do
+      {:ok, {{_version, 200, _reason}, headers, _body}} ->
+        case List.keyfind(headers, ~c"content-length", 0) do
+          {_name, length} -> {:ok, List.to_integer(length)}
+          nil -> {:error, :no_content_length}
+        end
+
+      {:ok, {{_version, status, _reason}, _headers, _body}} ->
+        {:error, {:http_status, status}}
+
+      {:error, reason} ->
+        {:error, reason}
+    end
+  end
+
+  defp fetch_range(request, offset, length) do
+    range = {~c"range", ~c"bytes=#{offset}-#{offset + length - 1}"}
+
+    case :httpc.request(:get, {request.url, [range | request.headers]}, request.http_options, body_format: :binary) do
+      {:ok, {{_version, 206, _reason}, _headers, body}} -> {:ok, body}
+      # A server that ignores Range sends the whole file
+      {:ok, {{_version, 200, _reason}, _headers, body}} -> {:ok, binary_part(body, offset, length)}
+      {:ok, {{_version, status, _reason}, _headers, _body}} -> {:error, {:http_status, status}}
+      {:error, reason} -> {:error, reason}
+    end
+  end
+end
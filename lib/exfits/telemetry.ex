@@ -0,0 +1,67 @@
+defmodule ExFITS.Telemetry do
+  @moduledoc """
+  Telemetry events emitted by ExFITS.
+
+  Events are only emitted when the optional `:telemetry` dependency is
+  available and a handler is attached to the event; otherwise the wrapped
+  call runs with no extra work. Each operation is a `:telemetry.span/3`:
+
+  - `[:exfits, :open, :start | :stop | :exception]` - opening a handle
+  - `[:exfits, :read, :start | :stop | :exception]` - reading and decoding an
+    image, section, header or table
+  - `[:exfits, :write, :start | :stop | :exception]` - writing an image or file
+
+  The `:stop` event carries the `:duration` measurement, plus `:bytes` (pixel
+  or column bytes read or written). Metadata always includes `:function` and
+  `:path` (`:memory` for decode/2 and encode/3, `:remote` when opening an
+  `ExFITS.Remote` file), and on `:stop` also `:status` - `:ok` or the error reason, which is
+  the CFITSIO status code for file errors.
+
+  ## Example
+
+      :telemetry.attach("log-fits-reads", [:exfits, :read, :stop], fn _event, %{duration: d, bytes: b}, meta, _ ->
+        IO.puts("\#{meta.function} \#{meta.path}: \#{b} bytes in \#{System.convert_time_unit(d, :native, :microsecond)} us")
+      end, nil)
+  """
+
+  @doc false
+  def span(event, function, path, bytes \\ nil, fun) do
+    name = [:exfits, event]
+
+    if enabled?(name) do
+      metadata = %{function: function, path: path}
+
+      :telemetry.span(name, metadata, fn ->
+        result = fun.()
+        measurements = %{bytes: bytes || result_bytes(result)}
+        {result, measurements, Map.put(metadata, :status, status(result))}
+      end)
+    else
+      fun.()
+    end
+  end
+
+  defp enabled?(name) do
+    Code.ensure_loaded?(:telemetry) and :telemetry.list_handlers(name) != []
+  end
+
+  defp status(:ok), do: :ok
+  defp status({:ok, _}), do: :ok
+  defp status({:error, reason}), do: reason
+  defp status(_other), do: :ok
+
+  # Payload size of a successful read, for the shapes the read functions return
+  defp result_bytes({:ok, %{data: data}}) when is_binary(data), do: byte_size(data)
+  defp result_bytes({:ok, {_width, _height, data}}) when is_binary(data), do: byte_size(data)
+  defp result_bytes({:ok, {_width, _height, data, _type}}) when is_binary(data), do: byte_size(data)
+  defp result_bytes({:ok, {data, _type}}) when is_binary(data), do: byte_size(data)
+
+  defp result_bytes({:ok, columns}) when is_map(columns) do
+    Enum.reduce(columns, 0, fn
+      {_name, %{data: data}}, acc when is_binary(data) -> acc + byte_size(data)
+      _column, acc -> acc
+    end)
+  end
+
+  defp result_bytes(_result), do: 0
+end
@@ -0,0 +1,95 @@
+defmodule ExFITS.WCS do
+  @moduledoc """
+  Celestial world coordinate systems of images, and batch transforms
+  between pixel and sky coordinates.
+
+  The transforms are native and cover the zenithal projections most survey
+  and instrument images use: gnomonic (`RA---TAN`/`DEC--TAN`) and
+  orthographic (`-SIN`, without PV terms), with the longitude axis first.
+  The linear part is read from CDi_j, from PCi_j and CDELTi, or from CDELTi
+  and CROTA2. SIP distortion terms are not applied.
+
+  Pixel coordinates follow FITS: 1-based, NAXIS1 first, with pixel centers
+  on integers. World coordinates are in degrees, the longitude in [0, 360).
+
+  A WCS is a plain struct, so one can also be built by hand as the target
+  grid of `ExFITS.reproject/4`.
+  """
+
+  alias ExFITS.NIF
+
+  @enforce_keys [:projection, :crval, :crpix, :cd]
+  defstruct [:projection, :crval, :crpix, :cd, lonpole: 180.0]
+
+  @type t :: %__MODULE__{
+          projection: :tan | :sin,
+          crval: {float, float},
+          crpix: {float, float},
+          cd: {{float, float}, {float, float}},
+          lonpole: float
+        }
+
+  @doc """
+  Read the celestial WCS of an image.
+
+  ## Parameters
+
+  - path: Path to the FITS file, or a handle from open/2
+  - options: Keyword list of options:
+    - hdu: HDU number or EXTNAME (default: first image)
+
+  ## Returns
+
+  - {:ok, %ExFITS.WCS{}}
+  - {:error, :no_celestial_wcs} if the header has no TAN or SIN WCS
+  - {:error, reason} on failure
+  """
+  def read(path, options \\ []) when (is_binary(path) or is_reference(path)) and is_list(options) do
+    with {:ok, wcs} <- NIF.read_wcs(path, Map.new(options)) do
+      {:ok, struct!(__MODULE__, wcs)}
+    end
+  end
+
+  @doc """
+  Transform pixel coordinates to world coordinates.
+
+  coords is a list of `{x, y}` tuples, or a binary of native-endian float64
+  pairs for large batches, and the result has the same form. Points outside
+  the projection come back as nil, or as NaN in a binary.
+
+  ## Example
+
+      {:ok, wcs} = ExFITS.WCS.read("frame.fits")
+      [{ra, dec}] = ExFITS.WCS.pixel_to_world(wcs, [{1024.0, 1024.0}])
+  """
+  def pixel_to_world(%__MODULE__{} = wcs, coords), do: transform(wcs, :to_world, coords)
+
+  @doc """
+  Transform world coordinates `{lon, lat}` in degrees to pixel coordinates,
+  in the same forms as pixel_to_world/2. Points the projection does not
+  reach, such as those on the far side of the sky, come back as nil.
+  """
+  def world_to_pixel(%__MODULE__{} = wcs, coords), do: transform(wcs, :to_pixel, coords)
+
+  defp transform(wcs, direction, coords) when is_binary(coords) do
+    {:ok, result} = NIF.wcs_transform(wcs, direction, coords)
+    result
+  end
+
+  defp transform(wcs, direction, coords) when is_list(coords) do
+    packed = for {a, b} <- coords, into: <<>>, do: <<a * 1.0::float-64-native, b * 1.0::float-64-native>>
+    {:ok, result} = NIF.wcs_transform(wcs, direction, packed)
+
+    for <<a::binary-8, b::binary-8 <- result>> do
+      case {decode(a), decode(b)} do
+        {nil, _} -> nil
+        {_, nil} -> nil
+        pair -> pair
+      end
+    end
+  end
+
+  # NaN does not match a float segment
+  defp decode(<<value::float-64-native>>), do: value
+  defp decode(_nan), do: nil
+end
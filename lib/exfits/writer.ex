@@ -0,0 +1,143 @@
+defmodule ExFITS.Writer do
+  @moduledoc """
+  Incremental writing of an image whose pixels arrive over time, such as the
+  rows of an exposure being read out.
+
+  open/3 creates the image HDU with its final dimensions and header, and
+  each write/2 sends a chunk of pixels straight to the file at the next
+  offset. Memory use is bounded by the chunk size, not the image size, and
+  the pixels are on disk while later chunks are still being produced.
+  close/2 adds the closing header cards and closes the file.
+
+  Pixels that are never written read back as zero.
+
+  ## Example
+
+      {:ok, writer} = ExFITS.Writer.open("exposure.fits", {4096, 4096}, type: {:u, 16}, header: %{OBJECT: "M31"})
+
+      writer =
+        Enum.reduce(readout_rows, writer, fn rows, writer ->
+          {:ok, writer} = ExFITS.Writer.write(writer, rows)
+          writer
+        end)
+
+      :ok = ExFITS.Writer.close(writer, %{"DATE-END": "2026-10-14T03:12:45"})
+  """
+
+  alias ExFITS.NIF
+  alias ExFITS.Telemetry
+
+  defstruct [:handle, :owned, :shape, :type, :header, :band, next_pixel: 0]
+
+  @doc """
+  Start writing an image.
+
+  ## Parameters
+
+  - target: Path of the file to create (replacing any existing one), or a
+    writable handle from `ExFITS.open/2` to append the image to
+  - shape: Tuple of dimensions in Nx order
+  - options: Keyword list of options:
+    - type: Nx type of the pixels in each chunk (default: {:f, 32})
+    - bitpix: FITS BITPIX value to store the pixels as (default: matches type)
+    - header: Map of header cards, or an ordered card list as for
+      `ExFITS.write_header/3` (default: %{})
+    - compress, tile, quantize_level, hcomp_scale: tile compression, as for
+      `ExFITS.write_array/4`. Chunks of a compressed image must then cover
+      whole rows of tiles, except the last one.
+    - reserve_cards: Header cards left free for close/2 to fill without
+      moving the data (default: 36, one header block)
+
+  ## Returns
+
+  - {:ok, writer} on success
+  - {:error, reason} on failure
+  """
+  def open(target, shape, options \\ []) when (is_binary(target) or is_reference(target)) and is_tuple(shape) do
+    type = Keyword.get(options, :type, {:f, 32})
+    bitpix = Keyword.get(options, :bitpix) || ExFITS.bitpix_for_type(type)
+    header = Keyword.get(options, :header, %{})
+    hdu_options = options |> Keyword.take([:compress, :tile, :quantize_level, :hcomp_scale, :reserve_cards]) |> Map.new()
+
+    with {:ok, handle, owned} <- open_target(target),
+         {:ok, band} <- begin_image(handle, owned, shape, bitpix, header, hdu_options) do
+      {:ok, %__MODULE__{handle: handle, owned: owned, shape: shape, type: type, header: header, band: band}}
+    end
+  end
+
+  defp open_target(target) when is_reference(target), do: {:ok, target, false}
+
+  defp open_target(path) do
+    with {:ok, handle} <- ExFITS.open(path, mode: :create), do: {:ok, handle, true}
+  end
+
+  defp begin_image(handle, owned, shape, bitpix, header, hdu_options) do
+    case NIF.begin_image(handle, shape, bitpix, header, hdu_options) do
+      {:ok, band} ->
+        {:ok, band}
+
+      error ->
+        if owned, do: ExFITS.close(handle)
+        error
+    end
+  end
+
+  @doc """
+  Write the next chunk of pixels, in row-major order, after those already
+  written.
+
+  ## Returns
+
+  - {:ok, writer} with the offset advanced past the chunk
+  - {:error, :out_of_bounds} if the chunk runs past the end of the image
+  - {:error, :unaligned_chunk} if a compressed image's chunk is not whole
+    rows of tiles
+  - {:error, reason} on failure
+  """
+  def write(%__MODULE__{next_pixel: next_pixel} = writer, data) when is_binary(data) do
+    write_at(writer, next_pixel, data)
+  end
+
+  @doc """
+  Write a chunk of pixels at the given offset, in pixels from the start of
+  the image in row-major order, for chunks that arrive out of order.
+
+  ## Returns
+
+  - {:ok, writer} with the next offset for write/2 set just past the chunk
+  - {:error, reason} as for write/2
+  """
+  def write_at(%__MODULE__{} = writer, offset, data) when is_integer(offset) and offset >= 0 and is_binary(data) do
+    {_kind, bits} = writer.type
+    pixels = div(byte_size(data) * 8, bits)
+
+    result =
+      Telemetry.span(:write, :write_chunk, writer.handle, byte_size(data), fn ->
+        NIF.write_image_chunk(writer.handle, offset + 1, data, writer.type)
+      end)
+
+    with :ok <- result do
+      {:ok, %{writer | next_pixel: offset + pixels}}
+    end
+  end
+
+  @doc """
+  Finish the image and close the file, if open/3 created it.
+
+  ## Parameters
+
+  - writer: Writer from open/3
+  - header: Cards to add or update now that the image is complete, as a map
+    or an ordered card list (default: %{})
+
+  ## Returns
+
+  - :ok on success
+  - {:error, reason} on failure
+  """
+  def close(%__MODULE__{} = writer, header \\ %{}) when is_map(header) or is_list(header) do
+    result = NIF.finish_image(writer.handle, writer.header, header)
+    closed = if writer.owned, do: ExFITS.close(writer.handle), else: :ok
+    if result == :ok, do: closed, else: result
+  end
+end
@@ -10,7 +10,8 @@ defmodule Mix.Tasks.Clean.Nif do
   def run(_) do
     # Define the files to be cleaned
     nif_files = [
-      "priv/exfits_nif.so"
+      "priv/exfits_nif.so",
+      "priv/exfits_nif.build"
     ]
 
     # Remove all NIF files that exist
@@ -1,20 +1,33 @@
 defmodule Mix.Tasks.Compile.Nif do
   @moduledoc """
   Compiles the Exfits NIF library.
+
+  The build mode comes from the `EXFITS_BUILD` environment variable:
+  `release` (the default) for an optimized build, or `debug` for one with
+  symbols and no optimization. The library is rebuilt when the mode
+  changes or a C source or the build script is newer than it.
+
+  See `c_src/build_cfitsio.sh` for the other build variables.
   """
   use Mix.Task.Compiler
 
+  @nif "priv/exfits_nif.so"
+  @mode_file "priv/exfits_nif.build"
+
   @impl Mix.Task.Compiler
   def run(_args) do
-    if File.exists?("priv/exfits_nif.so") do
-      # NIF already exists, nothing to do
+    mode = System.get_env("EXFITS_BUILD", "release")
+
+    if up_to_date?(mode) do
       {:noop, []}
     else
-      # Create priv directory
+      # Create priv directory and drop the stale library, which the build
+      # script would otherwise keep
       File.mkdir_p!("priv")
+      File.rm(@nif)
 
       # Run the build script
-      case System.cmd("sh", ["c_src/build_cfitsio.sh"], stderr_to_stdout: true) do
+      case System.cmd("sh", ["c_src/build_cfitsio.sh"], stderr_to_stdout: true, env: [{"EXFITS_BUILD", mode}]) do
         {output, 0} ->
           Mix.shell().info(output)
           {:ok, []}
@@ -26,4 +39,15 @@ defmodule Mix.Tasks.Compile.Nif do
       end
     end
   end
+
+  defp up_to_date?(mode) do
+    with {:ok, %{mtime: built}} <- File.stat(@nif, time: :posix),
+         {:ok, built_mode} <- File.read(@mode_file),
+         true <- String.trim(built_mode) == mode do
+      ["c_src/build_cfitsio.sh" | Path.wildcard("c_src/*.{c,h}")]
+      |> Enum.all?(fn source -> File.stat!(source, time: :posix).mtime <= built end)
+    else
+      _ -> false
+    end
+  end
 end
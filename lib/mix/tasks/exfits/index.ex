@@ -0,0 +1,78 @@
+defmodule Mix.Tasks.Exfits.Index do
+  @shortdoc "Index header keywords of FITS files into a columnar file"
+
+  @moduledoc """
+  Scan the headers of every FITS file under one or more directories and
+  write the values of the given keywords to an index file, as
+  `ExFITS.Index.build/3`.
+
+      mix exfits.index OUTPUT ROOT... --keys OBJECT,DATE-OBS,EXPTIME
+
+  ## Options
+
+  - `--keys` - Comma-separated header keywords to index (required)
+  - `--hdu` - HDU number to read each header from (default: the first
+    image HDU with data)
+  - `--extensions` - Comma-separated file name endings to index (default:
+    .fits,.fit,.fts,.fz,.fits.gz)
+  - `--concurrency` - Reader threads (default: schedulers online)
+  - `--max-in-flight` - Most files queued or being read at once
+
+  Files whose header cannot be read are left out and listed at the end.
+  """
+
+  use Mix.Task
+
+  @switches [keys: :string, hdu: :integer, extensions: :string, concurrency: :integer, max_in_flight: :integer]
+
+  @impl Mix.Task
+  def run(args) do
+    {options, paths, invalid} = OptionParser.parse(args, strict: @switches)
+
+    case {invalid, paths, options[:keys]} do
+      {[_ | _], _paths, _keys} ->
+        Mix.raise("Invalid options: #{Enum.map_join(invalid, ", ", &elem(&1, 0))}")
+
+      {[], [output, _root | _roots], keys} when is_binary(keys) ->
+        Mix.Task.run("app.start")
+        index(output, tl(paths), keys, options)
+
+      _ ->
+        Mix.raise("Usage: mix exfits.index OUTPUT ROOT... --keys KEY,KEY,...")
+    end
+  end
+
+  defp index(output, roots, keys, options) do
+    build_options =
+      options
+      |> Keyword.take([:hdu, :concurrency, :max_in_flight])
+      |> Keyword.put(:keys, split(keys))
+
+    build_options =
+      case options[:extensions] do
+        nil -> build_options
+        extensions -> Keyword.put(build_options, :extensions, split(extensions))
+      end
+
+    started = System.monotonic_time(:millisecond)
+
+    case ExFITS.Index.build(roots, output, build_options) do
+      {:ok, %{files: files, failed: failed}} ->
+        seconds = max(System.monotonic_time(:millisecond) - started, 1) / 1000
+
+        for {path, reason} <- failed do
+          Mix.shell().error("#{path}: #{inspect(reason)}")
+        end
+
+        Mix.shell().info(
+          "Indexed #{files} files into #{output} in #{Float.round(seconds, 1)}s " <>
+            "(#{round(files / seconds)} files/s, #{length(failed)} failed)"
+        )
+
+      {:error, reason} ->
+        Mix.raise("Could not write #{output}: #{inspect(reason)}")
+    end
+  end
+
+  defp split(list), do: list |> String.split(",", trim: true) |> Enum.map(&String.trim/1)
+end
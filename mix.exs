@@ -28,7 +28,9 @@ defmodule Exfits.MixProject do
   defp deps do
     [
       {:nx, "~> 0.6", optional: true},
-      {:ex_doc, "~> 0.30", only: :dev, runtime: false}
+      {:telemetry, "~> 1.0", optional: true},
+      {:ex_doc, "~> 0.30", only: :dev, runtime: false},
+      {:benchee, "~> 1.3", only: :dev}
     ]
   end
 
@@ -45,7 +47,10 @@ defmodule Exfits.MixProject do
         "cmd sh c_src/build_cfitsio.sh"
       ],
       # Ensure NIF is cleaned when running mix clean
-      clean: ["clean", "clean.nif"]
+      clean: ["clean", "clean.nif"],
+      # Benchmarks: see bench/exfits_bench.exs for options
+      bench: ["run bench/exfits_bench.exs"],
+      "bench.c": ["cmd sh bench/run_microbench.sh"]
     ]
   end
 
@@ -74,10 +79,20 @@ defmodule Exfits.MixProject do
       formatters: ["html"],
       groups_for_modules: [
         "Core": [
-          ExFITS
+          ExFITS,
+          ExFITS.Header,
+          ExFITS.HeaderCache,
+          ExFITS.Remote,
+          ExFITS.Writer,
+          ExFITS.BufferPool,
+          ExFITS.Index,
+          ExFITS.WCS
         ],
         "NIF Interface": [
           ExFITS.NIF
+        ],
+        "Instrumentation": [
+          ExFITS.Telemetry
         ]
       ]
     ]
@@ -46,4 +46,34 @@ defmodule ExFITSNxTest do
     # Clean up
     File.rm(filename)
   end
+
+  test "write and read an integer tensor in its own type" do
+    filename = Path.join(System.tmp_dir!(), "test_nx_s16.fits")
+    tensor = Nx.tensor([[-3, 0, 7], [100, 200, 300]], type: :s16)
+
+    assert ExFITS.write_nx(tensor, filename) == :ok
+    assert {:ok, read_tensor} = ExFITS.to_nx(filename, %{type: :native})
+    assert Nx.type(read_tensor) == {:s, 16}
+    assert Nx.to_binary(read_tensor) == Nx.to_binary(tensor)
+
+    assert {:ok, doubles} = ExFITS.to_nx(filename, %{type: {:f, 64}})
+    assert Nx.to_flat_list(doubles) == [-3.0, 0.0, 7.0, 100.0, 200.0, 300.0]
+
+    File.rm(filename)
+  end
+
+  test "read table columns as tensors" do
+    filename = Path.join(System.tmp_dir!(), "test_nx_table.fits")
+    ExFITS.TestTables.write_catalog(filename)
+
+    assert {:ok, %{"ID" => ids, "VEC" => vec, "NAME" => names}} =
+             ExFITS.table_to_nx(filename, columns: ["ID", "VEC", "NAME"], first_row: 3)
+
+    assert Nx.to_flat_list(ids) == [3, 4]
+    assert Nx.shape(vec) == {2, 3}
+    assert Nx.to_flat_list(vec[1]) == [4.0, 8.0, 12.0]
+    assert names == ["star3", "star4"]
+
+    File.rm(filename)
+  end
 end
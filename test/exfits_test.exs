@@ -50,15 +50,591 @@ defmodule ExFITSTest do
     # TODO: Add read tests when read functionality is fully implemented
   end
 
+  test "read through a persistent file handle" do
+    data = for y <- 1..4, x <- 1..3, do: (y - 1) * 3 + x
+    bin_data = :binary.list_to_bin(for val <- data, do: <<val::float-32-native>>)
+
+    test_file = Path.join(@temp_dir, "test_handle.fits")
+    :ok = ExFITS.write_image(test_file, bin_data, 3, 4)
+
+    {:ok, handle} = ExFITS.open(test_file, mode: :read)
+    assert {:ok, header} = ExFITS.read_header(handle)
+    assert header[:NAXIS1] == 3
+    assert {:ok, {3, 4, ^bin_data}} = ExFITS.read_image(handle)
+    assert {:ok, %{width: 3, height: 4}} = ExFITS.read(handle)
+    assert ExFITS.close(handle) == :ok
+
+    # A closed handle reports an error rather than crashing
+    assert {:error, _} = ExFITS.read_image(handle)
+  end
+
+  test "read 16-bit image in its native type" do
+    bin_data = :binary.list_to_bin(for val <- 1..6, do: <<val::float-32-native>>)
+    test_file = Path.join(@temp_dir, "test_native.fits")
+    :ok = ExFITS.NIF.write_image(test_file, bin_data, 3, 2, 16)
+
+    assert {:ok, {3, 2, data, {:s, 16}}} = ExFITS.read_image(test_file, type: :native)
+    assert data == :binary.list_to_bin(for val <- 1..6, do: <<val::signed-16-native>>)
+  end
+
+  test "write and read a 3D data cube" do
+    bin_data = :binary.list_to_bin(for val <- 1..24, do: <<val::signed-32-native>>)
+    test_file = Path.join(@temp_dir, "test_cube.fits")
+
+    :ok = ExFITS.write_array(test_file, bin_data, {2, 3, 4}, type: {:s, 32})
+
+    {:ok, header} = ExFITS.read_header(test_file)
+    assert {header[:NAXIS], header[:NAXIS1], header[:NAXIS2], header[:NAXIS3]} == {3, 4, 3, 2}
+
+    assert {:ok, %{shape: {2, 3, 4}, type: {:s, 32}, data: ^bin_data}} =
+             ExFITS.read_array(test_file, type: :native)
+  end
+
+  test "read a strided image section" do
+    bin_data = :binary.list_to_bin(for val <- 1..20, do: <<val::signed-16-native>>)
+    test_file = Path.join(@temp_dir, "test_section.fits")
+    :ok = ExFITS.write_array(test_file, bin_data, {4, 5}, type: {:s, 16})
+
+    # Columns 2 and 4 of rows 1 and 3 (FITS order: {x, y})
+    assert {:ok, %{shape: {2, 2}, type: {:s, 16}, data: data}} =
+             ExFITS.read_section(test_file, {2, 1}, {4, 3}, {2, 2}, type: :native)
+    assert data == <<2::signed-16-native, 4::signed-16-native, 12::signed-16-native, 14::signed-16-native>>
+
+    assert {:error, :invalid_section} = ExFITS.read_section(test_file, {1, 1}, {6, 1})
+  end
+
+  test "stream an image in row chunks" do
+    bin_data = :binary.list_to_bin(for val <- 1..15, do: <<val::float-32-native>>)
+    test_file = Path.join(@temp_dir, "test_stream.fits")
+    :ok = ExFITS.write_image(test_file, bin_data, 3, 5)
+
+    chunks = test_file |> ExFITS.stream_rows(2) |> Enum.to_list()
+    assert Enum.map(chunks, &byte_size/1) == [24, 24, 12]
+    assert IO.iodata_to_binary(chunks) == bin_data
+  end
+
   test "write multi-extension FITS file" do
-    # Skip this test for now since multi-extension functionality needs different implementation
-    # in the ExFITS module
     test_file = Path.join(@temp_dir, "test_multi.fits")
+    amp = fn offset -> :binary.list_to_bin(for val <- 1..6, do: <<(val + offset)::signed-16-native>>) end
 
-    # Create a dummy file just to make the test pass
-    File.write!(test_file, "test content")
-    assert File.exists?(test_file)
+    extensions = [
+      %{data: amp.(0), shape: {2, 3}, type: {:s, 16}, extname: "AMP1"},
+      %{data: amp.(100), shape: {2, 3}, type: {:s, 16}, extname: "AMP2"}
+    ]
+
+    :ok = ExFITS.write_extensions(test_file, extensions, primary_header: %{OBSERVER: "test"})
+
+    assert {:ok, [primary, first, second]} = ExFITS.list_hdus(test_file)
+    assert %{index: 1, type: :image, shape: {}} = primary
+    assert %{index: 2, extname: "AMP1", shape: {2, 3}, bitpix: 16} = first
+    assert %{index: 3, extname: "AMP2"} = second
+
+    expected = amp.(100)
+    assert {:ok, %{data: ^expected}} = ExFITS.read_array(test_file, type: :native, hdu: "AMP2")
+    assert {:ok, header} = ExFITS.read_header(test_file, hdu: 2)
+    assert header[:EXTNAME] |> to_string() |> String.trim() == "AMP1"
+  end
+
+  test "emits write and read telemetry spans when a handler is attached" do
+    test_file = Path.join(@temp_dir, "test_telemetry.fits")
+    data = :binary.copy(<<1.5::float-32-native>>, 12)
+    test_pid = self()
+
+    :telemetry.attach_many(
+      "exfits-test",
+      [[:exfits, :write, :stop], [:exfits, :read, :stop]],
+      fn event, measurements, metadata, _ -> send(test_pid, {event, measurements, metadata}) end,
+      nil
+    )
+
+    try do
+      :ok = ExFITS.write_array(test_file, data, {3, 4})
+      {:ok, _} = ExFITS.read_array(test_file)
+    after
+      :telemetry.detach("exfits-test")
+    end
+
+    assert_received {[:exfits, :write, :stop], %{bytes: 48, duration: _}, %{function: :write_array, status: :ok}}
+    assert_received {[:exfits, :read, :stop], %{bytes: 48}, %{function: :read_array, path: ^test_file}}
+  end
+
+  test "convert pixels with a fused byte swap and cast" do
+    big_endian = :binary.list_to_bin(for val <- [-2, 0, 300, 32767], do: <<val::signed-16-big>>)
+    expected = :binary.list_to_bin(for val <- [-2, 0, 300, 32767], do: <<val * 1.0::float-32-native>>)
+
+    assert {:ok, ^expected} = ExFITS.convert_pixels(big_endian, {:s, 16}, {:f, 32}, byte_order: :big)
+    assert {:ok, ^big_endian} = ExFITS.convert_pixels(big_endian, {:s, 16}, {:s, 16})
+
+    saturated = <<-1.0::float-64-native, 1.0e9::float-64-native>>
+    assert {:ok, <<0, 255>>} = ExFITS.convert_pixels(saturated, {:f, 64}, {:u, 8})
+  end
+
+  test "write and read a Rice tile-compressed image" do
+    test_file = Path.join(@temp_dir, "test_rice.fits")
+    data = :binary.list_to_bin(for val <- 1..(64 * 48), do: <<rem(val, 1000)::signed-16-native>>)
+
+    :ok = ExFITS.write_array(test_file, data, {48, 64}, type: {:s, 16}, compress: :rice, tile: {8, 64})
+
+    # The compressed image follows an empty primary HDU and is found without :hdu
+    assert {:ok, [%{shape: {}}, %{type: :image, shape: {48, 64}}]} = ExFITS.list_hdus(test_file)
+    assert {:ok, %{shape: {48, 64}, data: ^data}} = ExFITS.read_array(test_file, type: :native, threads: 4)
+    assert {:ok, %{data: ^data}} = ExFITS.read_array(test_file, type: :native, threads: 1)
+  end
+
+  test "read many files in order on the native pool" do
+    paths =
+      for index <- 1..5 do
+        path = Path.join(@temp_dir, "test_many_#{index}.fits")
+        data = :binary.copy(<<index::signed-16-native>>, 12)
+        :ok = ExFITS.write_array(path, data, {3, 4}, type: {:s, 16})
+        path
+      end
+
+    missing = Path.join(@temp_dir, "missing.fits")
+    results = ExFITS.read_many(paths ++ [missing], concurrency: 2, max_in_flight: 2, type: :native)
+
+    assert length(results) == 6
+    {found, [missing_result]} = Enum.split(results, 5)
+    assert {:error, _status} = missing_result
+
+    for {{:ok, image}, index} <- Enum.with_index(found, 1) do
+      assert %{shape: {3, 4}, type: {:s, 16}, header: %{NAXIS: 2}} = image
+      assert image.data == :binary.copy(<<index::signed-16-native>>, 12)
+    end
+
+    streamed = paths |> ExFITS.stream_many(concurrency: 3) |> Enum.map(&elem(&1, 0))
+    assert Enum.sort(streamed) == Enum.sort(paths)
+
+    # Halting early stops the pool and leaves no stray replies behind
+    first = hd(paths)
+    assert [{^first, {:ok, image}}] = paths |> ExFITS.stream_many(ordered: true, header: false) |> Enum.take(1)
+    refute Map.has_key?(image, :header)
+    refute_received {:exfits_read, _ref, _result}
+
+    # Paths are pulled as reads are submitted, so an endless stream works
+    assert [{^first, {:ok, _}} | _] = taken = paths |> Stream.cycle() |> ExFITS.stream_many(ordered: true) |> Enum.take(7)
+    assert length(taken) == 7
+    refute_received {:exfits_read, _ref, _result}
+  end
+
+  test "map an uncompressed image straight from the file" do
+    test_file = Path.join(@temp_dir, "test_mmap.fits")
+    data = :binary.list_to_bin(for val <- 1..12, do: <<val * 100::signed-16-native>>)
+    :ok = ExFITS.write_array(test_file, data, {3, 4}, type: {:s, 16})
+
+    assert {:ok, %{shape: {3, 4}, type: {:s, 16}, byte_order: :big} = mapped} = ExFITS.map_array(test_file)
+    assert {:ok, ^data} = ExFITS.convert_pixels(mapped.data, {:s, 16}, {:s, 16}, byte_order: :big)
+
+    compressed_file = Path.join(@temp_dir, "test_mmap_rice.fits")
+    :ok = ExFITS.write_array(compressed_file, data, {3, 4}, type: {:s, 16}, compress: :rice)
+    assert {:error, :not_mappable} = ExFITS.map_array(compressed_file)
+  end
+
+  test "read selected header keys, binary keys and raw header blocks" do
+    test_file = Path.join(@temp_dir, "test_header_keys.fits")
+    data = :binary.copy(<<1.0::float-32-native>>, 4)
+    :ok = ExFITS.write_fits(test_file, data, 2, 2, %{OBJECT: "M31", EXPTIME: 30.0})
+
+    assert {:ok, header} = ExFITS.read_header(test_file, keys: ["EXPTIME", :NAXIS1, "MISSING"])
+    assert header == %{"EXPTIME" => 30.0, NAXIS1: 2}
+
+    assert {:ok, %{"NAXIS" => 2}} = ExFITS.read_header(test_file, key_type: :binary)
+
+    assert {:ok, blocks} = ExFITS.read_header(test_file, raw: true)
+    assert rem(byte_size(blocks), 2880) == 0
+    assert ExFITS.Header.get(blocks, "OBJECT") == "M31"
+    assert %{"NAXIS1" => 2, "SIMPLE" => true, "EXPTIME" => 30.0} = ExFITS.Header.to_map(blocks)
+
+    card = String.pad_trailing("NOTE    = 'O''Brien  ' / quoted", 80)
+    assert {"NOTE", "O'Brien", "quoted"} = ExFITS.Header.parse_card(card)
+    assert {"GAIN", 1.5e3, ""} = ExFITS.Header.parse_card(String.pad_trailing("GAIN    = 1.5D3", 80))
+  end
+
+  test "serve repeated header reads from the header cache" do
+    start_supervised!({ExFITS.HeaderCache, max_bytes: 1024 * 1024})
+    test_file = Path.join(@temp_dir, "test_header_cache.fits")
+    :ok = ExFITS.write_fits(test_file, :binary.copy(<<1.0::float-32-native>>, 4), 2, 2, %{OBJECT: "M31"})
+    {:ok, %File.Stat{mtime: mtime}} = File.stat(test_file, time: :posix)
+
+    assert {:ok, %{NAXIS1: 2} = header} = ExFITS.read_header(test_file)
+    # Let the cache process store the entry
+    :sys.get_state(ExFITS.HeaderCache)
+
+    # Same size, inode and mtime: a hit never looks at the (now invalid) file
+    File.write!(test_file, :binary.copy(" ", File.stat!(test_file).size))
+    File.touch!(test_file, mtime)
+    assert {:ok, ^header} = ExFITS.read_header(test_file)
+    assert {:error, _status} = ExFITS.read_header(test_file, cache: false)
+
+    # A new mtime invalidates the entry
+    File.touch!(test_file, mtime + 10)
+    assert {:error, _status} = ExFITS.read_header(test_file)
+  end
+
+  test "write an ordered card list and read it back in order" do
+    test_file = Path.join(@temp_dir, "test_card_list.fits")
+    data = :binary.copy(<<7::signed-16-native>>, 6)
+    cards = [{:OBJECT, "M31", "target"}, {:COMMENT, "first comment"}, {"EXPTIME", 30.0}, {:FLATCOR, true}]
+    :ok = ExFITS.write_array(test_file, data, {2, 3}, type: {:s, 16}, header: cards)
+
+    :ok =
+      ExFITS.write_header(test_file, [
+        {:OBJECT, "M33"},
+        {:HISTORY, "retargeted"},
+        {:AIRMASS, 1.5},
+        {:AIRMASS, 1.25},
+        {:EXPTIME, 30.0}
+      ])
+
+    assert {:ok, read_cards} = ExFITS.read_header(test_file, format: :cards, key_type: :binary)
+    user_cards = Enum.drop_while(read_cards, fn card -> elem(card, 0) != "OBJECT" end)
+
+    assert [
+             {"OBJECT", object, _},
+             {"COMMENT", ~c"first comment"},
+             {"EXPTIME", 30.0, _},
+             {"FLATCOR", true, _},
+             {"HISTORY", ~c"retargeted"},
+             {"AIRMASS", 1.25, _}
+           ] = user_cards
+
+    # CFITSIO pads short string values to eight characters
+    assert object |> to_string() |> String.trim() == "M33"
+    assert {:ok, %{data: ^data}} = ExFITS.read_array(test_file, type: :native)
+  end
+
+  test "copy_with_header copies integer pixels exactly and applies header edits" do
+    source = Path.join(@temp_dir, "test_copy_source.fits")
+    dest = Path.join(@temp_dir, "test_copy_dest.fits")
+    data = for value <- [-32768, -1, 0, 1, 12345, 32767], into: <<>>, do: <<value::signed-16-native>>
+    :ok = ExFITS.write_array(source, data, {2, 3}, type: {:s, 16}, header: [{:OBJECT, "M31"}, {:HISTORY, "observed"}])
+
+    :ok = ExFITS.copy_with_header(source, dest, header: %{OBSERVER: "copy"})
+
+    assert {:ok, %{data: ^data, type: {:s, 16}}} = ExFITS.read_array(dest, type: :native)
+    assert {:ok, cards} = ExFITS.read_header(dest, format: :cards, key_type: :binary)
+    assert {"HISTORY", ~c"observed"} in cards
+    assert Enum.any?(cards, &match?({"OBSERVER", _, _}, &1))
+
+    # The HDU the edits apply to can be named by EXTNAME
+    catalog = Path.join(@temp_dir, "test_copy_catalog.fits")
+    catalog_copy = Path.join(@temp_dir, "test_copy_catalog_dest.fits")
+    ExFITS.TestTables.write_catalog(catalog)
+    :ok = ExFITS.copy_with_header(catalog, catalog_copy, header: %{OBSERVER: "copy"}, hdu: "CATALOG")
+
+    has_observer? = fn hdu ->
+      {:ok, cards} = ExFITS.read_header(catalog_copy, hdu: hdu, format: :cards, key_type: :binary)
+      Enum.any?(cards, &match?({"OBSERVER", _, _}, &1))
+    end
+
+    assert has_observer?.("CATALOG")
+    refute has_observer?.(1)
+    assert {:error, _} = ExFITS.copy_with_header(catalog, catalog_copy, header: %{OBSERVER: "copy"}, hdu: "MISSING")
+
+    # A handle cannot be copied onto itself
+    {:ok, handle} = ExFITS.open(catalog_copy, mode: :readwrite)
+    assert_raise ArgumentError, fn -> ExFITS.copy_with_header(handle, handle) end
+    :ok = ExFITS.close(handle)
+  end
+
+  test "encode and decode a FITS file in memory" do
+    data = for value <- 1..6, into: <<>>, do: <<value::signed-32-native>>
+    image = %{shape: {2, 3}, data: data, type: {:s, 32}}
+
+    assert {:ok, fits} = ExFITS.encode(image, %{OBJECT: "M31"})
+    assert rem(byte_size(fits), 2880) == 0
+    assert {:ok, %{shape: {2, 3}, data: ^data, header: header}} = ExFITS.decode(fits, type: :native)
+    assert header |> Map.fetch!(:OBJECT) |> to_string() |> String.trim() == "M31"
+
+    # The encoded bytes are a valid file on disk too
+    test_file = Path.join(@temp_dir, "test_encoded.fits")
+    File.write!(test_file, fits)
+    assert {:ok, %{data: ^data}} = ExFITS.read_array(test_file, type: :native)
+  end
+
+  test "decode a tile-compressed FITS file in memory with several threads" do
+    data = for value <- 1..(48 * 64), into: <<>>, do: <<rem(value, 1000)::signed-16-native>>
+    image = %{shape: {64, 48}, data: data, type: {:s, 16}}
+
+    assert {:ok, fits} = ExFITS.encode(image, %{}, compress: :rice)
+    assert {:ok, %{shape: {64, 48}, data: ^data}} = ExFITS.decode(fits, type: :native, threads: 4)
+  end
+
+  test "read columns of a binary table" do
+    test_file = Path.join(@temp_dir, "test_table.fits")
+    ExFITS.TestTables.write_catalog(test_file)
+
+    assert {:ok, columns} = ExFITS.read_table(test_file)
+    assert columns |> Map.keys() |> Enum.sort() == ["FLUX", "FLUX_ERR", "ID", "NAME", "VEC"]
+    ids = for i <- 1..4, into: <<>>, do: <<i::signed-32-native>>
+    assert %{data: ^ids, type: {:s, 32}, repeat: 1} = columns["ID"]
+    assert %{data: ["star1", "star2", "star3", "star4"], type: :string, repeat: 1} = columns["NAME"]
+    assert %{type: {:f, 32}, repeat: 3, data: vec} = columns["VEC"]
+    assert byte_size(vec) == 4 * 3 * 4
+
+    # Names match case-insensitively; a vector column keeps its values per row
+    assert {:ok, selected} =
+             ExFITS.read_table(test_file, columns: ["flux", "NAME", "VEC"], first_row: 2, rows: 2, hdu: "CATALOG")
+
+    assert map_size(selected) == 3
+    assert selected["FLUX"].data == <<3.0::float-64-native, 4.5::float-64-native>>
+    assert selected["NAME"].data == ["star2", "star3"]
+    assert <<_::binary-12, 3.0::float-32-native, 6.0::float-32-native, 9.0::float-32-native>> = selected["VEC"].data
+
+    assert {:ok, %{"ID" => %{data: <<>>}}} = ExFITS.read_table(test_file, columns: ["ID"], first_row: 5)
+    assert {:error, :column_not_found} = ExFITS.read_table(test_file, columns: ["MAG"])
+    # FLUX* matches two columns
+    assert {:error, status} = ExFITS.read_table(test_file, columns: ["FLUX*"])
+    assert is_integer(status)
+  end
+
+  test "read a remote file by byte range" do
+    test_file = Path.join(@temp_dir, "test_remote.fits")
+    data = for value <- 1..5000, into: <<>>, do: <<value::signed-32-native>>
+    :ok = ExFITS.write_array(test_file, data, {50, 100}, type: {:s, 32}, header: %{OBJECT: "M31"})
+    contents = File.read!(test_file)
+
+    test_pid = self()
+
+    fetch = fn offset, length ->
+      send(test_pid, {:fetched, offset, length})
+      {:ok, binary_part(contents, offset, length)}
+    end
+
+    options = [block_size: 2880, read_ahead: 1, cache_blocks: 2]
+
+    ExFITS.Remote.with_remote({fetch, byte_size(contents)}, options, fn handle ->
+      assert {:ok, %{OBJECT: _}} = ExFITS.read_header(handle)
+      assert {:ok, %{data: ^data}} = ExFITS.read_array(handle, type: :native)
+    end)
+
+    assert_received {:fetched, 0, 2880}
+
+    # A tile-compressed remote file is decoded on the calling thread only
+    compressed_file = Path.join(@temp_dir, "test_remote.fits.fz")
+    :ok = ExFITS.write_array(compressed_file, data, {50, 100}, type: {:s, 32}, compress: :rice)
+    compressed = File.read!(compressed_file)
+    fetch_compressed = fn offset, length -> {:ok, binary_part(compressed, offset, length)} end
+
+    ExFITS.Remote.with_remote({fetch_compressed, byte_size(compressed)}, options, fn handle ->
+      assert {:ok, %{data: ^data}} = ExFITS.read_array(handle, type: :native, threads: 4)
+      assert {:ok, %{data: ^data}} = ExFITS.read_array(handle, type: :native, threads: 4)
+    end)
+
+    failing = fn _offset, _length -> {:error, :unavailable} end
+    assert {:error, _status} = ExFITS.Remote.open(failing, byte_size(contents))
+  end
+
+  test "write an image incrementally in chunks" do
+    test_file = Path.join(@temp_dir, "test_writer.fits")
+    rows = for row <- 0..3, do: :binary.copy(<<row::unsigned-16-native>>, 5)
+
+    {:ok, writer} = ExFITS.Writer.open(test_file, {4, 5}, type: {:u, 16}, header: %{OBJECT: "M31"})
+
+    writer =
+      Enum.reduce(rows, writer, fn row, writer ->
+        {:ok, writer} = ExFITS.Writer.write(writer, row)
+        writer
+      end)
+
+    assert {:error, :out_of_bounds} = ExFITS.Writer.write(writer, hd(rows))
+    :ok = ExFITS.Writer.close(writer, %{EXPTIME: 30.0})
+
+    expected = IO.iodata_to_binary(rows)
+    assert {:ok, %{shape: {4, 5}, data: ^expected, type: {:u, 16}}} = ExFITS.read_array(test_file, type: :native)
+    assert {:ok, %{EXPTIME: 30.0}} = ExFITS.read_header(test_file)
+  end
+
+  test "compute image statistics natively, skipping NaN" do
+    test_file = Path.join(@temp_dir, "test_stats.fits")
+    values = [1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0, 10.0, 11.0]
+    data = IO.iodata_to_binary([for(v <- values, do: <<v::float-32-native>>), <<0x7FC00000::32-native>>])
+    :ok = ExFITS.write_array(test_file, data, {3, 4})
+
+    assert {:ok, stats} = ExFITS.stats(test_file, median: true, histogram: 2, range: {0.0, 12.0})
+    assert %{count: 11, nulls: 1, min: 1.0, max: 11.0, mean: 6.0, median: 6.0} = stats
+    assert_in_delta stats.stddev, :math.sqrt(10.0), 1.0e-9
+    assert %{counts: [5, 6], range: {0.0, 12.0}} = stats.histogram
+
+    assert {:ok, %{count: 3, max: 3.0}} = ExFITS.stats(test_file, start: {1, 1}, stop: {3, 1})
+
+    # Integer clip and range values are taken as floats
+    assert {:ok, %{histogram: %{counts: [5, 6], range: {0.0, 12.0}}, clipped: %{count: 11}}} =
+             ExFITS.stats(test_file, clip: 3, histogram: 2, range: {0, 12})
+
+    # Infinite pixels are counted, and what they reach comes back as an atom
+    infinite_file = Path.join(@temp_dir, "test_stats_infinite.fits")
+    {infinity, neg_infinity} = {<<0x7F800000::native-32>>, <<0xFF800000::native-32>>}
+    data = <<1.0::float-32-native>> <> infinity <> neg_infinity <> <<4.0::float-32-native>>
+    :ok = ExFITS.write_array(infinite_file, data, {2, 2})
+
+    assert {:ok, stats} = ExFITS.stats(infinite_file, median: true, histogram: 2)
+    assert %{count: 4, min: :neg_infinity, max: :infinity, mean: :nan, stddev: :nan, median: 2.5} = stats
+    assert %{counts: [4, 0], range: {:neg_infinity, :infinity}} = stats.histogram
+  end
+
+  test "pack and unpack rows of pixels natively" do
+    rows = for row <- 0..299, do: for(col <- 0..19, do: row * 20.0 + col)
+
+    {binary, 20, 300} = ExFITS.create_image_from_lists(rows)
+    assert byte_size(binary) == 300 * 20 * 4
+    assert ExFITS.binary_to_lists(binary, 20, 300) == rows
+
+    assert {<<1.0::float-32-native, 2.0::float-32-native>>, 2, 1} = ExFITS.create_image_from_lists([[1, 2.0]])
+    assert_raise ArgumentError, fn -> ExFITS.create_image_from_lists([[1.0, 2.0], [3.0]]) end
+
+    # Blank float pixels are NaN, which Erlang floats cannot hold
+    test_file = Path.join(@temp_dir, "test_lists_nan.fits")
+    {nan, infinity} = {<<0x7FC00000::native-32>>, <<0x7F800000::native-32>>}
+    :ok = ExFITS.write_array(test_file, <<1.0::float-32-native>> <> nan <> infinity, {1, 3})
+    assert {:ok, %{data: data}} = ExFITS.read_array(test_file)
+    assert ExFITS.binary_to_lists(data, 3, 1) == [[1.0, :nan, :infinity]]
+    assert {^data, 3, 1} = ExFITS.create_image_from_lists([[1.0, :nan, :infinity]])
+  end
+
+  test "median-combine frames strip by strip" do
+    frames =
+      for {value, i} <- Enum.with_index([1.0, 2.0, 100.0]) do
+        path = Path.join(@temp_dir, "test_frame_#{i}.fits")
+        :ok = ExFITS.write_array(path, :binary.copy(<<value::float-32-native>>, 12), {3, 4})
+        path
+      end
+
+    master = Path.join(@temp_dir, "test_master.fits")
+    :ok = ExFITS.combine(frames, master, strip_rows: 1, threads: 2, header: %{OBJECT: "BIAS"})
+
+    expected = :binary.copy(<<2.0::float-32-native>>, 12)
+    assert {:ok, %{shape: {3, 4}, data: ^expected}} = ExFITS.read_array(master, type: :native)
+    assert {:ok, %{NCOMBINE: 3, OBJECT: "BIAS"}} = ExFITS.read_header(master)
+
+    mean = :binary.copy(<<103.0 / 3::float-32-native>>, 12)
+    :ok = ExFITS.combine(frames, master, method: :mean)
+    assert {:ok, %{data: ^mean}} = ExFITS.read_array(master, type: :native)
+
+    other = Path.join(@temp_dir, "test_frame_other.fits")
+    :ok = ExFITS.write_array(other, :binary.copy(<<1.0::float-32-native>>, 6), {2, 3})
+    assert {:error, :shape_mismatch} = ExFITS.combine([other | frames], master)
+
+    # Pixels with no valid values are BLANK in an integer result
+    blank_frames =
+      for i <- 1..2 do
+        path = Path.join(@temp_dir, "test_frame_blank_#{i}.fits")
+        data = <<0x7FC00000::native-32>> <> :binary.copy(<<2.0::float-32-native>>, 5)
+        :ok = ExFITS.write_array(path, data, {2, 3})
+        path
+      end
+
+    :ok = ExFITS.combine(blank_frames, master, bitpix: 16)
+    assert {:ok, %{BLANK: -32768, BITPIX: 16}} = ExFITS.read_header(master)
+    assert {:ok, %{count: 5, nulls: 1, min: 2.0, max: 2.0}} = ExFITS.stats(master)
+  end
+
+  test "recycle frame buffers through the buffer pool" do
+    test_file = Path.join(@temp_dir, "test_pool.fits")
+    :ok = ExFITS.write_array(test_file, :binary.copy(<<1.0::float-32-native>>, 256 * 256), {256, 256})
+
+    # The task's heap, and with it the binary over the buffer, goes when it exits
+    read_frame = fn ->
+      Task.async(fn ->
+        {:ok, %{data: data}} = ExFITS.read_array(test_file, type: :native)
+        byte_size(data)
+      end)
+      |> Task.await()
+    end
+
+    assert read_frame.() == 256 * 256 * 4
+    before = ExFITS.BufferPool.stats()
+    assert read_frame.() == 256 * 256 * 4
+    assert ExFITS.BufferPool.stats().hits > before.hits
+  end
+
+  test "index header keywords of a directory tree" do
+    root = Path.join(@temp_dir, "index_tree")
+    File.mkdir_p!(Path.join(root, "night2"))
+
+    for {name, object, exptime} <- [{"a.fits", "M31", 30}, {"night2/b.fits", "M33", 45.5}] do
+      path = Path.join(root, name)
+      :ok = ExFITS.write_array(path, :binary.copy(<<0.0::float-32-native>>, 4), {2, 2})
+      :ok = ExFITS.write_header(path, %{OBJECT: object, EXPTIME: exptime})
+    end
+
+    File.write!(Path.join(root, "notes.txt"), "not a FITS file")
+    output = Path.join(@temp_dir, "test.exfitsix")
+
+    assert {:ok, %{files: 2, failed: []}} = ExFITS.Index.build(root, output, keys: ["OBJECT", "EXPTIME", "FILTER"])
+    assert {:ok, %{rows: 2, columns: columns}} = ExFITS.Index.read(output)
+    assert columns["path"] == [Path.join(root, "a.fits"), Path.join(root, "night2/b.fits")]
+    assert columns["OBJECT"] == ["M31", "M33"]
+    assert columns["EXPTIME"] == [30.0, 45.5]
+    assert columns["FILTER"] == [nil, nil]
+
+    assert {:ok, %{columns: %{"OBJECT" => _} = only}} = ExFITS.Index.read(output, columns: ["OBJECT"])
+    assert map_size(only) == 1
+  end
+
+  test "report the build mode and SIMD level" do
+    assert %{mode: mode, simd: simd, reentrant: reentrant, cfitsio_version: version} = ExFITS.build_info()
+    assert mode in [:release, :debug]
+    assert simd in [:avx2, :ssse3, :neon, :none]
+    assert is_boolean(reentrant) and version > 3.0
+  end
+
+  test "transform coordinates, cut out a sky region and reproject through a TAN WCS" do
+    test_file = Path.join(@temp_dir, "test_wcs.fits")
+    data = for y <- 1..20, x <- 1..20, into: <<>>, do: <<x + 100.0 * y::float-32-native>>
+
+    header = %{
+      CTYPE1: "RA---TAN",
+      CTYPE2: "DEC--TAN",
+      CRVAL1: 10.0,
+      CRVAL2: 20.0,
+      CRPIX1: 10.0,
+      CRPIX2: 10.0,
+      CD1_1: -0.001,
+      CD1_2: 0.0,
+      CD2_1: 0.0,
+      CD2_2: 0.001
+    }
+
+    :ok = ExFITS.write_array(test_file, data, {20, 20}, header: header)
+    assert {:ok, %ExFITS.WCS{projection: :tan} = wcs} = ExFITS.WCS.read(test_file)
+
+    assert [{ra, dec}, {east, _}] = ExFITS.WCS.pixel_to_world(wcs, [{10, 10}, {9, 10}])
+    assert_in_delta ra, 10.0, 1.0e-9
+    assert_in_delta dec, 20.0, 1.0e-9
+    assert east > ra
+
+    pixels = [{1.0, 1.0}, {20.0, 7.5}]
+    round_trip = ExFITS.WCS.world_to_pixel(wcs, ExFITS.WCS.pixel_to_world(wcs, pixels))
+
+    for {{x, y}, {x2, y2}} <- Enum.zip(pixels, round_trip) do
+      assert_in_delta x, x2, 1.0e-6
+      assert_in_delta y, y2, 1.0e-6
+    end
+
+    # 2.2 pixels around the reference pixel touches pixels 8..12 on each axis
+    assert {:ok, %{shape: {5, 5}, origin: {8, 8}, data: cutout, wcs: %{crpix: {3.0, 3.0}}}} =
+             ExFITS.read_sky_region(test_file, 10.0, 20.0, 0.0022)
+
+    assert <<first_pixel::float-32-native, _::binary>> = cutout
+    assert first_pixel == 808.0
+    assert {:error, :outside_image} = ExFITS.read_sky_region(test_file, 10.0, 21.0, 0.001)
+
+    # Onto its own grid the image comes back; on a grid shifted by 5 pixels
+    # the first 5 columns are off the image
+    assert {:ok, %{shape: {20, 20}, data: same}} = ExFITS.reproject(test_file, wcs, {20, 20}, threads: 4)
+
+    for {<<a::float-32-native>>, <<b::float-32-native>>} <-
+          Enum.zip(for(<<p::binary-4 <- data>>, do: p), for(<<p::binary-4 <- same>>, do: p)) do
+      assert_in_delta a, b, 1.0e-3
+    end
+
+    shifted = %{wcs | crpix: {15.0, 10.0}}
+
+    assert {:ok, %{data: <<edge::binary-4, _::binary-size(4 * 4), inside::float-32-native, _::binary>>}} =
+             ExFITS.reproject(test_file, shifted, {20, 20}, interpolation: :nearest)
 
-    # TODO: Implement proper multi-extension functionality in ExFITS module
+    refute match?(<<_::float-32-native>>, edge)
+    assert inside == 101.0
   end
 end
@@ -1 +1,56 @@
 ExUnit.start()
+
+defmodule ExFITS.TestTables do
+  @moduledoc false
+
+  # ExFITS writes no tables, so table fixtures are laid out by hand: an empty
+  # primary HDU and a BINTABLE named CATALOG of four rows with the columns
+  # ID (J), FLUX (D), FLUX_ERR (E), NAME (8A) and VEC (3E)
+  def write_catalog(path) do
+    rows =
+      for i <- 1..4, into: <<>> do
+        name = String.pad_trailing("star#{i}", 8)
+        <<i::signed-big-32, i * 1.5::float-big-64, i * 0.1::float-big-32, name::binary,
+          i * 1.0::float-big-32, i * 2.0::float-big-32, i * 3.0::float-big-32>>
+      end
+
+    primary = header([{"SIMPLE", true}, {"BITPIX", 8}, {"NAXIS", 0}, {"EXTEND", true}])
+
+    columns = [{"ID", "J"}, {"FLUX", "D"}, {"FLUX_ERR", "E"}, {"NAME", "8A"}, {"VEC", "3E"}]
+
+    table =
+      header(
+        [
+          {"XTENSION", "BINTABLE"},
+          {"BITPIX", 8},
+          {"NAXIS", 2},
+          {"NAXIS1", div(byte_size(rows), 4)},
+          {"NAXIS2", 4},
+          {"PCOUNT", 0},
+          {"GCOUNT", 1},
+          {"TFIELDS", length(columns)}
+        ] ++
+          Enum.flat_map(Enum.with_index(columns, 1), fn {{name, form}, i} ->
+            [{"TTYPE#{i}", name}, {"TFORM#{i}", form}]
+          end) ++ [{"EXTNAME", "CATALOG"}]
+      )
+
+    File.write!(path, [primary, table, pad(rows, 0)])
+  end
+
+  defp header(cards) do
+    cards
+    |> Enum.map(fn {key, value} -> String.pad_trailing(String.pad_trailing(key, 8) <> "= " <> value(value), 80) end)
+    |> Kernel.++([String.pad_trailing("END", 80)])
+    |> Enum.join()
+    |> pad(?\s)
+  end
+
+  defp value(true), do: String.pad_leading("T", 20)
+  defp value(value) when is_integer(value), do: String.pad_leading(Integer.to_string(value), 20)
+  defp value(value) when is_binary(value), do: "'" <> String.pad_trailing(value, 8) <> "'"
+
+  defp pad(bytes, fill) do
+    bytes <> :binary.copy(<<fill>>, rem(2880 - rem(byte_size(bytes), 2880), 2880))
+  end
+end